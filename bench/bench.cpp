@@ -0,0 +1,115 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmark registry and synthetic data generation.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <boost/tr1/random.hpp>
+#include "bench.h"
+
+namespace Bench
+{
+
+Benchmark::Benchmark(const std::string &name) : name(name)
+{
+    getBenchmarks().push_back(this);
+}
+
+std::vector<Benchmark *> &getBenchmarks()
+{
+    static std::vector<Benchmark *> benchmarks;
+    return benchmarks;
+}
+
+std::vector<Splat> makeSplats(std::size_t n, float size, std::tr1::uint32_t seed)
+{
+    typedef std::tr1::mt19937 engine_type;
+    typedef std::tr1::uniform_real<float> dist_type;
+    typedef std::tr1::variate_generator<engine_type &, dist_type> gen_type;
+
+    const int numPlanes = 8;
+    engine_type engine(seed);
+    gen_type unit(engine, dist_type(0.0f, 1.0f));
+    gen_type noise(engine, dist_type(-0.01f, 0.01f));
+
+    std::vector<Splat> splats(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        /* Cycle through axis-aligned planes at various depths, so that the
+         * splats form surfaces rather than filling the volume.
+         */
+        const int plane = i % numPlanes;
+        const int axis = plane % 3;
+        const float depth = (plane + 0.5f) / numPlanes;
+        Splat &s = splats[i];
+        for (int j = 0; j < 3; j++)
+        {
+            float u = (j == axis) ? depth + noise() : unit();
+            s.position[j] = u * size;
+            s.normal[j] = (j == axis) ? 1.0f : 0.0f;
+        }
+        s.radius = size * (0.001f + 0.002f * unit());
+        s.quality = 1.0f;
+    }
+    return splats;
+}
+
+std::string makePly(const std::vector<Splat> &splats)
+{
+    std::ostringstream data;
+    data <<
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " << splats.size() << "\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+    for (std::size_t i = 0; i < splats.size(); i++)
+    {
+        const Splat &splat = splats[i];
+        data.write((const char *) splat.position, 3 * sizeof(float));
+        data.write((const char *) splat.normal, 3 * sizeof(float));
+        data.write((const char *) &splat.radius, sizeof(float));
+    }
+    return data.str();
+}
+
+void consume(std::tr1::uint64_t value)
+{
+    static volatile std::tr1::uint64_t sink;
+    sink += value;
+}
+
+} // namespace Bench
@@ -0,0 +1,109 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Minimal framework for the micro-benchmarks run by <code>waf bench</code>.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "../src/tr1_cstdint.h"
+#include "../src/splat.h"
+
+/**
+ * Benchmarks of individual components, run on synthetic data held in
+ * memory so that the results do not depend on the disk.
+ */
+namespace Bench
+{
+
+/**
+ * A single benchmark. Subclasses are instantiated as static objects with
+ * @ref BENCH_REGISTER, which adds them to the list returned by
+ * @ref getBenchmarks.
+ *
+ * Each repetition calls @ref setUp, then times @ref run, then calls
+ * @ref tearDown. Only @ref run is included in the timing.
+ */
+class Benchmark : public boost::noncopyable
+{
+private:
+    std::string name;
+
+public:
+    explicit Benchmark(const std::string &name);
+    virtual ~Benchmark() {}
+
+    const std::string &getName() const { return name; }
+
+    /// Prepare for a repetition (not timed)
+    virtual void setUp() {}
+
+    /// Do the work being measured
+    virtual void run() = 0;
+
+    /// Clean up after a repetition (not timed)
+    virtual void tearDown() {}
+
+    /// Number of items processed by each call to @ref run
+    virtual std::tr1::uint64_t items() const = 0;
+
+    /// Name of the items counted by @ref items, for reporting
+    virtual const char *unit() const { return "items"; }
+};
+
+/// All registered benchmarks, in registration order
+std::vector<Benchmark *> &getBenchmarks();
+
+/**
+ * Generate @a n splats scattered through a cube of side @a size with its
+ * corner at the origin, clustered onto a few planes so that the bucketing
+ * has realistic structure. The output depends only on the arguments.
+ */
+std::vector<Splat> makeSplats(std::size_t n, float size, std::tr1::uint32_t seed);
+
+/**
+ * Encode splats as a binary little-endian PLY file with the properties
+ * expected by @ref FastPly::Reader.
+ */
+std::string makePly(const std::vector<Splat> &splats);
+
+/**
+ * Prevent the compiler from optimizing away a computation whose result is
+ * otherwise unused.
+ */
+void consume(std::tr1::uint64_t value);
+
+} // namespace Bench
+
+/// Register a @ref Bench::Benchmark subclass with a default constructor
+#define BENCH_REGISTER(cls) static cls cls##Instance
+
+#endif /* !BENCH_H */
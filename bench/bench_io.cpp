@@ -0,0 +1,143 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmarks for PLY decoding and asynchronous writing.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include "bench.h"
+#include "../src/fast_ply.h"
+#include "../src/async_io.h"
+#include "../src/binary_io.h"
+#include "../src/timeplot.h"
+#include "../src/tr1_unordered_map.h"
+#include "../test/memory_reader.h"
+#include "../test/memory_writer.h"
+
+namespace
+{
+
+/// Reads and decodes a PLY file held in memory, in blocks like @ref FastPly::ReaderBase::Handle
+class PlyDecode : public Bench::Benchmark
+{
+private:
+    static const std::size_t numSplats = 1000000;
+    static const std::size_t blockSize = 8192;
+
+    boost::scoped_ptr<FastPly::Reader> reader;
+
+public:
+    PlyDecode() : Bench::Benchmark("fast_ply.decode") {}
+
+    virtual void setUp()
+    {
+        if (!reader)
+            reader.reset(new FastPly::Reader(
+                    MemoryReaderFactory(Bench::makePly(Bench::makeSplats(numSplats, 1000.0f, 1))),
+                    "bench.ply", 1.0f, std::numeric_limits<float>::infinity()));
+    }
+
+    virtual void run()
+    {
+        FastPly::Reader::Handle handle(*reader);
+        const std::size_t vertexSize = reader->getVertexSize();
+        boost::scoped_array<char> buffer(new char[blockSize * vertexSize]);
+        float sum = 0.0f;
+        for (FastPly::Reader::size_type i = 0; i < reader->size(); i += blockSize)
+        {
+            FastPly::Reader::size_type last = std::min(i + FastPly::Reader::size_type(blockSize), reader->size());
+            handle.readRaw(i, last, buffer.get());
+            for (FastPly::Reader::size_type j = i; j < last; j++)
+                sum += handle.decode(buffer.get(), j - i).radius;
+        }
+        Bench::consume(std::tr1::uint64_t(sum));
+    }
+
+    virtual std::tr1::uint64_t items() const { return numSplats; }
+    virtual const char *unit() const { return "splats"; }
+};
+BENCH_REGISTER(PlyDecode);
+
+/// Pushes variable-sized chunks through an @ref AsyncWriter into memory
+class AsyncWrite : public Bench::Benchmark
+{
+private:
+    static const std::size_t totalBytes = 256 * 1024 * 1024;
+    static const std::size_t bufferBytes = 16 * 1024 * 1024;
+
+    std::tr1::unordered_map<std::string, std::string> outputs;
+    boost::shared_ptr<BinaryWriter> writer;
+
+public:
+    AsyncWrite() : Bench::Benchmark("async_io.writer") {}
+
+    virtual void setUp()
+    {
+        writer.reset(new MemoryWriter(outputs));
+        writer->open("bench.out");
+        // Size the output up front so that concurrent writes do not reallocate it
+        writer->resize(totalBytes);
+    }
+
+    virtual void run()
+    {
+        Timeplot::Worker tworker("bench");
+        AsyncWriter async(2, bufferBytes);
+        async.start();
+
+        std::size_t pos = 0;
+        std::size_t chunk = 4096;
+        while (pos < totalBytes)
+        {
+            std::size_t n = std::min(chunk, totalBytes - pos);
+            boost::shared_ptr<AsyncWriterItem> item = async.get(tworker, n);
+            std::memset(item->get(), pos & 0xff, n);
+            async.push(tworker, item, writer, n, pos);
+            pos += n;
+            // Vary the chunk size between 4KiB and 1MiB
+            chunk = chunk * 3 % (1024 * 1024) + 4096;
+        }
+        async.stop();
+    }
+
+    virtual void tearDown()
+    {
+        writer.reset();
+        outputs.clear();
+    }
+
+    virtual std::tr1::uint64_t items() const { return totalBytes; }
+    virtual const char *unit() const { return "bytes"; }
+};
+BENCH_REGISTER(AsyncWrite);
+
+} // anonymous namespace
@@ -0,0 +1,190 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Runs the registered benchmarks and reports the results as JSON.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include "bench.h"
+#include "../src/timer.h"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+/// Timings of one benchmark
+struct Result
+{
+    const Bench::Benchmark *benchmark;
+    std::vector<double> times;   ///< Seconds taken by each repetition
+};
+
+/// Whether @a name is selected by @a filters (an empty list selects everything)
+bool selected(const std::string &name, const std::vector<std::string> &filters)
+{
+    if (filters.empty())
+        return true;
+    BOOST_FOREACH(const std::string &f, filters)
+        if (name.find(f) != std::string::npos)
+            return true;
+    return false;
+}
+
+Result runBenchmark(Bench::Benchmark &b, int repeats)
+{
+    Result result;
+    result.benchmark = &b;
+
+    // Warm up caches and lazily-initialized state before timing
+    b.setUp();
+    b.run();
+    b.tearDown();
+
+    for (int i = 0; i < repeats; i++)
+    {
+        b.setUp();
+        Timer timer;
+        b.run();
+        result.times.push_back(timer.getElapsed());
+        b.tearDown();
+    }
+    return result;
+}
+
+void writeJson(std::ostream &out, const std::vector<Result> &results)
+{
+    out.precision(std::numeric_limits<double>::digits10 + 1);
+    out << "{\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        double total = 0.0;
+        BOOST_FOREACH(double t, r.times)
+            total += t;
+        const double mean = total / r.times.size();
+        const double best = *std::min_element(r.times.begin(), r.times.end());
+        const double items = r.benchmark->items();
+
+        out << (i > 0 ? "," : "") << "\n    {\n"
+            << "      \"name\": \"" << r.benchmark->getName() << "\",\n"
+            << "      \"unit\": \"" << r.benchmark->unit() << "\",\n"
+            << "      \"items\": " << r.benchmark->items() << ",\n"
+            << "      \"repeats\": " << r.times.size() << ",\n"
+            << "      \"min\": " << best << ",\n"
+            << "      \"mean\": " << mean << ",\n"
+            << "      \"rate\": " << (best > 0.0 ? items / best : 0.0) << "\n"
+            << "    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                                    "Show help")
+        ("list",                                                    "List the benchmarks and exit")
+        ("output,o",  po::value<std::string>(),                     "Write JSON to this file instead of stdout")
+        ("repeats,r", po::value<int>()->default_value(5),           "Timed repetitions of each benchmark");
+    po::options_description hidden;
+    hidden.add_options()
+        ("filter", po::value<std::vector<std::string> >()->composing(), "Substrings of benchmark names to run");
+    po::options_description all;
+    all.add(desc).add(hidden);
+    po::positional_options_description positional;
+    positional.add("filter", -1);
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\n\n" << desc;
+        return 2;
+    }
+    if (vm.count("help"))
+    {
+        std::cout << "Usage: mlsgpubench [options] [filter...]\n\n" << desc;
+        return 0;
+    }
+
+    std::vector<std::string> filters;
+    if (vm.count("filter"))
+        filters = vm["filter"].as<std::vector<std::string> >();
+    const int repeats = vm["repeats"].as<int>();
+    if (repeats < 1)
+    {
+        std::cerr << "--repeats must be positive\n";
+        return 2;
+    }
+
+    std::vector<Result> results;
+    BOOST_FOREACH(Bench::Benchmark *b, Bench::getBenchmarks())
+    {
+        if (!selected(b->getName(), filters))
+            continue;
+        if (vm.count("list"))
+        {
+            std::cout << b->getName() << '\n';
+            continue;
+        }
+        std::cerr << b->getName() << "... " << std::flush;
+        results.push_back(runBenchmark(*b, repeats));
+        const Result &r = results.back();
+        std::cerr << *std::min_element(r.times.begin(), r.times.end()) << " s\n";
+    }
+    if (vm.count("list"))
+        return 0;
+
+    if (vm.count("output"))
+    {
+        std::ofstream out(vm["output"].as<std::string>().c_str());
+        writeJson(out, results);
+        out.close();
+        if (!out)
+        {
+            std::cerr << "Failed to write " << vm["output"].as<std::string>() << '\n';
+            return 1;
+        }
+    }
+    else
+        writeJson(std::cout, results);
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmarks for @ref OOCMesher.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <cstring>
+#include <boost/array.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/shared_array.hpp>
+#include <CL/cl.hpp>
+#include "bench.h"
+#include "../src/mesher.h"
+#include "../src/mesh.h"
+#include "../src/timeplot.h"
+#include "../test/memory_writer.h"
+
+namespace
+{
+
+/**
+ * Synthetic mesher input: a wavy sheet of @ref sheetCells by @ref sheetCells
+ * quads, cut into square blocks as the device workers would produce it.
+ * Vertices on block boundaries are external and keyed by their position in
+ * the sheet, so that the mesher has to weld them.
+ */
+class SheetBlocks
+{
+public:
+    static const unsigned int sheetCells = 1024;
+    static const unsigned int blockCells = 64;
+
+    /// Mesh data for one block, in the layout expected by @ref HostKeyMesh
+    struct Block
+    {
+        MeshSizes sizes;
+        boost::shared_array<cl_ulong> data;   ///< cl_ulong for alignment
+    };
+
+    std::vector<Block> blocks;
+
+    SheetBlocks();
+
+    std::tr1::uint64_t numTriangles() const
+    {
+        return std::tr1::uint64_t(sheetCells) * sheetCells * 2;
+    }
+
+    /// Copy block @a i into @a buffer and point @a work at it
+    void load(std::size_t i, boost::shared_array<cl_ulong> &buffer, MesherWork &work) const;
+};
+
+SheetBlocks::SheetBlocks()
+{
+    const unsigned int numBlocks = sheetCells / blockCells;
+    const unsigned int side = blockCells + 1;
+    for (unsigned int by = 0; by < numBlocks; by++)
+        for (unsigned int bx = 0; bx < numBlocks; bx++)
+        {
+            const unsigned int numVertices = side * side;
+            const unsigned int numInternal = (side - 2) * (side - 2);
+            Block block;
+            block.sizes = MeshSizes(numVertices, blockCells * blockCells * 2, numInternal);
+            const std::size_t words = (block.sizes.getHostBytes() + sizeof(cl_ulong) - 1) / sizeof(cl_ulong);
+            block.data.reset(new cl_ulong[words]);
+            HostKeyMesh mesh(block.data.get(), block.sizes);
+
+            std::vector<cl_uint> index(numVertices);
+            unsigned int internal = 0, external = 0;
+            for (unsigned int y = 0; y < side; y++)
+                for (unsigned int x = 0; x < side; x++)
+                {
+                    const unsigned int gx = bx * blockCells + x;
+                    const unsigned int gy = by * blockCells + y;
+                    boost::array<cl_float, 3> v;
+                    v[0] = gx;
+                    v[1] = gy;
+                    v[2] = (gx * 7 + gy * 13) % 17 * 0.125f;
+                    cl_uint idx;
+                    if (x == 0 || y == 0 || x == side - 1 || y == side - 1)
+                    {
+                        idx = numInternal + external;
+                        mesh.vertexKeys[external] = cl_ulong(gy) * (sheetCells + 1) + gx;
+                        external++;
+                    }
+                    else
+                        idx = internal++;
+                    mesh.vertices[idx] = v;
+                    index[y * side + x] = idx;
+                }
+
+            std::size_t t = 0;
+            for (unsigned int y = 0; y < blockCells; y++)
+                for (unsigned int x = 0; x < blockCells; x++)
+                {
+                    const cl_uint v00 = index[y * side + x];
+                    const cl_uint v10 = index[y * side + x + 1];
+                    const cl_uint v01 = index[(y + 1) * side + x];
+                    const cl_uint v11 = index[(y + 1) * side + x + 1];
+                    const boost::array<cl_uint, 3> t0 = {{ v00, v10, v11 }};
+                    const boost::array<cl_uint, 3> t1 = {{ v00, v11, v01 }};
+                    mesh.triangles[t++] = t0;
+                    mesh.triangles[t++] = t1;
+                }
+            blocks.push_back(block);
+        }
+}
+
+void SheetBlocks::load(std::size_t i, boost::shared_array<cl_ulong> &buffer, MesherWork &work) const
+{
+    const Block &block = blocks[i];
+    const std::size_t bytes = block.sizes.getHostBytes();
+    buffer.reset(new cl_ulong[(bytes + sizeof(cl_ulong) - 1) / sizeof(cl_ulong)]);
+    std::memcpy(buffer.get(), block.data.get(), bytes);
+    work = MesherWork();
+    work.mesh = HostKeyMesh(buffer.get(), block.sizes);
+}
+
+const SheetBlocks &getSheet()
+{
+    static SheetBlocks sheet;
+    return sheet;
+}
+
+/**
+ * Base for the mesher benchmarks. It prepares fresh copies of the input
+ * (since the mesher may modify it in place) and a mesher writing to memory.
+ */
+class MesherBench : public Bench::Benchmark
+{
+protected:
+    std::vector<boost::shared_array<cl_ulong> > buffers;
+    std::vector<MesherWork> work;
+    boost::scoped_ptr<MemoryWriterPly> writer;
+    boost::scoped_ptr<OOCMesher> mesher;
+
+    /// Feed all the blocks to the mesher
+    void add()
+    {
+        Timeplot::Worker tworker("bench");
+        const MesherBase::InputFunctor functor = mesher->functor(0);
+        for (std::size_t i = 0; i < work.size(); i++)
+            functor(work[i], tworker);
+    }
+
+public:
+    explicit MesherBench(const std::string &name) : Bench::Benchmark(name) {}
+
+    virtual void setUp()
+    {
+        const SheetBlocks &sheet = getSheet();
+        buffers.resize(sheet.blocks.size());
+        work.resize(sheet.blocks.size());
+        for (std::size_t i = 0; i < sheet.blocks.size(); i++)
+            sheet.load(i, buffers[i], work[i]);
+        writer.reset(new MemoryWriterPly());
+        mesher.reset(new OOCMesher(*writer, TrivialNamer("bench.ply")));
+    }
+
+    virtual void tearDown()
+    {
+        mesher.reset();
+        writer.reset();
+        work.clear();
+        buffers.clear();
+    }
+
+    virtual std::tr1::uint64_t items() const { return getSheet().numTriangles(); }
+    virtual const char *unit() const { return "triangles"; }
+};
+
+/// Times @ref OOCMesher's input functor
+class OOCMesherAdd : public MesherBench
+{
+public:
+    OOCMesherAdd() : MesherBench("mesher.ooc.add") {}
+
+    virtual void run()
+    {
+        add();
+    }
+};
+BENCH_REGISTER(OOCMesherAdd);
+
+/// Times @ref OOCMesher::write, after the input has been added
+class OOCMesherWrite : public MesherBench
+{
+public:
+    OOCMesherWrite() : MesherBench("mesher.ooc.write") {}
+
+    virtual void setUp()
+    {
+        MesherBench::setUp();
+        add();
+    }
+
+    virtual void run()
+    {
+        Timeplot::Worker tworker("bench");
+        Bench::consume(mesher->write(tworker));
+    }
+};
+BENCH_REGISTER(OOCMesherWrite);
+
+} // anonymous namespace
@@ -0,0 +1,220 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmarks for the splat set, bucketing and octree construction.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <limits>
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "bench.h"
+#include "../src/splat_set.h"
+#include "../src/splat_set_impl.h"
+#include "../src/bucket.h"
+#include "../src/grid.h"
+#include "../src/splat_tree.h"
+#include "../src/fast_ply.h"
+#include "../test/memory_reader.h"
+
+namespace
+{
+
+/// Splats in the scene shared by the bucketing benchmarks
+const std::size_t sceneSplats = 1000000;
+/// Side length of the scene, in grid cells
+const float sceneSize = 1000.0f;
+/// Grid spacing used for the scene
+const float sceneSpacing = 1.0f;
+/// Bucket size used for blobs, matching the default --leaf-cells
+const Grid::size_type sceneMicroCells = 63;
+
+/// The scene, generated on first use
+const std::vector<Splat> &getScene()
+{
+    static std::vector<Splat> scene;
+    if (scene.empty())
+        scene = Bench::makeSplats(sceneSplats, sceneSize, 2);
+    return scene;
+}
+
+/// Converts splats to bucket ranges, the inner loop of @ref SplatSet::FastBlobSet::computeBlobs
+class SplatToBuckets : public Bench::Benchmark
+{
+public:
+    SplatToBuckets() : Bench::Benchmark("splat_set.splat_to_buckets") {}
+
+    virtual void setUp()
+    {
+        getScene();
+    }
+
+    virtual void run()
+    {
+        const std::vector<Splat> &scene = getScene();
+        const SplatSet::detail::SplatToBuckets toBuckets(sceneSpacing, sceneMicroCells);
+        boost::array<Grid::difference_type, 3> lower, upper;
+        std::tr1::uint64_t sum = 0;
+        for (std::size_t i = 0; i < scene.size(); i++)
+        {
+            toBuckets(scene[i], lower, upper);
+            sum += upper[0] - lower[0] + upper[1] - lower[1] + upper[2] - lower[2];
+        }
+        Bench::consume(sum);
+    }
+
+    virtual std::tr1::uint64_t items() const { return sceneSplats; }
+    virtual const char *unit() const { return "splats"; }
+};
+BENCH_REGISTER(SplatToBuckets);
+
+/// Runs @ref SplatSet::FastBlobSet::computeBlobs over PLY files held in memory
+class ComputeBlobs : public Bench::Benchmark
+{
+private:
+    static const std::size_t numFiles = 4;
+
+    std::vector<std::string> files;
+    boost::scoped_ptr<SplatSet::FastBlobSet<SplatSet::FileSet> > splats;
+
+public:
+    ComputeBlobs() : Bench::Benchmark("splat_set.compute_blobs") {}
+
+    virtual void setUp()
+    {
+        if (files.empty())
+        {
+            const std::vector<Splat> &scene = getScene();
+            const std::size_t perFile = scene.size() / numFiles;
+            for (std::size_t i = 0; i < numFiles; i++)
+            {
+                std::vector<Splat> part(scene.begin() + i * perFile, scene.begin() + (i + 1) * perFile);
+                files.push_back(Bench::makePly(part));
+            }
+        }
+        splats.reset(new SplatSet::FastBlobSet<SplatSet::FileSet>());
+        for (std::size_t i = 0; i < files.size(); i++)
+            splats->addFile(new FastPly::Reader(
+                    MemoryReaderFactory(files[i]),
+                    "bench.ply", 1.0f, std::numeric_limits<float>::infinity()));
+    }
+
+    virtual void run()
+    {
+        splats->computeBlobs(sceneSpacing, sceneMicroCells, NULL, false);
+    }
+
+    virtual void tearDown()
+    {
+        splats.reset();
+    }
+
+    virtual std::tr1::uint64_t items() const { return sceneSplats / numFiles * numFiles; }
+    virtual const char *unit() const { return "splats"; }
+};
+BENCH_REGISTER(ComputeBlobs);
+
+/// Runs @ref Bucket::bucket over the scene, with blobs already computed
+class BucketScene : public Bench::Benchmark
+{
+public:
+    typedef SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > Splats;
+
+private:
+    boost::scoped_ptr<Splats> splats;
+    std::tr1::uint64_t buckets;
+
+    void process(const SplatSet::Traits<Splats>::subset_type &subset,
+                 const Grid &grid, const Bucket::Recursion &recursionState)
+    {
+        (void) grid;
+        (void) recursionState;
+        buckets++;
+        Bench::consume(subset.numSplats());
+    }
+
+public:
+    BucketScene() : Bench::Benchmark("bucket.bucket"), buckets(0) {}
+
+    virtual void setUp()
+    {
+        if (!splats)
+        {
+            const std::vector<Splat> &scene = getScene();
+            splats.reset(new Splats());
+            splats->reset(&scene[0], &scene[0] + scene.size());
+            splats->computeBlobs(sceneSpacing, sceneMicroCells, NULL, false);
+        }
+        buckets = 0;
+    }
+
+    virtual void run()
+    {
+        // Parameters mirror the --levels, --subsampling and --leaf-cells defaults
+        Bucket::bucket(*splats, splats->getBoundingGrid(),
+                       100000, 255, 0, sceneMicroCells, 1024 * 1024 * 1024,
+                       boost::bind(&BucketScene::process, this, _1, _2, _3));
+    }
+
+    virtual std::tr1::uint64_t items() const { return sceneSplats; }
+    virtual const char *unit() const { return "splats"; }
+};
+BENCH_REGISTER(BucketScene);
+
+/// Builds a @ref SplatTreeHost for a single bucket-sized region
+class SplatTreeBuild : public Bench::Benchmark
+{
+private:
+    static const std::size_t numSplats = 200000;
+    static const Grid::size_type cells = 256;
+
+    std::vector<Splat> splats;
+
+public:
+    SplatTreeBuild() : Bench::Benchmark("splat_tree.build") {}
+
+    virtual void setUp()
+    {
+        if (splats.empty())
+            splats = Bench::makeSplats(numSplats, cells, 3);
+    }
+
+    virtual void run()
+    {
+        const Grid::size_type size[3] = {cells, cells, cells};
+        const Grid::difference_type offset[3] = {0, 0, 0};
+        SplatTreeHost tree(splats, size, offset, SplatTree::BUILD_PARALLEL);
+        Bench::consume(tree.getCommands().size());
+    }
+
+    virtual std::tr1::uint64_t items() const { return numSplats; }
+    virtual const char *unit() const { return "splats"; }
+};
+BENCH_REGISTER(SplatTreeBuild);
+
+} // anonymous namespace
@@ -0,0 +1,212 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmarks for the union-find structure, circular buffer and work queues.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <deque>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "bench.h"
+#include "../src/union_find.h"
+#include "../src/circular_buffer.h"
+#include "../src/work_queue.h"
+#include "../src/timeplot.h"
+
+namespace
+{
+
+/**
+ * Merges the faces of a 3D lattice of nodes, which is the pattern produced by
+ * the mesher when it finds connected components.
+ */
+class UnionFindLattice : public Bench::Benchmark
+{
+private:
+    static const int side = 100;
+
+    std::vector<UnionFind::Node<int> > nodes;
+
+    static int index(int x, int y, int z) { return (z * side + y) * side + x; }
+
+public:
+    UnionFindLattice() : Bench::Benchmark("union_find.merge") {}
+
+    virtual void setUp()
+    {
+        nodes.assign(side * side * side, UnionFind::Node<int>());
+    }
+
+    virtual void run()
+    {
+        // Leave every 10th slab unconnected so that there are several components
+        for (int z = 0; z < side; z++)
+            for (int y = 0; y < side; y++)
+                for (int x = 0; x < side; x++)
+                {
+                    if (x + 1 < side)
+                        UnionFind::merge(nodes, index(x, y, z), index(x + 1, y, z));
+                    if (y + 1 < side)
+                        UnionFind::merge(nodes, index(x, y, z), index(x, y + 1, z));
+                    if (z + 1 < side && (z + 1) % 10 != 0)
+                        UnionFind::merge(nodes, index(x, y, z), index(x, y, z + 1));
+                }
+        std::tr1::uint64_t roots = 0;
+        for (std::size_t i = 0; i < nodes.size(); i++)
+            roots += UnionFind::findRoot(nodes, int(i));
+        Bench::consume(roots);
+    }
+
+    virtual void tearDown()
+    {
+        nodes.clear();
+    }
+
+    virtual std::tr1::uint64_t items() const { return side * side * side; }
+    virtual const char *unit() const { return "nodes"; }
+};
+BENCH_REGISTER(UnionFindLattice);
+
+/**
+ * Allocates variable-sized pieces from a @ref CircularBuffer and frees them in
+ * FIFO order, keeping a bounded number outstanding.
+ */
+class CircularBufferCycle : public Bench::Benchmark
+{
+private:
+    static const std::size_t numAllocations = 1000000;
+    static const std::size_t bufferSize = 16 * 1024 * 1024;
+    static const std::size_t maxOutstanding = 64;
+
+    boost::scoped_ptr<CircularBuffer> buffer;
+
+public:
+    CircularBufferCycle() : Bench::Benchmark("circular_buffer.allocate") {}
+
+    virtual void setUp()
+    {
+        buffer.reset(new CircularBuffer("mem.bench.buffer", bufferSize));
+    }
+
+    virtual void run()
+    {
+        Timeplot::Worker tworker("bench");
+        std::deque<CircularBuffer::Allocation> outstanding;
+        std::size_t bytes = 1;
+        for (std::size_t i = 0; i < numAllocations; i++)
+        {
+            if (outstanding.size() == maxOutstanding)
+            {
+                buffer->free(outstanding.front());
+                outstanding.pop_front();
+            }
+            outstanding.push_back(buffer->allocate(tworker, bytes));
+            // Pseudo-random sizes up to 64KiB
+            bytes = (bytes * 1103515245 + 12345) % 65536 + 1;
+        }
+        while (!outstanding.empty())
+        {
+            buffer->free(outstanding.front());
+            outstanding.pop_front();
+        }
+    }
+
+    virtual void tearDown()
+    {
+        buffer.reset();
+    }
+
+    virtual std::tr1::uint64_t items() const { return numAllocations; }
+    virtual const char *unit() const { return "allocations"; }
+};
+BENCH_REGISTER(CircularBufferCycle);
+
+/**
+ * Passes integers from several producer threads to several consumer threads
+ * through a queue with the @ref WorkQueue interface.
+ */
+template<typename Queue>
+class QueueTransfer : public Bench::Benchmark
+{
+private:
+    static const int numProducers = 2;
+    static const int numConsumers = 2;
+    static const int itemsPerProducer = 500000;
+
+    boost::scoped_ptr<Queue> queue;
+
+    void produce()
+    {
+        // Items start at 1 since the stopped queue returns 0
+        for (int i = 1; i <= itemsPerProducer; i++)
+            queue->push(i);
+    }
+
+    void drain()
+    {
+        std::tr1::uint64_t sum = 0;
+        int item;
+        while ((item = queue->pop()) != 0)
+            sum += item;
+        Bench::consume(sum);
+    }
+
+public:
+    explicit QueueTransfer(const std::string &name) : Bench::Benchmark(name) {}
+
+    virtual void setUp()
+    {
+        queue.reset(new Queue());
+    }
+
+    virtual void run()
+    {
+        boost::thread_group producers, consumers;
+        for (int i = 0; i < numConsumers; i++)
+            consumers.create_thread(boost::bind(&QueueTransfer::drain, this));
+        for (int i = 0; i < numProducers; i++)
+            producers.create_thread(boost::bind(&QueueTransfer::produce, this));
+        producers.join_all();
+        queue->stop();
+        consumers.join_all();
+    }
+
+    virtual void tearDown()
+    {
+        queue.reset();
+    }
+
+    virtual std::tr1::uint64_t items() const { return numProducers * itemsPerProducer; }
+};
+
+QueueTransfer<WorkQueue<int> > workQueueInstance("work_queue.locked");
+QueueTransfer<LockFreeWorkQueue<int> > lockFreeWorkQueueInstance("work_queue.lock_free");
+
+} // anonymous namespace
@@ -0,0 +1,128 @@
+/**
+ * @file
+ *
+ * Predict the time for the bucketing pass of a recorded run under different
+ * pipeline settings. See @ref Simulate for the model, e.g.
+ * <code>pipelinesim --device-threads 2 --mem-bucket-splats 32M run.timeplot</code>.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <cstdlib>
+#include <boost/program_options.hpp>
+#include "src/options.h"
+#include "src/timeplot.h"
+#include "src/simulate.h"
+
+namespace po = boost::program_options;
+
+static po::variables_map processOptions(int argc, char **argv)
+{
+    const Simulate::Config defaults;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",              "Show help")
+        ("mem-load-splats",   po::value<Capacity>()->default_value(defaults.memLoadSplats), "Memory for bucket merging")
+        ("mem-host-splats",   po::value<Capacity>()->default_value(defaults.memHostSplats), "Memory for splats on the CPU")
+        ("mem-bucket-splats", po::value<Capacity>()->default_value(defaults.memBucketSplats), "Memory for splats in a single bucket")
+        ("mem-mesh",          po::value<Capacity>()->default_value(defaults.memMesh), "Memory for raw mesh data on the CPU")
+        ("devices",           po::value<int>()->default_value(defaults.devices), "Number of devices")
+        ("device-threads",    po::value<int>()->default_value(defaults.deviceThreads), "Number of threads per device")
+        ("mesher-threads",    po::value<int>()->default_value(defaults.mesherThreads), "Number of threads for labelling mesh components");
+
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input-file",        po::value<std::string>()->required(), "timeplot trace");
+
+    po::options_description all;
+    all.add(desc);
+    all.add(hidden);
+
+    po::positional_options_description positional;
+    positional.add("input-file", 1);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+                  .options(all)
+                  .positional(positional)
+                  .run(), vm);
+        if (vm.count("help"))
+        {
+            std::cout << "Usage: pipelinesim [options] trace\n\n" << desc << '\n';
+            std::exit(0);
+        }
+        po::notify(vm);
+        if (vm["devices"].as<int>() < 1
+            || vm["device-threads"].as<int>() < 1
+            || vm["mesher-threads"].as<int>() < 1)
+            throw po::error("thread and device counts must be at least 1");
+        return vm;
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\n\n" << "Usage: pipelinesim [options] trace\n\n" << desc << '\n';
+        std::exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    po::variables_map vm = processOptions(argc, argv);
+
+    Simulate::Config config;
+    config.memLoadSplats = vm["mem-load-splats"].as<Capacity>();
+    config.memHostSplats = vm["mem-host-splats"].as<Capacity>();
+    config.memBucketSplats = vm["mem-bucket-splats"].as<Capacity>();
+    config.memMesh = vm["mem-mesh"].as<Capacity>();
+    config.devices = vm["devices"].as<int>();
+    config.deviceThreads = vm["device-threads"].as<int>();
+    config.mesherThreads = vm["mesher-threads"].as<int>();
+
+    try
+    {
+        const std::string &filename = vm["input-file"].as<std::string>();
+        std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Could not open " + filename);
+        Timeplot::Trace trace;
+        Timeplot::readTrace(in, trace);
+
+        const Simulate::Workload workload = Simulate::extractWorkload(trace);
+        const Simulate::Result result = Simulate::simulate(workload, config);
+
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << "Bins:          " << workload.bins.size() << '\n';
+        std::cout << "Load batches:  " << result.loadBatches << '\n';
+        std::cout << "Device items:  " << result.deviceItems << '\n';
+        std::cout << "Recorded time: " << workload.recordedTime << " s\n";
+        std::cout << "Predicted:     " << result.time << " s\n\n";
+        std::cout << "Stage      Threads  Busy (s)  Utilisation\n";
+        for (std::size_t i = 0; i < result.stages.size(); i++)
+        {
+            const Simulate::StageResult &stage = result.stages[i];
+            const double util = result.time > 0.0 ? stage.busy / (stage.workers * result.time) : 0.0;
+            std::cout << std::left << std::setw(11) << stage.name
+                << std::right << std::setw(7) << stage.workers
+                << std::setw(10) << stage.busy
+                << std::setw(12) << std::setprecision(1) << util * 100.0 << "%\n"
+                << std::setprecision(3);
+        }
+    }
+    catch (std::runtime_error &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
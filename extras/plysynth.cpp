@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * Write a synthetic point cloud as a PLY file. See @ref Synthetic::parseParams
+ * for the description syntax, e.g.
+ * <code>plysynth facades:splats=1e9,holes=0.3,noise=0.2 big.ply</code>.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "src/binary_io.h"
+#include "src/synthetic.h"
+
+int main(int argc, char **argv)
+{
+    std::ios::sync_with_stdio(false);
+
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: plysynth scene[:key=value,...] [output.ply]\n"
+            "Scenes: terrain, facades, spheres\n"
+            "Keys: splats, seed, size, density, holes, noise, radius, order (scan|random)\n"
+            "Writes to stdout if no output file is given.\n";
+        return 1;
+    }
+
+    try
+    {
+        Synthetic::PlyReaderFactory factory(Synthetic::parseParams(argv[1]));
+        boost::scoped_ptr<BinaryReader> reader(factory());
+        reader->open(argv[1]);
+
+        std::ofstream file;
+        if (argc > 2)
+        {
+            file.open(argv[2], std::ios::out | std::ios::binary);
+            if (!file)
+            {
+                std::cerr << "Could not open " << argv[2] << '\n';
+                return 1;
+            }
+        }
+        std::ostream &out = argc > 2 ? file : std::cout;
+
+        // Generation is parallel within each block, so blocks must be large
+        const std::size_t bufferSize = 1024 * Synthetic::PlyReader::vertexSize * 1024;
+        std::vector<char> buffer(bufferSize);
+        const BinaryReader::offset_type size = reader->size();
+        for (BinaryReader::offset_type pos = 0; pos < size; pos += bufferSize)
+        {
+            std::size_t n = reader->read(&buffer[0], bufferSize, pos);
+            out.write(&buffer[0], n);
+        }
+        out.flush();
+        if (!out)
+        {
+            std::cerr << "Error writing output\n";
+            return 1;
+        }
+    }
+    catch (std::runtime_error &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ *
+ * Benchmark comparing the serial and parallel builders for @ref SplatTree.
+ * The splats are randomly generated in memory, so that the results are not
+ * affected by I/O.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <boost/tr1/random.hpp>
+#include "src/splat.h"
+#include "src/splat_tree.h"
+#include "src/grid.h"
+#include "src/timer.h"
+
+static double timeBuild(
+    const std::vector<Splat> &splats,
+    const Grid::size_type size[3], const Grid::difference_type offset[3],
+    SplatTree::BuildMethod method, int repeats)
+{
+    Timer timer;
+    for (int i = 0; i < repeats; i++)
+        SplatTreeHost tree(splats, size, offset, method);
+    return timer.getElapsed() / repeats;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 4)
+    {
+        std::cerr << "Usage: splattreebench [splats [cells [repeats]]]\n";
+        return 1;
+    }
+    const std::size_t numSplats = argc > 1 ? std::atol(argv[1]) : 1000000;
+    const Grid::size_type cells = argc > 2 ? std::atoi(argv[2]) : 512;
+    const int repeats = argc > 3 ? std::atoi(argv[3]) : 3;
+
+    typedef std::tr1::mt19937 engine_type;
+    typedef std::tr1::uniform_real<float> dist_type;
+    typedef std::tr1::variate_generator<engine_type &, dist_type> gen_type;
+    engine_type engine;
+    gen_type posGen(engine, dist_type(0.0f, cells));
+    gen_type radiusGen(engine, dist_type(0.5f, 4.0f));
+
+    std::vector<Splat> splats(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        Splat &s = splats[i];
+        for (int j = 0; j < 3; j++)
+        {
+            s.position[j] = posGen();
+            s.normal[j] = j == 2 ? 1.0f : 0.0f;
+        }
+        s.radius = radiusGen();
+        s.quality = 1.0f;
+    }
+
+    const Grid::size_type size[3] = {cells, cells, cells};
+    const Grid::difference_type offset[3] = {0, 0, 0};
+
+    SplatTreeHost serial(splats, size, offset, SplatTree::BUILD_SERIAL);
+    SplatTreeHost parallel(splats, size, offset, SplatTree::BUILD_PARALLEL);
+    if (serial.getCommands() != parallel.getCommands()
+        || serial.getStart() != parallel.getStart())
+    {
+        std::cerr << "Serial and parallel builders produced different octrees\n";
+        return 1;
+    }
+
+    double serialTime = timeBuild(splats, size, offset, SplatTree::BUILD_SERIAL, repeats);
+    double parallelTime = timeBuild(splats, size, offset, SplatTree::BUILD_PARALLEL, repeats);
+    std::cout << "splats:   " << numSplats << '\n'
+        << "cells:    " << cells << '\n'
+        << "commands: " << serial.getCommands().size() << '\n'
+        << "serial:   " << serialTime << " s\n"
+        << "parallel: " << parallelTime << " s\n"
+        << "speedup:  " << serialTime / parallelTime << '\n';
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Mesh simplification by vertex clustering, with cluster representatives
+ * placed using quadric error metrics. See @ref DecimateFilter.
+ */
+
+/// Set in the cluster key of each external vertex, which is a cluster of its own
+#define EXTERNAL_CLUSTER (1UL << 63)
+
+/// Number of distinct entries in a symmetric 4x4 quadric
+#define QUADRIC_SIZE 10
+
+/**
+ * Atomically add @a value to @a *ptr. OpenCL 1.1 has no floating-point
+ * atomics, so this is built on compare-and-swap.
+ */
+inline void atomicAddFloat(volatile __global float *ptr, float value)
+{
+    union { uint u; float f; } old, sum;
+    do
+    {
+        old.f = *ptr;
+        sum.f = old.f + value;
+    } while (atomic_cmpxchg((volatile __global uint *) ptr, old.u, sum.u) != old.u);
+}
+
+/**
+ * Computes the cluster key for each vertex, and initializes the values to
+ * sort with it. Internal vertices are keyed by the cell of the clustering
+ * grid that contains them. There is one work-item per vertex.
+ *
+ * @param[out] keys           Cluster keys.
+ * @param[out] indices        Original index of each vertex.
+ * @param      vertices       Vertices, as packed x,y,z triplets.
+ * @param      numInternal    Number of internal vertices.
+ * @param      invCellSize    Reciprocal of the size of a cluster cell.
+ */
+__kernel void clusterKeys(
+    __global ulong * restrict keys,
+    __global uint * restrict indices,
+    __global const float * restrict vertices,
+    uint numInternal,
+    float invCellSize)
+{
+    const uint gid = get_global_id(0);
+    ulong key;
+    if (gid < numInternal)
+    {
+        const float3 v = vload3(gid, vertices);
+        const uint3 c = convert_uint3_sat(floor(v * invCellSize));
+        key = ((ulong) c.z << 42) | ((ulong) c.y << 21) | c.x;
+    }
+    else
+        key = EXTERNAL_CLUSTER | gid;
+    keys[gid] = key;
+    indices[gid] = gid;
+}
+
+/**
+ * Write 1 to @a unique for each key that differs from the next key (the last
+ * of a run), 0 otherwise. There is one work-item per key, and the key array
+ * must be terminated by a sentinel.
+ */
+__kernel void countClusters(
+    __global uint * restrict unique,
+    __global const ulong * restrict keys)
+{
+    const uint gid = get_global_id(0);
+    unique[gid] = keys[gid] != keys[gid + 1] ? 1 : 0;
+}
+
+/**
+ * Records the cluster of each vertex and the range of sorted positions
+ * belonging to each cluster, and clears the quadrics. There is one work-item
+ * per sorted vertex.
+ *
+ * @param[out] remap          Cluster of each vertex (by original index).
+ * @param[out] firstMember    Sorted position of the first member of each cluster.
+ * @param[out] quadrics       Quadrics for each cluster.
+ * @param      clusters       Exclusive scan of the output of @ref countClusters.
+ * @param      indices        Original index of each sorted vertex.
+ * @param      keys           Sorted cluster keys.
+ * @param      numVertices    Number of vertices.
+ */
+__kernel void assignClusters(
+    __global uint * restrict remap,
+    __global uint * restrict firstMember,
+    __global float * restrict quadrics,
+    __global const uint * restrict clusters,
+    __global const uint * restrict indices,
+    __global const ulong * restrict keys,
+    uint numVertices)
+{
+    const uint gid = get_global_id(0);
+    const uint c = clusters[gid];
+    remap[indices[gid]] = c;
+    if (gid == 0 || keys[gid - 1] != keys[gid])
+    {
+        firstMember[c] = gid;
+        for (uint i = 0; i < QUADRIC_SIZE; i++)
+            quadrics[c * QUADRIC_SIZE + i] = 0.0f;
+    }
+    if (gid == numVertices - 1)
+        firstMember[c + 1] = numVertices;
+}
+
+/**
+ * Adds the area-weighted plane quadric of each triangle to the clusters of
+ * its vertices. External clusters are skipped since their positions are
+ * fixed. There is one work-item per triangle.
+ *
+ * @param[in,out] quadrics    Quadrics for each cluster.
+ * @param      triangles      Input triangles.
+ * @param      vertices       Input vertices.
+ * @param      remap          Cluster of each vertex.
+ * @param      clusters       Exclusive scan of the output of @ref countClusters.
+ * @param      numInternal    Number of internal vertices.
+ */
+__kernel void accumulateQuadrics(
+    __global float *quadrics,
+    __global const uint * restrict triangles,
+    __global const float * restrict vertices,
+    __global const uint * restrict remap,
+    __global const uint * restrict clusters,
+    uint numInternal)
+{
+    const uint gid = get_global_id(0);
+    const uint numInternalClusters = clusters[numInternal];
+    const uint3 tri = vload3(gid, triangles);
+    const float3 a = vload3(tri.x, vertices);
+    const float3 b = vload3(tri.y, vertices);
+    const float3 c = vload3(tri.z, vertices);
+    const float3 n = cross(b - a, c - a);
+    const float len = length(n);
+    if (!(len > 0.0f))
+        return;
+
+    const float3 u = n / len;
+    const float d = -dot(u, a);
+    const float w = 0.5f * len;
+    float q[QUADRIC_SIZE];
+    q[0] = w * u.x * u.x; q[1] = w * u.x * u.y; q[2] = w * u.x * u.z; q[3] = w * u.x * d;
+    q[4] = w * u.y * u.y; q[5] = w * u.y * u.z; q[6] = w * u.y * d;
+    q[7] = w * u.z * u.z; q[8] = w * u.z * d;
+    q[9] = w * d * d;
+
+    const uint3 r = (uint3) (remap[tri.x], remap[tri.y], remap[tri.z]);
+    for (uint i = 0; i < QUADRIC_SIZE; i++)
+    {
+        if (r.x < numInternalClusters)
+            atomicAddFloat(&quadrics[r.x * QUADRIC_SIZE + i], q[i]);
+        if (r.y < numInternalClusters && r.y != r.x)
+            atomicAddFloat(&quadrics[r.y * QUADRIC_SIZE + i], q[i]);
+        if (r.z < numInternalClusters && r.z != r.x && r.z != r.y)
+            atomicAddFloat(&quadrics[r.z * QUADRIC_SIZE + i], q[i]);
+    }
+}
+
+/**
+ * Computes the position of each cluster. External clusters keep their
+ * vertex and key. Internal clusters are placed at the point minimizing the
+ * quadric error, provided that the system is well-conditioned; otherwise
+ * the mean of the members is used. The result is clamped to the cluster
+ * cell. There is one work-item per input vertex, since the number of
+ * clusters is only known on the device; the excess work-items do nothing.
+ *
+ * @param      clusters       Exclusive scan of the output of @ref countClusters.
+ * @param      numInternal    Number of internal vertices.
+ * @param      numVertices    Number of vertices.
+ */
+__kernel void solveClusters(
+    __global float * restrict outVertices,
+    __global ulong * restrict outKeys,
+    __global const float * restrict quadrics,
+    __global const uint * restrict firstMember,
+    __global const uint * restrict indices,
+    __global const float * restrict vertices,
+    __global const ulong * restrict vertexKeys,
+    __global const uint * restrict clusters,
+    uint numInternal,
+    uint numVertices,
+    float cellSize)
+{
+    const uint gid = get_global_id(0);
+    if (gid >= clusters[numVertices])
+        return;
+    const uint numInternalClusters = clusters[numInternal];
+    const uint first = firstMember[gid];
+    const uint last = firstMember[gid + 1];
+
+    if (gid >= numInternalClusters)
+    {
+        const uint idx = indices[first];
+        vstore3(vload3(idx, vertices), gid, outVertices);
+        outKeys[gid] = vertexKeys[idx];
+        return;
+    }
+
+    float3 mean = (float3) (0.0f, 0.0f, 0.0f);
+    for (uint i = first; i < last; i++)
+        mean += vload3(indices[i], vertices);
+    mean /= (float) (last - first);
+
+    /* Solve A x = -b relative to the mean, i.e. A (x - mean) = -(b + A mean),
+     * which is better conditioned in single precision.
+     */
+    __global const float *q = quadrics + gid * QUADRIC_SIZE;
+    const float3 r0 = (float3) (q[0], q[1], q[2]);
+    const float3 r1 = (float3) (q[1], q[4], q[5]);
+    const float3 r2 = (float3) (q[2], q[5], q[7]);
+    const float3 rhs = -((float3) (q[3], q[6], q[8])
+                         + (float3) (dot(r0, mean), dot(r1, mean), dot(r2, mean)));
+    const float3 c0 = cross(r1, r2);
+    const float det = dot(r0, c0);
+    const float trace = q[0] + q[4] + q[7];
+
+    float3 pos = mean;
+    if (fabs(det) > 1e-3f * trace * trace * trace)
+    {
+        const float3 c1 = cross(r2, r0);
+        const float3 c2 = cross(r0, r1);
+        // Inverse of a symmetric matrix via the cofactors
+        pos += (float3) (dot(c0, rhs), dot(c1, rhs), dot(c2, rhs)) / det;
+    }
+
+    const float3 lo = floor(mean / cellSize) * cellSize;
+    pos = clamp(pos, lo, lo + cellSize);
+    vstore3(pos, gid, outVertices);
+}
+
+/// Key given to triangles that collapse to fewer than three clusters
+#define DEGENERATE_TRIANGLE 0xFFFFFFFFFFFFFFFFUL
+
+/// Returns the clusters of the corners of triangle @a t
+inline uint3 clusterTriangle(uint t, __global const uint * restrict triangles, __global const uint * restrict remap)
+{
+    const uint3 tri = vload3(t, triangles);
+    return (uint3) (remap[tri.x], remap[tri.y], remap[tri.z]);
+}
+
+/// Returns the corners of @a r in increasing order
+inline uint3 sortTriangle(uint3 r)
+{
+    const uint lo = min(r.x, min(r.y, r.z));
+    const uint hi = max(r.x, max(r.y, r.z));
+    return (uint3) (lo, r.x + r.y + r.z - lo - hi, hi);
+}
+
+/// Returns +1 if @a r is an even permutation of its sorted order, otherwise -1
+inline int triangleOrientation(uint3 r)
+{
+    const int inversions = (r.x > r.y) + (r.x > r.z) + (r.y > r.z);
+    return (inversions & 1) ? -1 : 1;
+}
+
+/**
+ * Computes a sort key for each triangle such that copies of a triangle
+ * (possibly with different orientations) have equal keys. The key is exact
+ * when the cluster indices fit into 21 bits, and a hash otherwise. There is
+ * one work-item per triangle.
+ *
+ * @param[out] triangleKeys   Sort key for each triangle, or @ref DEGENERATE_TRIANGLE.
+ * @param[out] triangleOrder  Index of each triangle, to be sorted with the keys.
+ * @param      triangles      Input triangles.
+ * @param      remap          Cluster of each vertex.
+ * @param      clusters       Exclusive scan of the output of @ref countClusters.
+ * @param      numVertices    Number of vertices.
+ */
+__kernel void keyTriangles(
+    __global ulong * restrict triangleKeys,
+    __global uint * restrict triangleOrder,
+    __global const uint * restrict triangles,
+    __global const uint * restrict remap,
+    __global const uint * restrict clusters,
+    uint numVertices)
+{
+    const uint gid = get_global_id(0);
+    const uint3 r = clusterTriangle(gid, triangles, remap);
+    ulong key;
+    if (r.x == r.y || r.x == r.z || r.y == r.z)
+        key = DEGENERATE_TRIANGLE;
+    else
+    {
+        const uint3 s = sortTriangle(r);
+        if (clusters[numVertices] <= (1U << 21))
+            key = ((ulong) s.z << 42) | ((ulong) s.y << 21) | s.x;
+        else
+        {
+            key = s.x * 0x9E3779B97F4A7C15UL;
+            key = (key ^ (key >> 29) ^ s.y) * 0xBF58476D1CE4E5B9UL;
+            key = (key ^ (key >> 32) ^ s.z) * 0x94D049BB133111EBUL;
+            key ^= key >> 31;
+        }
+        key = min(key, DEGENERATE_TRIANGLE - 1);
+    }
+    triangleKeys[gid] = key;
+    triangleOrder[gid] = gid;
+}
+
+/**
+ * Flags the triangles to keep: those whose vertices remain in distinct
+ * clusters, with only one of each set of copies. Copies with opposite
+ * orientations cancel in pairs, since they are folded over one another; if
+ * any remain, the first with the surviving orientation is kept. There is one
+ * work-item per triangle, in sorted order. The first work-item of each run
+ * of copies flags the whole run.
+ *
+ * Runs are also broken where hashed keys collide but the triangles differ.
+ * A collision can therefore only cause a copy to be kept, never a distinct
+ * triangle to be dropped.
+ *
+ * @param[out] keep           1 for each kept triangle, 0 otherwise (by original index).
+ * @param      triangleKeys   Sorted output of @ref keyTriangles.
+ * @param      triangleOrder  Original index of each sorted triangle.
+ * @param      triangles      Input triangles.
+ * @param      remap          Cluster of each vertex.
+ * @param      numTriangles   Number of triangles.
+ */
+__kernel void markTriangles(
+    __global uint * restrict keep,
+    __global const ulong * restrict triangleKeys,
+    __global const uint * restrict triangleOrder,
+    __global const uint * restrict triangles,
+    __global const uint * restrict remap,
+    uint numTriangles)
+{
+    const uint gid = get_global_id(0);
+    const ulong key = triangleKeys[gid];
+    if (key == DEGENERATE_TRIANGLE)
+    {
+        keep[triangleOrder[gid]] = 0;
+        return;
+    }
+
+    const uint3 s = sortTriangle(clusterTriangle(triangleOrder[gid], triangles, remap));
+    if (gid > 0 && triangleKeys[gid - 1] == key
+        && all(sortTriangle(clusterTriangle(triangleOrder[gid - 1], triangles, remap)) == s))
+        return; // Not the start of a run
+
+    int net = 0;
+    uint end = gid;
+    while (end < numTriangles && triangleKeys[end] == key)
+    {
+        const uint3 r = clusterTriangle(triangleOrder[end], triangles, remap);
+        if (any(sortTriangle(r) != s))
+            break;
+        net += triangleOrientation(r);
+        end++;
+    }
+
+    bool kept = false;
+    for (uint i = gid; i < end; i++)
+    {
+        const uint t = triangleOrder[i];
+        const bool k = !kept && net != 0
+            && triangleOrientation(clusterTriangle(t, triangles, remap)) == (net > 0 ? 1 : -1);
+        keep[t] = k ? 1 : 0;
+        kept = kept || k;
+    }
+}
+
+/**
+ * Writes the kept triangles, with indices replaced by clusters. There is one
+ * work-item per input triangle.
+ *
+ * @param[out] outTriangles   Compacted triangles.
+ * @param      keep           Exclusive scan of the output of @ref markTriangles.
+ * @param      triangles      Input triangles.
+ * @param      remap          Cluster of each vertex.
+ */
+__kernel void compactTriangles(
+    __global uint * restrict outTriangles,
+    __global const uint * restrict keep,
+    __global const uint * restrict triangles,
+    __global const uint * restrict remap)
+{
+    const uint gid = get_global_id(0);
+    const uint pos = keep[gid];
+    if (keep[gid + 1] != pos)
+    {
+        const uint3 tri = vload3(gid, triangles);
+        const uint3 r = (uint3) (remap[tri.x], remap[tri.y], remap[tri.z]);
+        vstore3(r, pos, outTriangles);
+    }
+}
@@ -280,21 +280,74 @@ inline float3 projectOriginPlane(const Plane * restrict plane)
 }
 
 /**
- * Compute isovalues for all grid corners in a slice. Those with no defined
- * isovalue are assigned a value of NaN.
+ * Finds the blocks of corners that may be influenced by splats, so that only
+ * those need to be processed by @ref processCorners. A block is occupied if
+ * its cell in the finest level of the octree is non-empty. Corners in empty
+ * blocks are written as NaN directly.
+ *
+ * @param[out] corners     The isovalues from a slice (only empty blocks are written).
+ * @param[out] blocks      Morton codes (see @ref makeCode) of the lowest corner of each occupied block.
+ * @param[in,out] numBlocks Number of entries written to @a blocks. It must be zero on entry.
+ * @param      start, startBase, startShift As for @ref processCorners.
+ * @param      zStride, zBias See @ref Marching::ImageParams
+ *
+ * The work groups are arranged exactly as for a dense dispatch of @ref processCorners.
+ */
+KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
+void findBlocks(
+    __write_only image2d_t corners,
+    __global uint * restrict blocks,
+    __global uint *numBlocks,
+    __global const command_type * restrict start,
+    uint startBase,
+    uint startShift,
+    uint zStride,
+    int zBias)
+{
+    int3 wid;  // position of one corner of the workgroup in region coordinates
+    wid.x = get_group_id(0) * WGS_X;
+    wid.y = get_group_id(1) * WGS_Y;
+    wid.z = get_group_id(2) * WGS_Z + get_global_offset(2);
+    uint code = makeCode(wid);
+    command_type pos = start[startBase + (code >> startShift)];
+
+    uint lid = get_local_id(0);
+    if (pos >= 0)
+    {
+        if (lid == 0)
+            blocks[atomic_inc(numBlocks)] = code;
+    }
+    else
+    {
+        int3 outCoord = wid + decode(lid);
+        outCoord.y += outCoord.z * zStride + zBias;
+        write_imagef(corners, outCoord.xy, nan(0U));
+    }
+}
+
+/**
+ * Compute isovalues for all grid corners in the occupied blocks of a slice.
+ * Those with no defined isovalue are assigned a value of NaN.
  *
  * @param[out] corners     The isovalues from a slice.
  * @param      splats      Input splats, in global grid coordinates, and with the inverse squared radius in the w component.
  * @param      commands, start Encoded octree for the local bin
+ * @param      startBase   Position in @a start of the first cell of the octree (non-zero
+ *                         for octrees built in a batch).
  * @param      startShift  Subsampling shift for octree, times 3.
  * @param      offset      Difference between global grid coordinates and the local region of interest.
  * @param      zStride, zBias See @ref Marching::ImageParams
  * @param      boundaryFactor Value of \f$1 - \gamma^2\f$ where \f$\gamma\f$ is the maximum
  *                         normalised distance between the projection point and the weighted
  *                         center of the region.
+ * @param      blocks      Blocks to process, as written by @ref findBlocks.
+ * @param      numBlocks   Number of valid entries in @a blocks, as written by @ref findBlocks.
  *
  * The local ID is a one-dimension encoding of a 3D local ID (see @ref decode).
- * The group ID specifies which of these 3D blocks we are processing.
+ * The group ID indexes @a blocks to specify which of these 3D blocks we are processing.
+ * The kernel is launched for every block that might be occupied, so that the
+ * count need not be read back, and work groups beyond @a numBlocks exit
+ * immediately.
  */
 KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
 void processCorners(
@@ -302,21 +355,25 @@ void processCorners(
     __global const Splat * restrict splats,
     __global const command_type * restrict commands,
     __global const command_type * restrict start,
+    uint startBase,
     uint startShift,
     int3 offset,
     uint zStride,
     int zBias,
-    float boundaryFactor)
+    float boundaryFactor,
+    __global const uint * restrict blocks,
+    __global const uint * restrict numBlocks)
 {
     __local command_type lSplatIds[MAX_BUCKET];
     __local float4 lPositionRadius[MAX_BUCKET];
 
-    int3 wid;  // position of one corner of the workgroup in region coordinates
-    wid.x = get_group_id(0) * WGS_X;
-    wid.y = get_group_id(1) * WGS_Y;
-    wid.z = get_group_id(2) * WGS_Z + get_global_offset(2);
-    uint code = makeCode(wid) >> startShift;
-    command_type pos = start[code];
+    // The whole work group takes this branch, so the barriers below are safe
+    if (get_group_id(0) >= *numBlocks)
+        return;
+
+    uint code = blocks[get_group_id(0)];
+    int3 wid = decode(code);  // position of one corner of the workgroup in region coordinates
+    command_type pos = start[startBase + (code >> startShift)];
 
     uint lid = get_local_id(0);
 
@@ -134,6 +134,84 @@ inline uint makeCode(int3 xyz)
     return ans;
 }
 
+/**
+ * Computes the position in the sort keys at which each level starts. The
+ * levels are stored finest first, and within each level the octrees of a
+ * batch are stored consecutively.
+ *
+ * @param[out] levelOffsets Values added to codes to give sort keys (allocated to hold @a maxShift + 1 values).
+ * @param minShift          Minimum bit shift (determines subsampling of grid to give finest level).
+ * @param maxShift          Maximum bit shift (determines base level).
+ * @param numTrees          Number of octrees in the batch.
+ */
+inline void initLevelOffsets(__local uint *levelOffsets, uint minShift, uint maxShift, uint numTrees)
+{
+    uint pos = 0;
+    uint add = numTrees << (3 * (maxShift - minShift));
+    for (uint i = minShift; i <= maxShift; i++)
+    {
+        levelOffsets[i] = pos;
+        pos += add;
+        add >>= 3;
+    }
+}
+
+/**
+ * Writes the 8 entries for a single splat. This is the common code for
+ * @ref writeEntries and @ref writeEntriesBatch.
+ *
+ * @param[out] keys        The cell codes for the entries.
+ * @param[out] values      The splat IDs for the entries.
+ * @param[in,out] splats   The original splats. On output, radius replaced by 1/radius^2.
+ * @param bias             Amount to subtract from global coordinates to get local ones.
+ * @param levelOffsets     Values computed by @ref initLevelOffsets.
+ * @param minShift         Minimum bit shift (determines subsampling of grid to give finest level).
+ * @param maxShift         Maximum bit shift (determines base level).
+ * @param tree             Index of the octree within the batch.
+ * @param pos              Index of the first entry to write.
+ * @param splatId          Index of the splat within @a splats.
+ */
+inline void emitEntries(
+    __global uint *keys,
+    __global uint *values,
+    __global Splat *splats,
+    int3 bias,
+    __local const uint *levelOffsets,
+    uint minShift,
+    uint maxShift,
+    uint tree,
+    uint pos,
+    uint splatId)
+{
+    float4 positionRadius = splats[splatId].positionRadius;
+    int3 ilo;
+    int shift;
+    prepare(&ilo, &shift, minShift, maxShift, positionRadius, bias);
+
+    float radius2 = positionRadius.w * positionRadius.w;
+    splats[splatId].positionRadius.w = 1.0f / radius2; // replace with form used in mls.cl
+    radius2 *= 1.00001f;   // be conservative in deciding intersections
+    int3 ofs;
+    uint levelOffset = levelOffsets[shift] + (tree << (3 * (maxShift - shift)));
+    int bound = 1 << (maxShift - shift);
+    for (ofs.z = 0; ofs.z < 2; ofs.z++)
+        for (ofs.y = 0; ofs.y < 2; ofs.y++)
+            for (ofs.x = 0; ofs.x < 2; ofs.x++)
+            {
+                int3 addr = ilo + ofs;
+                uint key = makeCode(addr) + levelOffset;
+                bool isect = goodEntry(addr, shift, positionRadius.xyz, radius2, bias);
+                // Avoid going outside the octree bounds. ilo was already clamped to >= 0 in
+                // prepare so we don't need to worry about the lower bound
+                isect &= all(addr < bound);
+                key = isect ? key : UINT_MAX;
+
+                values[pos] = splatId;
+                keys[pos] = key;
+                pos++;
+            }
+}
+
 /**
  * Write splat entries for an octree.
  *
@@ -169,48 +247,66 @@ __kernel void writeEntries(
     if (get_local_id(0) == 0)
     {
         // TODO: compute in parallel, as long as splats array is big enough
-        uint pos = 0;
-        uint add = 1U << (3 * (maxShift - minShift));
-        for (uint i = minShift; i <= maxShift; i++)
-        {
-            levelOffsets[i] = pos;
-            pos += add;
-            add >>= 3;
-        }
+        initLevelOffsets(levelOffsets, minShift, maxShift, 1);
     }
     barrier(CLK_LOCAL_MEM_FENCE);
 
     uint gid = get_global_id(0);
-    uint pos = gid * 8;
-    gid += firstSplat;
+    emitEntries(keys, values, splats, bias, levelOffsets, minShift, maxShift,
+                0, gid * 8, gid + firstSplat);
+}
 
-    float4 positionRadius = splats[gid].positionRadius;
-    int3 ilo;
-    int shift;
-    prepare(&ilo, &shift, minShift, maxShift, positionRadius, bias);
+/**
+ * Variant of @ref writeEntries that builds several octrees at once. The
+ * octrees all have the same number of levels, and each takes a contiguous
+ * range of the splats. The start arrays of the octrees are interleaved
+ * level by level, so that within level @a l, tree @a t occupies
+ * positions starting at <code>levelOffsets[l] + (t << 3 * (maxShift - l))</code>.
+ *
+ * @param[out] keys        The cell codes for the entries.
+ * @param[out] values      The splat IDs for the entries.
+ * @param[in,out] splats   The original splats. On output, radius replaced by 1/radius^2.
+ * @param batch            For each octree, the bias in xyz and the index of its first splat
+ *                         (relative to @a firstSplat) in w.
+ * @param numTrees         Number of elements in @a batch.
+ * @param levelOffsets     Values added to codes to give sort keys (allocated to hold @a maxShift + 1 values).
+ * @param minShift         Minimum bit shift (determines subsampling of grid to give finest level).
+ * @param maxShift         Maximum bit shift (determines base level).
+ * @param firstSplat       Index of first splat to process within @a splats
+ */
+__kernel void writeEntriesBatch(
+    __global uint *keys,
+    __global uint *values,
+    __global Splat *splats,
+    __global const int4 * restrict batch,
+    uint numTrees,
+    __local uint *levelOffsets,
+    uint minShift,
+    uint maxShift,
+    uint firstSplat)
+{
+    if (get_local_id(0) == 0)
+    {
+        initLevelOffsets(levelOffsets, minShift, maxShift, numTrees);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    float radius2 = positionRadius.w * positionRadius.w;
-    splats[gid].positionRadius.w = 1.0f / radius2; // replace with form used in mls.cl
-    radius2 *= 1.00001f;   // be conservative in deciding intersections
-    int3 ofs;
-    uint levelOffset = levelOffsets[shift];
-    int bound = 1 << (maxShift - shift);
-    for (ofs.z = 0; ofs.z < 2; ofs.z++)
-        for (ofs.y = 0; ofs.y < 2; ofs.y++)
-            for (ofs.x = 0; ofs.x < 2; ofs.x++)
-            {
-                int3 addr = ilo + ofs;
-                uint key = makeCode(addr) + levelOffset;
-                bool isect = goodEntry(addr, shift, positionRadius.xyz, radius2, bias);
-                // Avoid going outside the octree bounds. ilo was already clamped to >= 0 in
-                // prepare so we don't need to worry about the lower bound
-                isect &= all(addr < bound);
-                key = isect ? key : UINT_MAX;
+    uint gid = get_global_id(0);
 
-                values[pos] = gid;
-                keys[pos] = key;
-                pos++;
-            }
+    // Find the last tree whose first splat is at or before this one
+    uint lo = 0;
+    uint hi = numTrees;
+    while (hi - lo > 1)
+    {
+        uint mid = (lo + hi) >> 1;
+        if (batch[mid].w <= (int) gid)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    emitEntries(keys, values, splats, batch[lo].xyz, levelOffsets, minShift, maxShift,
+                lo, gid * 8, gid + firstSplat);
 }
 
 /**
@@ -0,0 +1,69 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Kernels to pack vertices and triangles into 64-bit values for transfer to
+ * the host. The format is described by @ref MeshPacking.
+ *
+ * The following macros must be defined by the host:
+ * - PACKED_BITS: number of bits per component.
+ */
+
+#define PACKED_MAX ((1U << PACKED_BITS) - 1U)
+
+/**
+ * Quantise each vertex @a v to <code>(v - biasInvScale.xyz) * biasInvScale.w</code>,
+ * rounded and clamped to the representable range, and pack the result.
+ *
+ * There is one workitem per vertex.
+ */
+__kernel void packVertices(
+    __global ulong * restrict out,
+    __global const float * restrict vertices,
+    float4 biasInvScale)
+{
+    uint gid = get_global_id(0);
+    float3 vertex = vload3(gid, vertices);
+    float3 q = (vertex - biasInvScale.xyz) * biasInvScale.w;
+    uint3 iq = convert_uint3_sat_rte(clamp(q, 0.0f, (float) PACKED_MAX));
+    iq = min(iq, (uint3) PACKED_MAX);
+    out[gid] = (ulong) iq.x
+        | ((ulong) iq.y << PACKED_BITS)
+        | ((ulong) iq.z << (2 * PACKED_BITS));
+}
+
+/**
+ * Pack each triangle into a single value. The caller must ensure that all
+ * indices fit into @c PACKED_BITS bits.
+ *
+ * There is one workitem per triangle.
+ */
+__kernel void packTriangles(
+    __global ulong * restrict out,
+    __global const uint * restrict triangles)
+{
+    uint gid = get_global_id(0);
+    uint3 tri = vload3(gid, triangles);
+    out[gid] = (ulong) tri.x
+        | ((ulong) tri.y << PACKED_BITS)
+        | ((ulong) tri.z << (2 * PACKED_BITS));
+}
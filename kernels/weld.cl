@@ -0,0 +1,131 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Kernels used by @ref MeshWelder to merge external vertices of several
+ * meshes on the device.
+ */
+
+/// Flag set on a triangle index that refers to the external staging area
+#define EXTERNAL_FLAG 0x80000000U
+
+/**
+ * Append the indices of a mesh to the accumulated triangles. Indices of
+ * internal vertices are offset to their position in the combined internal
+ * vertices, while indices of external vertices are made to refer to the
+ * staging area and flagged with @c EXTERNAL_FLAG.
+ *
+ * There is one work-item per index.
+ *
+ * @param[out] out             Accumulated indices.
+ * @param      in              Indices of the mesh being appended.
+ * @param      outOffset       Position in @a out for the first new index.
+ * @param      numInternal     Number of internal vertices in the new mesh.
+ * @param      internalBase    Number of internal vertices already accumulated.
+ * @param      externalBase    Number of external vertices already staged.
+ */
+__kernel void appendTriangles(
+    __global uint * restrict out,
+    __global const uint * restrict in,
+    uint outOffset,
+    uint numInternal,
+    uint internalBase,
+    uint externalBase)
+{
+    const uint gid = get_global_id(0);
+    const uint idx = in[gid];
+    out[outOffset + gid] = idx < numInternal
+        ? internalBase + idx
+        : (externalBase + idx - numInternal) | EXTERNAL_FLAG;
+}
+
+/**
+ * Sets each element to its own index, to serve as the values when sorting
+ * the staged keys. There is one work-item per element.
+ */
+__kernel void initIndices(__global uint *indices)
+{
+    const uint gid = get_global_id(0);
+    indices[gid] = gid;
+}
+
+/**
+ * Write 1 to @a unique for each key that differs from the next key (the last
+ * of a run), 0 otherwise. There is one work-item per key, and the key array
+ * must be terminated by a sentinel.
+ */
+__kernel void countUniqueKeys(
+    __global uint * restrict unique,
+    __global const ulong * restrict keys)
+{
+    const uint gid = get_global_id(0);
+    unique[gid] = keys[gid] != keys[gid + 1] ? 1 : 0;
+}
+
+/**
+ * Copy one vertex of each run of equal keys to the output, and record where
+ * every staged vertex ended up. There is one work-item per staged vertex.
+ *
+ * @param[out] outVertices     Output vertices, as packed x,y,z triplets.
+ * @param[out] outKeys         Keys corresponding to @a outVertices.
+ * @param[out] remap           Maps staging positions to output positions.
+ * @param      unique          Exclusive scan of the output of @ref countUniqueKeys.
+ * @param      indices         Original staging position of each sorted key.
+ * @param      keys            Sorted keys (plus a sentinel).
+ * @param      vertices        Staged vertices, in original order.
+ * @param      base            Output position of the first external vertex.
+ */
+__kernel void compactExternal(
+    __global float * restrict outVertices,
+    __global ulong * restrict outKeys,
+    __global uint * restrict remap,
+    __global const uint * restrict unique,
+    __global const uint * restrict indices,
+    __global const ulong * restrict keys,
+    __global const float * restrict vertices,
+    uint base)
+{
+    const uint gid = get_global_id(0);
+    const uint u = base + unique[gid];
+    const uint idx = indices[gid];
+    const ulong key = keys[gid];
+    if (key != keys[gid + 1])
+    {
+        vstore3(vload3(idx, vertices), u, outVertices);
+        outKeys[u] = key;
+    }
+    remap[idx] = u;
+}
+
+/**
+ * Resolve the indices flagged by @ref appendTriangles. There is one
+ * work-item per index.
+ */
+__kernel void reindexTriangles(
+    __global uint *triangles,
+    __global const uint * restrict remap)
+{
+    const uint gid = get_global_id(0);
+    const uint idx = triangles[gid];
+    if (idx & EXTERNAL_FLAG)
+        triangles[gid] = remap[idx & ~EXTERNAL_FLAG];
+}
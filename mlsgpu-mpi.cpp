@@ -121,18 +121,28 @@ private:
     int gatherRoot;
     MPI_Comm progressComm;
     int progressRoot;
+    std::string *subsamplingRecorded;
 
 public:
+    /**
+     * Constructor.
+     *
+     * @param subsamplingRecorded  Receives the fit data recorded by the
+     *                             subsampling model (see @ref SubsamplingModel::saveRecorded),
+     *                             or is left untouched if there is no model.
+     */
     Slave(const std::vector<std::pair<cl::Context, cl::Device> > &devices,
           const po::variables_map &vm,
           Splats &splats,
           MPI_Comm scatterComm, int scatterRoot,
           MPI_Comm gatherComm, int gatherRoot,
-          MPI_Comm progressComm, int progressRoot)
+          MPI_Comm progressComm, int progressRoot,
+          std::string *subsamplingRecorded)
         : devices(devices), vm(vm), splats(splats),
         scatterComm(scatterComm), scatterRoot(scatterRoot),
         gatherComm(gatherComm), gatherRoot(gatherRoot),
-        progressComm(progressComm), progressRoot(progressRoot)
+        progressComm(progressComm), progressRoot(progressRoot),
+        subsamplingRecorded(subsamplingRecorded)
     {
     }
 
@@ -290,11 +300,72 @@ void Slave::operator()() const
 
     slaveWorkers.stop();
     gatherGroup.stop();
+    if (slaveWorkers.subsamplingModel)
+    {
+        // Saved by the root, once all ranks have contributed
+        std::ostringstream recorded;
+        slaveWorkers.subsamplingModel->saveRecorded(recorded);
+        *subsamplingRecorded = recorded.str();
+    }
     progress.sync();
 
     Statistics::finalizeEventTimes();
 }
 
+/**
+ * Combine the subsampling models from all ranks and save the result on the @a
+ * root rank. Each rank contributes only the data it recorded, so that the data
+ * loaded from the file at startup is counted once.
+ *
+ * @param recorded     Data written by @ref SubsamplingModel::saveRecorded on
+ *                     this rank, or empty if this rank had no devices.
+ */
+static void doSubsamplingModel(const po::variables_map &vm, MPI_Comm comm, int root,
+                               const std::string &recorded)
+{
+    if (!vm.count(Option::subsamplingModel))
+        return;
+
+    int rank;
+    int size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    if (rank == root)
+    {
+        boost::scoped_ptr<SubsamplingModel> model(createSubsamplingModel(vm));
+        for (int slave = 0; slave < size; slave++)
+        {
+            std::string data = recorded;
+            if (slave != root)
+            {
+                /* Receive from each rank in turn, so that a rank that has
+                 * already moved on to sending its statistics is not mistaken
+                 * for one sending its model.
+                 */
+                MPI_Status status;
+                MPI_Probe(slave, MLSGPU_TAG_WORK, comm, &status);
+                int length;
+                MPI_Get_count(&status, MPI_CHAR, &length);
+                boost::scoped_array<char> buffer(new char[std::max(length, 1)]);
+                MPI_Recv(buffer.get(), length, MPI_CHAR, slave, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+                data.assign(buffer.get(), length);
+            }
+            if (!data.empty())
+            {
+                std::istringstream in(data);
+                model->merge(in);
+            }
+        }
+        writeSubsamplingModel(*model, vm[Option::subsamplingModel].as<std::string>());
+    }
+    else
+    {
+        MPI_Send(const_cast<char *>(recorded.data()), recorded.length(), MPI_CHAR,
+                 root, MLSGPU_TAG_WORK, comm);
+    }
+}
+
 /**
  * Collect statistics from all rank, and write to the output file on the @a root
  * rank.
@@ -414,12 +485,13 @@ static std::size_t run(
                                &splats, comm, root, _1, _2, &Log::log[Log::info], true));
 
     boost::scoped_ptr<boost::thread> slaveThread;
+    std::string subsamplingRecorded;
     if (!devices.empty())
     {
         slaveThread.reset(new boost::thread(Slave(
                     devices, vm, splats,
                     scatterComm, root, gatherComm, root,
-                    progressComm, root)));
+                    progressComm, root, &subsamplingRecorded)));
     }
 
     boost::scoped_ptr<FastPly::WriterMPI> writer(new FastPly::WriterMPI);
@@ -440,7 +512,7 @@ static std::size_t run(
             // Open a scope so that objects will be released before finalization
             boost::scoped_ptr<Timeplot::Action> initTimer(new Timeplot::Action("init", mainWorker, "init.time"));
 
-            MesherGroup mesherGroup(memMesh);
+            MesherGroup mesherGroup(memMesh, vm[Option::mesherThreads].as<int>());
             ReceiverGather<MesherGroup::WorkItem, MesherGroup> receiver("receiver", mesherGroup, gatherComm, numSlaves);
             Scatter scatter(scatterComm, mainWorker);
             BucketCollector collector(maxLoadSplats, scatter);
@@ -455,9 +527,12 @@ static std::size_t run(
                 Statistics::Timer timer(passName.str());
 
                 ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
+                Metrics::Gauge progressGauge("progress", boost::bind(&ProgressDisplay::count, &progress));
+                Metrics::Gauge progressTotalGauge("progress.total", boost::bind(&ProgressDisplay::expected_count, &progress));
                 ProgressMPI progressMPI(&progress, splats.numSplats(), progressComm, 0);
 
                 mesherGroup.setInputFunctor(mesher->functor(pass));
+                mesherGroup.setPrepareFunctor(mesher->prepareFunctor(pass));
 
                 // Start threads
                 boost::thread receiverThread(boost::ref(receiver));
@@ -500,6 +575,8 @@ static std::size_t run(
 
     std::size_t ret = mesher->write(mainWorker, &Log::log[Log::info]);
 
+    doSubsamplingModel(vm, comm, root, subsamplingRecorded);
+
     grandTotalTimer.reset();
     doStatistics(vm, comm, root);
     return ret;
@@ -528,6 +605,18 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    try
+    {
+        // Devices differ between processes, so only the host memory is budgeted
+        applyMemoryBudget(vm, std::vector<cl::Device>(), true, rank);
+    }
+    catch (invalid_option &e)
+    {
+        if (rank == 0)
+            cerr << e.what() << endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
     std::vector<cl::Device> devices = CLH::findDevices(vm);
     int numDevices = devices.size();
     int totalDevices;
@@ -589,12 +678,15 @@ int main(int argc, char **argv)
 
     try
     {
+        Timeplot::Closer timeplotCloser;
         if (vm.count(Option::timeplot))
         {
             ostringstream name;
             name << vm[Option::timeplot].as<string>() << "." << rank;
-            Timeplot::init(name.str());
+            Timeplot::init(name.str(), vm.count(Option::timeplotBinary));
         }
+        Metrics::Exporter metrics;
+        startMetrics(vm, metrics, rank);
 
         std::size_t filesWritten;
         if (vm.count(Option::resume))
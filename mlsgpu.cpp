@@ -37,6 +37,7 @@
 #include <boost/thread/thread.hpp>
 #include <boost/progress.hpp>
 #include <boost/ref.hpp>
+#include <boost/bind.hpp>
 #include "src/tr1_unordered_map.h"
 #include <iostream>
 #include <map>
@@ -68,10 +69,112 @@
 #include "src/bucket_collector.h"
 #include "src/bucket_loader.h"
 #include "src/mlsgpu_core.h"
+#include "src/checkpoint.h"
 
 namespace po = boost::program_options;
 using namespace std;
 
+/**
+ * Chunk-boundary callback for @ref BucketCollector that writes incremental
+ * checkpoints. Once the interval has elapsed, it drains the pipeline so that
+ * the mesher has seen exactly the complete chunks, writes the checkpoint,
+ * and restarts the workers.
+ */
+class PassCheckpointer : public boost::noncopyable
+{
+public:
+    typedef void result_type;
+
+    PassCheckpointer(
+        Timeplot::Worker &tworker,
+        const boost::filesystem::path &path,
+        double interval,
+        MesherBase &mesher,
+        BucketCollector &collector,
+        SlaveWorkers &slaveWorkers,
+        MesherGroup &mesherGroup,
+        SplatSet::FileSet &splats,
+        const Grid &grid,
+        ProgressMeter *progress)
+        : tworker(tworker), path(path), interval(interval),
+        mesher(mesher), collector(collector), slaveWorkers(slaveWorkers),
+        mesherGroup(mesherGroup), splats(splats), grid(grid), progress(progress)
+    {
+    }
+
+    void operator()(ChunkId::gen_type completeChunks)
+    {
+        if (timer.getElapsed() < interval)
+            return;
+
+        collector.flush();
+        slaveWorkers.stop();
+        mesherGroup.stop();
+        mesher.checkpointPass(tworker, path);
+        Log::log[Log::debug] << "Checkpointed after " << completeChunks << " chunk(s)\n";
+        slaveWorkers.start(splats, grid, progress);
+        mesherGroup.start();
+        timer = Timer();
+    }
+
+private:
+    Timeplot::Worker &tworker;
+    const boost::filesystem::path path;
+    const double interval;
+    MesherBase &mesher;
+    BucketCollector &collector;
+    SlaveWorkers &slaveWorkers;
+    MesherGroup &mesherGroup;
+    SplatSet::FileSet &splats;
+    const Grid &grid;
+    ProgressMeter *progress;
+    Timer timer;               ///< Time since the last checkpoint (or the start of the pass)
+};
+
+/**
+ * Functors for @ref BucketCollector that keep a @ref ChunkTracker informed,
+ * so that @ref StreamMesher can be told when each chunk is complete. Every
+ * bin is counted before it is passed to the loader, and at each chunk
+ * boundary the bins of the complete chunks are flushed before those chunks
+ * are closed.
+ */
+class ChunkTrackerFunctors : public boost::noncopyable
+{
+public:
+    ChunkTrackerFunctors(
+        Timeplot::Worker &tworker,
+        ChunkTracker &tracker,
+        BucketLoader &loader)
+        : tworker(tworker), tracker(tracker), loader(loader), collector(NULL)
+    {
+    }
+
+    /// Set the collector to flush at chunk boundaries
+    void setCollector(BucketCollector *collector) { this->collector = collector; }
+
+    /// Bin functor for @ref BucketCollector
+    void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins)
+    {
+        for (std::size_t i = 0; i < bins.size(); i++)
+            tracker.add(bins[i].chunkId);
+        loader(bins);
+    }
+
+    /// Chunk functor for @ref BucketCollector
+    void operator()(ChunkId::gen_type completeChunks)
+    {
+        MLSGPU_ASSERT(collector != NULL, state_error);
+        collector->flush();
+        tracker.close(tworker, completeChunks);
+    }
+
+private:
+    Timeplot::Worker &tworker;
+    ChunkTracker &tracker;
+    BucketLoader &loader;
+    BucketCollector *collector;
+};
+
 /**
  * Main execution.
  *
@@ -99,15 +202,36 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
         boost::scoped_ptr<FastPly::Writer> writer(new FastPly::Writer(writerType));
         setWriterComments(vm, *writer);
 
-        boost::scoped_ptr<MesherBase> mesher(new OOCMesher(*writer, getNamer(vm, out)));
+        const MesherType mesherType = getMesherType(vm, devices.size());
+        boost::scoped_ptr<MesherBase> mesher;
+        if (mesherType == STREAM_MESHER)
+        {
+            StreamMesher *streamMesher = new StreamMesher(*writer, getNamer(vm, out));
+            mesher.reset(streamMesher);
+            streamMesher->setChunkCapacity(memMesh);
+        }
+        else
+            mesher.reset(new OOCMesher(*writer, getNamer(vm, out)));
         setMesherOptions(vm, *mesher);
 
+        bool finished = false;
+        ChunkId::gen_type skipChunks = 0;
         if (vm.count(Option::resume))
         {
             boost::filesystem::path path(vm[Option::resume].as<std::string>());
-            ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
+            if (Checkpoint::Reader(path).getKind() == Checkpoint::KIND_FINAL)
+            {
+                ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
+                finished = true;
+            }
+            else
+            {
+                skipChunks = mesher->resumePass(mainWorker, path);
+                Log::log[Log::info] << "Resuming after " << skipChunks << " complete chunk(s)\n";
+            }
         }
-        else
+
+        if (!finished)
         {
             {
                 // Open a scope so that objects will be released before finalization
@@ -115,11 +239,23 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 boost::scoped_ptr<Timeplot::Action> initTimer(new Timeplot::Action("init", mainWorker, "init.time"));
 
                 Log::log[Log::info] << "Initializing...\n";
-                MesherGroup mesherGroup(memMesh);
+                MesherGroup mesherGroup(memMesh, vm[Option::mesherThreads].as<int>());
                 SlaveWorkers slaveWorkers(
                     mainWorker, vm, devices,
                     makeOutputGenerator(mesherGroup));
-                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                boost::scoped_ptr<ChunkTracker> tracker;
+                boost::scoped_ptr<ChunkTrackerFunctors> trackerFunctors;
+                BucketCollector::Functor collectorFunctor = boost::ref(*slaveWorkers.loader);
+                if (mesherType == STREAM_MESHER)
+                {
+                    tracker.reset(new ChunkTracker(mesherGroup));
+                    trackerFunctors.reset(new ChunkTrackerFunctors(mainWorker, *tracker, *slaveWorkers.loader));
+                    collectorFunctor = boost::ref(*trackerFunctors);
+                    for (std::size_t i = 0; i < slaveWorkers.deviceWorkerGroups.size(); i++)
+                        slaveWorkers.deviceWorkerGroups[i].setChunkTracker(tracker.get());
+                }
+                BucketCollector collector(maxLoadSplats, collectorFunctor);
+                collector.setSkipChunks(skipChunks);
 
                 Splats splats;
                 doComputeBlobs(mainWorker, vm, splats,
@@ -137,8 +273,28 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                     Statistics::Timer timer(passName.str());
 
                     ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
+                    Metrics::Gauge progressGauge("progress", boost::bind(&ProgressDisplay::count, &progress));
+                    Metrics::Gauge progressTotalGauge("progress.total", boost::bind(&ProgressDisplay::expected_count, &progress));
 
                     mesherGroup.setInputFunctor(mesher->functor(pass));
+                    mesherGroup.setPrepareFunctor(mesher->prepareFunctor(pass));
+
+                    boost::scoped_ptr<PassCheckpointer> checkpointer;
+                    if (vm[Option::checkpointInterval].as<double>() > 0.0)
+                    {
+                        checkpointer.reset(new PassCheckpointer(
+                                mainWorker, vm[Option::checkpoint].as<std::string>(),
+                                vm[Option::checkpointInterval].as<double>(),
+                                *mesher, collector, slaveWorkers, mesherGroup,
+                                splats, grid, &progress));
+                        collector.setChunkFunctor(boost::ref(*checkpointer));
+                    }
+
+                    if (trackerFunctors)
+                    {
+                        trackerFunctors->setCollector(&collector);
+                        collector.setChunkFunctor(boost::ref(*trackerFunctors));
+                    }
 
                     // Start threads
                     slaveWorkers.start(splats, grid, &progress);
@@ -163,9 +319,11 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                      * are terminated.
                      */
                     collector.flush();
+                    collector.setChunkFunctor(BucketCollector::ChunkFunctor());
                     slaveWorkers.stop();
                     mesherGroup.stop();
                 }
+                slaveWorkers.saveSubsamplingModel();
             }
 
             if (vm.count(Option::checkpoint))
@@ -199,6 +357,7 @@ int main(int argc, char **argv)
 
     try
     {
+        applyMemoryBudget(vm, devices, false);
         validateOptions(vm, false);
     }
     catch (invalid_option &e)
@@ -232,8 +391,11 @@ int main(int argc, char **argv)
 
     try
     {
+        Timeplot::Closer timeplotCloser;
         if (vm.count(Option::timeplot))
-            Timeplot::init(vm[Option::timeplot].as<string>());
+            Timeplot::init(vm[Option::timeplot].as<string>(), vm.count(Option::timeplotBinary));
+        Metrics::Exporter metrics;
+        startMetrics(vm, metrics);
 
         std::size_t filesWritten = run(cd, vm[Option::outputFile].as<string>(), vm);
         if (filesWritten == 0)
@@ -0,0 +1,207 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Minimal atomic integers, built on compiler intrinsics since the code base
+ * predates C++11 @c std::atomic.
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+#include "tr1_cstdint.h"
+
+#if _MSC_VER
+# include <windows.h>
+# include <intrin.h>
+#endif
+
+namespace AtomicDetail
+{
+
+#if _MSC_VER
+
+template<std::size_t Size> struct Ops;
+
+template<> struct Ops<4>
+{
+    template<typename T>
+    static T compareExchange(volatile T *ptr, T expected, T desired)
+    {
+        return (T) _InterlockedCompareExchange(
+            reinterpret_cast<volatile long *>(ptr), (long) desired, (long) expected);
+    }
+
+    template<typename T>
+    static T fetchAdd(volatile T *ptr, T delta)
+    {
+        return (T) _InterlockedExchangeAdd(reinterpret_cast<volatile long *>(ptr), (long) delta);
+    }
+};
+
+template<> struct Ops<8>
+{
+    template<typename T>
+    static T compareExchange(volatile T *ptr, T expected, T desired)
+    {
+        return (T) _InterlockedCompareExchange64(
+            reinterpret_cast<volatile __int64 *>(ptr), (__int64) desired, (__int64) expected);
+    }
+
+    template<typename T>
+    static T fetchAdd(volatile T *ptr, T delta)
+    {
+        T old = *ptr;
+        while (true)
+        {
+            T seen = compareExchange(ptr, old, T(old + delta));
+            if (seen == old)
+                return old;
+            old = seen;
+        }
+    }
+};
+
+#endif
+
+} // namespace AtomicDetail
+
+/// Full memory barrier
+inline void atomicFence()
+{
+#if _MSC_VER
+    _ReadWriteBarrier();
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+/**
+ * An integer that may be concurrently read and modified by several threads.
+ * All operations are sequentially consistent, which is stronger than most
+ * callers need but avoids having to reason about weaker orderings.
+ *
+ * Only integral types of 4 or 8 bytes are supported.
+ */
+template<typename T>
+class Atomic : public boost::noncopyable
+{
+    BOOST_STATIC_ASSERT(sizeof(T) == 4 || sizeof(T) == 8);
+private:
+    volatile T value;
+
+public:
+    explicit Atomic(T value = T()) : value(value) {}
+
+    /// Read the current value
+    T load() const
+    {
+        if (sizeof(T) > sizeof(void *))
+        {
+            // Plain loads of this size may tear, so use a no-op compare-and-swap
+            T expected = T();
+            const_cast<Atomic *>(this)->compareExchange(expected, T());
+            return expected;
+        }
+        atomicFence();
+        T ans = value;
+        atomicFence();
+        return ans;
+    }
+
+    /// Replace the current value
+    void store(T v)
+    {
+        if (sizeof(T) > sizeof(void *))
+        {
+            T expected = value;
+            while (!compareExchange(expected, v))
+            {
+            }
+            return;
+        }
+        atomicFence();
+        value = v;
+        atomicFence();
+    }
+
+    /**
+     * Replace the current value with @a v if @a v is larger.
+     *
+     * @return The new value.
+     */
+    T fetchMax(T v)
+    {
+        T expected = load();
+        while (expected < v)
+        {
+            if (compareExchange(expected, v))
+                return v;
+        }
+        return expected;
+    }
+
+    /// Add @a delta and return the previous value
+    T fetchAdd(T delta)
+    {
+#if _MSC_VER
+        return AtomicDetail::Ops<sizeof(T)>::fetchAdd(&value, delta);
+#else
+        return __sync_fetch_and_add(&value, delta);
+#endif
+    }
+
+    /// Subtract @a delta and return the previous value
+    T fetchSub(T delta)
+    {
+        return fetchAdd(T(T() - delta));
+    }
+
+    /**
+     * If the value is @a expected, replace it with @a desired. Otherwise,
+     * @a expected is updated to the current value.
+     *
+     * @return Whether the value was replaced.
+     */
+    bool compareExchange(T &expected, T desired)
+    {
+#if _MSC_VER
+        T old = AtomicDetail::Ops<sizeof(T)>::compareExchange(&value, expected, desired);
+#else
+        T old = __sync_val_compare_and_swap(&value, expected, desired);
+#endif
+        if (old == expected)
+            return true;
+        expected = old;
+        return false;
+    }
+};
+
+#endif /* !ATOMIC_H */
@@ -0,0 +1,325 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref BlockCompress::Writer and @ref BlockCompress::Reader.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <ios>
+#include <stdexcept>
+#include <algorithm>
+#include <boost/exception/all.hpp>
+#include <boost/thread/locks.hpp>
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+#include "block_compress.h"
+#include "statistics.h"
+#include "errors.h"
+
+namespace BlockCompress
+{
+
+namespace
+{
+
+/// Header preceding each block
+struct Header
+{
+    std::tr1::uint32_t magic;           ///< Always @ref blockMagic
+    std::tr1::uint8_t codec;            ///< A @ref Codec value
+    std::tr1::uint8_t filter;           ///< A @ref Filter value
+    std::tr1::uint16_t recordSize;      ///< Bytes per record
+    std::tr1::uint32_t rawBytes;        ///< Size of the block before compression
+    std::tr1::uint32_t storedBytes;     ///< Size of the payload following the header
+};
+
+/// Identifies a block header (also detects byte order mismatches)
+static const std::tr1::uint32_t blockMagic = 0x4b4c4253;
+
+/// Encoding of the payload
+enum Codec
+{
+    CODEC_STORED = 0,
+    CODEC_ZLIB = 1
+};
+
+/**
+ * Apply a @ref Filter and byte shuffle to @a bytes bytes of records of
+ * @a recordSize bytes each. Byte @a b of word @a i of the input is placed at
+ * position <code>b * words + i</code> of the output, where @a words is the
+ * total number of words.
+ */
+static void encode(const char *in, char *out, std::size_t bytes,
+                   std::size_t recordSize, Filter filter)
+{
+    const std::size_t stride = recordSize / 4;
+    const std::size_t words = bytes / 4;
+    for (std::size_t i = 0; i < words; i++)
+    {
+        std::tr1::uint32_t cur, prev = 0;
+        std::memcpy(&cur, in + i * 4, 4);
+        if (i >= stride)
+            std::memcpy(&prev, in + (i - stride) * 4, 4);
+        std::tr1::uint32_t v;
+        switch (filter)
+        {
+        case FILTER_XOR_DELTA: v = cur ^ prev; break;
+        case FILTER_DELTA:     v = cur - prev; break;
+        default:               v = cur; break;
+        }
+        const unsigned char *vb = reinterpret_cast<const unsigned char *>(&v);
+        for (int b = 0; b < 4; b++)
+            out[b * words + i] = vb[b];
+    }
+}
+
+/// Inverse of @ref encode.
+static void decode(const char *in, char *out, std::size_t bytes,
+                   std::size_t recordSize, Filter filter)
+{
+    const std::size_t stride = recordSize / 4;
+    const std::size_t words = bytes / 4;
+    for (std::size_t i = 0; i < words; i++)
+    {
+        std::tr1::uint32_t v, prev = 0;
+        unsigned char *vb = reinterpret_cast<unsigned char *>(&v);
+        for (int b = 0; b < 4; b++)
+            vb[b] = in[b * words + i];
+        if (i >= stride)
+            std::memcpy(&prev, out + (i - stride) * 4, 4);
+        std::tr1::uint32_t cur;
+        switch (filter)
+        {
+        case FILTER_XOR_DELTA: cur = v ^ prev; break;
+        case FILTER_DELTA:     cur = v + prev; break;
+        default:               cur = v; break;
+        }
+        std::memcpy(out + i * 4, &cur, 4);
+    }
+}
+
+} // anonymous namespace
+
+bool haveCodec()
+{
+#if HAVE_ZLIB_H
+    return true;
+#else
+    return false;
+#endif
+}
+
+Writer::Writer(std::ostream &out, std::size_t recordSize, Filter filter, std::size_t blockBytes)
+    : out(out), recordSize(recordSize), filter(filter),
+    blockBytes(std::max(blockBytes - blockBytes % recordSize, recordSize))
+{
+    MLSGPU_ASSERT(recordSize > 0 && recordSize % 4 == 0 && recordSize <= 0xffff, std::invalid_argument);
+    raw.reserve(this->blockBytes);
+}
+
+void Writer::write(const void *data, std::size_t bytes)
+{
+    MLSGPU_ASSERT(bytes % recordSize == 0, std::invalid_argument);
+    const char *ptr = static_cast<const char *>(data);
+    while (bytes > 0)
+    {
+        std::size_t n = std::min(bytes, blockBytes - raw.size());
+        raw.insert(raw.end(), ptr, ptr + n);
+        ptr += n;
+        bytes -= n;
+        if (raw.size() == blockBytes)
+            flush();
+    }
+}
+
+void Writer::flush()
+{
+    if (raw.empty())
+        return;
+
+    Statistics::Timer timer("tmpcompress.encode.time");
+    filtered.resize(raw.size());
+    encode(&raw[0], &filtered[0], raw.size(), recordSize, filter);
+
+    Header header;
+    header.magic = blockMagic;
+    header.codec = CODEC_STORED;
+    header.filter = filter;
+    header.recordSize = recordSize;
+    header.rawBytes = raw.size();
+    header.storedBytes = raw.size();
+    const char *payload = &filtered[0];
+
+#if HAVE_ZLIB_H
+    uLongf compressedBytes = compressBound(raw.size());
+    compressed.resize(compressedBytes);
+    if (compress2(&compressed[0], &compressedBytes,
+                  reinterpret_cast<const Bytef *>(&filtered[0]), raw.size(), 1) == Z_OK
+        && compressedBytes < raw.size())
+    {
+        header.codec = CODEC_ZLIB;
+        header.storedBytes = compressedBytes;
+        payload = reinterpret_cast<const char *>(&compressed[0]);
+    }
+#endif
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(payload, header.storedBytes);
+    Statistics::getStatistic<Statistics::Variable>("tmpcompress.ratio").add(
+        double(header.storedBytes + sizeof(header)) / header.rawBytes);
+    raw.clear();
+}
+
+Reader::Reader(BinaryReader *base)
+    : base(base), rawSize(0), cachedBlock(~std::size_t(0))
+{
+}
+
+Reader::~Reader()
+{
+    if (isOpen())
+        close();
+}
+
+void Reader::openImpl(const boost::filesystem::path &path)
+{
+    base->open(path);
+    blocks.clear();
+    rawSize = 0;
+    cachedBlock = ~std::size_t(0);
+
+    const offset_type fileSize = base->size();
+    offset_type pos = 0;
+    while (pos < fileSize)
+    {
+        Header header;
+        if (fileSize - pos < sizeof(header)
+            || base->read(&header, sizeof(header), pos) != sizeof(header)
+            || header.magic != blockMagic
+            || (header.codec != CODEC_STORED && header.codec != CODEC_ZLIB)
+            || header.recordSize == 0 || header.recordSize % 4 != 0
+            || header.rawBytes == 0 || header.rawBytes % header.recordSize != 0
+            || fileSize - pos - sizeof(header) < header.storedBytes)
+        {
+            base->close();
+            throw std::runtime_error("Compressed temporary file is truncated or corrupt");
+        }
+        Block b;
+        b.rawOffset = rawSize;
+        b.fileOffset = pos + sizeof(header);
+        b.rawBytes = header.rawBytes;
+        b.storedBytes = header.storedBytes;
+        b.recordSize = header.recordSize;
+        b.codec = header.codec;
+        b.filter = header.filter;
+        blocks.push_back(b);
+        rawSize += header.rawBytes;
+        pos = b.fileOffset + header.storedBytes;
+    }
+}
+
+void Reader::closeImpl()
+{
+    base->close();
+    blocks.clear();
+    rawSize = 0;
+    cachedBlock = ~std::size_t(0);
+}
+
+void Reader::load(std::size_t idx) const
+{
+    if (idx == cachedBlock)
+        return;
+
+    Statistics::Timer timer("tmpcompress.decode.time");
+    const Block &b = blocks[idx];
+    cachedBlock = ~std::size_t(0);
+    scratch.resize(b.storedBytes);
+    if (b.storedBytes > 0
+        && base->read(&scratch[0], b.storedBytes, b.fileOffset) != b.storedBytes)
+        throw std::runtime_error("Compressed temporary file is truncated or corrupt");
+
+    const char *filtered = scratch.empty() ? NULL : &scratch[0];
+    std::vector<char> inflated;
+    if (b.codec == CODEC_ZLIB)
+    {
+#if HAVE_ZLIB_H
+        inflated.resize(b.rawBytes);
+        uLongf rawBytes = b.rawBytes;
+        if (uncompress(reinterpret_cast<Bytef *>(&inflated[0]), &rawBytes,
+                       reinterpret_cast<const Bytef *>(&scratch[0]), b.storedBytes) != Z_OK
+            || rawBytes != b.rawBytes)
+            throw std::runtime_error("Compressed temporary file is truncated or corrupt");
+        filtered = &inflated[0];
+#else
+        throw std::runtime_error("Compressed temporary file requires zlib support");
+#endif
+    }
+    else if (b.storedBytes != b.rawBytes)
+        throw std::runtime_error("Compressed temporary file is truncated or corrupt");
+
+    cache.resize(b.rawBytes);
+    if (b.rawBytes > 0)
+        decode(filtered, &cache[0], b.rawBytes, b.recordSize, Filter(b.filter));
+    cachedBlock = idx;
+}
+
+std::size_t Reader::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    char *out = static_cast<char *>(buf);
+    std::size_t done = 0;
+    while (done < count && offset < rawSize)
+    {
+        // Find the last block starting at or before offset
+        std::size_t lo = 0, hi = blocks.size();
+        while (hi - lo > 1)
+        {
+            std::size_t mid = (lo + hi) / 2;
+            if (blocks[mid].rawOffset <= offset)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        load(lo);
+        const std::size_t start = offset - blocks[lo].rawOffset;
+        const std::size_t n = std::min(count - done, cache.size() - start);
+        std::memcpy(out + done, &cache[start], n);
+        done += n;
+        offset += n;
+    }
+    return done;
+}
+
+BinaryReader::offset_type Reader::sizeImpl() const
+{
+    return rawSize;
+}
+
+} // namespace BlockCompress
@@ -0,0 +1,160 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Block compression of temporary files of fixed-size records.
+ */
+
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "tr1_cstdint.h"
+#include "binary_io.h"
+
+/**
+ * Compression of files of fixed-size records, in independently compressed
+ * blocks so that they can still be read at random offsets.
+ *
+ * Each block is a header followed by the payload. Before compression, the
+ * records in a block are passed through a @ref Filter that makes them more
+ * compressible, and the bytes are then grouped by their position within
+ * 32-bit words. The payload is compressed with zlib if it is available and
+ * the result is smaller; otherwise it is stored as is. Blocks are
+ * self-describing, so a file may be extended by appending further blocks.
+ */
+namespace BlockCompress
+{
+
+/// Transformations applied to the 32-bit words of each record before compression
+enum Filter
+{
+    /// No transformation
+    FILTER_NONE = 0,
+    /// XOR with the corresponding word of the previous record (suits floats)
+    FILTER_XOR_DELTA = 1,
+    /// Subtract the corresponding word of the previous record (suits indices)
+    FILTER_DELTA = 2
+};
+
+/// Returns true if the library was built with a compression codec.
+bool haveCodec();
+
+/**
+ * Appends compressed blocks to a stream. Data is buffered until a block is
+ * full, so @ref flush must be called before the stream is closed.
+ */
+class Writer : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param out          Stream to receive the blocks.
+     * @param recordSize   Bytes per record. It must be a multiple of 4.
+     * @param filter       Filter to apply before compression.
+     * @param blockBytes   Approximate uncompressed size of each block. It is
+     *                     rounded down to a multiple of @a recordSize.
+     */
+    Writer(std::ostream &out, std::size_t recordSize, Filter filter,
+           std::size_t blockBytes = 256 * 1024);
+
+    /**
+     * Append data. Only whole records may be written.
+     *
+     * @pre @a bytes is a multiple of the record size.
+     */
+    void write(const void *data, std::size_t bytes);
+
+    /// Emit any partial block
+    void flush();
+
+private:
+    std::ostream &out;
+    const std::size_t recordSize;
+    const Filter filter;
+    const std::size_t blockBytes;
+    std::vector<char> raw;                   ///< Buffered data for the current block
+    std::vector<char> filtered;              ///< Scratch space for the filtered block
+    std::vector<unsigned char> compressed;   ///< Scratch space for the compressed block
+};
+
+/**
+ * Reads a file written by @ref Writer, presenting the uncompressed data.
+ * The block headers are scanned when the file is opened. The most recently
+ * decompressed block is cached, so sequential reads are cheap.
+ */
+class Reader : public BinaryReader
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param base   Reader for the compressed file, which takes ownership of it.
+     */
+    explicit Reader(BinaryReader *base);
+
+    virtual ~Reader();
+
+private:
+    /// Location of a block
+    struct Block
+    {
+        offset_type rawOffset;       ///< Position of the block in the uncompressed data
+        offset_type fileOffset;      ///< Position of the payload in the file
+        std::tr1::uint32_t rawBytes;     ///< Uncompressed size
+        std::tr1::uint32_t storedBytes;  ///< Size of the payload in the file
+        std::tr1::uint16_t recordSize;   ///< Record size for unfiltering
+        std::tr1::uint8_t codec;         ///< Compression of the payload
+        std::tr1::uint8_t filter;        ///< A @ref Filter
+    };
+
+    boost::scoped_ptr<BinaryReader> base;   ///< Underlying compressed file
+    std::vector<Block> blocks;              ///< Index of all blocks
+    offset_type rawSize;                    ///< Total uncompressed size
+
+    mutable boost::mutex mutex;             ///< Protects the cache
+    mutable std::size_t cachedBlock;        ///< Index of block in @ref cache, or ~0 if none
+    mutable std::vector<char> cache;        ///< Decoded contents of @ref cachedBlock
+    mutable std::vector<char> scratch;      ///< Space for the stored payload
+
+    /// Decode block @a idx into @ref cache.
+    void load(std::size_t idx) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+};
+
+} // namespace BlockCompress
+
+#endif /* !BLOCK_COMPRESS_H */
@@ -39,7 +39,7 @@
 
 BucketCollector::BucketCollector(SplatSet::splat_id maxSplats, Functor functor)
     : maxSplats(maxSplats), functor(functor),
-    bins("mem.BucketCollector.bins"), numSplats(0),
+    bins("mem.BucketCollector.bins"), numSplats(0), skipChunks(0),
     binsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.bins")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.splats"))
 {
@@ -50,14 +50,18 @@ void BucketCollector::operator()(
     const Grid &grid,
     const Bucket::Recursion &recursionState)
 {
-    if (numSplats + splats.numSplats() > maxSplats)
-        flush();
-
     if (recursionState.chunk != curChunkId.coords)
     {
         curChunkId.gen++;
         curChunkId.coords = recursionState.chunk;
+        if (chunkFunctor && curChunkId.gen > skipChunks)
+            chunkFunctor(curChunkId.gen);
     }
+    if (curChunkId.gen < skipChunks)
+        return;
+
+    if (numSplats + splats.numSplats() > maxSplats)
+        flush();
 
     bins.push_back(Bin());
     Bin &bin = bins.back();
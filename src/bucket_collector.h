@@ -43,7 +43,9 @@
  * them until the total number of splats reaches a threshold. It then
  * makes a callback with the collected results.
  *
- * It also assigns generation numbers to chunk IDs.
+ * It also assigns generation numbers to chunk IDs. Optionally, it can skip
+ * the chunks that are already complete (when resuming from a checkpoint) and
+ * notify a callback at each chunk boundary.
  */
 class BucketCollector : public boost::noncopyable
 {
@@ -57,6 +59,15 @@ public:
 
     typedef boost::function<void(const Statistics::Container::vector<Bin> &bins)> Functor;
 
+    /**
+     * Type of the callback made at chunk boundaries. The argument is the
+     * number of chunks that are complete, i.e., the generation number of the
+     * chunk about to start. It is called before the first bin of that chunk
+     * is collected, so it may call @ref flush to push out all bins of the
+     * complete chunks.
+     */
+    typedef boost::function<void(ChunkId::gen_type completeChunks)> ChunkFunctor;
+
     void operator()(
         const SplatSet::SubsetBase &splats,
         const Grid &grid,
@@ -72,12 +83,24 @@ public:
 
     void flush(); ///< Flush any partial bins to the output
 
+    /**
+     * Discard bins belonging to chunks with a generation number less than @a
+     * skip. Generation numbers are still assigned as normal, so that they
+     * match those of a previous run over the same input.
+     */
+    void setSkipChunks(ChunkId::gen_type skip) { skipChunks = skip; }
+
+    /// Set a callback to make at each chunk boundary (see @ref ChunkFunctor)
+    void setChunkFunctor(const ChunkFunctor &chunkFunctor) { this->chunkFunctor = chunkFunctor; }
+
 private:
     ChunkId curChunkId;           ///< Last-seen chunk ID
     SplatSet::splat_id maxSplats; ///< Limit on splats to pass to @ref functor
     Functor functor;              ///< Callback function
     Statistics::Container::vector<Bin> bins;  ///< Buffer of splat ranges
     SplatSet::splat_id numSplats; ///< Splats collected in @ref bins
+    ChunkId::gen_type skipChunks; ///< Chunks to discard (see @ref setSkipChunks)
+    ChunkFunctor chunkFunctor;    ///< Callback at chunk boundaries (may be empty)
 
     Statistics::Variable &binsStat;   ///< Number of bins per flush
     Statistics::Variable &splatsStat; ///< Number of splats per flush
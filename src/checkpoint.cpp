@@ -0,0 +1,197 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref Checkpoint::Writer and @ref Checkpoint::Reader.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <ios>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/exception/all.hpp>
+#include "checkpoint.h"
+#include "errors.h"
+
+namespace Checkpoint
+{
+
+namespace
+{
+
+/// Fixed header at the start of every checkpoint file
+struct Header
+{
+    char magic[8];                      ///< Always @ref checkpointMagic
+    std::tr1::uint32_t byteOrder;       ///< Always @ref checkpointByteOrder, in native order
+    std::tr1::uint32_t version;         ///< Always @ref checkpointVersion
+    std::tr1::uint32_t kind;            ///< A @ref Kind value
+    std::tr1::uint32_t numSections;     ///< Number of entries in the section table
+    std::tr1::uint64_t tableOffset;     ///< File position of the section table
+};
+
+/// Identifies checkpoint files
+static const char checkpointMagic[8] = {'M', 'L', 'S', 'G', 'P', 'U', 'C', 'K'};
+/// Detects checkpoints written on a machine of different endianness
+static const std::tr1::uint32_t checkpointByteOrder = 0x01020304;
+/// Version of the layout
+static const std::tr1::uint32_t checkpointVersion = 1;
+
+} // anonymous namespace
+
+Writer::Writer(const boost::filesystem::path &path, Kind kind)
+    : path(path), tmpPath(path.string() + ".tmp"), kind(kind), committed(false)
+{
+    out.open(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not open file"))
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(tmpPath.string());
+    }
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+Writer::~Writer()
+{
+    if (!committed)
+    {
+        out.close();
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmpPath, ec);
+    }
+}
+
+void Writer::pad()
+{
+    static const char zeros[ALIGNMENT] = {};
+    std::size_t rem = std::size_t(out.tellp()) % ALIGNMENT;
+    if (rem != 0)
+        out.write(zeros, ALIGNMENT - rem);
+}
+
+void Writer::addSectionRaw(const void *data, std::size_t count, std::size_t size)
+{
+    MLSGPU_ASSERT(!committed, state_error);
+    MLSGPU_ASSERT(size > 0, std::invalid_argument);
+
+    pad();
+    Section s;
+    s.offset = std::tr1::uint64_t(out.tellp());
+    s.count = count;
+    s.size = size;
+    out.write(static_cast<const char *>(data), count * size);
+    if (!out)
+        throw boost::enable_error_info(std::ios::failure("Failed to write checkpoint"))
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(tmpPath.string());
+    sections.push_back(s);
+}
+
+void Writer::commit()
+{
+    MLSGPU_ASSERT(!committed, state_error);
+
+    pad();
+    Header header;
+    std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.byteOrder = checkpointByteOrder;
+    header.version = checkpointVersion;
+    header.kind = kind;
+    header.numSections = sections.size();
+    header.tableOffset = std::tr1::uint64_t(out.tellp());
+    if (!sections.empty())
+        out.write(reinterpret_cast<const char *>(&sections[0]), sections.size() * sizeof(Section));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out)
+        throw boost::enable_error_info(std::ios::failure("Failed to write checkpoint"))
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(tmpPath.string());
+
+    boost::filesystem::rename(tmpPath, path);
+    committed = true;
+}
+
+Reader::Reader(const boost::filesystem::path &path)
+{
+    mapping.open(path.string());
+    if (!mapping.is_open())
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not create mapping"))
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+
+    const std::size_t fileSize = mapping.size();
+    if (fileSize < sizeof(Header))
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    Header header;
+    std::memcpy(&header, mapping.data(), sizeof(header));
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0)
+        throw std::runtime_error("File is not a checkpoint");
+    if (header.byteOrder != checkpointByteOrder)
+        throw std::runtime_error("Checkpoint was written on a machine with different byte order");
+    if (header.version != checkpointVersion)
+        throw std::runtime_error("Checkpoint has an unsupported version");
+    if (header.kind != KIND_FINAL && header.kind != KIND_PASS)
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    kind = Kind(header.kind);
+
+    if (header.tableOffset % ALIGNMENT != 0
+        || header.tableOffset > fileSize
+        || (fileSize - header.tableOffset) / sizeof(Writer::Section) < header.numSections)
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+
+    sections.resize(header.numSections);
+    if (header.numSections > 0)
+        std::memcpy(&sections[0], mapping.data() + header.tableOffset,
+                    header.numSections * sizeof(Writer::Section));
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        const Writer::Section &s = sections[i];
+        if (s.size == 0
+            || s.offset % ALIGNMENT != 0
+            || s.offset < sizeof(Header)
+            || s.offset > header.tableOffset
+            || (header.tableOffset - s.offset) / s.size < s.count)
+            throw std::runtime_error("Checkpoint is truncated or corrupt");
+    }
+}
+
+const void *Reader::sectionRaw(std::size_t idx, std::size_t size, std::size_t &count) const
+{
+    if (idx >= sections.size() || sections[idx].size != size)
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    count = sections[idx].count;
+    return mapping.data() + sections[idx].offset;
+}
+
+} // namespace Checkpoint
@@ -0,0 +1,188 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Binary checkpoint files that can be loaded by memory mapping.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include "tr1_cstdint.h"
+#include "errors.h"
+
+/**
+ * Binary checkpoint files. A checkpoint consists of a fixed header, followed
+ * by a number of @em sections, each of which is an array of fixed-size POD
+ * records, followed by a table describing the sections. Each section starts
+ * on an @ref ALIGNMENT byte boundary, so that once the file is mapped into
+ * memory the records can be used in place rather than parsed.
+ *
+ * Records are stored in native byte order, so a checkpoint can only be
+ * resumed on a machine with the same architecture. This is detected when the
+ * file is opened.
+ */
+namespace Checkpoint
+{
+
+/// Alignment of sections within the file, in bytes
+static const std::size_t ALIGNMENT = 8;
+
+/// Describes when a checkpoint was taken
+enum Kind
+{
+    /// All passes are complete and only the output files remain to be written
+    KIND_FINAL = 0,
+    /// Taken part-way through a pass, at a chunk boundary
+    KIND_PASS = 1
+};
+
+/**
+ * Writes a checkpoint file. The data are first written to a temporary file
+ * alongside the target, which is only renamed over the target by @ref
+ * commit. Thus, a crash while writing a checkpoint leaves any previous
+ * checkpoint intact.
+ */
+class Writer : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. This opens the temporary file and writes a placeholder header.
+     *
+     * @param path     Final filename for the checkpoint.
+     * @param kind     Kind of checkpoint, returned by @ref Reader::getKind.
+     * @throw std::ios::failure if the temporary file could not be created.
+     */
+    Writer(const boost::filesystem::path &path, Kind kind);
+
+    /// Destructor. If @ref commit was not called, the temporary file is removed.
+    ~Writer();
+
+    /**
+     * Append a section containing @a count records.
+     *
+     * @throw std::ios::failure on I/O failure.
+     */
+    template<typename T>
+    void addSection(const T *data, std::size_t count)
+    {
+        addSectionRaw(data, count, sizeof(T));
+    }
+
+    /**
+     * Append a section containing @a count records of @a size bytes each.
+     *
+     * @throw std::ios::failure on I/O failure.
+     */
+    void addSectionRaw(const void *data, std::size_t count, std::size_t size);
+
+    /**
+     * Write the section table and header, and rename the temporary file over
+     * the target.
+     *
+     * @throw std::ios::failure on I/O failure.
+     */
+    void commit();
+
+private:
+    /// Entry in the section table
+    struct Section
+    {
+        std::tr1::uint64_t offset;   ///< Position of the first record in the file
+        std::tr1::uint64_t count;    ///< Number of records
+        std::tr1::uint64_t size;     ///< Bytes per record
+    };
+
+    boost::filesystem::path path;      ///< Final filename
+    boost::filesystem::path tmpPath;   ///< Filename used until @ref commit
+    boost::filesystem::ofstream out;   ///< Stream for @ref tmpPath
+    Kind kind;                         ///< Kind to record in the header
+    std::vector<Section> sections;     ///< Sections written so far
+    bool committed;                    ///< Set once @ref commit succeeds
+
+    /// Write zero bytes until the position is a multiple of @ref ALIGNMENT
+    void pad();
+
+    friend class Reader;
+};
+
+/**
+ * Reads a checkpoint file by mapping it into memory. The pointers returned
+ * by @ref section are only valid while the reader exists.
+ */
+class Reader : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. This maps the file and validates the header and section
+     * table.
+     *
+     * @throw std::ios::failure if the file could not be opened or mapped.
+     * @throw std::runtime_error if the file is not a valid checkpoint.
+     */
+    explicit Reader(const boost::filesystem::path &path);
+
+    /// Kind recorded by the writer
+    Kind getKind() const { return kind; }
+
+    /// Number of sections in the file
+    std::size_t numSections() const { return sections.size(); }
+
+    /**
+     * Retrieve a section.
+     *
+     * @param idx       Index of the section, in the order they were added.
+     * @param[out] count Number of records in the section.
+     * @return Pointer to the first record. If @a count is zero it must not
+     * be dereferenced.
+     * @throw std::runtime_error if the section does not exist or its records
+     * are not of type @a T.
+     */
+    template<typename T>
+    const T *section(std::size_t idx, std::size_t &count) const
+    {
+        return static_cast<const T *>(sectionRaw(idx, sizeof(T), count));
+    }
+
+    /// Untyped version of @ref section
+    const void *sectionRaw(std::size_t idx, std::size_t size, std::size_t &count) const;
+
+private:
+    boost::iostreams::mapped_file_source mapping;   ///< Mapping of the whole file
+    Kind kind;                                      ///< Kind read from the header
+    std::vector<Writer::Section> sections;          ///< Validated section table
+};
+
+} // namespace Checkpoint
+
+#endif /* !CHECKPOINT_H */
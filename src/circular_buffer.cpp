@@ -34,35 +34,119 @@
 #include <cassert>
 #include <limits>
 #include <string>
-#include <list>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/bind.hpp>
 #include "statistics.h"
 #include "allocator.h"
 #include "errors.h"
 #include "timeplot.h"
 #include "circular_buffer.h"
 
+#if HAVE_MMAP && HAVE_MUNMAP && HAVE_MADVISE
+# include <sys/mman.h>
+# ifdef MADV_HUGEPAGE
+#  define CIRCULAR_BUFFER_HUGE_PAGES 1
+# endif
+#endif
+
+namespace
+{
+
+#if CIRCULAR_BUFFER_HUGE_PAGES
+/// Buffers smaller than this are not worth mapping separately
+static const std::size_t hugePageSize = 2 * 1024 * 1024;
+
+/**
+ * Map anonymous memory and advise the kernel to back it with transparent
+ * huge pages.
+ *
+ * @return The mapping, or @c NULL if it is too small or mapping failed.
+ */
+static char *mapHugePages(std::size_t size)
+{
+    if (size < hugePageSize)
+        return NULL;
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    // This is only a hint, so failure is not an error
+    madvise(ptr, size, MADV_HUGEPAGE);
+    return static_cast<char *>(ptr);
+}
+#endif
+
+} // anonymous namespace
+
 std::size_t CircularBufferBase::Allocation::get() const
 {
-    return *point;
+    return pos;
 }
 
-CircularBufferBase::Allocation::Allocation(
-    Statistics::Container::list<std::size_t>::iterator point)
-    : point(point)
+CircularBufferBase::Allocation::Allocation(std::tr1::uint64_t seq, std::size_t pos)
+    : seq(seq), pos(pos)
 {
 }
 
 CircularBufferBase::Allocation::Allocation()
-    : point()
+    : seq(0), pos(0)
 {
 }
 
-CircularBufferBase::CircularBufferBase(const std::string &name, std::size_t size)
-    : bufferSize(size), firstFree(0), allocPoints(name)
+CircularBufferBase::CircularBufferBase(
+    const std::string &name, std::size_t size, std::size_t maxAllocations)
+    : waiting(0), bufferSize(size), firstFree(0), numSlots(1),
+    slotAllocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
+    head(0), tail(0), allocatedElements(0),
+    unallocatedGauge(name + ".unallocated", boost::bind(&CircularBufferBase::approxUnallocated, this))
 {
     MLSGPU_ASSERT(size > 0, std::invalid_argument);
+    MLSGPU_ASSERT(maxAllocations > 0, std::invalid_argument);
+    maxAllocations = std::min(maxAllocations, size);
+    while (numSlots < maxAllocations)
+        numSlots *= 2;
+    slots.reset(new Slot[numSlots]);
+    slotAllocator.recordAllocate(numSlots * sizeof(Slot));
+}
+
+CircularBufferBase::~CircularBufferBase()
+{
+    slotAllocator.recordDeallocate(numSlots * sizeof(Slot));
+}
+
+void CircularBufferBase::reclaim()
+{
+    while (tail != head)
+    {
+        Slot &slot = slots[tail & (numSlots - 1)];
+        if (!slot.freed.load())
+            break;
+        slot.freed.store(0);
+        tail++;
+    }
+}
+
+std::size_t CircularBufferBase::findSpace(std::size_t n) const
+{
+    if (tail == head)
+        return 0;
+    if (head - tail == numSlots)
+        return bufferSize; // all slots in use
+
+    std::size_t end = slots[tail & (numSlots - 1)].start;
+    if (firstFree <= end)
+    {
+        if (end - firstFree >= n)
+            return firstFree;
+    }
+    else
+    {
+        if (bufferSize - firstFree >= n)
+            return firstFree;
+        else if (end >= n)
+            return 0;
+    }
+    return bufferSize;
 }
 
 CircularBufferBase::Allocation CircularBufferBase::allocate(
@@ -76,46 +160,46 @@ CircularBufferBase::Allocation CircularBufferBase::allocate(
     action.setValue(n);
 
     boost::lock_guard<boost::mutex> allocLock(allocMutex);
-    boost::unique_lock<boost::mutex> lock(mutex);
-    std::size_t pos = bufferSize; // sentinel invalid value
-
-retry:
-    if (allocPoints.empty())
-        pos = 0;
-    else
+    reclaim();
+    std::size_t pos = findSpace(n);
+    if (pos == bufferSize)
     {
-        std::size_t end = allocPoints.front();
-        if (firstFree <= end)
+        /* Slow path: announce that we are waiting before checking again, so
+         * that a concurrent free either is seen by the check or sees the
+         * flag and wakes us. See @ref free.
+         */
+        boost::unique_lock<boost::mutex> lock(mutex);
+        waiting.store(1);
+        while (true)
         {
-            if (end - firstFree >= n)
-                pos = firstFree;
-        }
-        else
-        {
-            if (bufferSize - firstFree >= n)
-                pos = firstFree;
-            else if (end >= n)
-                pos = 0;
+            reclaim();
+            pos = findSpace(n);
+            if (pos != bufferSize)
+                break;
+            spaceCondition.wait(lock);
         }
+        waiting.store(0);
     }
 
-    if (pos == bufferSize)
-    {
-        spaceCondition.wait(lock);
-        goto retry;
-    }
-
+    Slot &slot = slots[head & (numSlots - 1)];
+    slot.start = pos;
+    slot.size = n;
+    allocatedElements.fetchAdd(n);
     firstFree = pos + n;
-    return Allocation(allocPoints.insert(allocPoints.end(), pos));
+    return Allocation(head++, pos);
 }
 
 void CircularBufferBase::free(const Allocation &alloc)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    bool first = allocPoints.begin() == alloc.point;
-    allocPoints.erase(alloc.point);
-    if (first)
+    Slot &slot = slots[alloc.seq & (numSlots - 1)];
+    // The slot may be reused as soon as it is flagged, so read the size first
+    allocatedElements.fetchSub(slot.size);
+    slot.freed.store(1);
+    if (waiting.load())
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
         spaceCondition.notify_one();
+    }
 }
 
 std::size_t CircularBufferBase::size() const
@@ -125,12 +209,20 @@ std::size_t CircularBufferBase::size() const
 
 std::size_t CircularBufferBase::unallocated()
 {
-    if (allocPoints.empty())
+    boost::lock_guard<boost::mutex> allocLock(allocMutex);
+    reclaim();
+    if (tail == head)
         return bufferSize;
-    else if (allocPoints.front() >= firstFree)
-        return allocPoints.front() - firstFree;
+    std::size_t end = slots[tail & (numSlots - 1)].start;
+    if (end >= firstFree)
+        return end - firstFree;
     else
-        return bufferSize - firstFree + allocPoints.front();
+        return bufferSize - firstFree + end;
+}
+
+std::size_t CircularBufferBase::approxUnallocated() const
+{
+    return bufferSize - allocatedElements.load();
 }
 
 void *CircularBuffer::Allocation::get() const
@@ -163,16 +255,38 @@ void CircularBuffer::free(const Allocation &alloc)
     CircularBufferBase::free(alloc.base);
 }
 
-CircularBuffer::CircularBuffer(const std::string &name, std::size_t size)
+CircularBuffer::CircularBuffer(const std::string &name, std::size_t size, bool hugePages)
     :
     CircularBufferBase(name, size),
     allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
-    buffer(NULL)
+    buffer(NULL), mapped(false)
 {
+#if CIRCULAR_BUFFER_HUGE_PAGES
+    if (hugePages)
+    {
+        buffer = mapHugePages(size);
+        if (buffer != NULL)
+        {
+            mapped = true;
+            allocator.recordAllocate(size);
+            return;
+        }
+    }
+#else
+    (void) hugePages;
+#endif
     buffer = allocator.allocate(size);
 }
 
 CircularBuffer::~CircularBuffer()
 {
+#if CIRCULAR_BUFFER_HUGE_PAGES
+    if (mapped)
+    {
+        munmap(buffer, size());
+        allocator.recordDeallocate(size());
+        return;
+    }
+#endif
     allocator.deallocate(buffer, size());
 }
@@ -34,14 +34,17 @@
 #include <cstddef>
 #include <utility>
 #include <string>
-#include <list>
+#include <memory>
 #include <boost/noncopyable.hpp>
-#include <boost/thread/locks.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include "tr1_cstdint.h"
 #include "statistics.h"
 #include "allocator.h"
 #include "timeplot.h"
+#include "atomic.h"
+#include "metrics.h"
 
 /**
  * Thread-safe circular buffer manager. It does not actually handle
@@ -52,27 +55,50 @@
  * memory is available. The memory must later be returned with @ref free. It is
  * not required to free memory in the same order as allocations, but it should
  * be done roughly in this order for best performance. The intended use case is
- * multiple producers allocating memory to pass data to multiple consumers,
- * which free the memory.
+ * a producer allocating memory to pass data to multiple consumers, which free
+ * the memory.
+ *
+ * Each live allocation occupies a slot in a ring indexed by a sequence
+ * number. Freeing an allocation only sets a flag in its slot, without taking
+ * any locks (unless the producer is asleep waiting for space, in which case it
+ * must be woken). The producer reclaims the space by advancing past flagged
+ * slots, in allocation order. Multiple producers are supported, but they are
+ * serialized by a mutex.
  */
 class CircularBufferBase : public boost::noncopyable
 {
 private:
+    /// Bookkeeping for one allocation
+    struct Slot
+    {
+        /// Start position of the allocation (only accessed by the producer)
+        std::size_t start;
+        /// Number of elements in the allocation
+        std::size_t size;
+        /// Set to non-zero by @ref CircularBufferBase::free
+        Atomic<std::tr1::uint32_t> freed;
+    };
+
     /**
      * Mutex taken by @ref allocate, to ensure that allocations make progress.
      * Without this, one thread could be continually making and releasing small
-     * allocations, while starving a thread that needs one big allocation.
+     * allocations, while starving a thread that needs one big allocation. It
+     * also protects the producer-side state (@ref head, @ref tail, @ref
+     * firstFree).
      *
      * This mutex must be taken @em before taking @ref mutex.
      */
     boost::mutex allocMutex;
 
-    /// Mutex to protect internal data structures
+    /// Mutex used only to sleep on @ref spaceCondition
     boost::mutex mutex;
 
     /// Condition signalled when it may be possible to allocate more memory
     boost::condition_variable spaceCondition;
 
+    /// Non-zero while a producer is (about to be) asleep on @ref spaceCondition
+    Atomic<std::tr1::uint32_t> waiting;
+
     /// Total number of elements
     std::size_t bufferSize;
 
@@ -82,8 +108,39 @@ private:
      */
     std::size_t firstFree;
 
-    /// Start positions of all live allocations.
-    Statistics::Container::list<std::size_t> allocPoints;
+    /// Ring of allocation records, indexed by sequence number modulo @ref numSlots
+    boost::scoped_array<Slot> slots;
+
+    /// Size of @ref slots (a power of 2)
+    std::size_t numSlots;
+
+    /// Allocator used only to account for the memory in @ref slots
+    Statistics::Allocator<std::allocator<char> > slotAllocator;
+
+    /// Sequence number of the next allocation
+    std::tr1::uint64_t head;
+
+    /// Sequence number of the oldest allocation that has not been reclaimed
+    std::tr1::uint64_t tail;
+
+    /// Total size of allocations that have not been freed
+    Atomic<std::size_t> allocatedElements;
+
+    /// Exports @ref approxUnallocated as <code><i>name</i>.unallocated</code>
+    Metrics::Gauge unallocatedGauge;
+
+    /**
+     * Advance @ref tail past allocations that have been freed.
+     * @pre The caller holds @ref allocMutex.
+     */
+    void reclaim();
+
+    /**
+     * Find space for @a n elements without blocking.
+     * @pre The caller holds @ref allocMutex and has called @ref reclaim.
+     * @return The position, or @ref bufferSize if there is not enough space.
+     */
+    std::size_t findSpace(std::size_t n) const;
 
 public:
     /**
@@ -95,14 +152,13 @@ public:
     {
         friend class CircularBufferBase;
     private:
-        /**
-         * Iterator into @ref CircularBufferBase::allocPoints to be removed
-         * on free.
-         */
-        Statistics::Container::list<std::size_t>::iterator point;
+        /// Sequence number of the allocation, which selects its slot
+        std::tr1::uint64_t seq;
+        /// Start position
+        std::size_t pos;
 
         /// Constructor used by @ref CircularBufferBase::allocate
-        explicit Allocation(Statistics::Container::list<std::size_t>::iterator point);
+        Allocation(std::tr1::uint64_t seq, std::size_t pos);
     public:
         /// Creates an invalid allocation
         Allocation();
@@ -116,10 +172,16 @@ public:
      *
      * @param name       Name for allocator used for internal metadata.
      * @param size       Number of elements in the buffer.
+     * @param maxAllocations Maximum number of live allocations. Allocation will
+     *                   block if this many allocations are live, even if there is
+     *                   space. It is rounded up to a power of 2, and
+     *                   reduced if it exceeds @a size.
      *
      * @pre @a size &gt; 0
      */
-    explicit CircularBufferBase(const std::string &name, std::size_t size);
+    CircularBufferBase(const std::string &name, std::size_t size, std::size_t maxAllocations = 4096);
+
+    ~CircularBufferBase();
 
     /// Return number of elements in the buffer
     std::size_t size() const;
@@ -133,6 +195,13 @@ public:
      */
     std::size_t unallocated();
 
+    /**
+     * Return the number of elements not covered by live allocations. Unlike
+     * @ref unallocated, this never blocks, but it does not account for space
+     * that is unusable because an allocation cannot wrap around the end.
+     */
+    std::size_t approxUnallocated() const;
+
     /**
      * Allocate items from the buffer.
      * @param tworker        Worker to which waiting time is accounted.
@@ -149,6 +218,8 @@ public:
      * allocator provided was not returned from @ref allocate on this
      * circular buffer, or has already been freed.
      *
+     * This does not block, unless a producer is waiting for space.
+     *
      * @param alloc          Allocation returned from @ref allocate.
      */
     void free(const Allocation &alloc);
@@ -167,6 +238,8 @@ private:
     Statistics::Allocator<std::allocator<char> > allocator;
     /// Memory backing the buffer
     char *buffer;
+    /// Whether @ref buffer was mapped directly from the OS rather than from @ref allocator
+    bool mapped;
 public:
     /**
      * Information about an allocation from @ref allocate
@@ -184,6 +257,7 @@ public:
 
     using CircularBufferBase::size;
     using CircularBufferBase::unallocated;
+    using CircularBufferBase::approxUnallocated;
 
     /**
      * Allocate some memory from the buffer. If the memory is not yet
@@ -236,10 +310,12 @@ public:
      *
      * @param name      Buffer name used for memory statistic.
      * @param size      Bytes of storage to reserve.
+     * @param hugePages If true, ask the OS to back the buffer with huge pages
+     *                  where it is supported. This is only a hint.
      *
      * @pre @a size &gt; 0
      */
-    CircularBuffer(const std::string &name, std::size_t size);
+    CircularBuffer(const std::string &name, std::size_t size, bool hugePages = false);
 
     /// Destructor
     ~CircularBuffer();
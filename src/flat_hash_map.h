@@ -0,0 +1,286 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Open-addressing hash table keyed by 64-bit integers.
+ */
+
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include "tr1_cstdint.h"
+#include "allocator.h"
+#include "errors.h"
+
+/**
+ * Hash map from 64-bit keys to small values, stored in a single flat array
+ * with linear probing. Compared to @c std::tr1::unordered_map, there is no
+ * per-element allocation and a lookup usually touches a single cache line.
+ * Memory is accounted through @ref Statistics::Allocator in the same way as
+ * the @ref Statistics::Container wrappers.
+ *
+ * The key @ref EMPTY_KEY (all bits set) marks unused slots and may not be
+ * inserted. Elements cannot be erased individually, and any insertion may
+ * invalidate iterators.
+ *
+ * The interface is a subset of that of @c std::tr1::unordered_map.
+ */
+template<typename T,
+    typename Alloc = Statistics::Allocator<std::allocator<std::pair<std::tr1::uint64_t, T> > > >
+class FlatHashMap
+{
+public:
+    typedef std::tr1::uint64_t key_type;
+    typedef T mapped_type;
+    typedef std::pair<key_type, T> value_type;
+    typedef std::size_t size_type;
+
+    /// Reserved key used to mark empty slots
+    static const key_type EMPTY_KEY = ~key_type(0);
+
+private:
+    typedef Statistics::Container::vector<value_type, Alloc> slot_vector;
+
+    /**
+     * Forward iterator that skips over empty slots.
+     *
+     * @param V  Either @ref value_type or <code>const value_type</code>
+     */
+    template<typename V>
+    class Iterator : public std::iterator<std::forward_iterator_tag, V>
+    {
+        friend class FlatHashMap;
+    private:
+        V *pos;     ///< Current slot
+        V *last;    ///< One past the final slot
+
+        Iterator(V *pos, V *last) : pos(pos), last(last)
+        {
+            skip();
+        }
+
+        /// Advance past empty slots
+        void skip()
+        {
+            while (pos != last && pos->first == EMPTY_KEY)
+                ++pos;
+        }
+
+    public:
+        Iterator() : pos(NULL), last(NULL) {}
+
+        /// Conversion from mutable to const iterator
+        template<typename W>
+        Iterator(const Iterator<W> &other) : pos(other.pos), last(other.last) {}
+
+        V &operator*() const { return *pos; }
+        V *operator->() const { return pos; }
+
+        Iterator &operator++()
+        {
+            ++pos;
+            skip();
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        template<typename W>
+        bool operator==(const Iterator<W> &other) const { return pos == other.pos; }
+        template<typename W>
+        bool operator!=(const Iterator<W> &other) const { return pos != other.pos; }
+
+        template<typename W> friend class Iterator;
+    };
+
+public:
+    typedef Iterator<value_type> iterator;
+    typedef Iterator<const value_type> const_iterator;
+
+    /**
+     * Constructor. The table is initially empty and does not allocate
+     * memory until the first insertion.
+     *
+     * @param allocName  Name of the statistic used to track memory usage.
+     */
+    explicit FlatHashMap(const std::string &allocName)
+        : slots(allocName), numElements(0)
+    {
+    }
+
+    size_type size() const { return numElements; }
+    bool empty() const { return numElements == 0; }
+
+    /// Number of slots currently allocated
+    size_type bucket_count() const { return slots.size(); }
+
+    iterator begin() { return iterator(data(), data() + slots.size()); }
+    iterator end() { return iterator(data() + slots.size(), data() + slots.size()); }
+    const_iterator begin() const { return const_iterator(data(), data() + slots.size()); }
+    const_iterator end() const { return const_iterator(data() + slots.size(), data() + slots.size()); }
+
+    /// Remove all elements, but retain the allocated slots
+    void clear()
+    {
+        for (size_type i = 0; i < slots.size(); i++)
+            slots[i].first = EMPTY_KEY;
+        numElements = 0;
+    }
+
+    /// Ensure that @a n elements can be held without reallocating
+    void reserve(size_type n)
+    {
+        size_type cap = slots.empty() ? MIN_SLOTS : slots.size();
+        while (!fits(n, cap))
+            cap *= 2;
+        if (cap != slots.size())
+            resize(cap);
+    }
+
+    /**
+     * Insert @a value if its key is not already present.
+     *
+     * @return An iterator to the element with the key, and a flag indicating
+     * whether the insertion took place.
+     * @pre <code>value.first != EMPTY_KEY</code>
+     */
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        MLSGPU_ASSERT(value.first != EMPTY_KEY, std::invalid_argument);
+        if (!fits(numElements + 1, slots.size()))
+            resize(slots.empty() ? MIN_SLOTS : 2 * slots.size());
+
+        value_type *s = probe(value.first);
+        bool added = false;
+        if (s->first == EMPTY_KEY)
+        {
+            *s = value;
+            numElements++;
+            added = true;
+        }
+        return std::make_pair(iterator(s, data() + slots.size()), added);
+    }
+
+    /// Access the element with key @a key, inserting a default-constructed value if necessary.
+    mapped_type &operator[](key_type key)
+    {
+        return insert(value_type(key, mapped_type())).first->second;
+    }
+
+    iterator find(key_type key)
+    {
+        if (slots.empty())
+            return end();
+        value_type *s = probe(key);
+        return s->first == EMPTY_KEY ? end() : iterator(s, data() + slots.size());
+    }
+
+    const_iterator find(key_type key) const
+    {
+        return const_cast<FlatHashMap *>(this)->find(key);
+    }
+
+    size_type count(key_type key) const
+    {
+        return find(key) != end() ? 1 : 0;
+    }
+
+private:
+    /// Capacity allocated by the first insertion
+    static const size_type MIN_SLOTS = 16;
+
+    slot_vector slots;       ///< Slots, of which a power of two are allocated
+    size_type numElements;   ///< Number of occupied slots
+
+    value_type *data() { return slots.empty() ? NULL : &slots[0]; }
+    const value_type *data() const { return slots.empty() ? NULL : &slots[0]; }
+
+    /// Whether @a n elements may be stored in @a cap slots without exceeding the maximum load factor of 3/4
+    static bool fits(size_type n, size_type cap)
+    {
+        return n <= cap - cap / 4;
+    }
+
+    /**
+     * Mixes the bits of a key (the finalizer of SplitMix64). Vertex keys
+     * pack coordinates into bit fields, so the low bits alone would
+     * cluster badly.
+     */
+    static std::tr1::uint64_t hash(key_type key)
+    {
+        key ^= key >> 30;
+        key *= UINT64_C(0xbf58476d1ce4e5b9);
+        key ^= key >> 27;
+        key *= UINT64_C(0x94d049bb133111eb);
+        key ^= key >> 31;
+        return key;
+    }
+
+    /**
+     * Find the slot holding @a key, or the empty slot where it should be
+     * inserted.
+     *
+     * @pre There is at least one empty slot.
+     */
+    value_type *probe(key_type key)
+    {
+        const size_type mask = slots.size() - 1;
+        size_type i = size_type(hash(key)) & mask;
+        while (slots[i].first != key && slots[i].first != EMPTY_KEY)
+            i = (i + 1) & mask;
+        return &slots[i];
+    }
+
+    /// Reallocate to @a cap slots and reinsert all the elements
+    void resize(size_type cap)
+    {
+        std::vector<value_type, Alloc> old(slots.get_allocator());
+        old.swap(slots);
+        slots.assign(cap, value_type(EMPTY_KEY, mapped_type()));
+        for (size_type i = 0; i < old.size(); i++)
+            if (old[i].first != EMPTY_KEY)
+                *probe(old[i].first) = old[i];
+    }
+};
+
+template<typename T, typename Alloc>
+const typename FlatHashMap<T, Alloc>::key_type FlatHashMap<T, Alloc>::EMPTY_KEY;
+
+template<typename T, typename Alloc>
+const typename FlatHashMap<T, Alloc>::size_type FlatHashMap<T, Alloc>::MIN_SLOTS;
+
+#endif /* !FLAT_HASH_MAP_H */
@@ -262,8 +262,11 @@ CLH::ResourceUsage Marching::resourceUsage(
     Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
     Grid::size_type maxSwathe,
     std::size_t meshMemory,
-    const Grid::size_type alignment[3])
+    const Grid::size_type alignment[3],
+    cl_channel_type distanceType,
+    bool overlapSwathes)
 {
+    MLSGPU_ASSERT(distanceType == CL_FLOAT || distanceType == CL_HALF_FLOAT, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxWidth && maxWidth <= MAX_DIMENSION, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxHeight && maxHeight <= MAX_DIMENSION, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxDepth && maxDepth <= MAX_DIMENSION, std::invalid_argument);
@@ -285,8 +288,10 @@ CLH::ResourceUsage Marching::resourceUsage(
     CLH::ResourceUsage ans;
     // Keep this in sync with the actual allocations below
 
-    // image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), imageWidth, imageHeight * (maxSwathe + 1));
-    ans.addImage("distances", imageWidth, imageHeight * (maxSwathe + 1), sizeof(cl_float));
+    // images[i] = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, distanceType), imageWidth, imageHeight * (maxSwathe + 1));
+    for (int i = 0; i < (overlapSwathes ? 2 : 1); i++)
+        ans.addImage("distances", imageWidth, imageHeight * (maxSwathe + 1),
+                     distanceType == CL_HALF_FLOAT ? sizeof(cl_half) : sizeof(cl_float));
 
     // cells = cl::Buffer(context, CL_MEM_READ_WRITE, swatheCells * sizeof(cl_uint3));
     ans.addBuffer("cells", swatheCells * sizeof(cl_uint3));
@@ -336,7 +341,9 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
                    Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
                    Grid::size_type maxSwathe,
                    std::size_t meshMemory,
-                   const Grid::size_type alignment[3])
+                   const Grid::size_type alignment[3],
+                   cl_channel_type distanceType,
+                   bool overlapSwathes)
 :
     maxWidth(maxWidth), maxHeight(maxHeight), maxDepth(maxDepth),
     genOccupiedKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.marching.genOccupied.time")),
@@ -356,12 +363,27 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     readback("mem.Marching.readback", context, device),
     viReadback("mem.Marching.viReadback", context, device, maxDepth)
 {
+    MLSGPU_ASSERT(distanceType == CL_FLOAT || distanceType == CL_HALF_FLOAT, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxWidth && maxWidth <= MAX_DIMENSION, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxHeight && maxHeight <= MAX_DIMENSION, std::invalid_argument);
     MLSGPU_ASSERT(2 <= maxDepth && maxDepth <= MAX_DIMENSION, std::invalid_argument);
     MLSGPU_ASSERT(alignment[2] <= maxSwathe, std::invalid_argument);
     MLSGPU_ASSERT(meshMemory >= (maxWidth - 1) * (maxHeight - 1) * MAX_CELL_BYTES, std::invalid_argument);
 
+    const cl::ImageFormat distanceFormat(CL_R, distanceType);
+    if (distanceType != CL_FLOAT)
+    {
+        std::vector<cl::ImageFormat> formats;
+        context.getSupportedImageFormats(CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, &formats);
+        bool found = false;
+        for (std::size_t i = 0; i < formats.size(); i++)
+            if (formats[i].image_channel_order == CL_R
+                && formats[i].image_channel_data_type == distanceType)
+                found = true;
+        if (!found)
+            throw CLH::invalid_device(device, "half-precision images are not supported");
+    }
+
     Grid::size_type imageWidth = roundUp(maxWidth, alignment[0]);
     Grid::size_type imageHeight = roundUp(maxHeight, alignment[1]);
     this->maxSwathe = std::min(maxSwathe, maxDepth) / alignment[2] * alignment[2];
@@ -377,8 +399,9 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
         &Statistics::getStatistic<Statistics::Variable>("kernel.marching.sortVertices.time"));
 
     makeTables(context);
-    image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
-                        imageWidth, imageHeight * (maxSwathe + 1));
+    for (int i = 0; i < (overlapSwathes ? 2 : 1); i++)
+        images[i] = cl::Image2D(context, CL_MEM_READ_WRITE, distanceFormat,
+                                imageWidth, imageHeight * (maxSwathe + 1));
     zStride = imageHeight;
 
     const std::size_t sliceCells = (maxWidth - 1) * (maxHeight - 1);
@@ -424,7 +447,6 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     generateElementsKernel.setArg(2, indices);
     generateElementsKernel.setArg(3, viCount);
     generateElementsKernel.setArg(4, cells);
-    generateElementsKernel.setArg(5, image);
     generateElementsKernel.setArg(6, startTable);
     generateElementsKernel.setArg(7, dataTable);
     generateElementsKernel.setArg(8, keyTable);
@@ -446,8 +468,9 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
 
 void Marching::copySlice(
     const cl::CommandQueue &queue,
-    const cl::Image2D &image,
+    const cl::Image2D &srcImage,
     Grid::size_type src,
+    const cl::Image2D &trgImage,
     Grid::size_type trg,
     const ImageParams &params,
     const std::vector<cl::Event> *events,
@@ -467,7 +490,7 @@ void Marching::copySlice(
     try
     {
         cl::Event last;
-        queue.enqueueCopyImage(image, image, srcOrigin, trgOrigin, region, events, &last);
+        queue.enqueueCopyImage(srcImage, trgImage, srcOrigin, trgOrigin, region, events, &last);
         Statistics::timeEvent(last, copySliceTime);
         if (event != NULL)
             *event = last;
@@ -483,8 +506,8 @@ void Marching::copySlice(
         offset.s[0] = (cl_int) trgOrigin[0] - (cl_int) srcOrigin[0];
         offset.s[1] = (cl_int) trgOrigin[1] - (cl_int) srcOrigin[1];
 
-        copySliceKernel.setArg(0, image);
-        copySliceKernel.setArg(1, image);
+        copySliceKernel.setArg(0, srcImage);
+        copySliceKernel.setArg(1, trgImage);
         copySliceKernel.setArg(2, offset);
         CLH::enqueueNDRangeKernelSplit(
             queue,
@@ -497,10 +520,33 @@ void Marching::copySlice(
     }
 }
 
-std::size_t Marching::generateCells(
+void Marching::enqueueSwathe(
     const cl::CommandQueue &queue,
+    Generator &generator,
+    const cl::Image2D *prevImage,
+    const cl::Image2D &image,
     const Swathe &swathe,
-    const std::vector<cl::Event> *events)
+    std::vector<cl::Event> &wait)
+{
+    cl::Event last;
+    if (prevImage != NULL)
+    {
+        // Copy end of previous range to start of current one
+        copySlice(queue, *prevImage, maxSwathe, image, 0, swathe, &wait, &last);
+        wait.resize(1);
+        wait[0] = last;
+    }
+    generator.enqueue(queue, image, swathe, &wait, &last);
+    wait.resize(1);
+    wait[0] = last;
+}
+
+void Marching::enqueueCells(
+    const cl::CommandQueue &queue,
+    const cl::Image2D &image,
+    const Swathe &swathe,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
 {
     const std::size_t viOffset = swathe.zFirst * sizeof(cl_uint2);
     const std::size_t viSize = (swathe.zLast - swathe.zFirst) * sizeof(cl_uint2);
@@ -538,15 +584,26 @@ std::size_t Marching::generateCells(
     wait.resize(1);
     wait[0] = last;
 
+    std::vector<cl::Event> reads(2);
     queue.enqueueReadBuffer(viHistogram, CL_FALSE, viOffset, viSize,
-                            viReadback.get() + swathe.zFirst, &wait, &last);
-    Statistics::timeEvent(last, readbackTime);
+                            viReadback.get() + swathe.zFirst, &wait, &reads[0]);
+    Statistics::timeEvent(reads[0], readbackTime);
     queue.enqueueReadBuffer(numOccupied, CL_FALSE, 0, sizeof(cl_uint),
                             &readback->compacted,
-                            &wait, &last);
-    Statistics::timeEvent(last, readbackTime);
-    queue.finish();
+                            &wait, &reads[1]);
+    Statistics::timeEvent(reads[1], readbackTime);
+    CLH::enqueueMarkerWithWaitList(queue, &reads, event);
+}
 
+std::size_t Marching::generateCells(
+    const cl::CommandQueue &queue,
+    const cl::Image2D &image,
+    const Swathe &swathe,
+    const std::vector<cl::Event> *events)
+{
+    cl::Event done;
+    enqueueCells(queue, image, swathe, events, &done);
+    done.wait();
     return readback->compacted;
 }
 
@@ -584,8 +641,9 @@ void Marching::shipOut(const cl::CommandQueue &queue,
     wait[0] = last;
 
     // Start this readback - but we don't immediately need the result.
+    std::vector<cl::Event> reads(2);
     queue.enqueueReadBuffer(vertexUnique, CL_FALSE, sizes.s[0] * sizeof(cl_uint), sizeof(cl_uint),
-                            &readback->numWelded, &wait, NULL);
+                            &readback->numWelded, &wait, &reads[0]);
 
     // TODO: should we be sorting key/value pairs? The values are going to end up moving
     // twice, and most of them will be eliminated entirely! However, sorting them does
@@ -606,7 +664,7 @@ void Marching::shipOut(const cl::CommandQueue &queue,
     wait[0] = last;
 
     queue.enqueueReadBuffer(firstExternal, CL_FALSE, 0, sizeof(cl_uint),
-                            &readback->firstExternal, &wait, NULL);
+                            &readback->firstExternal, &wait, &reads[1]);
 
     CLH::enqueueNDRangeKernel(queue,
                               reindexKernel,
@@ -614,20 +672,27 @@ void Marching::shipOut(const cl::CommandQueue &queue,
                               cl::NDRange(sizes.s[1]),
                               cl::NullRange,
                               &wait, &last, &reindexKernelTime);
-    queue.finish(); // wait for readback of numWelded and firstExternal (TODO: overkill)
+    wait[0] = last;
+
+    /* Only the sizes are needed on the host. The reindexing can still be in
+     * flight, since the output functor is made to wait for it.
+     */
+    cl::Event::waitForEvents(reads);
 
     DeviceKeyMesh outputMesh; // TODO: store buffers in this instead of copying references
     outputMesh.vertices = weldedVertices;
     outputMesh.vertexKeys = weldedVertexKeys;
     outputMesh.triangles = indices;
     outputMesh.assign(readback->numWelded, sizes.s[1] / 3, readback->firstExternal);
-    output(queue, outputMesh, NULL, event);
+    output(queue, outputMesh, &wait, event);
 }
 
 Grid::size_type Marching::addSlices(
     const cl::CommandQueue &queue,
     const OutputFunctor &output,
+    const cl::Image2D &image,
     const Swathe &swathe,
+    std::size_t compacted,
     const cl_uint3 &keyOffset,
     std::size_t localSize,
     cl_uint2 &offsets, cl_uint &zTop,
@@ -639,7 +704,8 @@ Grid::size_type Marching::addSlices(
     Grid::size_type shipOuts = 0;
     cl_uint3 top = { {2 * (swathe.width - 1), 2 * (swathe.height - 1), 2 * zTop} };
 
-    std::size_t compacted = generateCells(queue, swathe, events);
+    if (events != NULL)
+        wait = *events;
 
     if (compacted > 0)
     {
@@ -689,9 +755,10 @@ Grid::size_type Marching::addSlices(
                 Swathe subSwathe = swathe;
                 subSwathe.zFirst = subFirst;
                 subSwathe.zLast = subLast;
+                std::size_t subCompacted = generateCells(queue, image, subSwathe, &wait);
                 shipOuts += addSlices(
                     queue, output,
-                    subSwathe, keyOffset, localSize,
+                    image, subSwathe, subCompacted, keyOffset, localSize,
                     offsets, zTop,
                     &wait, &last);
                 wait.resize(1);
@@ -722,6 +789,8 @@ Grid::size_type Marching::addSlices(
             wait.resize(1);
             wait[0] = last;
 
+            generateElementsKernel.setArg(5, image);
+            generateElementsKernel.setArg(10, swathe.zBias);
             generateElementsKernel.setArg(12, top);
             CLH::enqueueNDRangeKernelSplit(queue,
                                            generateElementsKernel,
@@ -768,7 +837,7 @@ void Marching::generate(
     MLSGPU_ASSERT(1U <= depth && depth <= maxDepth, std::length_error);
 
     std::vector<cl::Event> wait;
-    cl::Event last, readEvent;
+    cl::Event last, cellsEvent;
     cl_uint2 offsets = { {0, 0} };
     cl_uint zTop = 0;
 
@@ -779,32 +848,63 @@ void Marching::generate(
     generateElementsKernel.setArg(11, keyOffset);
     generateElementsKernel.setArg(13, CLH_LOCAL(NUM_EDGES * wgsCompacted * sizeof(cl_float3)));
 
+    /* If there is a second image, swathes are pipelined through the two
+     * images. For swathe k, the generator is enqueued into images[k % 2]
+     * before the host waits for the cell counts of swathe k - 1 and extracts
+     * its geometry from the other image, so that the device has work to do
+     * during the readback. With a single image, the previous swathe must be
+     * consumed before the image is overwritten.
+     */
+    const bool overlap = images[1]() != NULL;
     Grid::size_type shipOuts = 0;
-    for (Grid::size_type z = 0; z < depth; z += maxSwathe)
+    Swathe pending;          // Swathe whose cells have been enqueued but not processed
+    bool havePending = false;
+    int cur = 0;             // Index of the image for the current swathe
+    int prev = 0;            // Index of the image for the pending swathe
+    for (Grid::size_type z = 0; z < depth; z += maxSwathe, prev = cur, cur = overlap ? 1 - cur : 0)
     {
         swathe.zFirst = z;
         swathe.zLast = std::min(depth, z + maxSwathe) - 1;
         swathe.zBias = (1 - cl_int(z)) * cl_int(swathe.zStride);
-        generateElementsKernel.setArg(10, swathe.zBias);
+        const cl::Image2D *prevImage = z != 0 ? &images[prev] : NULL;
+
+        if (overlap)
+            enqueueSwathe(queue, generator, prevImage, images[cur], swathe, wait);
 
-        if (z != 0)
+        if (havePending)
         {
-            // Copy end of previous range to start of current one
-            copySlice(queue, image, maxSwathe, 0, swathe, &wait, &last);
-            wait.resize(1);
-            wait[0] = last;
+            cellsEvent.wait();
+            std::vector<cl::Event> pendingWait(1, cellsEvent);
+            shipOuts += addSlices(
+                queue, output,
+                images[prev], pending, readback->compacted,
+                keyOffset, wgsCompacted,
+                offsets, zTop,
+                &pendingWait, &last);
+            // enqueueCells reuses the buffers consumed by addSlices
+            wait.push_back(last);
         }
-        generator.enqueue(queue, image, swathe, &wait, &last);
-        wait.resize(1);
-        wait[0] = last;
+
+        if (!overlap)
+            enqueueSwathe(queue, generator, prevImage, images[cur], swathe, wait);
 
         if (z > 0)
             swathe.zFirst--; // Use the copied previous slice as well
 
+        enqueueCells(queue, images[cur], swathe, &wait, &cellsEvent);
+        wait.resize(1);
+        wait[0] = cellsEvent;
+        pending = swathe;
+        havePending = true;
+    }
+
+    if (havePending)
+    {
+        cellsEvent.wait();
         shipOuts += addSlices(
             queue, output,
-            swathe, keyOffset,
-            wgsCompacted,
+            images[prev], pending, readback->compacted,
+            keyOffset, wgsCompacted,
             offsets, zTop,
             &wait, &last);
         wait.resize(1);
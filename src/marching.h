@@ -404,9 +404,12 @@ private:
     cl::Buffer firstExternal;
 
     /**
-     * The image holding slices of the signed distance function.
+     * The images holding slices of the signed distance function. When
+     * swathes are overlapped, successive swathes alternate between them, so
+     * that the generator can fill one while geometry is still being extracted
+     * from the other. Otherwise only the first is allocated.
      */
-    cl::Image2D image;
+    cl::Image2D images[2];
 
     /**
      * The number of y steps between slices in the backing image.
@@ -499,7 +502,7 @@ public:
      * memory allocated in buffers and images, but excludes all overheads for
      * fragmentation, alignment, parameters, programs, command buffers etc.
      *
-     * @param device, maxWidth, maxHeight, maxDepth, maxSwathe, meshMemory, alignment  Parameters that would be passed to the constructor.
+     * @param device, maxWidth, maxHeight, maxDepth, maxSwathe, meshMemory, alignment, distanceType, overlapSwathes  Parameters that would be passed to the constructor.
      *
      * @return The required resources.
      *
@@ -510,7 +513,9 @@ public:
         Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
         Grid::size_type maxSwathe,
         std::size_t meshMemory,
-        const Grid::size_type alignment[3]);
+        const Grid::size_type alignment[3],
+        cl_channel_type distanceType = CL_FLOAT,
+        bool overlapSwathes = false);
 
     /**
      * The function type to pass to @ref generate for receiving output data.
@@ -555,25 +560,40 @@ public:
      * @param maxSwathe      Maximum number of slices to process in one go (in cells)
      * @param meshMemory     Bytes of memory to allocate for mesh data (including internal data)
      * @param alignment      Alignment values that would be returned by @ref Generator::alignment.
+     * @param distanceType   Channel type for the image holding the signed distance
+     *                       function: either @c CL_FLOAT or @c CL_HALF_FLOAT. The
+     *                       latter halves the memory and bandwidth of the image, at
+     *                       the cost of about three decimal digits of precision in
+     *                       the vertex positions along each edge.
+     * @param overlapSwathes If true, a second distance image is allocated so
+     *                       that swathes can be pipelined (see @ref generate).
      *
      * @pre
      * - @a maxWidth, @a maxHeight, @a maxDepth are between 2 and @ref MAX_DIMENSION.
      * - @a maxSwathe is at least @a alignment[2]
      * - @a meshMemory &gt;= (@a maxWidth - 1) * (@a maxHeight - 1) * @ref MAX_CELL_BYTES
+     *
+     * @throw CLH::invalid_device if @a distanceType is not supported for images by @a context.
      */
     Marching(const cl::Context &context, const cl::Device &device,
              Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
              Grid::size_type maxSwathe,
              std::size_t meshMemory,
-             const Grid::size_type alignment[3]);
+             const Grid::size_type alignment[3],
+             cl_channel_type distanceType = CL_FLOAT,
+             bool overlapSwathes = false);
 
     /**
      * Generate an isosurface.
      *
      * @note Because this function needs to read back intermediate results
      * before enqueuing more work, this is not purely an enqueuing operation.
-     * It will block until all of the work has completed. To hide latency, it is
-     * necessary to have something happening on another CPU thread.
+     * It will block until all of the work has completed. If swathes are
+     * overlapped (see the constructor), the generator for one swathe is
+     * enqueued before the host waits for the cell counts of the previous one,
+     * so the device does not sit idle during the readback. To hide the
+     * remaining latency, it is necessary to have something happening on
+     * another CPU thread.
      *
      * The region that is processed is assumed to be at an offset of @a
      * keyOffset within some larger grid. To accommodate this, vertex keys for
@@ -609,11 +629,12 @@ public:
 
 private:
     /**
-     * Copy one slice of the image to another.
+     * Copy one slice of an image to another.
      *
      * @param queue           Command queue to use for enqueuing work.
-     * @param image           Image to operate on.
+     * @param srcImage        Image to copy from.
      * @param zSrc            Slice number for source.
+     * @param trgImage        Image to copy to (may be the same as @a srcImage).
      * @param zTrg            Slice number for target.
      * @param params          Image parameters.
      * @param events          Events to wait for before starting (may be @c NULL).
@@ -624,34 +645,68 @@ private:
      */
     void copySlice(
         const cl::CommandQueue &queue,
-        const cl::Image2D &image,
+        const cl::Image2D &srcImage,
         Grid::size_type zSrc,
+        const cl::Image2D &trgImage,
         Grid::size_type zTrg,
         const ImageParams &params,
         const std::vector<cl::Event> *events,
         cl::Event *event);
 
+    /**
+     * Fill an image with the signed distance function for a swathe, first
+     * copying the last slice of the previous swathe if there is one.
+     *
+     * @param queue           Command queue to use for enqueuing work.
+     * @param generator       Generates the function.
+     * @param prevImage       Image holding the previous swathe, or @c NULL for the first swathe.
+     * @param image           Image to fill (may be the same as @a prevImage).
+     * @param swathe          Swathe to generate.
+     * @param[in,out] wait    Events to wait for before starting. On return, it
+     *                        holds the single event for the generator.
+     */
+    void enqueueSwathe(
+        const cl::CommandQueue &queue,
+        Generator &generator,
+        const cl::Image2D *prevImage,
+        const cl::Image2D &image,
+        const Swathe &swathe,
+        std::vector<cl::Event> &wait);
+
     /**
      * Determine which cells in a slice need to be processed further,
      * and produce per-cell counts of vertices and indices.
-     * This function may wait for previous events, but operates
-     * synchronously. On input, two images contain adjacent slices of
-     * samples of the function. On output, @ref cells contains a list
-     * of x,y pairs giving the coordinates of the cells that will generate
-     * geometry, @ref viCount contains the vertex and index counts per
-     * cell, and @ref numOccupied contains the number of cells.
+     * On input, @a image contains the samples of the function. On
+     * completion of @a event, @ref cells contains a list of x,y pairs giving
+     * the coordinates of the cells that will generate geometry, @ref viCount
+     * contains the vertex and index counts per cell, @ref numOccupied
+     * contains the number of cells, and these counts have been read back
+     * into @ref readback and @ref viReadback.
      *
      * @param queue           Command queue to use for enqueuing work.
+     * @param image           Image holding the samples.
      * @param swathe          Swathe of data to process
      * @param events          Events to wait for before starting (may be @c NULL).
-     *
-     * @return The number of cells that need further processing.
+     * @param[out] event      Event signalled when the readbacks are complete.
      *
      * @note @a firstSlice and @a lastSlice reference corners, so only
      * @a lastSlice - @a firstSlice cell-slices are processed.
      */
+    void enqueueCells(
+        const cl::CommandQueue &queue,
+        const cl::Image2D &image,
+        const Swathe &swathe,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+
+    /**
+     * Synchronous version of @ref enqueueCells.
+     *
+     * @return The number of cells that need further processing.
+     */
     std::size_t generateCells(
         const cl::CommandQueue &queue,
+        const cl::Image2D &image,
         const Swathe &swathe,
         const std::vector<cl::Event> *events);
 
@@ -691,7 +746,9 @@ private:
      *
      * @param queue           Command queue to use for enqueuing work.
      * @param output          Passed to @ref shipOut.
+     * @param image           Image holding the samples for @a swathe.
      * @param swathe          The range of slices to process.
+     * @param compacted       Number of occupied cells, as found by @ref enqueueCells.
      * @param keyOffset       Passed to @ref shipOut.
      * @param localSize       Work group size, matching the dynamic local memory allocation.
      * @param[in,out] offsets Positions in vertex and index buffers to start appending.
@@ -700,13 +757,16 @@ private:
      * @param[out] event      Event signalled on completion (may be @c NULL).
      *
      * @pre
+     * - @ref enqueueCells has completed for @a swathe.
      * - All kernel arguments for @ref generateElements have been set, except for
-     *   @a top.
+     *   @a top, @a isoImage and @a zBias.
      */
     Grid::size_type addSlices(
         const cl::CommandQueue &queue,
         const OutputFunctor &output,
+        const cl::Image2D &image,
         const Swathe &swathe,
+        std::size_t compacted,
         const cl_uint3 &keyOffset,
         std::size_t localSize,
         cl_uint2 &offsets, cl_uint &zTop,
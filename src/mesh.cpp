@@ -34,6 +34,7 @@
 
 #include <CL/cl.hpp>
 #include <vector>
+#include <cstring>
 #include "mesh.h"
 #include "clh.h"
 #include "errors.h"
@@ -59,6 +60,61 @@ HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes)
     triangles = reinterpret_cast<boost::array<cl_uint, 3> *>(vertices + numVertices());
 }
 
+/**
+ * Returns the start of the packed data within an unpacked region that holds
+ * @a n elements of 12 bytes. Each packed element is 8 bytes, so the packed
+ * data occupies the last two thirds.
+ */
+static inline char *packedTail(void *base, std::size_t n)
+{
+    return reinterpret_cast<char *>(base) + n * (3 * sizeof(cl_uint) - sizeof(cl_ulong));
+}
+
+void HostKeyMesh::unpackVertices()
+{
+    if (!packing.vertices)
+        return;
+
+    /* The expansion proceeds front to back. Element i is written to bytes
+     * [12i, 12i + 12) while the packed element i + 1 starts at 4n + 8i + 8,
+     * so unread input is never overwritten. The packed data is not
+     * necessarily 8-byte aligned, so it is accessed with memcpy.
+     */
+    const std::size_t n = numVertices();
+    const char *src = packedTail(vertices, n);
+    const cl_ulong mask = MeshPacking::maxValue();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        cl_ulong p;
+        std::memcpy(&p, src + i * sizeof(cl_ulong), sizeof(p));
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            cl_uint q = (p >> (j * MeshPacking::PACKED_BITS)) & mask;
+            vertices[i][j] = packing.bias[j] + packing.scale * q;
+        }
+    }
+    packing.vertices = false;
+}
+
+void HostKeyMesh::unpackTriangles()
+{
+    if (!packing.triangles)
+        return;
+
+    // Same in-place strategy as unpackVertices
+    const std::size_t n = numTriangles();
+    const char *src = packedTail(triangles, n);
+    const cl_ulong mask = MeshPacking::maxValue();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        cl_ulong p;
+        std::memcpy(&p, src + i * sizeof(cl_ulong), sizeof(p));
+        for (unsigned int j = 0; j < 3; j++)
+            triangles[i][j] = (p >> (j * MeshPacking::PACKED_BITS)) & mask;
+    }
+    packing.triangles = false;
+}
+
 void enqueueReadMesh(const cl::CommandQueue &queue,
                      const DeviceKeyMesh &dMesh, HostKeyMesh &hMesh,
                      const std::vector<cl::Event> *events,
@@ -71,11 +127,19 @@ void enqueueReadMesh(const cl::CommandQueue &queue,
 
     if (trianglesEvent != NULL)
     {
-        CLH::enqueueReadBuffer(queue,
-                               dMesh.triangles, CL_FALSE,
-                               0, dMesh.numTriangles() * (3 * sizeof(cl_uint)),
-                               hMesh.triangles,
-                               events, trianglesEvent);
+        if (dMesh.packing.triangles)
+            CLH::enqueueReadBuffer(queue,
+                                   dMesh.triangles, CL_FALSE,
+                                   0, dMesh.numTriangles() * sizeof(cl_ulong),
+                                   packedTail(hMesh.triangles, dMesh.numTriangles()),
+                                   events, trianglesEvent);
+        else
+            CLH::enqueueReadBuffer(queue,
+                                   dMesh.triangles, CL_FALSE,
+                                   0, dMesh.numTriangles() * (3 * sizeof(cl_uint)),
+                                   hMesh.triangles,
+                                   events, trianglesEvent);
+        hMesh.packing.triangles = dMesh.packing.triangles;
         queue.flush();
     }
 
@@ -92,11 +156,22 @@ void enqueueReadMesh(const cl::CommandQueue &queue,
 
     if (verticesEvent != NULL)
     {
-        CLH::enqueueReadBuffer(queue,
-                               dMesh.vertices, CL_FALSE,
-                               0, dMesh.numVertices() * (3 * sizeof(cl_float)),
-                               hMesh.vertices,
-                               events, verticesEvent);
+        if (dMesh.packing.vertices)
+            CLH::enqueueReadBuffer(queue,
+                                   dMesh.vertices, CL_FALSE,
+                                   0, dMesh.numVertices() * sizeof(cl_ulong),
+                                   packedTail(hMesh.vertices, dMesh.numVertices()),
+                                   events, verticesEvent);
+        else
+            CLH::enqueueReadBuffer(queue,
+                                   dMesh.vertices, CL_FALSE,
+                                   0, dMesh.numVertices() * (3 * sizeof(cl_float)),
+                                   hMesh.vertices,
+                                   events, verticesEvent);
+        hMesh.packing.vertices = dMesh.packing.vertices;
+        hMesh.packing.scale = dMesh.packing.scale;
+        for (unsigned int i = 0; i < 3; i++)
+            hMesh.packing.bias[i] = dMesh.packing.bias[i];
         queue.flush();
     }
 }
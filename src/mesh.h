@@ -84,6 +84,41 @@ public:
     }
 };
 
+/**
+ * Describes whether the vertices and triangles of a mesh are held in a packed
+ * form. Packed vertices are @c cl_ulong values holding three unsigned
+ * fixed-point coordinates of @ref PACKED_BITS bits each, with x in the least
+ * significant bits; a coordinate @a q represents <code>bias + scale * q</code>.
+ * Packed triangles are @c cl_ulong values holding three vertex indices of
+ * @ref PACKED_BITS bits each, again with the first in the least significant
+ * bits.
+ *
+ * Packing is only used to reduce the cost of transferring a mesh from the
+ * device; see @ref PackMeshFilter and @ref enqueueReadMesh.
+ */
+struct MeshPacking
+{
+    enum
+    {
+        /// Number of bits per component of a packed vertex or triangle
+        PACKED_BITS = 21
+    };
+
+    bool vertices;          ///< Whether vertices are packed
+    bool triangles;         ///< Whether triangles are packed
+    cl_float scale;         ///< Size of a quantisation step for packed vertices
+    cl_float bias[3];       ///< Position of the zero quantised vertex
+
+    /// Constructs a description of an unpacked mesh
+    MeshPacking() : vertices(false), triangles(false), scale(1.0f)
+    {
+        bias[0] = bias[1] = bias[2] = 0.0f;
+    }
+
+    /// Largest value that can be stored in one packed component
+    static cl_ulong maxValue() { return (cl_ulong(1) << PACKED_BITS) - 1; }
+};
+
 /**
  * Encapsulates a mesh consisting of vertices, triangles and vertex keys in
  * OpenCL buffers. Every vertex has an associated key and the vertices are
@@ -114,6 +149,12 @@ struct DeviceKeyMesh : public MeshSizes
      */
     cl::Buffer vertexKeys;                 ///< Vertex keys
 
+    /**
+     * Whether @ref vertices and @ref triangles are packed. If so, they hold
+     * one @c cl_ulong per vertex or triangle instead of the layouts above.
+     */
+    MeshPacking packing;
+
     DeviceKeyMesh() {}
 
     /**
@@ -129,12 +170,19 @@ struct DeviceKeyMesh : public MeshSizes
  * DeviceKeyMesh, the host holds keys @em only for external vertices. Thus,
  * <code>vertexKeys[i]</code> corresponds to <code>vertices[i +
  * numInternalVertices]</code>.
+ *
+ * If @ref enqueueReadMesh transferred a packed mesh, the packed values are
+ * held in the second part of the @ref vertices or @ref triangles memory (which
+ * is always sized for the unpacked form) and @ref packing records this. They
+ * must be expanded with @ref unpackVertices and @ref unpackTriangles before
+ * the data is used.
  */
 struct HostKeyMesh : public MeshSizes
 {
     boost::array<cl_float, 3> *vertices;
     boost::array<cl_uint, 3> *triangles;
     cl_ulong *vertexKeys;
+    MeshPacking packing;
 
     HostKeyMesh() :
         vertices(NULL), triangles(NULL), vertexKeys(NULL) {}
@@ -145,6 +193,18 @@ struct HostKeyMesh : public MeshSizes
      * @pre @a ptr is @c cl_ulong aligned.
      */
     HostKeyMesh(void *ptr, const MeshSizes &sizes);
+
+    /**
+     * Expands packed vertices in place. It does nothing if the vertices are
+     * not packed.
+     */
+    void unpackVertices();
+
+    /**
+     * Expands packed triangles in place. It does nothing if the triangles
+     * are not packed.
+     */
+    void unpackTriangles();
 };
 
 /**
@@ -157,6 +217,11 @@ struct HostKeyMesh : public MeshSizes
  * are discarded. Properties that are not transferred as preserved in @a
  * hMesh.
  *
+ * If @a dMesh is packed, the packed form is transferred and @a hMesh.packing
+ * is updated to match. The caller must then call @ref
+ * HostKeyMesh::unpackVertices and @ref HostKeyMesh::unpackTriangles once the
+ * corresponding transfers are complete.
+ *
  * @param queue          Queue in which to enqueue the transfers.
  * @param dMesh          Source of the copy.
  * @param hMesh          Target of the copy.
@@ -35,12 +35,17 @@
 #include <CL/cl.hpp>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <string>
+#include <stdexcept>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include "mesh_filter.h"
 #include "errors.h"
 #include "grid.h"
 #include "clh.h"
+#include "statistics_cl.h"
 
 void MeshFilterChain::operator()(
     const cl::CommandQueue &queue,
@@ -111,3 +116,366 @@ void ScaleBiasFilter::operator()(
                                    events, event, &kernelTime);
     outMesh = inMesh;
 }
+
+/// Key written after the last cluster key, so that every run has an end
+static const cl_ulong sentinelKey = CL_ULONG_MAX;
+
+DecimateFilter::DecimateFilter(
+    const cl::Context &context, const cl::Device &device, float cellSize,
+    std::size_t maxVertices, std::size_t maxTriangles)
+    : sortKeys(context, device, clogs::TYPE_ULONG, clogs::TYPE_UINT),
+    scanUint(context, device, clogs::TYPE_UINT),
+    maxVertices(maxVertices), maxTriangles(maxTriangles),
+    cellSize(cellSize),
+    kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.decimate.time")),
+    retainedStat(Statistics::getStatistic<Statistics::Variable>("device.decimate.retained"))
+{
+    MLSGPU_ASSERT(cellSize > 0.0f, std::invalid_argument);
+    MLSGPU_ASSERT(maxVertices > 0 && maxTriangles > 0, std::invalid_argument);
+
+    cl::Program program = CLH::build(context, std::vector<cl::Device>(1, device), "kernels/decimate.cl");
+    clusterKeysKernel = cl::Kernel(program, "clusterKeys");
+    countClustersKernel = cl::Kernel(program, "countClusters");
+    assignClustersKernel = cl::Kernel(program, "assignClusters");
+    accumulateQuadricsKernel = cl::Kernel(program, "accumulateQuadrics");
+    solveClustersKernel = cl::Kernel(program, "solveClusters");
+    keyTrianglesKernel = cl::Kernel(program, "keyTriangles");
+    markTrianglesKernel = cl::Kernel(program, "markTriangles");
+    compactTrianglesKernel = cl::Kernel(program, "compactTriangles");
+
+    // If this section is modified, remember to update resourceUsage
+    const std::size_t n = maxVertices;
+    keys = cl::Buffer(context, CL_MEM_READ_WRITE, (n + 1) * sizeof(cl_ulong));
+    indices = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint));
+    clusters = cl::Buffer(context, CL_MEM_READ_WRITE, (n + 1) * sizeof(cl_uint));
+    remap = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint));
+    firstMember = cl::Buffer(context, CL_MEM_READ_WRITE, (n + 1) * sizeof(cl_uint));
+    quadrics = cl::Buffer(context, CL_MEM_READ_WRITE, n * (10 * sizeof(cl_float)));
+    vertices = cl::Buffer(context, CL_MEM_READ_WRITE, n * (3 * sizeof(cl_float)));
+    vertexKeys = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_ulong));
+    triangleKeys = cl::Buffer(context, CL_MEM_READ_WRITE, maxTriangles * sizeof(cl_ulong));
+    triangleOrder = cl::Buffer(context, CL_MEM_READ_WRITE, maxTriangles * sizeof(cl_uint));
+    keep = cl::Buffer(context, CL_MEM_READ_WRITE, (maxTriangles + 1) * sizeof(cl_uint));
+    triangles = cl::Buffer(context, CL_MEM_READ_WRITE, maxTriangles * (3 * sizeof(cl_uint)));
+    counts = cl::Buffer(context, CL_MEM_READ_WRITE, 3 * sizeof(cl_uint));
+
+    clusterKeysKernel.setArg(0, keys);
+    clusterKeysKernel.setArg(1, indices);
+    countClustersKernel.setArg(0, clusters);
+    countClustersKernel.setArg(1, keys);
+    assignClustersKernel.setArg(0, remap);
+    assignClustersKernel.setArg(1, firstMember);
+    assignClustersKernel.setArg(2, quadrics);
+    assignClustersKernel.setArg(3, clusters);
+    assignClustersKernel.setArg(4, indices);
+    assignClustersKernel.setArg(5, keys);
+    accumulateQuadricsKernel.setArg(0, quadrics);
+    accumulateQuadricsKernel.setArg(3, remap);
+    accumulateQuadricsKernel.setArg(4, clusters);
+    solveClustersKernel.setArg(0, vertices);
+    solveClustersKernel.setArg(1, vertexKeys);
+    solveClustersKernel.setArg(2, quadrics);
+    solveClustersKernel.setArg(3, firstMember);
+    solveClustersKernel.setArg(4, indices);
+    solveClustersKernel.setArg(7, clusters);
+    solveClustersKernel.setArg(10, cellSize);
+    keyTrianglesKernel.setArg(0, triangleKeys);
+    keyTrianglesKernel.setArg(1, triangleOrder);
+    keyTrianglesKernel.setArg(3, remap);
+    keyTrianglesKernel.setArg(4, clusters);
+    markTrianglesKernel.setArg(0, keep);
+    markTrianglesKernel.setArg(1, triangleKeys);
+    markTrianglesKernel.setArg(2, triangleOrder);
+    markTrianglesKernel.setArg(4, remap);
+    compactTrianglesKernel.setArg(0, triangles);
+    compactTrianglesKernel.setArg(1, keep);
+    compactTrianglesKernel.setArg(3, remap);
+
+    sortKeys.setEventCallback(
+        &Statistics::timeEventCallback,
+        &Statistics::getStatistic<Statistics::Variable>("kernel.decimate.sort.time"));
+    scanUint.setEventCallback(
+        &Statistics::timeEventCallback,
+        &Statistics::getStatistic<Statistics::Variable>("kernel.decimate.scan.time"));
+}
+
+CLH::ResourceUsage DecimateFilter::resourceUsage(std::size_t maxVertices, std::size_t maxTriangles)
+{
+    const std::size_t n = maxVertices;
+    CLH::ResourceUsage ans;
+    ans.addBuffer("decimate.keys", (n + 1) * sizeof(cl_ulong));
+    ans.addBuffer("decimate.indices", n * sizeof(cl_uint));
+    ans.addBuffer("decimate.clusters", (n + 1) * sizeof(cl_uint));
+    ans.addBuffer("decimate.remap", n * sizeof(cl_uint));
+    ans.addBuffer("decimate.firstMember", (n + 1) * sizeof(cl_uint));
+    ans.addBuffer("decimate.quadrics", n * (10 * sizeof(cl_float)));
+    ans.addBuffer("decimate.vertices", n * (3 * sizeof(cl_float)));
+    ans.addBuffer("decimate.vertexKeys", n * sizeof(cl_ulong));
+    ans.addBuffer("decimate.triangleKeys", maxTriangles * sizeof(cl_ulong));
+    ans.addBuffer("decimate.triangleOrder", maxTriangles * sizeof(cl_uint));
+    ans.addBuffer("decimate.keep", (maxTriangles + 1) * sizeof(cl_uint));
+    ans.addBuffer("decimate.triangles", maxTriangles * (3 * sizeof(cl_uint)));
+    ans.addBuffer("decimate.counts", 3 * sizeof(cl_uint));
+    return ans;
+}
+
+void DecimateFilter::operator()(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &inMesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event,
+    DeviceKeyMesh &outMesh) const
+{
+    MLSGPU_ASSERT(!inMesh.packing.vertices && !inMesh.packing.triangles, std::invalid_argument);
+
+    const std::size_t numVertices = inMesh.numVertices();
+    const std::size_t numInternal = inMesh.numInternalVertices();
+    const std::size_t numTriangles = inMesh.numTriangles();
+    if (numInternal == 0 || numTriangles == 0)
+    {
+        // Nothing can be merged
+        outMesh = inMesh;
+        CLH::enqueueMarkerWithWaitList(queue, events, event);
+        return;
+    }
+
+    MLSGPU_ASSERT(numVertices <= maxVertices, std::length_error);
+    MLSGPU_ASSERT(numTriangles <= maxTriangles, std::length_error);
+
+    /* The cluster and triangle counts are only needed on the host to
+     * describe the output, so the kernels read them from the device and a
+     * single read-back is done once everything has been enqueued.
+     */
+    std::vector<cl::Event> wait(1);
+    cl::Event last;
+
+    queue.enqueueWriteBuffer(keys, CL_FALSE, numVertices * sizeof(cl_ulong), sizeof(cl_ulong),
+                             &sentinelKey, events, &last);
+    wait[0] = last;
+
+    clusterKeysKernel.setArg(2, inMesh.vertices);
+    clusterKeysKernel.setArg(3, cl_uint(numInternal));
+    clusterKeysKernel.setArg(4, cl_float(1.0f / cellSize));
+    CLH::enqueueNDRangeKernel(queue,
+                              clusterKeysKernel,
+                              cl::NullRange,
+                              cl::NDRange(numVertices),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    sortKeys.enqueue(queue, keys, indices, numVertices, 0, &wait, &last);
+    wait[0] = last;
+
+    CLH::enqueueNDRangeKernel(queue,
+                              countClustersKernel,
+                              cl::NullRange,
+                              cl::NDRange(numVertices),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    scanUint.enqueue(queue, clusters, numVertices + 1, NULL, &wait, &last);
+    wait[0] = last;
+
+    queue.enqueueCopyBuffer(clusters, counts, numInternal * sizeof(cl_uint), 0, sizeof(cl_uint),
+                            &wait, &last);
+    std::vector<cl::Event> copies(1, last);
+    queue.enqueueCopyBuffer(clusters, counts, numVertices * sizeof(cl_uint), sizeof(cl_uint), sizeof(cl_uint),
+                            &wait, &last);
+    copies.push_back(last);
+
+    assignClustersKernel.setArg(6, cl_uint(numVertices));
+    CLH::enqueueNDRangeKernel(queue,
+                              assignClustersKernel,
+                              cl::NullRange,
+                              cl::NDRange(numVertices),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    accumulateQuadricsKernel.setArg(1, inMesh.triangles);
+    accumulateQuadricsKernel.setArg(2, inMesh.vertices);
+    accumulateQuadricsKernel.setArg(5, cl_uint(numInternal));
+    CLH::enqueueNDRangeKernel(queue,
+                              accumulateQuadricsKernel,
+                              cl::NullRange,
+                              cl::NDRange(numTriangles),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    solveClustersKernel.setArg(5, inMesh.vertices);
+    solveClustersKernel.setArg(6, inMesh.vertexKeys);
+    solveClustersKernel.setArg(8, cl_uint(numInternal));
+    solveClustersKernel.setArg(9, cl_uint(numVertices));
+    CLH::enqueueNDRangeKernel(queue,
+                              solveClustersKernel,
+                              cl::NullRange,
+                              cl::NDRange(numVertices),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    std::vector<cl::Event> done(1, last);
+
+    /* Sort the triangles so that copies are adjacent. The compaction below
+     * still uses the original order, so the output order is stable.
+     */
+    keyTrianglesKernel.setArg(2, inMesh.triangles);
+    keyTrianglesKernel.setArg(5, cl_uint(numVertices));
+    CLH::enqueueNDRangeKernel(queue,
+                              keyTrianglesKernel,
+                              cl::NullRange,
+                              cl::NDRange(numTriangles),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    sortKeys.enqueue(queue, triangleKeys, triangleOrder, numTriangles, 0, &wait, &last);
+    wait[0] = last;
+
+    markTrianglesKernel.setArg(3, inMesh.triangles);
+    markTrianglesKernel.setArg(5, cl_uint(numTriangles));
+    CLH::enqueueNDRangeKernel(queue,
+                              markTrianglesKernel,
+                              cl::NullRange,
+                              cl::NDRange(numTriangles),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    wait[0] = last;
+
+    scanUint.enqueue(queue, keep, numTriangles + 1, NULL, &wait, &last);
+    wait[0] = last;
+
+    queue.enqueueCopyBuffer(keep, counts, numTriangles * sizeof(cl_uint), 2 * sizeof(cl_uint), sizeof(cl_uint),
+                            &wait, &last);
+    copies.push_back(last);
+
+    compactTrianglesKernel.setArg(2, inMesh.triangles);
+    CLH::enqueueNDRangeKernel(queue,
+                              compactTrianglesKernel,
+                              cl::NullRange,
+                              cl::NDRange(numTriangles),
+                              cl::NullRange,
+                              &wait, &last, &kernelTime);
+    done.push_back(last);
+
+    cl::Event readEvent;
+    queue.enqueueReadBuffer(counts, CL_FALSE, 0, 3 * sizeof(cl_uint), readback, &copies, &readEvent);
+    CLH::enqueueMarkerWithWaitList(queue, &done, event);
+
+    // The output mesh is described by host-side counts, so wait for them here
+    readEvent.wait();
+    const cl_uint numInternalClusters = readback[0];
+    const cl_uint numClusters = readback[1];
+    retainedStat.add(double(numClusters) / numVertices);
+
+    outMesh = DeviceKeyMesh();
+    outMesh.vertices = vertices;
+    outMesh.vertexKeys = vertexKeys;
+    outMesh.triangles = triangles;
+    outMesh.assign(numClusters, readback[2], numInternalClusters);
+}
+
+PackMeshFilter::PackMeshFilter(
+    const cl::Context &context, std::size_t maxVertices, std::size_t maxTriangles)
+    : maxVertices(maxVertices), maxTriangles(maxTriangles),
+    kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.packMesh.time"))
+{
+    std::map<std::string, std::string> defines;
+    defines["PACKED_BITS"] = boost::lexical_cast<std::string>(int(MeshPacking::PACKED_BITS));
+
+    cl::Program program = CLH::build(context, "kernels/pack_mesh.cl", defines);
+    verticesKernel = cl::Kernel(program, "packVertices");
+    trianglesKernel = cl::Kernel(program, "packTriangles");
+
+    // If this section is modified, remember to update resourceUsage
+    vertices = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * sizeof(cl_ulong));
+    triangles = cl::Buffer(context, CL_MEM_READ_WRITE, maxTriangles * sizeof(cl_ulong));
+    verticesKernel.setArg(0, vertices);
+    trianglesKernel.setArg(0, triangles);
+
+    const float zero[3] = {0.0f, 0.0f, 0.0f};
+    const float one[3] = {1.0f, 1.0f, 1.0f};
+    setBox(zero, one);
+}
+
+CLH::ResourceUsage PackMeshFilter::resourceUsage(std::size_t maxVertices, std::size_t maxTriangles)
+{
+    CLH::ResourceUsage ans;
+    ans.addBuffer("pack.vertices", maxVertices * sizeof(cl_ulong));
+    ans.addBuffer("pack.triangles", maxTriangles * sizeof(cl_ulong));
+    return ans;
+}
+
+void PackMeshFilter::setBox(const float lower[3], const float upper[3])
+{
+    float size = 0.0f;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(lower[i] <= upper[i], std::invalid_argument);
+        size = std::max(size, upper[i] - lower[i]);
+        packing.bias[i] = lower[i];
+    }
+    if (size <= 0.0f)
+        size = 1.0f;
+    packing.scale = size / MeshPacking::maxValue();
+
+    cl_float4 biasInvScale;
+    for (unsigned int i = 0; i < 3; i++)
+        biasInvScale.s[i] = packing.bias[i];
+    biasInvScale.s[3] = 1.0f / packing.scale;
+    verticesKernel.setArg(2, biasInvScale);
+}
+
+void PackMeshFilter::operator()(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &inMesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event,
+    DeviceKeyMesh &outMesh) const
+{
+    MLSGPU_ASSERT(!inMesh.packing.vertices && !inMesh.packing.triangles, std::invalid_argument);
+
+    const std::size_t numVertices = inMesh.numVertices();
+    const std::size_t numTriangles = inMesh.numTriangles();
+    const bool packTriangles = numVertices <= MeshPacking::maxValue() + 1;
+    MLSGPU_ASSERT(numVertices <= maxVertices, std::length_error);
+    MLSGPU_ASSERT(numTriangles <= maxTriangles, std::length_error);
+
+    std::vector<cl::Event> wait;
+    cl::Event verticesEvent, trianglesEvent;
+
+    // See ScaleBiasFilter::operator() for why the setArg calls are guarded
+    if (numVertices > 0)
+        verticesKernel.setArg(1, inMesh.vertices);
+    CLH::enqueueNDRangeKernelSplit(queue,
+                                   verticesKernel,
+                                   cl::NullRange,
+                                   cl::NDRange(numVertices),
+                                   cl::NullRange,
+                                   events, &verticesEvent, &kernelTime);
+    wait.push_back(verticesEvent);
+
+    if (packTriangles)
+    {
+        if (numTriangles > 0)
+            trianglesKernel.setArg(1, inMesh.triangles);
+        CLH::enqueueNDRangeKernelSplit(queue,
+                                       trianglesKernel,
+                                       cl::NullRange,
+                                       cl::NDRange(numTriangles),
+                                       cl::NullRange,
+                                       events, &trianglesEvent, &kernelTime);
+        wait.push_back(trianglesEvent);
+    }
+
+    outMesh = inMesh;
+    outMesh.packing = packing;
+    outMesh.packing.vertices = true;
+    outMesh.packing.triangles = packTriangles;
+    if (numVertices > 0)
+        outMesh.vertices = vertices;
+    if (packTriangles && numTriangles > 0)
+        outMesh.triangles = triangles;
+    CLH::enqueueMarkerWithWaitList(queue, &wait, event);
+}
@@ -31,6 +31,7 @@
 # include <config.h>
 #endif
 #include <CL/cl.hpp>
+#include <clogs/clogs.h>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
@@ -38,6 +39,7 @@
 #include "mesh.h"
 #include "marching.h"
 #include "statistics.h"
+#include "clh.h"
 
 class Grid;
 
@@ -167,4 +169,169 @@ public:
         DeviceKeyMesh &outMesh) const;
 };
 
+/**
+ * Mesh filter that simplifies the mesh by vertex clustering. Space is
+ * divided into cubic cells, and the internal vertices falling into each cell
+ * are merged into one. The merged vertex is placed to minimize the sum of
+ * squared distances to the planes of the triangles incident on the cluster
+ * (quadric error metric), falling back to the mean of the members when that
+ * is ill-conditioned. Triangles that collapse are removed, as are
+ * duplicates: triangles that end up with the same three clusters are kept
+ * only once, and coincident triangles with opposite orientations cancel.
+ *
+ * External vertices are never merged or moved, so that meshes still weld
+ * correctly with their neighbours. The filter must therefore be applied
+ * while vertices are still in grid coordinates (i.e. before @ref
+ * ScaleBiasFilter), so that the cells are aligned between meshes.
+ *
+ * The output references internal buffers, which are allocated by the
+ * constructor. The operator() is not reentrant. It enqueues all the work
+ * before waiting for a single read-back of the output size.
+ */
+class DecimateFilter
+{
+private:
+    mutable cl::Kernel clusterKeysKernel;
+    mutable cl::Kernel countClustersKernel;
+    mutable cl::Kernel assignClustersKernel;
+    mutable cl::Kernel accumulateQuadricsKernel;
+    mutable cl::Kernel solveClustersKernel;
+    mutable cl::Kernel keyTrianglesKernel;
+    mutable cl::Kernel markTrianglesKernel;
+    mutable cl::Kernel compactTrianglesKernel;
+
+    mutable clogs::Radixsort sortKeys;  ///< Sorts vertices by cluster key, and triangles by their clusters
+    mutable clogs::Scan scanUint;       ///< Scans cluster and triangle flags
+
+    /**
+     * @name Buffers
+     * If this section is modified, remember to update @ref resourceUsage.
+     * @{
+     */
+    cl::Buffer keys;                    ///< Cluster keys (plus a sentinel)
+    cl::Buffer indices;                 ///< Original index of each sorted vertex
+    cl::Buffer clusters;                ///< Run flags, then their scan (plus the total)
+    cl::Buffer remap;                   ///< Cluster of each vertex
+    cl::Buffer firstMember;             ///< First sorted position of each cluster (plus an end marker)
+    cl::Buffer quadrics;                ///< Quadric for each cluster
+    cl::Buffer vertices;                ///< Output vertices
+    cl::Buffer vertexKeys;              ///< Output vertex keys
+    cl::Buffer triangleKeys;            ///< Sort key for each triangle (see @ref keyTriangles)
+    cl::Buffer triangleOrder;           ///< Original index of each sorted triangle
+    cl::Buffer keep;                    ///< Triangle flags, then their scan
+    cl::Buffer triangles;               ///< Output triangles
+    cl::Buffer counts;                  ///< Internal clusters, total clusters and kept triangles
+    /** @} */
+
+    std::size_t maxVertices;            ///< Number of vertices allocated in the buffers
+    std::size_t maxTriangles;           ///< Number of triangles allocated in the buffers
+
+    mutable cl_uint readback[3];        ///< Host copy of @ref counts
+
+    cl_float cellSize;                  ///< Size of a cluster cell
+
+    /// Statistic for time spent in the kernels
+    Statistics::Variable &kernelTime;
+    /// Fraction of vertices retained
+    Statistics::Variable &retainedStat;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param context      Context for allocating buffers.
+     * @param device       Device for compiling kernels.
+     * @param cellSize     Size of a cluster cell, in grid cells.
+     * @param maxVertices  Maximum number of vertices in an input mesh.
+     * @param maxTriangles Maximum number of triangles in an input mesh.
+     *
+     * @pre @a cellSize > 0, @a maxVertices > 0 and @a maxTriangles > 0.
+     */
+    DecimateFilter(const cl::Context &context, const cl::Device &device, float cellSize,
+                   std::size_t maxVertices, std::size_t maxTriangles);
+
+    /// Returns the resources that would be allocated by the constructor.
+    static CLH::ResourceUsage resourceUsage(std::size_t maxVertices, std::size_t maxTriangles);
+
+    /// Filter operation (see @ref MeshFilter).
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &inMesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event,
+        DeviceKeyMesh &outMesh) const;
+};
+
+/**
+ * Mesh filter that packs the vertices and triangles into 64-bit values (see
+ * @ref MeshPacking), reducing the amount of data that must be transferred
+ * to the host. Vertices are quantised to a grid covering an axis-aligned box
+ * that must be set with @ref setBox before use; vertices outside the box are
+ * clamped to it. Triangles are only packed if every index fits; otherwise
+ * they are passed through unchanged.
+ *
+ * This filter should be last in a chain, as other filters do not understand
+ * packed meshes. The output references internal buffers, which are allocated
+ * by the constructor. As for @ref ScaleBiasFilter, @c operator() is not
+ * reentrant.
+ */
+class PackMeshFilter
+{
+private:
+    /// Kernel generated from @ref packVertices (mutable so that the arguments can be set)
+    mutable cl::Kernel verticesKernel;
+    /// Kernel generated from @ref packTriangles (mutable so that the arguments can be set)
+    mutable cl::Kernel trianglesKernel;
+
+    /**
+     * @name Output buffers
+     * If this section is modified, remember to update @ref resourceUsage.
+     * @{
+     */
+    cl::Buffer vertices;                  ///< Output buffer for packed vertices
+    cl::Buffer triangles;                 ///< Output buffer for packed triangles
+    std::size_t maxVertices;              ///< Number of elements allocated in @ref vertices
+    std::size_t maxTriangles;             ///< Number of elements allocated in @ref triangles
+    /** @} */
+
+    /// Statistic for time spent in the kernels
+    Statistics::Variable &kernelTime;
+
+    /// Quantisation parameters for the current box
+    MeshPacking packing;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param context      Context for allocating buffers.
+     * @param maxVertices  Maximum number of vertices in an input mesh.
+     * @param maxTriangles Maximum number of triangles in an input mesh.
+     */
+    PackMeshFilter(const cl::Context &context, std::size_t maxVertices, std::size_t maxTriangles);
+
+    /// Returns the resources that would be allocated by the constructor.
+    static CLH::ResourceUsage resourceUsage(std::size_t maxVertices, std::size_t maxTriangles);
+
+    /**
+     * Set the box containing the vertices. The box is divided into
+     * 2<sup>@ref MeshPacking::PACKED_BITS</sup> - 1 steps along its longest
+     * axis, with the same step used along the other axes.
+     *
+     * @param lower    Lower corner of the box.
+     * @param upper    Upper corner of the box.
+     *
+     * @pre @a lower[i] <= @a upper[i] for each i.
+     */
+    void setBox(const float lower[3], const float upper[3]);
+
+    /// Filter operation (see @ref MeshFilter).
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &inMesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event,
+        DeviceKeyMesh &outMesh) const;
+};
+
 #endif /* !MESH_FILTER_H */
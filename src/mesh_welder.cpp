@@ -0,0 +1,256 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref MeshWelder.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.hpp>
+#include <clogs/clogs.h>
+#include <vector>
+#include "mesh_welder.h"
+#include "clh.h"
+#include "errors.h"
+#include "statistics.h"
+#include "statistics_cl.h"
+
+/// Key written after the last staged key, so that every run has an end
+static const cl_ulong sentinelKey = CL_ULONG_MAX;
+
+MeshWelder::MeshWelder(const cl::Context &context, const cl::Device &device,
+                       std::size_t maxVertices, std::size_t maxTriangles)
+    : maxVertices(maxVertices), maxTriangles(maxTriangles),
+    sortKeys(context, device, clogs::TYPE_ULONG, clogs::TYPE_UINT),
+    scanUint(context, device, clogs::TYPE_UINT),
+    numInternal(0), numExternal(0), numTriangles(0), numWelded(0),
+    kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.weld.time")),
+    removedStat(Statistics::getStatistic<Statistics::Variable>("device.weld.removed"))
+{
+    MLSGPU_ASSERT(maxVertices > 0 && maxVertices < 0x80000000U, std::invalid_argument);
+    MLSGPU_ASSERT(maxTriangles > 0, std::invalid_argument);
+
+    cl::Program program = CLH::build(context, std::vector<cl::Device>(1, device), "kernels/weld.cl");
+    appendTrianglesKernel = cl::Kernel(program, "appendTriangles");
+    initIndicesKernel = cl::Kernel(program, "initIndices");
+    countUniqueKeysKernel = cl::Kernel(program, "countUniqueKeys");
+    compactExternalKernel = cl::Kernel(program, "compactExternal");
+    reindexTrianglesKernel = cl::Kernel(program, "reindexTriangles");
+
+    // If these are updated, also update resourceUsage
+    vertices = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * (3 * sizeof(cl_float)));
+    vertexKeys = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * sizeof(cl_ulong));
+    triangles = cl::Buffer(context, CL_MEM_READ_WRITE, maxTriangles * (3 * sizeof(cl_uint)));
+    extVertices = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * (3 * sizeof(cl_float)));
+    extKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxVertices + 1) * sizeof(cl_ulong));
+    extIndices = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * sizeof(cl_uint));
+    unique = cl::Buffer(context, CL_MEM_READ_WRITE, (maxVertices + 1) * sizeof(cl_uint));
+    remap = cl::Buffer(context, CL_MEM_READ_WRITE, maxVertices * sizeof(cl_uint));
+
+    /* The output keys and the remap table are only written after the sort,
+     * so they can double as its scratch space.
+     */
+    sortKeys.setTemporaryBuffers(vertexKeys, remap);
+    sortKeys.setEventCallback(
+        &Statistics::timeEventCallback,
+        &Statistics::getStatistic<Statistics::Variable>("kernel.weld.sort.time"));
+    scanUint.setEventCallback(
+        &Statistics::timeEventCallback,
+        &Statistics::getStatistic<Statistics::Variable>("kernel.weld.scan.time"));
+
+    appendTrianglesKernel.setArg(0, triangles);
+    initIndicesKernel.setArg(0, extIndices);
+    countUniqueKeysKernel.setArg(0, unique);
+    countUniqueKeysKernel.setArg(1, extKeys);
+    compactExternalKernel.setArg(0, vertices);
+    compactExternalKernel.setArg(1, vertexKeys);
+    compactExternalKernel.setArg(2, remap);
+    compactExternalKernel.setArg(3, unique);
+    compactExternalKernel.setArg(4, extIndices);
+    compactExternalKernel.setArg(5, extKeys);
+    compactExternalKernel.setArg(6, extVertices);
+    reindexTrianglesKernel.setArg(0, triangles);
+    reindexTrianglesKernel.setArg(1, remap);
+}
+
+CLH::ResourceUsage MeshWelder::resourceUsage(std::size_t maxVertices, std::size_t maxTriangles)
+{
+    CLH::ResourceUsage ans;
+    ans.addBuffer("weld.vertices", maxVertices * (3 * sizeof(cl_float)));
+    ans.addBuffer("weld.vertexKeys", maxVertices * sizeof(cl_ulong));
+    ans.addBuffer("weld.triangles", maxTriangles * (3 * sizeof(cl_uint)));
+    ans.addBuffer("weld.extVertices", maxVertices * (3 * sizeof(cl_float)));
+    ans.addBuffer("weld.extKeys", (maxVertices + 1) * sizeof(cl_ulong));
+    ans.addBuffer("weld.extIndices", maxVertices * sizeof(cl_uint));
+    ans.addBuffer("weld.unique", (maxVertices + 1) * sizeof(cl_uint));
+    ans.addBuffer("weld.remap", maxVertices * sizeof(cl_uint));
+    return ans;
+}
+
+void MeshWelder::operator()(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &mesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(!mesh.packing.vertices && !mesh.packing.triangles, std::invalid_argument);
+
+    const std::size_t nV = mesh.numVertices();
+    const std::size_t nI = mesh.numInternalVertices();
+    const std::size_t nE = mesh.numExternalVertices();
+    const std::size_t nT = mesh.numTriangles();
+
+    if (nV > maxVertices || nT > maxTriangles)
+    {
+        // Too big to ever accumulate
+        output(queue, mesh, events, event);
+        return;
+    }
+    if (numInternal + numExternal + nV > maxVertices || numTriangles + nT > maxTriangles)
+        flush(queue, events, NULL);
+
+    std::vector<cl::Event> wait;
+    cl::Event e;
+
+    CLH::enqueueCopyBuffer(queue, mesh.vertices, vertices,
+                           0, numInternal * (3 * sizeof(cl_float)),
+                           nI * (3 * sizeof(cl_float)), events, &e);
+    wait.push_back(e);
+    CLH::enqueueCopyBuffer(queue, mesh.vertices, extVertices,
+                           nI * (3 * sizeof(cl_float)), numExternal * (3 * sizeof(cl_float)),
+                           nE * (3 * sizeof(cl_float)), events, &e);
+    wait.push_back(e);
+    CLH::enqueueCopyBuffer(queue, mesh.vertexKeys, extKeys,
+                           nI * sizeof(cl_ulong), numExternal * sizeof(cl_ulong),
+                           nE * sizeof(cl_ulong), events, &e);
+    wait.push_back(e);
+
+    // See ScaleBiasFilter::operator() for why this is guarded
+    if (nT > 0)
+        appendTrianglesKernel.setArg(1, mesh.triangles);
+    appendTrianglesKernel.setArg(2, cl_uint(numTriangles * 3));
+    appendTrianglesKernel.setArg(3, cl_uint(nI));
+    appendTrianglesKernel.setArg(4, cl_uint(numInternal));
+    appendTrianglesKernel.setArg(5, cl_uint(numExternal));
+    CLH::enqueueNDRangeKernel(queue,
+                              appendTrianglesKernel,
+                              cl::NullRange,
+                              cl::NDRange(nT * 3),
+                              cl::NullRange,
+                              events, &e, &kernelTime);
+    wait.push_back(e);
+
+    numInternal += nI;
+    numExternal += nE;
+    numTriangles += nT;
+    CLH::enqueueMarkerWithWaitList(queue, &wait, event);
+}
+
+void MeshWelder::flush(const cl::CommandQueue &queue,
+                       const std::vector<cl::Event> *events,
+                       cl::Event *event)
+{
+    if (numInternal + numExternal == 0 && numTriangles == 0)
+    {
+        CLH::enqueueMarkerWithWaitList(queue, events, event);
+        return;
+    }
+
+    std::vector<cl::Event> wait(1);
+    cl::Event last;
+
+    numWelded = 0;
+    if (numExternal > 0)
+    {
+        queue.enqueueWriteBuffer(extKeys, CL_FALSE, numExternal * sizeof(cl_ulong), sizeof(cl_ulong),
+                                 &sentinelKey, events, &last);
+        wait[0] = last;
+
+        CLH::enqueueNDRangeKernel(queue,
+                                  initIndicesKernel,
+                                  cl::NullRange,
+                                  cl::NDRange(numExternal),
+                                  cl::NullRange,
+                                  &wait, &last, &kernelTime);
+        wait[0] = last;
+
+        sortKeys.enqueue(queue, extKeys, extIndices, numExternal, 0, &wait, &last);
+        wait[0] = last;
+
+        CLH::enqueueNDRangeKernel(queue,
+                                  countUniqueKeysKernel,
+                                  cl::NullRange,
+                                  cl::NDRange(numExternal),
+                                  cl::NullRange,
+                                  &wait, &last, &kernelTime);
+        wait[0] = last;
+
+        scanUint.enqueue(queue, unique, numExternal + 1, NULL, &wait, &last);
+        wait[0] = last;
+
+        // The output size is needed on the host before the mesh can be passed on
+        queue.enqueueReadBuffer(unique, CL_TRUE, numExternal * sizeof(cl_uint), sizeof(cl_uint),
+                                &numWelded, &wait, NULL);
+
+        compactExternalKernel.setArg(7, cl_uint(numInternal));
+        CLH::enqueueNDRangeKernel(queue,
+                                  compactExternalKernel,
+                                  cl::NullRange,
+                                  cl::NDRange(numExternal),
+                                  cl::NullRange,
+                                  &wait, &last, &kernelTime);
+        wait[0] = last;
+
+        CLH::enqueueNDRangeKernel(queue,
+                                  reindexTrianglesKernel,
+                                  cl::NullRange,
+                                  cl::NDRange(numTriangles * 3),
+                                  cl::NullRange,
+                                  &wait, &last, &kernelTime);
+        wait[0] = last;
+
+        removedStat.add(double(numExternal - numWelded) / numExternal);
+    }
+    else
+    {
+        CLH::enqueueMarkerWithWaitList(queue, events, &last);
+        wait[0] = last;
+    }
+
+    DeviceKeyMesh outMesh;
+    outMesh.vertices = vertices;
+    outMesh.vertexKeys = vertexKeys;
+    outMesh.triangles = triangles;
+    outMesh.assign(numInternal + numWelded, numTriangles, numInternal);
+
+    numInternal = 0;
+    numExternal = 0;
+    numTriangles = 0;
+    output(queue, outMesh, &wait, event);
+}
@@ -0,0 +1,141 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Device-side merging of the external vertices of several meshes.
+ */
+
+#ifndef MESH_WELDER_H
+#define MESH_WELDER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <CL/cl.hpp>
+#include <clogs/clogs.h>
+#include <cstddef>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "mesh.h"
+#include "marching.h"
+#include "clh.h"
+#include "statistics.h"
+
+/**
+ * Accumulates the meshes produced for adjacent regions of the same output
+ * chunk and welds their external vertices on the device, so that vertices
+ * shared between the regions are transferred and processed by the host only
+ * once. It is used as a @ref Marching::OutputFunctor, and passes the welded
+ * meshes to another output functor set with @ref setOutput.
+ *
+ * Each mesh passed in is appended to internal buffers: internal vertices go
+ * directly to the output, while external vertices are staged. @ref flush
+ * sorts the staged vertices by key, keeps one vertex for each key, rewrites
+ * the triangles and sends the result downstream. A flush also happens
+ * automatically if the buffers become full. A mesh that would not fit even
+ * in empty buffers is passed straight through.
+ *
+ * The welded vertices are still reported as external, since they may also
+ * be shared with regions that were not part of the same flush.
+ *
+ * The object is not thread-safe, and all calls must use the same in-order
+ * command queue.
+ */
+class MeshWelder : public boost::noncopyable
+{
+public:
+    typedef void result_type;
+
+    /**
+     * Constructor.
+     *
+     * @param context      Context for allocating buffers.
+     * @param device       Device for compiling kernels.
+     * @param maxVertices  Maximum number of vertices to accumulate.
+     * @param maxTriangles Maximum number of triangles to accumulate.
+     */
+    MeshWelder(const cl::Context &context, const cl::Device &device,
+               std::size_t maxVertices, std::size_t maxTriangles);
+
+    /// Returns the resources that would be allocated by the constructor.
+    static CLH::ResourceUsage resourceUsage(std::size_t maxVertices, std::size_t maxTriangles);
+
+    /**
+     * Sets the functor that receives welded meshes. It is copied; use @c
+     * boost::ref if it should be held by reference.
+     */
+    void setOutput(const Marching::OutputFunctor &output) { this->output = output; }
+
+    /**
+     * Append a mesh (see @ref Marching::OutputFunctor). The event is
+     * signaled once @a mesh is no longer needed.
+     */
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &mesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+
+    /**
+     * Weld everything accumulated so far and pass it to the output functor.
+     * It does nothing (other than to signal @a event) if nothing has been
+     * accumulated.
+     */
+    void flush(const cl::CommandQueue &queue,
+               const std::vector<cl::Event> *events,
+               cl::Event *event);
+
+private:
+    const std::size_t maxVertices, maxTriangles;
+
+    Marching::OutputFunctor output;
+
+    cl::Kernel appendTrianglesKernel;
+    cl::Kernel initIndicesKernel;
+    cl::Kernel countUniqueKeysKernel;
+    cl::Kernel compactExternalKernel;
+    cl::Kernel reindexTrianglesKernel;
+
+    clogs::Radixsort sortKeys;      ///< Sorts staged keys, with their positions as values
+    clogs::Scan scanUint;           ///< Scans @ref unique
+
+    cl::Buffer vertices;            ///< Output vertices (internal first, then welded external)
+    cl::Buffer vertexKeys;          ///< Output vertex keys
+    cl::Buffer triangles;           ///< Accumulated triangles
+    cl::Buffer extVertices;         ///< Staged external vertices
+    cl::Buffer extKeys;             ///< Keys of staged external vertices (plus a sentinel)
+    cl::Buffer extIndices;          ///< Staging position of each sorted key
+    cl::Buffer unique;              ///< Run boundaries, then their exclusive scan
+    cl::Buffer remap;               ///< Output position of each staged vertex
+
+    std::size_t numInternal;        ///< Internal vertices accumulated
+    std::size_t numExternal;        ///< External vertices staged
+    std::size_t numTriangles;       ///< Triangles accumulated
+
+    cl_uint numWelded;              ///< Readback of the number of welded external vertices
+
+    Statistics::Variable &kernelTime;
+    /// Fraction of staged external vertices removed by each flush
+    Statistics::Variable &removedStat;
+};
+
+#endif /* !MESH_WELDER_H */
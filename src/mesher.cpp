@@ -43,6 +43,7 @@
 #include <boost/ref.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
@@ -54,11 +55,12 @@
 #include <boost/filesystem.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/iostreams/positioning.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
 #include "tr1_unordered_map.h"
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <limits>
 #include <utility>
 #include <iterator>
 #include <map>
@@ -77,11 +79,14 @@
 #include "misc.h"
 #include "circular_buffer.h"
 #include "binary_io.h"
+#include "thread_name.h"
+#include "checkpoint.h"
 
 std::map<std::string, MesherType> MesherTypeWrapper::getNameMap()
 {
     std::map<std::string, MesherType> ans;
     ans["ooc"] = OOC_MESHER;
+    ans["stream"] = STREAM_MESHER;
     return ans;
 }
 
@@ -95,6 +100,74 @@ std::string ChunkNamer::operator()(const ChunkId &chunkId) const
     return nameStream.str();
 }
 
+MeshComponents::MeshComponents()
+    : numComponents(0),
+    vertexComponent("mem.MeshComponents::vertexComponent"),
+    componentVertices("mem.MeshComponents::componentVertices"),
+    componentTriangles("mem.MeshComponents::componentTriangles"),
+    firstVertex("mem.MeshComponents::firstVertex"),
+    nextVertex("mem.MeshComponents::nextVertex"),
+    firstTriangle("mem.MeshComponents::firstTriangle"),
+    nextTriangle("mem.MeshComponents::nextTriangle"),
+    nodes("mem.MeshComponents::nodes")
+{
+}
+
+void MeshComponents::compute(
+    std::size_t numVertices, std::size_t numTriangles,
+    const boost::array<cl_uint, 3> *triangles)
+{
+    nodes.clear();
+    nodes.resize(numVertices);
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        // Only need to use two edges in the union-find tree, since the
+        // third will be redundant.
+        for (unsigned int j = 0; j < 2; j++)
+            UnionFind::merge(nodes, triangles[i][j], triangles[i][j + 1]);
+    }
+
+    // Number the roots
+    numComponents = 0;
+    vertexComponent.reserve(numVertices, false);
+    for (std::size_t i = 0; i < numVertices; i++)
+        if (nodes[i].isRoot())
+            vertexComponent[i] = numComponents++;
+
+    componentVertices.reserve(numComponents, false);
+    componentTriangles.reserve(numComponents, false);
+    firstVertex.reserve(numComponents, false);
+    firstTriangle.reserve(numComponents, false);
+    nextVertex.reserve(numVertices, false);
+    nextTriangle.reserve(numTriangles, false);
+    std::fill(componentTriangles.data(), componentTriangles.data() + numComponents, 0);
+    std::fill(firstVertex.data(), firstVertex.data() + numComponents, -1);
+    std::fill(firstTriangle.data(), firstTriangle.data() + numComponents, -1);
+
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        if (nodes[i].isRoot())
+            componentVertices[vertexComponent[i]] = nodes[i].size();
+        else
+            vertexComponent[i] = vertexComponent[UnionFind::findRoot(nodes, i)];
+    }
+
+    for (std::tr1::int32_t i = (std::tr1::int32_t) numVertices - 1; i >= 0; i--)
+    {
+        std::tr1::int32_t c = vertexComponent[i];
+        nextVertex[i] = firstVertex[c];
+        firstVertex[c] = i;
+    }
+
+    for (std::tr1::int32_t i = (std::tr1::int32_t) numTriangles - 1; i >= 0; i--)
+    {
+        std::tr1::int32_t c = vertexComponent[triangles[i][0]];
+        componentTriangles[c]++;
+        nextTriangle[i] = firstTriangle[c];
+        firstTriangle[c] = i;
+    }
+}
+
 
 OOCMesher::TmpWriterItem::TmpWriterItem()
     : vertices("mem.OOCMesher::TmpWriterItem::vertices"),
@@ -104,19 +177,29 @@ OOCMesher::TmpWriterItem::TmpWriterItem()
 {
 }
 
+void OOCMesher::TmpWriterWorker::write(
+    std::ostream &file, BlockCompress::Writer *compressor,
+    const void *data, std::size_t bytes)
+{
+    if (compressor != NULL)
+        compressor->write(data, bytes);
+    else
+        file.write(static_cast<const char *>(data), bytes);
+}
+
 void OOCMesher::TmpWriterWorker::operator()(TmpWriterItem &item)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
     typedef std::pair<std::size_t, std::size_t> range;
     BOOST_FOREACH(const range &r, item.vertexRanges)
     {
-        verticesFile.write(reinterpret_cast<char *>(&item.vertices[r.first]),
-                           (r.second - r.first) * sizeof(vertex_type));
+        write(verticesFile, owner.verticesCompressor.get(), &item.vertices[r.first],
+              (r.second - r.first) * sizeof(vertex_type));
     }
     BOOST_FOREACH(const range &r, item.triangleRanges)
     {
-        trianglesFile.write(reinterpret_cast<char *>(&item.triangles[r.first]),
-                            (r.second - r.first) * sizeof(triangle_type));
+        write(trianglesFile, owner.trianglesCompressor.get(), &item.triangles[r.first],
+              (r.second - r.first) * sizeof(triangle_type));
     }
     if (!verticesFile || !trianglesFile)
     {
@@ -128,6 +211,7 @@ void OOCMesher::TmpWriterWorker::operator()(TmpWriterItem &item)
 
 OOCMesher::TmpWriterWorkerGroup::TmpWriterWorkerGroup(std::size_t slots)
     : WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>("tmpwriter", 1),
+    compress(false),
     itemAllocator("mem.OOCMesher::TmpWriterWorkerGroup::itemAllocator", slots)
 {
     addWorker(new TmpWriterWorker(*this, verticesFile, trianglesFile));
@@ -139,11 +223,58 @@ void OOCMesher::TmpWriterWorkerGroup::start()
 {
     createTmpFile(verticesPath, verticesFile);
     createTmpFile(trianglesPath, trianglesFile);
+    startCompressors();
+    WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
+}
+
+void OOCMesher::TmpWriterWorkerGroup::startCompressors()
+{
+    if (compress)
+    {
+        verticesCompressor.reset(new BlockCompress::Writer(
+                verticesFile, sizeof(vertex_type), BlockCompress::FILTER_XOR_DELTA));
+        trianglesCompressor.reset(new BlockCompress::Writer(
+                trianglesFile, sizeof(triangle_type), BlockCompress::FILTER_DELTA));
+    }
+}
+
+void OOCMesher::TmpWriterWorkerGroup::startAppend()
+{
+    verticesFile.open(verticesPath, std::ios::binary | std::ios::app);
+    trianglesFile.open(trianglesPath, std::ios::binary | std::ios::app);
+    if (!verticesFile || !trianglesFile)
+    {
+        int e = errno;
+        throw boost::enable_error_info(std::ios::failure("Could not open temporary file"))
+            << boost::errinfo_file_name((!verticesFile ? verticesPath : trianglesPath).string())
+            << boost::errinfo_errno(e);
+    }
+    startCompressors();
     WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
 }
 
+void OOCMesher::TmpWriterWorkerGroup::setPaths(
+    const boost::filesystem::path &vertices, const boost::filesystem::path &triangles)
+{
+    verticesPath = vertices;
+    trianglesPath = triangles;
+}
+
+void OOCMesher::TmpWriterWorkerGroup::setCompressed(bool compress)
+{
+    MLSGPU_ASSERT(!compress || BlockCompress::haveCodec(), std::invalid_argument);
+    this->compress = compress;
+}
+
 void OOCMesher::TmpWriterWorkerGroup::stopPostJoin()
 {
+    if (verticesCompressor)
+    {
+        verticesCompressor->flush();
+        trianglesCompressor->flush();
+        verticesCompressor.reset();
+        trianglesCompressor.reset();
+    }
     verticesFile.close();
     trianglesFile.close();
     if (!verticesFile || !trianglesFile)
@@ -173,19 +304,16 @@ void OOCMesher::TmpWriterWorkerGroup::freeItem(boost::shared_ptr<TmpWriterItem>
 }
 
 const int OOCMesher::reorderSlots = 3;
+const std::size_t OOCMesher::maxWriteBytes = 16 * 1024 * 1024;
 
 OOCMesher::OOCMesher(FastPly::Writer &writer, const Namer &namer)
     : MesherBase(writer, namer),
-    tmpNodes("mem.OOCMesher::tmpNodes"),
-    tmpClumpId("mem.OOCMesher::tmpClumpId"),
     tmpVertexLabel("mem.OOCMesher::tmpVertexLabel"),
-    tmpFirstVertex("mem.OOCMesher::tmpFirstVertex"),
-    tmpNextVertex("mem.OOCMesher::tmpNextVertex"),
-    tmpFirstTriangle("mem.OOCMesher::tmpFirstTriangle"),
-    tmpNextTriangle("mem.OOCMesher::tmpNextTriangle"),
+    tmpVerticesBytes(0), tmpTrianglesBytes(0),
     clumps("mem.OOCMesher::clumps"),
     clumpIdMap("mem.OOCMesher::clumpIdMap"),
     retainFiles(false),
+    resumedPass(false),
     tmpWriter(reorderSlots),
     chunks("mem.OOCMesher::chunks")
 {
@@ -217,63 +345,23 @@ OOCMesher::~OOCMesher()
     }
 }
 
-void OOCMesher::computeLocalComponents(
-    std::size_t numVertices,
-    std::size_t numTriangles,
-    const triangle_type *triangles,
-    Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes)
-{
-    nodes.clear();
-    nodes.resize(numVertices);
-    for (std::size_t i = 0; i < numTriangles; i++)
-    {
-        // Only need to use two edges in the union-find tree, since the
-        // third will be redundant.
-        for (unsigned int j = 0; j < 2; j++)
-            UnionFind::merge(nodes, triangles[i][j], triangles[i][j + 1]);
-    }
-}
-
-void OOCMesher::updateGlobalClumps(
-    std::size_t numTriangles,
-    const Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes,
-    const triangle_type *triangles,
-    Statistics::Container::PODBuffer<clump_id> &clumpId)
+void OOCMesher::updateGlobalClumps(const MeshComponents &components)
 {
-    std::size_t numVertices = nodes.size();
-
-    // Allocate clumps for the local components
-    clumpId.reserve(numVertices, false);
-    for (std::size_t i = 0; i < numVertices; i++)
+    const std::size_t numComponents = components.numComponents;
+    if (numComponents > std::size_t(std::numeric_limits<clump_id>::max()) - clumps.size())
     {
-        if (nodes[i].isRoot())
-        {
-            if (clumps.size() >= boost::make_unsigned<clump_id>::type(std::numeric_limits<clump_id>::max()))
-            {
-                /* Ideally this would throw, but it's called from a worker
-                 * thread and there is no easy way to immediately notify the
-                 * master thread that it should shut everything down.
-                 */
-                std::cerr << "There were too many connected components.\n";
-                std::exit(1);
-            }
-            clumpId[i] = clumps.size();
-            clumps.push_back(Clump(nodes[i].size()));
-        }
-    }
-
-    // Compute clump IDs for the non-root vertices
-    for (std::size_t i = 0; i < numVertices; i++)
-    {
-        std::tr1::int32_t r = UnionFind::findRoot(nodes, i);
-        clumpId[i] = clumpId[r];
+        /* Ideally this would throw, but it's called from a worker
+         * thread and there is no easy way to immediately notify the
+         * master thread that it should shut everything down.
+         */
+        std::cerr << "There were too many connected components.\n";
+        std::exit(1);
     }
 
-    // Compute triangle counts for the clumps
-    for (std::size_t i = 0; i < numTriangles; i++)
+    for (std::size_t i = 0; i < numComponents; i++)
     {
-        Clump &clump = clumps[clumpId[triangles[i][0]]];
-        clump.triangles++;
+        clumps.push_back(Clump(components.componentVertices[i]));
+        clumps.back().triangles = components.componentTriangles[i];
     }
 }
 
@@ -281,16 +369,17 @@ void OOCMesher::updateClumpKeyMap(
     std::size_t numVertices,
     std::size_t numExternalVertices,
     const cl_ulong *keys,
-    const Statistics::Container::PODBuffer<clump_id> &clumpId)
+    const MeshComponents &components,
+    clump_id clumpIdFirst)
 {
     const std::size_t numInternalVertices = numVertices - numExternalVertices;
 
     for (std::size_t i = 0; i < numExternalVertices; i++)
     {
         cl_ulong key = keys[i];
-        clump_id cid = clumpId[i + numInternalVertices];
+        clump_id cid = clumpIdFirst + components.vertexComponent[i + numInternalVertices];
 
-        std::pair<Statistics::Container::unordered_map<cl_ulong, clump_id>::const_iterator, bool> added;
+        std::pair<clump_id_map_type::iterator, bool> added;
         added = clumpIdMap.insert(std::make_pair(key, cid));
         if (!added.second)
         {
@@ -342,36 +431,14 @@ void OOCMesher::flushBuffer(Timeplot::Worker &tworker)
 
 void OOCMesher::updateLocalClumps(
     Chunk &chunk,
-    const Statistics::Container::PODBuffer<clump_id> &globalClumpId,
+    const MeshComponents &components,
     clump_id clumpIdFirst,
-    clump_id clumpIdLast,
     HostKeyMesh &mesh,
     Timeplot::Worker &tworker)
 {
     const std::size_t numVertices = mesh.numVertices();
     const std::size_t numInternalVertices = mesh.numInternalVertices();
-    const clump_id numClumps = clumpIdLast - clumpIdFirst;
-
-    tmpFirstVertex.reserve(numClumps, false);
-    std::fill(tmpFirstVertex.data(), tmpFirstVertex.data() + numClumps, -1);
-    tmpFirstTriangle.reserve(numClumps, false);
-    std::fill(tmpFirstTriangle.data(), tmpFirstTriangle.data() + numClumps, -1);
-    tmpNextVertex.reserve(numVertices, false);
-    tmpNextTriangle.reserve(mesh.numTriangles(), false);
-
-    for (std::tr1::int32_t i = (std::tr1::int32_t) numVertices - 1; i >= 0; i--)
-    {
-        clump_id cid = globalClumpId[i] - clumpIdFirst;
-        tmpNextVertex[i] = tmpFirstVertex[cid];
-        tmpFirstVertex[cid] = i;
-    }
-
-    for (std::tr1::int32_t i = (std::tr1::int32_t) mesh.numTriangles() - 1; i >= 0; i--)
-    {
-        clump_id cid = globalClumpId[mesh.triangles[i][0]] - clumpIdFirst;
-        tmpNextTriangle[i] = tmpFirstTriangle[cid];
-        tmpFirstTriangle[cid] = i;
-    }
+    const clump_id numClumps = components.numComponents;
 
     tmpVertexLabel.reserve(numVertices, false);
 
@@ -385,16 +452,16 @@ void OOCMesher::updateLocalClumps(
     if (!reorderBuffer)
         reorderBuffer = tmpWriter.get(tworker, 1);
 
-    for (clump_id gid = clumpIdFirst; gid < clumpIdLast; gid++)
+    for (clump_id cid = 0; cid < numClumps; cid++)
     {
-        clump_id cid = gid - clumpIdFirst;
+        const clump_id gid = clumpIdFirst + cid;
 
         // These count *emitted* vertices - which for external vertices can be less than
         // incoming ones due to sharing within the chunk.
         std::size_t clumpInternalVertices = 0;
         std::size_t clumpExternalVertices = 0;
         std::size_t clumpTriangles = 0;
-        for (std::tr1::int32_t vid = tmpFirstVertex[cid]; vid != -1; vid = tmpNextVertex[vid])
+        for (std::tr1::int32_t vid = components.firstVertex[cid]; vid != -1; vid = components.nextVertex[vid])
         {
             bool elide = false; // true if the vertex is elided due to sharing
             if (std::size_t(vid) >= numInternalVertices)
@@ -425,7 +492,7 @@ void OOCMesher::updateLocalClumps(
 
         // tmpVertexLabel now contains the intermediate encoded ID for each vertex.
         // Transform and emit the triangles using this mapping.
-        for (std::tr1::int32_t tid = tmpFirstTriangle[cid]; tid != -1; tid = tmpNextTriangle[tid])
+        for (std::tr1::int32_t tid = components.firstTriangle[cid]; tid != -1; tid = components.nextTriangle[tid])
         {
             triangle_type out;
             for (int j = 0; j < 3; j++)
@@ -444,8 +511,21 @@ void OOCMesher::updateLocalClumps(
     }
 }
 
+void OOCMesher::prepare(MesherWork &work, MeshComponents &components)
+{
+    HostKeyMesh &mesh = work.mesh;
+
+    if (work.hasEvents)
+        work.trianglesEvent.wait();
+    mesh.unpackTriangles();
+    components.compute(mesh.numVertices(), mesh.numTriangles(), mesh.triangles);
+    work.components = &components;
+}
+
 void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 {
+    if (work.chunkEnd)
+        return;
     if (work.chunkId.gen >= chunks.size())
         chunks.resize(work.chunkId.gen + 1);
     Chunk &chunk = chunks[work.chunkId.gen];
@@ -453,19 +533,21 @@ void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 
     HostKeyMesh &mesh = work.mesh;
 
-    if (work.hasEvents)
-        work.trianglesEvent.wait();
+    if (work.components == NULL)
+        prepare(work, tmpComponents);
+    const MeshComponents &components = *work.components;
     clump_id oldClumps = clumps.size();
-    computeLocalComponents(mesh.numVertices(), mesh.numTriangles(), mesh.triangles, tmpNodes);
-    updateGlobalClumps(mesh.numTriangles(), tmpNodes, mesh.triangles, tmpClumpId);
+    updateGlobalClumps(components);
 
     if (work.hasEvents)
         work.vertexKeysEvent.wait();
-    updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys, tmpClumpId);
+    updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys,
+                      components, oldClumps);
 
     if (work.hasEvents)
         work.verticesEvent.wait();
-    updateLocalClumps(chunk, tmpClumpId, oldClumps, clumps.size(), mesh, tworker);
+    mesh.unpackVertices();
+    updateLocalClumps(chunk, components, oldClumps, mesh, tworker);
 }
 
 MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
@@ -474,18 +556,44 @@ MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
     (void) pass;
     assert(pass == 0);
 
-    writtenVerticesTmp = 0;
-    writtenTrianglesTmp = 0;
-    tmpWriter.start();
+    if (resumedPass)
+    {
+        // Continue appending to the files restored by resumePass
+        tmpWriter.startAppend();
+        resumedPass = false;
+    }
+    else
+    {
+        writtenVerticesTmp = 0;
+        writtenTrianglesTmp = 0;
+        tmpWriter.setCompressed(getTmpCompression());
+        tmpWriter.start();
+    }
 
     return boost::bind(&OOCMesher::add, this, _1, _2);
 }
 
+MesherBase::PrepareFunctor OOCMesher::prepareFunctor(unsigned int pass) const
+{
+    (void) pass;
+    assert(pass == 0);
+    return &OOCMesher::prepare;
+}
+
+BinaryReader *OOCMesher::createTmpReader() const
+{
+    BinaryReader *reader = createReader(SYSCALL_READER);
+    if (tmpWriter.isCompressed())
+        reader = new BlockCompress::Reader(reader);
+    return reader;
+}
+
 void OOCMesher::finalize(Timeplot::Worker &tworker)
 {
     flushBuffer(tworker);
     if (tmpWriter.running())
         tmpWriter.stop();
+    UnionFind::flatten(clumps);
 }
 
 void OOCMesher::getStatistics(
@@ -550,7 +658,7 @@ void OOCMesher::getChunkStatistics(
     for (std::size_t j = 0; j < chunk.clumps.size(); j++)
     {
         const Chunk::Clump &cc = chunk.clumps[j];
-        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        clump_id cid = UnionFind::findRootConst(clumps, cc.globalId);
         if (clumps[cid].vertices >= thresholdVertices)
         {
             keptVertices += cc.numInternalVertices + cc.numExternalVertices;
@@ -585,7 +693,7 @@ std::size_t OOCMesher::getAsyncMem(std::tr1::uint64_t thresholdVertices) const
             }
         }
     }
-    return asyncMem;
+    return std::min(asyncMem, maxWriteBytes);
 }
 
 void OOCMesher::rewriteTriangles(
@@ -643,7 +751,7 @@ void OOCMesher::writeChunkPrepare(
     for (std::size_t j = 0; j < chunk.clumps.size(); j++)
     {
         const Chunk::Clump &cc = chunk.clumps[j];
-        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        clump_id cid = UnionFind::findRootConst(clumps, cc.globalId);
         startVertex[j] = writtenVertices;
         startTriangle[j] = writtenTriangles;
         if (clumps[cid].vertices >= thresholdVertices)
@@ -666,6 +774,7 @@ void OOCMesher::writeChunkPrepare(
 
 void OOCMesher::writeChunkVertices(
     Timeplot::Worker &tworker,
+    FastPly::Writer &writer,
     BinaryReader &verticesTmpRead,
     AsyncWriter &asyncWriter,
     const Chunk &chunk,
@@ -680,26 +789,28 @@ void OOCMesher::writeChunkVertices(
     for (std::size_t j = firstClump; j < lastClump; j++)
     {
         const Chunk::Clump &cc = chunk.clumps[j];
-        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        clump_id cid = UnionFind::findRootConst(clumps, cc.globalId);
         if (clumps[cid].vertices >= thresholdVertices)
         {
-            std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
-            /* This test catches a corner case where a clump
+            const std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            const std::size_t pieceVertices = maxWriteBytes / sizeof(vertex_type);
+            /* The loop test also catches a corner case where a clump
              * contains only triangles built from previously emitted
              * external vertices.
              */
-            if (numVertices > 0)
+            for (std::size_t first = 0; first < numVertices; first += pieceVertices)
             {
+                const std::size_t count = std::min(numVertices - first, pieceVertices);
                 boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
-                    tworker, numVertices * sizeof(vertex_type));
+                    tworker, count * sizeof(vertex_type));
                 {
                     Statistics::Timer timer(readVerticesStat);
                     verticesTmpRead.read(
                         item->get(),
-                        numVertices * sizeof(vertex_type),
-                        cc.firstVertex * sizeof(vertex_type));
+                        count * sizeof(vertex_type),
+                        (cc.firstVertex + first) * sizeof(vertex_type));
                 }
-                getWriter().writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
+                writer.writeVertices(tworker, startVertex[j] + first, count, item, asyncWriter);
             }
             // Yes, numTriangles. That's easier to make add up to the total
             // than vertices (which share), and still a good indicator
@@ -712,6 +823,7 @@ void OOCMesher::writeChunkVertices(
 
 void OOCMesher::writeChunkTriangles(
     Timeplot::Worker &tworker,
+    FastPly::Writer &writer,
     BinaryReader &trianglesTmpRead,
     AsyncWriter &asyncWriter,
     const Chunk &chunk,
@@ -732,48 +844,141 @@ void OOCMesher::writeChunkTriangles(
     for (std::size_t j = firstClump; j < lastClump; j++)
     {
         const Chunk::Clump &cc = chunk.clumps[j];
-        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        clump_id cid = UnionFind::findRootConst(clumps, cc.globalId);
         if (clumps[cid].vertices >= thresholdVertices)
         {
-            triangles.reserve(cc.numTriangles, false);
-            boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
-                tworker, cc.numTriangles * FastPly::Writer::triangleSize);
-            std::tr1::uint8_t *raw = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+            const std::size_t pieceTriangles = maxWriteBytes / FastPly::Writer::triangleSize;
+            triangles.reserve(std::min(std::size_t(cc.numTriangles), pieceTriangles), false);
+            for (std::size_t first = 0; first < cc.numTriangles; first += pieceTriangles)
             {
-                Statistics::Timer timer(readTrianglesStat);
-                trianglesTmpRead.read(
-                    triangles.data(),
-                    cc.numTriangles * sizeof(triangle_type),
-                    cc.firstTriangle * sizeof(triangle_type));
-            }
+                const std::size_t count = std::min(cc.numTriangles - first, pieceTriangles);
+                boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
+                    tworker, count * FastPly::Writer::triangleSize);
+                std::tr1::uint8_t *raw = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+                {
+                    Statistics::Timer timer(readTrianglesStat);
+                    trianglesTmpRead.read(
+                        triangles.data(),
+                        count * sizeof(triangle_type),
+                        (cc.firstTriangle + first) * sizeof(triangle_type));
+                }
 
-            rewriteTriangles(
-                cc.numTriangles,
-                externalBoundary, externalRemap,
-                startVertex[j],
-                triangles.data(), raw);
+                rewriteTriangles(
+                    count,
+                    externalBoundary, externalRemap,
+                    startVertex[j],
+                    triangles.data(), raw);
 
-            getWriter().writeTrianglesRaw(tworker, startTriangle[j], cc.numTriangles, item, asyncWriter);
+                writer.writeTrianglesRaw(tworker, startTriangle[j] + first, count, item, asyncWriter);
+            }
             if (progress != NULL)
                 *progress += cc.numTriangles;
         }
     }
 }
 
-std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+OOCMesher::ChunkBuffers::ChunkBuffers()
+    : externalRemap("mem.OOCMesher::externalRemap"),
+    startVertex("mem.OOCMesher::startVertex"),
+    startTriangle("mem.OOCMesher::startTriangle"),
+    triangles("mem.OOCMesher::triangles")
+{
+}
+
+void OOCMesher::writeChunks(int idx, WriteState &state)
 {
-    std::size_t outputFiles = 0;
+    Timeplot::Worker tworker("writer", idx);
+    thread_set_name("writer");
+
+    // Copies the handle factory and comments, but has its own file handle
+    FastPly::Writer writer(getWriter());
+    ChunkBuffers buffers;
+    std::string filename;
+
+    try
+    {
+        boost::scoped_ptr<BinaryReader> verticesTmpRead(createTmpReader());
+        verticesTmpRead->open(tmpWriter.getVerticesPath());
+        boost::scoped_ptr<BinaryReader> trianglesTmpRead(createTmpReader());
+        trianglesTmpRead->open(tmpWriter.getTrianglesPath());
+
+        while (true)
+        {
+            std::size_t i;
+            {
+                boost::lock_guard<boost::mutex> lock(state.mutex);
+                if (state.error || state.nextChunk >= chunks.size())
+                    break;
+                i = state.nextChunk++;
+            }
+
+            const Chunk &chunk = chunks[i];
+            std::tr1::uint64_t chunkVertices, chunkTriangles, chunkExternal;
+            // Note: chunkExternal includes discarded clumps, the others exclude them
+            getChunkStatistics(state.thresholdVertices, chunk, chunkVertices, chunkTriangles, chunkExternal);
+
+            if (chunkTriangles > 0)
+            {
+                filename = getOutputName(chunk.chunkId);
+                writer.setNumVertices(chunkVertices);
+                writer.setNumTriangles(chunkTriangles);
+                writer.open(filename);
+
+                writeChunkPrepare(
+                    chunk, state.thresholdVertices, chunkExternal,
+                    buffers.startVertex, buffers.startTriangle, buffers.externalRemap);
+
+                writeChunkVertices(
+                    tworker, writer, *verticesTmpRead, state.asyncWriter, chunk,
+                    state.thresholdVertices, buffers.startVertex.data(), state.progress,
+                    0, chunk.clumps.size());
+
+                writeChunkTriangles(
+                    tworker, writer, *trianglesTmpRead, state.asyncWriter, chunk,
+                    state.thresholdVertices, chunkExternal,
+                    buffers.startVertex.data(), buffers.startTriangle.data(),
+                    buffers.externalRemap.data(),
+                    buffers.triangles, state.progress,
+                    0, chunk.clumps.size());
+
+                writer.close();
+                filename.clear();
+
+                boost::lock_guard<boost::mutex> lock(state.mutex);
+                state.outputFiles++;
+            }
+        }
+    }
+    catch (std::ios::failure &e)
+    {
+        const int err = errno;
+        boost::exception_ptr error;
+        if (filename.empty())
+            error = boost::copy_exception(e);
+        else
+            error = boost::copy_exception(
+                boost::enable_error_info(e)
+                << boost::errinfo_file_name(filename)
+                << boost::errinfo_errno(err));
+        boost::lock_guard<boost::mutex> lock(state.mutex);
+        if (!state.error)
+            state.error = error;
+    }
+    catch (...)
+    {
+        boost::exception_ptr error = boost::current_exception();
+        boost::lock_guard<boost::mutex> lock(state.mutex);
+        if (!state.error)
+            state.error = error;
+    }
+}
 
+std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+{
     Timeplot::Action writeAction("write", tworker, "finalize.time");
-    FastPly::Writer &writer = getWriter();
 
     finalize(tworker);
 
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
-    verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
-    trianglesTmpRead->open(tmpWriter.getTrianglesPath());
-
     std::tr1::uint64_t thresholdVertices;
     clump_id keptComponents;
     std::tr1::uint64_t keptVertices, keptTriangles;
@@ -788,89 +993,276 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
         progress.reset(new ProgressDisplay(2 * keptTriangles, *progressStream));
     }
 
-    /* Maps from an linear enumeration of all external vertices of a chunk to
-     * the final index in the file. It is badIndex for dropped vertices,
-     * although that is not actually used and could be skipped. This is declared
-     * outside the loop purely to facilitate memory reuse.
+    const std::size_t numThreads = std::max(std::size_t(1), std::min(getWriteThreads(), chunks.size()));
+    /* Each thread has at most one allocation that has not yet been pushed,
+     * so one extra allocation is enough to allow writes to overlap.
      */
-    Statistics::Container::PODBuffer<std::tr1::uint32_t> externalRemap("mem.OOCMesher::externalRemap");
-    // Offset to first vertex of each clump in output file
-    Statistics::Container::PODBuffer<std::tr1::uint32_t> startVertex("mem.OOCMesher::startVertex");
-    // Offset to first triangle of each clump in output file
-    Statistics::Container::PODBuffer<FastPly::Writer::size_type> startTriangle("mem.OOCMesher::startTriangle");
-    Statistics::Container::PODBuffer<triangle_type> triangles("mem.OOCMesher::triangles");
-
-    AsyncWriter asyncWriter(1, asyncMem * 2); // * 2 to allow overlapping
+    AsyncWriter asyncWriter(numThreads, asyncMem * (numThreads + 1));
     asyncWriter.start();
 
-    for (std::size_t i = 0; i < chunks.size(); i++)
-    {
-        const Chunk &chunk = chunks[i];
-        std::tr1::uint64_t chunkVertices, chunkTriangles, chunkExternal;
-        // Note: chunkExternal includes discarded clumps, the others exclude them
-        getChunkStatistics(thresholdVertices, chunk, chunkVertices, chunkTriangles, chunkExternal);
+    WriteState state(thresholdVertices, asyncWriter, progress.get());
+    boost::thread_group threads;
+    for (std::size_t i = 0; i < numThreads; i++)
+        threads.create_thread(boost::bind(&OOCMesher::writeChunks, this, int(i), boost::ref(state)));
+    threads.join_all();
+    asyncWriter.stop();
 
-        if (chunkTriangles > 0)
-        {
-            const std::string filename = getOutputName(chunk.chunkId);
-            try
-            {
-                writer.setNumVertices(chunkVertices);
-                writer.setNumTriangles(chunkTriangles);
-                writer.open(filename);
-                outputFiles++;
+    if (state.error)
+        boost::rethrow_exception(state.error);
 
-                writeChunkPrepare(
-                    chunk, thresholdVertices, chunkExternal,
-                    startVertex, startTriangle, externalRemap);
+    Statistics::getStatistic<Statistics::Counter>("output.files").add(state.outputFiles);
+    return state.outputFiles;
+}
 
-                writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, startVertex.data(), progress.get(),
-                    0, chunk.clumps.size());
+namespace
+{
 
-                writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, chunkExternal,
-                    startVertex.data(), startTriangle.data(), externalRemap.data(),
-                    triangles, progress.get(),
-                    0, chunk.clumps.size());
+/**
+ * @name
+ * @{
+ * Records in binary checkpoints written by @ref OOCMesher. Each is a
+ * fixed-size POD with explicit padding, so that the layout does not depend on
+ * the compiler.
+ */
 
-                writer.close();
+/// Scalar state, stored as a section with a single record
+struct CheckpointState
+{
+    std::tr1::uint64_t writtenVerticesTmp;
+    std::tr1::uint64_t writtenTrianglesTmp;
+    std::tr1::uint64_t completeChunks;
+    std::tr1::uint64_t verticesBytes;     ///< Size of the vertices temporary file
+    std::tr1::uint64_t trianglesBytes;    ///< Size of the triangles temporary file
+    std::tr1::uint32_t compressed;        ///< Non-zero if the temporary files are compressed
+    std::tr1::uint32_t pad;
+};
+
+/// Size of a temporary file, or zero if it has not been created
+static std::tr1::uint64_t tmpFileSize(const boost::filesystem::path &path)
+{
+    return path.empty() ? 0 : boost::filesystem::file_size(path);
+}
+
+/// Record for @ref OOCMesher::Clump
+struct CheckpointClump
+{
+    std::tr1::int32_t encoded;   ///< @ref UnionFind::Node::encoded
+    std::tr1::uint32_t pad;
+    std::tr1::uint64_t vertices;
+    std::tr1::uint64_t triangles;
+};
+
+/// Record for @ref OOCMesher::Chunk, which owns a range of @ref CheckpointChunkClump records
+struct CheckpointChunk
+{
+    std::tr1::uint32_t gen;
+    std::tr1::uint32_t coords[3];
+    std::tr1::uint64_t numExternalVertices;
+    std::tr1::uint64_t firstClump;
+    std::tr1::uint64_t numClumps;
+};
+
+/// Record for @ref OOCMesher::Chunk::Clump
+struct CheckpointChunkClump
+{
+    std::tr1::uint64_t firstVertex;
+    std::tr1::uint64_t firstTriangle;
+    std::tr1::uint32_t numInternalVertices;
+    std::tr1::uint32_t numExternalVertices;
+    std::tr1::uint32_t numTriangles;
+    std::tr1::int32_t globalId;
+};
+
+/// Record for an entry of @ref OOCMesher::clumpIdMap
+struct CheckpointKey
+{
+    cl_ulong key;
+    std::tr1::int32_t clumpId;
+    std::tr1::uint32_t pad;
+};
+
+/** @} */
+
+/// Section indices in the checkpoint file
+enum CheckpointSection
+{
+    SECTION_STATE,
+    SECTION_VERTICES_PATH,
+    SECTION_TRIANGLES_PATH,
+    SECTION_CLUMPS,
+    SECTION_CHUNKS,
+    SECTION_CHUNK_CLUMPS,
+    SECTION_KEYS
+};
+
+} // anonymous namespace
+
+void OOCMesher::saveCheckpoint(const boost::filesystem::path &path, Checkpoint::Kind kind) const
+{
+    Statistics::Timer timer("checkpoint.save.time");
+    Checkpoint::Writer out(path, kind);
+
+    CheckpointState state;
+    state.writtenVerticesTmp = writtenVerticesTmp;
+    state.writtenTrianglesTmp = writtenTrianglesTmp;
+    state.completeChunks = chunks.size();
+    state.verticesBytes = tmpFileSize(tmpWriter.getVerticesPath());
+    state.trianglesBytes = tmpFileSize(tmpWriter.getTrianglesPath());
+    state.compressed = tmpWriter.isCompressed();
+    state.pad = 0;
+    out.addSection(&state, 1);
+
+    const std::string verticesPath = tmpWriter.getVerticesPath().string();
+    const std::string trianglesPath = tmpWriter.getTrianglesPath().string();
+    out.addSection(verticesPath.data(), verticesPath.size());
+    out.addSection(trianglesPath.data(), trianglesPath.size());
+
+    {
+        std::vector<CheckpointClump> records(clumps.size());
+        for (std::size_t i = 0; i < clumps.size(); i++)
+        {
+            records[i].encoded = clumps[i].encoded();
+            records[i].pad = 0;
+            records[i].vertices = clumps[i].vertices;
+            records[i].triangles = clumps[i].triangles;
+        }
+        out.addSection(records.empty() ? NULL : &records[0], records.size());
+    }
+
+    {
+        std::vector<CheckpointChunk> records(chunks.size());
+        std::vector<CheckpointChunkClump> chunkClumps;
+        for (std::size_t i = 0; i < chunks.size(); i++)
+        {
+            const Chunk &chunk = chunks[i];
+            MLSGPU_ASSERT(chunk.bufferedClumps.empty(), state_error);
+            records[i].gen = chunk.chunkId.gen;
+            for (int j = 0; j < 3; j++)
+                records[i].coords[j] = chunk.chunkId.coords[j];
+            records[i].numExternalVertices = chunk.numExternalVertices;
+            records[i].firstClump = chunkClumps.size();
+            records[i].numClumps = chunk.clumps.size();
+            BOOST_FOREACH(const Chunk::Clump &clump, chunk.clumps)
+            {
+                CheckpointChunkClump r;
+                r.firstVertex = clump.firstVertex;
+                r.firstTriangle = clump.firstTriangle;
+                r.numInternalVertices = clump.numInternalVertices;
+                r.numExternalVertices = clump.numExternalVertices;
+                r.numTriangles = clump.numTriangles;
+                r.globalId = clump.globalId;
+                chunkClumps.push_back(r);
             }
-            catch (std::ios::failure &e)
+        }
+        out.addSection(records.empty() ? NULL : &records[0], records.size());
+        out.addSection(chunkClumps.empty() ? NULL : &chunkClumps[0], chunkClumps.size());
+    }
+
+    {
+        // The key map is only needed to continue a pass
+        std::vector<CheckpointKey> records;
+        if (kind == Checkpoint::KIND_PASS)
+        {
+            records.reserve(clumpIdMap.size());
+            for (clump_id_map_type::const_iterator i = clumpIdMap.begin(); i != clumpIdMap.end(); ++i)
             {
-                throw boost::enable_error_info(e)
-                    << boost::errinfo_file_name(filename)
-                    << boost::errinfo_errno(errno);
+                CheckpointKey r;
+                r.key = i->first;
+                r.clumpId = i->second;
+                r.pad = 0;
+                records.push_back(r);
             }
         }
+        out.addSection(records.empty() ? NULL : &records[0], records.size());
     }
-    asyncWriter.stop();
-    Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
-    return outputFiles;
+
+    out.commit();
 }
 
-void OOCMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+ChunkId::gen_type OOCMesher::loadCheckpoint(const boost::filesystem::path &path, Checkpoint::Kind kind)
 {
-    retainFiles = true;
-    finalize(tworker);
+    Statistics::Timer timer("checkpoint.load.time");
+    Checkpoint::Reader in(path);
+    if (in.getKind() != kind)
+    {
+        if (kind == Checkpoint::KIND_FINAL)
+            throw std::runtime_error("Checkpoint was taken during a pass and cannot be used to write output");
+        else
+            throw std::runtime_error("Checkpoint was not taken during a pass");
+    }
 
-    try
+    std::size_t count;
+    const CheckpointState *state = in.section<CheckpointState>(SECTION_STATE, count);
+    if (count != 1)
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    writtenVerticesTmp = state->writtenVerticesTmp;
+    writtenTrianglesTmp = state->writtenTrianglesTmp;
+    const std::tr1::uint64_t completeChunks = state->completeChunks;
+    if (state->compressed && !BlockCompress::haveCodec())
+        throw std::runtime_error("Checkpoint has compressed temporary files, but compression is not supported");
+    tmpWriter.setCompressed(state->compressed != 0);
+    tmpVerticesBytes = state->verticesBytes;
+    tmpTrianglesBytes = state->trianglesBytes;
+
+    const char *verticesPath = in.section<char>(SECTION_VERTICES_PATH, count);
+    const std::string verticesStr(verticesPath, count);
+    const char *trianglesPath = in.section<char>(SECTION_TRIANGLES_PATH, count);
+    const std::string trianglesStr(trianglesPath, count);
+    tmpWriter.setPaths(verticesStr, trianglesStr);
+
+    const CheckpointClump *clumpRecords = in.section<CheckpointClump>(SECTION_CLUMPS, count);
+    clumps.clear();
+    clumps.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
     {
-        boost::filesystem::ofstream dump(path);
-        if (!dump)
-            throw std::ios::failure("Could not open file");
-        boost::archive::text_oarchive archive(dump);
-        archive << *this;
-        dump.close();
+        clumps.push_back(Clump(clumpRecords[i].vertices));
+        clumps.back().triangles = clumpRecords[i].triangles;
+        clumps.back().setEncoded(clumpRecords[i].encoded);
     }
-    catch (std::ios::failure &e)
+
+    std::size_t numChunkClumps;
+    const CheckpointChunk *chunkRecords = in.section<CheckpointChunk>(SECTION_CHUNKS, count);
+    const CheckpointChunkClump *chunkClumps = in.section<CheckpointChunkClump>(SECTION_CHUNK_CLUMPS, numChunkClumps);
+    if (count != completeChunks)
+        throw std::runtime_error("Checkpoint is truncated or corrupt");
+    chunks.clear();
+    chunks.resize(count);
+    for (std::size_t i = 0; i < count; i++)
     {
-        throw boost::enable_error_info(e)
-            << boost::errinfo_errno(errno)
-            << boost::errinfo_file_name(path.string());
+        const CheckpointChunk &r = chunkRecords[i];
+        Chunk &chunk = chunks[i];
+        if (r.firstClump > numChunkClumps || numChunkClumps - r.firstClump < r.numClumps)
+            throw std::runtime_error("Checkpoint is truncated or corrupt");
+        chunk.chunkId.gen = r.gen;
+        for (int j = 0; j < 3; j++)
+            chunk.chunkId.coords[j] = r.coords[j];
+        chunk.numExternalVertices = r.numExternalVertices;
+        chunk.clumps.reserve(r.numClumps);
+        for (std::size_t j = 0; j < r.numClumps; j++)
+        {
+            const CheckpointChunkClump &c = chunkClumps[r.firstClump + j];
+            if (c.globalId < 0 || std::size_t(c.globalId) >= clumps.size())
+                throw std::runtime_error("Checkpoint is truncated or corrupt");
+            chunk.clumps.push_back(Chunk::Clump(
+                    c.firstVertex, c.numInternalVertices, c.numExternalVertices,
+                    c.firstTriangle, c.numTriangles, c.globalId));
+        }
     }
+
+    const CheckpointKey *keys = in.section<CheckpointKey>(SECTION_KEYS, count);
+    clumpIdMap.clear();
+    clumpIdMap.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
+        clumpIdMap[keys[i].key] = keys[i].clumpId;
+
+    return completeChunks;
+}
+
+void OOCMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    retainFiles = true;
+    finalize(tworker);
+    saveCheckpoint(path, Checkpoint::KIND_FINAL);
 }
 
 std::size_t OOCMesher::resume(
@@ -879,22 +1271,228 @@ std::size_t OOCMesher::resume(
     std::ostream *progressStream)
 {
     retainFiles = true; // to allow resume to be re-run
-    try
+    loadCheckpoint(path, Checkpoint::KIND_FINAL);
+    return write(tworker, progressStream);
+}
+
+void OOCMesher::checkpointPass(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    Timeplot::Action timer("checkpoint", tworker, "checkpoint.time");
+
+    /* The temporary files must be complete up to the recorded lengths, so
+     * drain the writer (which closes the files) and reopen them afterwards.
+     */
+    retainFiles = true;
+    flushBuffer(tworker);
+    tmpWriter.stop();
+    saveCheckpoint(path, Checkpoint::KIND_PASS);
+    tmpWriter.startAppend();
+}
+
+ChunkId::gen_type OOCMesher::resumePass(Timeplot::Worker &tworker, const boost::filesystem::path &path)
+{
+    (void) tworker;
+    retainFiles = true; // to allow the resume to be re-run
+    ChunkId::gen_type completeChunks = loadCheckpoint(path, Checkpoint::KIND_PASS);
+
+    /* Anything written to the temporary files after the checkpoint belongs
+     * to chunks that will be regenerated, so discard it. The sizes are
+     * recorded in bytes rather than derived from the record counts, since the
+     * files may be compressed.
+     */
+    boost::filesystem::resize_file(tmpWriter.getVerticesPath(), tmpVerticesBytes);
+    boost::filesystem::resize_file(tmpWriter.getTrianglesPath(), tmpTrianglesBytes);
+    resumedPass = true;
+    return completeChunks;
+}
+
+StreamMesher::Chunk::Chunk()
+    : vertices("mem.StreamMesher::vertices"),
+    triangles("mem.StreamMesher::triangles"),
+    vertexIdMap("mem.StreamMesher::vertexIdMap")
+{
+}
+
+StreamMesher::StreamMesher(FastPly::Writer &writer, const Namer &namer)
+    : MesherBase(writer, namer),
+    pieceBytes(0),
+    chunkBytes(0),
+    chunkCapacity(std::numeric_limits<std::size_t>::max()),
+    tmpVertexLabel("mem.StreamMesher::tmpVertexLabel"),
+    outputFiles(0)
+{
+}
+
+StreamMesher::~StreamMesher()
+{
+    if (asyncWriter && asyncWriter->running())
+        asyncWriter->stop();
+}
+
+MesherBase::InputFunctor StreamMesher::functor(unsigned int pass)
+{
+    (void) pass;
+    assert(pass == 0);
+    MLSGPU_ASSERT(getPruneThreshold() == 0.0, state_error);
+
+    /* Writes are done in pieces of a quarter of the buffer, so that one
+     * piece can be filled while others are being written.
+     */
+    const std::size_t bufferSize = std::max(getReorderCapacity(), std::size_t(64 * 1024));
+    pieceBytes = bufferSize / 4;
+    asyncWriter.reset(new AsyncWriter(1, bufferSize));
+    asyncWriter->start();
+    chunks.clear();
+    chunkBytes = 0;
+    outputFiles = 0;
+    return boost::bind(&StreamMesher::add, this, _1, _2);
+}
+
+void StreamMesher::add(MesherWork &work, Timeplot::Worker &tworker)
+{
+    boost::ptr_map<ChunkId::gen_type, Chunk>::iterator pos = chunks.find(work.chunkId.gen);
+    if (work.chunkEnd)
     {
-        boost::filesystem::ifstream dump(path);
-        if (!dump)
-            throw std::ios::failure("Could not open file");
-        boost::archive::text_iarchive archive(dump);
-        archive >> *this;
-        dump.close();
+        if (pos != chunks.end())
+            flushChunk(tworker, pos);
+        return;
     }
-    catch (std::ios::failure &e)
+
+    HostKeyMesh &mesh = work.mesh;
+    const std::size_t numVertices = mesh.numVertices();
+    const std::size_t numInternalVertices = mesh.numInternalVertices();
+    const std::size_t numTriangles = mesh.numTriangles();
+    // Upper bound, since some external vertices may already be present
+    const std::size_t bytes = numVertices * sizeof(vertex_type) + numTriangles * sizeof(triangle_type);
+    if (bytes > chunkCapacity - chunkBytes)
+        throw std::runtime_error("Incomplete output chunks exceed the chunk buffer capacity");
+
+    if (pos == chunks.end())
     {
-        throw boost::enable_error_info(e)
-            << boost::errinfo_errno(errno)
-            << boost::errinfo_file_name(path.string());
+        ChunkId::gen_type gen = work.chunkId.gen;
+        pos = chunks.insert(gen, new Chunk).first;
+        pos->second->chunkId = work.chunkId;
     }
-    return write(tworker, progressStream);
+    Chunk &chunk = *pos->second;
+    if (numVertices > std::numeric_limits<std::tr1::uint32_t>::max() - chunk.vertices.size())
+        throw std::overflow_error("Too many vertices in one output chunk");
+
+    if (work.hasEvents)
+    {
+        work.verticesEvent.wait();
+        work.vertexKeysEvent.wait();
+        work.trianglesEvent.wait();
+    }
+    mesh.unpackVertices();
+    mesh.unpackTriangles();
+
+    Statistics::Timer timer("mesher.stream.add");
+    const std::size_t oldVertices = chunk.vertices.size();
+    tmpVertexLabel.reserve(numVertices, false);
+    for (std::size_t i = 0; i < numInternalVertices; i++)
+    {
+        tmpVertexLabel[i] = chunk.vertices.size();
+        chunk.vertices.push_back(mesh.vertices[i]);
+    }
+    for (std::size_t i = numInternalVertices; i < numVertices; i++)
+    {
+        std::pair<vertex_id_map_type::iterator, bool> added = chunk.vertexIdMap.insert(
+            std::make_pair(mesh.vertexKeys[i - numInternalVertices],
+                           std::tr1::uint32_t(chunk.vertices.size())));
+        if (added.second)
+            chunk.vertices.push_back(mesh.vertices[i]);
+        tmpVertexLabel[i] = added.first->second;
+    }
+
+    chunk.triangles.reserve(chunk.triangles.size() + numTriangles);
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        triangle_type t;
+        for (int j = 0; j < 3; j++)
+            t[j] = tmpVertexLabel[mesh.triangles[i][j]];
+        chunk.triangles.push_back(t);
+    }
+    chunkBytes += (chunk.vertices.size() - oldVertices) * sizeof(vertex_type)
+        + numTriangles * sizeof(triangle_type);
+}
+
+void StreamMesher::flushChunk(Timeplot::Worker &tworker, boost::ptr_map<ChunkId::gen_type, Chunk>::iterator pos)
+{
+    const Chunk &chunk = *pos->second;
+    const Statistics::Container::vector<vertex_type> &vertices = chunk.vertices;
+    const Statistics::Container::vector<triangle_type> &triangles = chunk.triangles;
+
+    if (!triangles.empty())
+    {
+        Timeplot::Action timer("write", tworker, "mesher.stream.write");
+        FastPly::Writer &writer = getWriter();
+        writer.setNumVertices(vertices.size());
+        writer.setNumTriangles(triangles.size());
+        writer.open(getOutputName(chunk.chunkId));
+
+        const std::size_t pieceVertices = std::max(pieceBytes / FastPly::Writer::vertexSize, std::size_t(1));
+        for (std::size_t first = 0; first < vertices.size(); first += pieceVertices)
+        {
+            const std::size_t count = std::min(pieceVertices, vertices.size() - first);
+            boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(tworker, count * FastPly::Writer::vertexSize);
+            std::memcpy(item->get(), &vertices[first], count * FastPly::Writer::vertexSize);
+            writer.writeVertices(tworker, first, count, item, *asyncWriter);
+        }
+
+        const std::size_t pieceTriangles = std::max(pieceBytes / FastPly::Writer::triangleSize, std::size_t(1));
+        for (std::size_t first = 0; first < triangles.size(); first += pieceTriangles)
+        {
+            const std::size_t count = std::min(pieceTriangles, triangles.size() - first);
+            boost::shared_ptr<AsyncWriterItem> item = asyncWriter->get(tworker, count * FastPly::Writer::triangleSize);
+            char *ptr = static_cast<char *>(item->get());
+            for (std::size_t i = 0; i < count; i++, ptr += FastPly::Writer::triangleSize)
+            {
+                *ptr = 3;
+                std::memcpy(ptr + 1, &triangles[first + i][0], 3 * sizeof(cl_uint));
+            }
+            writer.writeTrianglesRaw(tworker, first, count, item, *asyncWriter);
+        }
+
+        writer.close();
+        outputFiles++;
+    }
+
+    chunkBytes -= vertices.size() * sizeof(vertex_type) + triangles.size() * sizeof(triangle_type);
+    chunks.erase(pos);
+}
+
+std::size_t StreamMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
+{
+    (void) progressStream;
+    Timeplot::Action writeAction("write", tworker, "finalize.time");
+
+    while (!chunks.empty())
+        flushChunk(tworker, chunks.begin());
+    if (asyncWriter && asyncWriter->running())
+        asyncWriter->stop();
+
+    Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+    return outputFiles;
+}
+
+void StreamMesher::checkpoint(Timeplot::Worker &, const boost::filesystem::path &)
+{
+    throw std::runtime_error("Checkpointing is not supported by the streaming mesher");
+}
+
+std::size_t StreamMesher::resume(Timeplot::Worker &, const boost::filesystem::path &, std::ostream *)
+{
+    throw std::runtime_error("Checkpointing is not supported by the streaming mesher");
+}
+
+void StreamMesher::checkpointPass(Timeplot::Worker &, const boost::filesystem::path &)
+{
+    throw std::runtime_error("Checkpointing is not supported by the streaming mesher");
+}
+
+ChunkId::gen_type StreamMesher::resumePass(Timeplot::Worker &, const boost::filesystem::path &)
+{
+    throw std::runtime_error("Checkpointing is not supported by the streaming mesher");
 }
 
 namespace
@@ -41,6 +41,7 @@
 #include <string>
 #include <iosfwd>
 #include <utility>
+#include <stdexcept>
 #include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
@@ -56,6 +57,8 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/split_free.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/ptr_container/ptr_map.hpp>
 #include "tr1_unordered_map.h"
 #include "tr1_unordered_set.h"
 #include "marching.h"
@@ -69,6 +72,10 @@
 #include "circular_buffer.h"
 #include "chunk_id.h"
 #include "progress.h"
+#include "checkpoint.h"
+#include "flat_hash_map.h"
+#include "block_compress.h"
+#include "errors.h"
 
 class TestTmpWriterWorkerGroup;
 
@@ -111,7 +118,8 @@ inline void serialize(Archive &ar, boost::filesystem::path &path, const unsigned
  */
 enum MesherType
 {
-    OOC_MESHER
+    OOC_MESHER,
+    STREAM_MESHER
 };
 
 /**
@@ -124,6 +132,55 @@ public:
     static std::map<std::string, MesherType> getNameMap();
 };
 
+/**
+ * Connected components of a single mesh, computed without reference to any
+ * other mesh. Components are numbered in increasing order of their union-find
+ * roots. The vertices and triangles of each component are threaded into
+ * singly-linked lists, in increasing order and terminated by -1.
+ *
+ * The buffers are retained between calls to @ref compute, so an object should
+ * be reused (one per thread) rather than constructed per mesh.
+ */
+class MeshComponents : public boost::noncopyable
+{
+public:
+    std::size_t numComponents;     ///< Number of components found by @ref compute
+
+    /// Component index of each vertex
+    Statistics::Container::PODBuffer<std::tr1::int32_t> vertexComponent;
+    /// Number of vertices in each component
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> componentVertices;
+    /// Number of triangles in each component
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> componentTriangles;
+
+    /**
+     * @name
+     * @{
+     * Linked lists of the vertices and triangles in each component.
+     */
+    Statistics::Container::PODBuffer<std::tr1::int32_t> firstVertex;
+    Statistics::Container::PODBuffer<std::tr1::int32_t> nextVertex;
+    Statistics::Container::PODBuffer<std::tr1::int32_t> firstTriangle;
+    Statistics::Container::PODBuffer<std::tr1::int32_t> nextTriangle;
+    /** @} */
+
+    MeshComponents();
+
+    /**
+     * Labels the components of a mesh, replacing any previous contents.
+     *
+     * @param numVertices    Number of vertices indexed by @a triangles.
+     * @param numTriangles   Number of triangles in @a triangles.
+     * @param triangles      The vertex indices of the triangles.
+     */
+    void compute(std::size_t numVertices, std::size_t numTriangles,
+                 const boost::array<cl_uint, 3> *triangles);
+
+private:
+    /// Union-find tree over the vertices, used while computing
+    Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > nodes;
+};
+
 /**
  * Data about a mesh passed in to a @ref MesherBase::InputFunctor. It contains
  * host mesh data that may still be being read asynchronously from a device,
@@ -137,6 +194,22 @@ struct MesherWork
     cl::Event verticesEvent;       ///< Signaled when vertices may be read
     cl::Event vertexKeysEvent;     ///< Signaled when vertex keys may be read
     cl::Event trianglesEvent;      ///< Signaled when triangles may be read
+
+    /**
+     * Components of @ref mesh, if already computed by a @ref
+     * MesherBase::PrepareFunctor. In that case the triangles have also been
+     * unpacked. Otherwise this is @c NULL.
+     */
+    const MeshComponents *components;
+
+    /**
+     * If true, this carries no mesh, but indicates that no more meshes will
+     * arrive for @ref chunkId (see @ref ChunkTracker). Meshers that do not
+     * need this information ignore it.
+     */
+    bool chunkEnd;
+
+    MesherWork() : hasEvents(false), components(NULL), chunkEnd(false) {}
 };
 
 /**
@@ -197,7 +270,11 @@ public:
  * -# Call @ref write.
  *
  * @warning The functor is @em not required to be thread-safe. The caller must
- * serialize calls if necessary (@ref MesherGroup only uses one thread).
+ * serialize calls if necessary. A mesher may instead provide a @ref
+ * prepareFunctor, which is thread-safe, to do the part of the work that
+ * depends only on the individual mesh; @ref MesherGroup runs it concurrently
+ * and then calls the input functor serially, in the order the meshes were
+ * pushed.
  */
 class MesherBase
 {
@@ -209,6 +286,14 @@ public:
      */
     typedef boost::function<void(MesherWork &work, Timeplot::Worker &tworker)> InputFunctor;
 
+    /**
+     * Type returned by @ref prepareFunctor. It processes a mesh in isolation,
+     * storing the results in the provided @ref MeshComponents and setting
+     * @ref MesherWork::components to point at them. It must be thread-safe
+     * (provided that each thread uses a different @ref MeshComponents).
+     */
+    typedef boost::function<void(MesherWork &work, MeshComponents &components)> PrepareFunctor;
+
     /**
      * Function object that generates a filename from a chunk ID.
      */
@@ -227,7 +312,8 @@ public:
      * @param namer          Callback function to assign names to output files.
      */
     MesherBase(FastPly::Writer &writer, const Namer &namer)
-        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024), writer(writer), namer(namer) {}
+        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024), writeThreads(1), tmpCompression(false),
+        writer(writer), namer(namer) {}
 
     /// Virtual destructor to allow destruction via base class pointer
     virtual ~MesherBase() {}
@@ -250,12 +336,39 @@ public:
      */
     void setReorderCapacity(std::size_t bytes) { reorderCapacity = bytes; }
 
+    /**
+     * Sets the number of threads used by @ref write to emit separate output
+     * files concurrently, if supported by the mesher type. Each thread
+     * copies the writer passed to the constructor, so it must be safe to
+     * copy and to use the copies concurrently.
+     *
+     * @pre @a threads &gt; 0.
+     */
+    void setWriteThreads(std::size_t threads)
+    {
+        MLSGPU_ASSERT(threads > 0, std::invalid_argument);
+        writeThreads = threads;
+    }
+
+    /**
+     * Sets whether temporary files, if there are any, are compressed. This
+     * must be called before the first pass starts. It trades CPU time for
+     * temporary disk space and bandwidth.
+     */
+    void setTmpCompression(bool compress) { tmpCompression = compress; }
+
     /// Retrieve the value set with @ref setPruneThreshold.
     double getPruneThreshold() const { return pruneThreshold; }
 
     /// Retrieve the value set with @ref setReorderCapacity.
     std::size_t getReorderCapacity() const { return reorderCapacity; }
 
+    /// Retrieve the value set with @ref setWriteThreads.
+    std::size_t getWriteThreads() const { return writeThreads; }
+
+    /// Retrieve the value set with @ref setTmpCompression.
+    bool getTmpCompression() const { return tmpCompression; }
+
     /**
      * Retrieves a functor that will accept data in a specific pass.
      * Multi-pass classes may do finalization on a previous pass before
@@ -272,6 +385,18 @@ public:
      */
     virtual InputFunctor functor(unsigned int pass) = 0;
 
+    /**
+     * Retrieves a thread-safe functor that does per-mesh work in advance of
+     * the functor returned by @ref functor for the same pass. Using it is
+     * optional. The default returns an empty function, indicating that
+     * there is no such work.
+     */
+    virtual PrepareFunctor prepareFunctor(unsigned int pass) const
+    {
+        (void) pass;
+        return PrepareFunctor();
+    }
+
     /**
      * Instead of calling @ref write, one may instead call this function. It will
      * serialize the state necessary to complete the writing into @a path. Later
@@ -293,6 +418,30 @@ public:
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL) = 0;
 
+    /**
+     * Write an incremental checkpoint part-way through a pass, from which
+     * @ref resumePass can continue. It must only be called while the input
+     * functor is idle, and at a chunk boundary: every chunk that has been
+     * seen so far must be complete. The file at @a path is only replaced
+     * once the new checkpoint has been completely written.
+     *
+     * @param tworker         Timeplot worker for the current thread.
+     * @param path            File to write.
+     */
+    virtual void checkpointPass(Timeplot::Worker &tworker, const boost::filesystem::path &path) = 0;
+
+    /**
+     * Restore the state recorded by @ref checkpointPass on a newly
+     * constructed mesher. The pass must then be run again as usual, but
+     * skipping all input for the chunks that were already complete.
+     *
+     * @param tworker         Timeplot worker for the current thread.
+     * @param path            Checkpoint file written by @ref checkpointPass.
+     * @return The number of complete chunks. Input for chunks with a lower
+     * generation number must not be passed to the functor.
+     */
+    virtual ChunkId::gen_type resumePass(Timeplot::Worker &tworker, const boost::filesystem::path &path) = 0;
+
     /**
      * Performs any final file I/O.
      *
@@ -314,6 +463,10 @@ private:
     double pruneThreshold;
     /// Capacity set by @ref setReorderCapacity
     std::size_t reorderCapacity;
+    /// Thread count set by @ref setWriteThreads
+    std::size_t writeThreads;
+    /// Flag set by @ref setTmpCompression
+    bool tmpCompression;
 
     FastPly::Writer &writer;       ///< Writer for output files
     const Namer namer;             ///< Output file namer
@@ -358,6 +511,13 @@ public:
     typedef boost::array<float, 3> vertex_type;
     typedef boost::array<cl_uint, 3> triangle_type;
 
+    /**
+     * Largest single allocation made from the asynchronous writer when
+     * writing the output. Larger clumps are written in several pieces, so
+     * that the writer's memory is independent of the data.
+     */
+    static const std::size_t maxWriteBytes;
+
 protected:
     static const int reorderSlots;
 
@@ -430,7 +590,7 @@ protected:
             }
         };
 
-        typedef Statistics::Container::unordered_map<cl_ulong, std::tr1::uint32_t> vertex_id_map_type;
+        typedef FlatHashMap<std::tr1::uint32_t> vertex_id_map_type;
 
         /// ID for this chunk, used to generate the filename
         ChunkId chunkId;
@@ -544,6 +704,10 @@ protected:
         TmpWriterWorkerGroup &owner;   ///< Owning worker group
         std::ostream &verticesFile;    ///< File for temporary vertices
         std::ostream &trianglesFile;   ///< File for temporary triangles
+
+        /// Write to @a file, or through @a compressor if it is non-NULL
+        static void write(std::ostream &file, BlockCompress::Writer *compressor,
+                          const void *data, std::size_t bytes);
     public:
         TmpWriterWorker(TmpWriterWorkerGroup &owner, std::ostream &verticesFile, std::ostream &trianglesFile)
             : WorkerBase("tmpwriter", 0),
@@ -558,11 +722,16 @@ protected:
      * files when the group is stopped.
      *
      * Errors while writing the temporary files immediately terminate the program.
+     *
+     * If compression is enabled with @ref setCompressed, the files are written
+     * with @ref BlockCompress::Writer and must be read back with @ref
+     * BlockCompress::Reader.
      */
     class TmpWriterWorkerGroup : public WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>
     {
         friend class ::TestTmpWriterWorkerGroup;
         friend class boost::serialization::access;
+        friend class TmpWriterWorker;
     private:
         /// File to which vertices are written
         boost::filesystem::ofstream verticesFile;
@@ -573,6 +742,16 @@ protected:
         /// Filename for @ref trianglesFile
         boost::filesystem::path trianglesPath;
 
+        /// Whether the files are compressed
+        bool compress;
+        /// Compressor for @ref verticesFile, if @ref compress is set and the group is running
+        boost::scoped_ptr<BlockCompress::Writer> verticesCompressor;
+        /// Compressor for @ref trianglesFile, if @ref compress is set and the group is running
+        boost::scoped_ptr<BlockCompress::Writer> trianglesCompressor;
+
+        /// Create the compressors if required, once the files are open
+        void startCompressors();
+
         /// Allocator for items
         CircularBufferBase itemAllocator;
         /// Backing store of items
@@ -583,6 +762,7 @@ protected:
         {
             ar & verticesPath;
             ar & trianglesPath;
+            ar & compress;
         }
     public:
         /**
@@ -607,6 +787,29 @@ protected:
 
         void freeItem(boost::shared_ptr<TmpWriterItem> item);
 
+        /**
+         * Start the group, appending to the temporary files named by @ref
+         * setPaths rather than creating new ones.
+         */
+        void startAppend();
+
+        /**
+         * Set the paths to existing temporary files, when restoring from a
+         * checkpoint. The files are not opened until @ref startAppend.
+         */
+        void setPaths(const boost::filesystem::path &vertices, const boost::filesystem::path &triangles);
+
+        /**
+         * Set whether the temporary files are compressed. It only takes
+         * effect the next time the group is started.
+         *
+         * @pre @ref BlockCompress::haveCodec() returns true, if @a compress is true.
+         */
+        void setCompressed(bool compress);
+
+        /// Retrieve the value set with @ref setCompressed.
+        bool isCompressed() const { return compress; }
+
         /**
          * Get the path to the temporary file for vertices. If @ref start has
          * not been called this will return an empty path.
@@ -630,13 +833,8 @@ private:
      * These are stored in the object so that memory can be recycled if
      * possible, rather than thrashing the allocator.
      */
-    Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > tmpNodes;
-    Statistics::Container::PODBuffer<clump_id> tmpClumpId;
+    MeshComponents tmpComponents;  ///< Used for meshes that were not prepared
     Statistics::Container::PODBuffer<std::tr1::uint32_t> tmpVertexLabel;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpFirstVertex;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpNextVertex;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpFirstTriangle;
-    Statistics::Container::PODBuffer<std::tr1::int32_t> tmpNextTriangle;
     /** @} */
 
     /// Total number of vertices written to temporary file
@@ -644,6 +842,16 @@ private:
     /// Total number of triangles written to temporary file
     std::tr1::uint64_t writtenTrianglesTmp;
 
+    /**
+     * @name
+     * @{
+     * Sizes in bytes of the temporary files recorded in a checkpoint, set by
+     * @ref loadCheckpoint.
+     */
+    std::tr1::uint64_t tmpVerticesBytes;
+    std::tr1::uint64_t tmpTrianglesBytes;
+    /** @} */
+
     /**
      * Reorder buffer. Initially only the vertices and triangles are placed
      * here. During @ref flushBuffer, the ranges to write are filled in from
@@ -657,75 +865,56 @@ private:
 
     Statistics::Container::vector<Clump> clumps;  ///< All clumps seen so far
 
-    typedef Statistics::Container::unordered_map<cl_ulong, clump_id> clump_id_map_type;
+    /**
+     * Maps external vertex keys to global clump IDs. Vertex keys only use 63
+     * bits (see @ref Marching::KEY_AXIS_BITS), so they never collide with
+     * @ref FlatHashMap::EMPTY_KEY.
+     */
+    typedef FlatHashMap<clump_id> clump_id_map_type;
     /// Maps external vertex keys to global clump IDs
     clump_id_map_type clumpIdMap;
 
     /**
-     * Identifies components with a local set of triangles, and
-     * returns a union-find tree for them.
+     * Create global clumps from the local components of a mesh. The clumps are
+     * populated with the appropriate vertex and triangle counts, but are not
+     * merged together using shared external vertices. The clumps are
+     * allocated contiguously, in the same order as the components.
      *
-     * @param numVertices    Number of vertices indexed by @a triangles.
-     *                       Also the size of the returned union-find tree.
-     * @param numTriangles   Number of triangles in @a triangles.
-     * @param triangles      The vertex indices of the triangles.
-     * @param[out] nodes     A union-find tree over the vertices.
+     * @param components     Local components of the mesh.
      */
-    static void computeLocalComponents(
-        std::size_t numVertices,
-        std::size_t numTriangles,
-        const triangle_type *triangles,
-        Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes);
-
-    /**
-     * Create global clumps from local union-find tree. The clumps are populated
-     * with the appropriate vertex and triangle counts, but are not merged together
-     * using shared external vertices.
-     *
-     * @param numTriangles   Number of triangles in @a triangles.
-     * @param nodes          Union-find tree over the block vertices (see @ref computeLocalComponents).
-     * @param triangles      Triangles in the block.
-     * @param[out] clumpId   Clump IDs, one per vertex passed in.
-     */
-    void updateGlobalClumps(
-        std::size_t numTriangles,
-        const Statistics::Container::vector<UnionFind::Node<std::tr1::int32_t> > &nodes,
-        const triangle_type *triangles,
-        Statistics::Container::PODBuffer<clump_id> &clumpId);
+    void updateGlobalClumps(const MeshComponents &components);
 
     /**
      * Update @ref clumpIdMap and merge global clumps that share external vertices.
      *
-     * @param numVertices    Total number of vertices in @a clumpId
+     * @param numVertices    Total number of vertices in the mesh
      * @param numExternalVertices Number of external vertices in @a keys
      * @param keys           Vertex keys in the mesh.
-     * @param clumpId        Vertex clump IDs computed by @ref updateGlobalClumps.
-     *
-     * Note that the internal vertices in @a clumpId are ignored, but must still be present.
+     * @param components     Local components of the mesh.
+     * @param clumpIdFirst   Global clump ID allocated to the first component by @ref updateGlobalClumps.
      */
     void updateClumpKeyMap(
         std::size_t numVertices,
         std::size_t numExternalVertices,
         const cl_ulong *keys,
-        const Statistics::Container::PODBuffer<clump_id> &clumpId);
+        const MeshComponents &components,
+        clump_id clumpIdFirst);
 
     /**
      * Populate the per-chunk clump data and write the geometry to external
      * memory. This also does chunk-level welding to update @ref Chunk::vertexIdMap.
      *
      * @param chunk          The chunk to update.
-     * @param globalClumpId  The clump IDs generated by @ref updateGlobalClumps
-     * @param clumpIdFirst   Smallest value in @a globalClumpId
-     * @param clumpIdLast    One greater than largest value in @a globalClumpId
+     * @param components     Local components of the mesh.
+     * @param clumpIdFirst   Global clump ID allocated to the first component by @ref updateGlobalClumps.
      * @param mesh           The original data. All fields (vertices, triangles and keys)
      *                       must have finished loading.
      * @param tworker        Timeplot worker for recording interactions with the writer worker group
      */
     void updateLocalClumps(
         Chunk &chunk,
-        const Statistics::Container::PODBuffer<clump_id> &globalClumpId,
+        const MeshComponents &components,
         clump_id clumpIdFirst,
-        clump_id clumpIdLast,
         HostKeyMesh &mesh,
         Timeplot::Worker &tworker);
 
@@ -737,6 +926,30 @@ private:
     /// Implementation of the functor
     void add(MesherWork &work, Timeplot::Worker &worker);
 
+    /**
+     * Implementation of the prepare functor. This waits for the triangles,
+     * unpacks them and computes the local components.
+     */
+    static void prepare(MesherWork &work, MeshComponents &components);
+
+    /**
+     * Write the state to a binary checkpoint. For @ref Checkpoint::KIND_PASS
+     * this includes @ref clumpIdMap, which is needed to continue the pass;
+     * otherwise it holds just enough data that @ref write can be run on the
+     * reconstituted structure.
+     *
+     * @pre The temporary files are closed.
+     */
+    void saveCheckpoint(const boost::filesystem::path &path, Checkpoint::Kind kind) const;
+
+    /**
+     * Restore the state written by @ref saveCheckpoint.
+     *
+     * @return The number of complete chunks recorded in the checkpoint.
+     * @throw std::runtime_error if the checkpoint is corrupt or not of kind @a kind.
+     */
+    ChunkId::gen_type loadCheckpoint(const boost::filesystem::path &path, Checkpoint::Kind kind);
+
     /**
      * Serialize just enough data that @ref write can be run on the reconstituted structure
      */
@@ -752,6 +965,12 @@ protected:
     /// If set to true, will not delete the temporary files
     bool retainFiles;
 
+    /**
+     * Set by @ref resumePass, so that @ref functor appends to the restored
+     * temporary files instead of creating new ones.
+     */
+    bool resumedPass;
+
     /// Writer for temporary data
     TmpWriterWorkerGroup tmpWriter;
 
@@ -763,10 +982,18 @@ protected:
     Statistics::Container::vector<Chunk> chunks;
 
     /**
-     * Flush out any temporary data to the temporary file writer then shut it down
+     * Flush out any temporary data to the temporary file writer then shut it
+     * down. This also compresses all paths in @ref clumps, after which the
+     * read-only functions that take a threshold are safe to call concurrently.
      */
     void finalize(Timeplot::Worker &tworker);
 
+    /**
+     * Create a reader that is suitable for the temporary files, taking
+     * compression into account. The caller must free it.
+     */
+    BinaryReader *createTmpReader() const;
+
     /**
      * Compute the number of components, vertices and triangles retained overall,
      * and update statistics. If @a record is true (the default), the statistics
@@ -809,7 +1036,8 @@ protected:
 
     /**
      * Compute minimum number of bytes needed for the async writer. This is
-     * only called after all the geometry has been received.
+     * only called after all the geometry has been received. It never
+     * exceeds @ref maxWriteBytes.
      *
      * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
      */
@@ -858,6 +1086,7 @@ protected:
      * Transfer clumps from the vertices temporary file to the output file.
      *
      * @param tworker           Worker to pass to @ref AsyncWriter::get
+     * @param writer            Writer for the output file, which must be open
      * @param verticesTmpRead   Reader for the vertices temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
      * @param chunk             Output chunk to write
@@ -873,6 +1102,7 @@ protected:
      */
     void writeChunkVertices(
         Timeplot::Worker &tworker,
+        FastPly::Writer &writer,
         BinaryReader &verticesTmpRead,
         AsyncWriter &asyncWriter,
         const Chunk &chunk,
@@ -885,6 +1115,7 @@ protected:
      * Transfer clumps from the triangles temporary file to the output file.
      *
      * @param tworker           Worker to pass to @ref AsyncWriter::get
+     * @param writer            Writer for the output file, which must be open
      * @param trianglesTmpRead  Reader for the triangles temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
      * @param chunk             Output chunk to write
@@ -904,6 +1135,7 @@ protected:
      */
     void writeChunkTriangles(
         Timeplot::Worker &tworker,
+        FastPly::Writer &writer,
         BinaryReader &trianglesTmpRead,
         AsyncWriter &asyncWriter,
         const Chunk &chunk,
@@ -916,6 +1148,60 @@ protected:
         ProgressMeter *progress,
         std::size_t firstClump, std::size_t lastClump);
 
+    /**
+     * Buffers used to write a single output chunk. They are retained between
+     * chunks purely to facilitate memory reuse.
+     */
+    struct ChunkBuffers
+    {
+        /**
+         * Maps from an linear enumeration of all external vertices of a chunk
+         * to the final index in the file (see @ref writeChunkPrepare).
+         */
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> externalRemap;
+        /// Offset to first vertex of each clump in output file
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> startVertex;
+        /// Offset to first triangle of each clump in output file
+        Statistics::Container::PODBuffer<FastPly::Writer::size_type> startTriangle;
+        /// Triangles read back from the temporary file
+        Statistics::Container::PODBuffer<triangle_type> triangles;
+
+        ChunkBuffers();
+    };
+
+    /**
+     * State shared between the threads of @ref write.
+     */
+    struct WriteState
+    {
+        boost::mutex mutex;                   ///< Mutex protecting the mutable fields
+        std::size_t nextChunk;                ///< Index of the next chunk to claim
+        std::size_t outputFiles;              ///< Number of files written so far
+        boost::exception_ptr error;           ///< First exception thrown by any thread
+
+        const std::tr1::uint64_t thresholdVertices; ///< See @ref getStatistics
+        AsyncWriter &asyncWriter;             ///< Asynchronous writer shared by all threads
+        ProgressMeter *progress;              ///< Progress meter (may be @c NULL)
+
+        WriteState(std::tr1::uint64_t thresholdVertices, AsyncWriter &asyncWriter, ProgressMeter *progress)
+            : nextChunk(0), outputFiles(0),
+            thresholdVertices(thresholdVertices), asyncWriter(asyncWriter), progress(progress) {}
+    };
+
+    /**
+     * Thread function for @ref write. It repeatedly claims the next chunk
+     * from @a state and writes it, using its own copy of the writer, its
+     * own readers for the temporary files and its own @ref ChunkBuffers. If
+     * an exception is thrown, it is recorded in @a state and all the threads
+     * stop claiming chunks.
+     *
+     * @param idx               Index of the thread, used to name it.
+     * @param state             State shared with the other threads.
+     *
+     * @pre @ref finalize has been called.
+     */
+    void writeChunks(int idx, WriteState &state);
+
 public:
     /**
      * @copydoc MesherBase::MesherBase
@@ -926,10 +1212,129 @@ public:
 
     virtual unsigned int numPasses() const { return 1; }
     virtual InputFunctor functor(unsigned int pass);
+    virtual PrepareFunctor prepareFunctor(unsigned int pass) const;
+    virtual std::size_t write(Timeplot::Worker &tworker, std::ostream *progressStream = NULL);
+    virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+    virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                               std::ostream *progressStream = NULL);
+    virtual void checkpointPass(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+    virtual ChunkId::gen_type resumePass(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+};
+
+/**
+ * Mesher class that writes each output file as soon as its chunk is
+ * complete, without any temporary files. It does not support pruning of
+ * small components, which requires global knowledge of the mesh, nor
+ * checkpointing.
+ *
+ * External vertices are welded within the chunk as each mesh arrives, and
+ * the chunk is buffered in memory until a @ref MesherWork::chunkEnd notice
+ * arrives for it (or @ref write is called), at which point it is handed to
+ * an asynchronous writer. Meshes for different chunks may be interleaved, so
+ * the caller does not need to drain a parallel pipeline at chunk boundaries.
+ * Memory use is thus proportional to the size of the incomplete chunks,
+ * rather than the whole output, and is limited by @ref setChunkCapacity.
+ */
+class StreamMesher : public MesherBase
+{
+public:
+    typedef boost::array<float, 3> vertex_type;
+    typedef boost::array<cl_uint, 3> triangle_type;
+
+    /**
+     * @copydoc MesherBase::MesherBase
+     */
+    StreamMesher(FastPly::Writer &writer, const Namer &namer);
+
+    ~StreamMesher();
+
+    /**
+     * Sets the maximum number of bytes of vertices and triangles to hold for
+     * incomplete chunks. If input would exceed it, the functor throws @c
+     * std::runtime_error.
+     */
+    void setChunkCapacity(std::size_t bytes) { chunkCapacity = bytes; }
+
+    /// Retrieve the value set with @ref setChunkCapacity.
+    std::size_t getChunkCapacity() const { return chunkCapacity; }
+
+    virtual unsigned int numPasses() const { return 1; }
+
+    /**
+     * @copydoc MesherBase::functor
+     *
+     * The returned functor writes each chunk once its @ref
+     * MesherWork::chunkEnd notice is seen. The buffer for the asynchronous
+     * writes is sized by @ref setReorderCapacity.
+     *
+     * @pre The prune threshold is zero.
+     */
+    virtual InputFunctor functor(unsigned int pass);
     virtual std::size_t write(Timeplot::Worker &tworker, std::ostream *progressStream = NULL);
+
+    /**
+     * Not supported.
+     * @throw std::runtime_error always.
+     */
     virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+
+    /**
+     * Not supported.
+     * @throw std::runtime_error always.
+     */
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL);
+
+    /**
+     * Not supported.
+     * @throw std::runtime_error always.
+     */
+    virtual void checkpointPass(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+
+    /**
+     * Not supported.
+     * @throw std::runtime_error always.
+     */
+    virtual ChunkId::gen_type resumePass(Timeplot::Worker &tworker, const boost::filesystem::path &path);
+
+private:
+    typedef FlatHashMap<std::tr1::uint32_t> vertex_id_map_type;
+
+    /// Buffered data for an incomplete chunk
+    struct Chunk
+    {
+        ChunkId chunkId;
+        /// Vertices, in output order
+        Statistics::Container::vector<vertex_type> vertices;
+        /// Triangles, indexing @ref vertices
+        Statistics::Container::vector<triangle_type> triangles;
+        /// Maps external vertex keys to indices in @ref vertices
+        vertex_id_map_type vertexIdMap;
+
+        Chunk();
+    };
+
+    /// Writer for completed chunks (constructed by @ref functor)
+    boost::scoped_ptr<AsyncWriter> asyncWriter;
+    /// Maximum bytes to pass to @ref asyncWriter in one item
+    std::size_t pieceBytes;
+
+    /// Incomplete chunks, indexed by generation
+    boost::ptr_map<ChunkId::gen_type, Chunk> chunks;
+    /// Bytes of vertices and triangles held in @ref chunks
+    std::size_t chunkBytes;
+    /// Limit set by @ref setChunkCapacity
+    std::size_t chunkCapacity;
+    /// Temporary mapping from mesh vertex indices to indices in @ref Chunk::vertices
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> tmpVertexLabel;
+    /// Number of output files written so far
+    std::size_t outputFiles;
+
+    /// Implementation of the functor
+    void add(MesherWork &work, Timeplot::Worker &tworker);
+
+    /// Write out a chunk and remove it from @ref chunks
+    void flushChunk(Timeplot::Worker &tworker, boost::ptr_map<ChunkId::gen_type, Chunk>::iterator pos);
 };
 
 /**
@@ -81,9 +81,9 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
         archive >> *this;
     }
 
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
+    boost::scoped_ptr<BinaryReader> verticesTmpRead(createTmpReader());
     verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
+    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createTmpReader());
     trianglesTmpRead->open(tmpWriter.getTrianglesPath());
 
     std::tr1::uint64_t thresholdVertices;
@@ -185,12 +185,12 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
                 }
 
                 writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
+                    tworker, writer, *verticesTmpRead, asyncWriter, chunk,
                     thresholdVertices, startVertex.data(), progress.get(),
                     first, last);
 
                 writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
+                    tworker, writer, *trianglesTmpRead, asyncWriter, chunk,
                     thresholdVertices, chunkExternal,
                     startVertex.data(), startTriangle.data(), externalRemap.data(),
                     triangles, progress.get(),
@@ -0,0 +1,409 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref Metrics.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if HAVE_SOCKET && HAVE_BIND && HAVE_LISTEN && HAVE_ACCEPT && HAVE_POLL
+# define METRICS_HTTP 1
+#else
+# define METRICS_HTTP 0
+#endif
+
+#include <string>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+#include <cerrno>
+#include <ctime>
+#include <boost/thread/locks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/exception/all.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#if METRICS_HTTP
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+#include "metrics.h"
+#include "statistics.h"
+#include "thread_name.h"
+#include "logging.h"
+#include "errors.h"
+
+namespace Metrics
+{
+
+namespace
+{
+
+/// Registered gauges, indexed by name
+class GaugeRegistry : public boost::noncopyable
+{
+public:
+    boost::mutex mutex;
+    std::map<std::string, Gauge::Function> gauges;
+
+    static GaugeRegistry &getInstance()
+    {
+        static GaugeRegistry instance;
+        return instance;
+    }
+};
+
+/// Convert a statistic name to a legal Prometheus metric name
+static std::string prometheusName(const std::string &name)
+{
+    std::string ans = "mlsgpu_";
+    for (std::string::const_iterator i = name.begin(); i != name.end(); ++i)
+        ans += (std::isalnum((unsigned char) *i) || *i == '_') ? *i : '_';
+    return ans;
+}
+
+/// Quote a string for JSON
+static std::string jsonString(const std::string &s)
+{
+    std::string ans = "\"";
+    for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+    {
+        if (*i == '"' || *i == '\\')
+            ans += '\\';
+        if ((unsigned char) *i < 0x20)
+            ans += ' ';
+        else
+            ans += *i;
+    }
+    return ans + '"';
+}
+
+/// Functor for @ref Statistics::Registry::forEach that writes Prometheus text
+class PrometheusWriter
+{
+private:
+    std::ostream *o;
+
+public:
+    explicit PrometheusWriter(std::ostream &o) : o(&o) {}
+
+    void operator()(const Statistics::Statistic &stat) const
+    {
+        const std::string name = prometheusName(stat.getName());
+        if (const Statistics::Counter *c = dynamic_cast<const Statistics::Counter *>(&stat))
+        {
+            *o << "# TYPE " << name << "_total counter\n"
+                << name << "_total " << c->getTotal() << '\n';
+        }
+        else if (const Statistics::Variable *v = dynamic_cast<const Statistics::Variable *>(&stat))
+        {
+            const unsigned long long n = v->getNumSamples();
+            *o << "# TYPE " << name << " summary\n"
+                << name << "_count " << n << '\n'
+                << name << "_sum " << (n > 0 ? v->getMean() * n : 0.0) << '\n';
+        }
+        else if (const Statistics::Peak *p = dynamic_cast<const Statistics::Peak *>(&stat))
+        {
+            *o << "# TYPE " << name << " gauge\n"
+                << name << ' ' << p->get() << '\n'
+                << "# TYPE " << name << "_max gauge\n"
+                << name << "_max " << p->getMax() << '\n';
+        }
+    }
+};
+
+/// Functor for @ref Statistics::Registry::forEach that writes JSON members
+class JsonWriter
+{
+private:
+    std::ostream *o;
+    bool *first;
+
+public:
+    JsonWriter(std::ostream &o, bool &first) : o(&o), first(&first) {}
+
+    void operator()(const Statistics::Statistic &stat) const
+    {
+        std::ostringstream value;
+        value.precision(o->precision());
+        if (const Statistics::Counter *c = dynamic_cast<const Statistics::Counter *>(&stat))
+            value << "{\"type\": \"counter\", \"total\": " << c->getTotal() << '}';
+        else if (const Statistics::Variable *v = dynamic_cast<const Statistics::Variable *>(&stat))
+        {
+            const unsigned long long n = v->getNumSamples();
+            value << "{\"type\": \"variable\", \"samples\": " << n;
+            if (n > 0)
+                value << ", \"mean\": " << v->getMean();
+            if (n > 1)
+                value << ", \"stddev\": " << v->getStddev();
+            value << '}';
+        }
+        else if (const Statistics::Peak *p = dynamic_cast<const Statistics::Peak *>(&stat))
+            value << "{\"type\": \"peak\", \"current\": " << p->get() << ", \"max\": " << p->getMax() << '}';
+        else
+            return;
+
+        *o << (*first ? "\n    " : ",\n    ") << jsonString(stat.getName()) << ": " << value.str();
+        *first = false;
+    }
+};
+
+} // anonymous namespace
+
+Gauge::Gauge(const std::string &name, const Function &function)
+{
+    GaugeRegistry &registry = GaugeRegistry::getInstance();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    this->name = name;
+    for (unsigned int i = 1; registry.gauges.count(this->name); i++)
+        this->name = name + "." + boost::lexical_cast<std::string>(i);
+    registry.gauges[this->name] = function;
+}
+
+Gauge::~Gauge()
+{
+    GaugeRegistry &registry = GaugeRegistry::getInstance();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    registry.gauges.erase(name);
+}
+
+void writePrometheus(std::ostream &o)
+{
+    o.precision(12);
+    Statistics::Registry::getInstance().forEach(PrometheusWriter(o));
+
+    GaugeRegistry &registry = GaugeRegistry::getInstance();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    for (std::map<std::string, Gauge::Function>::const_iterator i = registry.gauges.begin();
+         i != registry.gauges.end(); ++i)
+    {
+        const std::string name = prometheusName(i->first);
+        o << "# TYPE " << name << " gauge\n"
+            << name << ' ' << i->second() << '\n';
+    }
+}
+
+void writeJson(std::ostream &o)
+{
+    o.precision(12);
+    o << "{\n  \"time\": " << (unsigned long long) std::time(NULL) << ",\n  \"statistics\": {";
+    bool first = true;
+    Statistics::Registry::getInstance().forEach(JsonWriter(o, first));
+    o << "\n  },\n  \"gauges\": {";
+
+    GaugeRegistry &registry = GaugeRegistry::getInstance();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    first = true;
+    for (std::map<std::string, Gauge::Function>::const_iterator i = registry.gauges.begin();
+         i != registry.gauges.end(); ++i)
+    {
+        o << (first ? "\n    " : ",\n    ") << jsonString(i->first) << ": " << i->second();
+        first = false;
+    }
+    o << "\n  }\n}\n";
+}
+
+Exporter::Exporter() : stopping(false), listenFd(-1), snapshotInterval(0.0)
+{
+}
+
+Exporter::~Exporter()
+{
+    stop();
+}
+
+bool Exporter::haveHttp()
+{
+    return METRICS_HTTP;
+}
+
+void Exporter::listen(int port)
+{
+    MLSGPU_ASSERT(listenFd == -1, state_error);
+#if METRICS_HTTP
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw boost::enable_error_info(std::runtime_error("Could not create metrics socket"))
+            << boost::errinfo_errno(errno);
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+        || ::listen(fd, 4) != 0)
+    {
+        int err = errno;
+        close(fd);
+        throw boost::enable_error_info(std::runtime_error(
+                "Could not listen on metrics port " + boost::lexical_cast<std::string>(port)))
+            << boost::errinfo_errno(err);
+    }
+    listenFd = fd;
+    httpThread = boost::thread(&Exporter::runHttp, this);
+#else
+    (void) port;
+    throw std::runtime_error("Serving metrics over HTTP is not supported by this build");
+#endif
+}
+
+void Exporter::snapshot(const std::string &filename, double interval)
+{
+    MLSGPU_ASSERT(snapshotFile.empty(), state_error);
+    MLSGPU_ASSERT(interval > 0.0, std::invalid_argument);
+    snapshotFile = filename;
+    snapshotInterval = interval;
+    snapshotThread = boost::thread(&Exporter::runSnapshot, this);
+}
+
+void Exporter::stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+        stopCondition.notify_all();
+    }
+    if (httpThread.joinable())
+        httpThread.join();
+    if (snapshotThread.joinable())
+        snapshotThread.join();
+#if METRICS_HTTP
+    if (listenFd != -1)
+    {
+        close(listenFd);
+        listenFd = -1;
+    }
+#endif
+}
+
+void Exporter::runHttp()
+{
+#if METRICS_HTTP
+    thread_set_name("metrics.http");
+    while (true)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (stopping)
+                break;
+        }
+
+        pollfd p;
+        p.fd = listenFd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        /* The request is not parsed: every request gets the metrics. Wait
+         * briefly for it to arrive so that the client does not see a reset.
+         */
+        char request[4096];
+        p.fd = fd;
+        if (poll(&p, 1, 1000) > 0)
+        {
+            ssize_t ignored = recv(fd, request, sizeof(request), 0);
+            (void) ignored;
+        }
+
+        std::ostringstream body;
+        writePrometheus(body);
+        const std::string payload = body.str();
+        std::ostringstream response;
+        response << "HTTP/1.0 200 OK\r\n"
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Content-Length: " << payload.size() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << payload;
+        const std::string out = response.str();
+        std::size_t sent = 0;
+        while (sent < out.size())
+        {
+#ifdef MSG_NOSIGNAL
+            ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+#else
+            ssize_t n = send(fd, out.data() + sent, out.size() - sent, 0);
+#endif
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        close(fd);
+    }
+#endif
+}
+
+void Exporter::writeSnapshot()
+{
+    const boost::filesystem::path path(snapshotFile);
+    const boost::filesystem::path tmp(snapshotFile + ".tmp");
+    try
+    {
+        {
+            boost::filesystem::ofstream out(tmp);
+            writeJson(out);
+            out.close();
+            if (!out)
+                throw std::ios::failure("Could not write metrics snapshot");
+        }
+        boost::filesystem::rename(tmp, path);
+    }
+    catch (std::exception &e)
+    {
+        // Monitoring must not bring down the run
+        Log::log[Log::warn] << "Warning: could not write metrics to " << snapshotFile
+            << ": " << e.what() << '\n';
+    }
+}
+
+void Exporter::runSnapshot()
+{
+    thread_set_name("metrics.file");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        lock.unlock();
+        writeSnapshot();
+        lock.lock();
+        if (!stopping)
+            stopCondition.timed_wait(lock, boost::posix_time::microseconds(
+                    (long long) (snapshotInterval * 1e6)));
+    }
+    lock.unlock();
+    writeSnapshot();
+}
+
+} // namespace Metrics
@@ -0,0 +1,138 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Live export of the statistics registry while a run is in progress.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <ostream>
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * Snapshots of @ref Statistics::Registry and of live values that are not
+ * statistics (such as queue depths), which can be served over HTTP in the
+ * Prometheus text format or written periodically to a JSON file.
+ */
+namespace Metrics
+{
+
+/**
+ * A named value that is sampled each time metrics are exported. The value
+ * is registered for the lifetime of the object, so it should be declared
+ * after the members that the function reads.
+ *
+ * If the name is already taken, a numeric suffix is appended to make it
+ * unique.
+ *
+ * The function is called from the exporting thread, so it must be
+ * thread-safe and should not block for long.
+ */
+class Gauge : public boost::noncopyable
+{
+public:
+    typedef boost::function<double()> Function;
+
+    Gauge(const std::string &name, const Function &function);
+    ~Gauge();
+
+    /// The name under which the gauge is exported, including any suffix
+    const std::string &getName() const { return name; }
+
+private:
+    std::string name;
+};
+
+/**
+ * Write all statistics and gauges in the Prometheus text exposition format.
+ * Names are prefixed with @c mlsgpu_ and characters that are not legal in
+ * Prometheus names are replaced by underscores.
+ */
+void writePrometheus(std::ostream &o);
+
+/**
+ * Write all statistics and gauges as a JSON object.
+ */
+void writeJson(std::ostream &o);
+
+/**
+ * Background threads that export metrics. Each kind of export is started
+ * separately, and all are stopped by @ref stop or the destructor.
+ */
+class Exporter : public boost::noncopyable
+{
+public:
+    Exporter();
+    ~Exporter();
+
+    /// Whether this build can serve HTTP (i.e., has POSIX sockets)
+    static bool haveHttp();
+
+    /**
+     * Serve @ref writePrometheus on every HTTP request to
+     * <code>127.0.0.1:</code>@a port.
+     *
+     * @throw std::runtime_error if the port could not be bound or HTTP is not supported.
+     */
+    void listen(int port);
+
+    /**
+     * Replace @a filename with the output of @ref writeJson every
+     * @a interval seconds. The file is written under a temporary name and
+     * then renamed, so readers never see a partial snapshot.
+     */
+    void snapshot(const std::string &filename, double interval);
+
+    /// Stop all threads, writing a final snapshot if one was requested
+    void stop();
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable stopCondition;
+    bool stopping;
+
+    boost::thread httpThread;
+    int listenFd;                   ///< Listening socket, or -1
+
+    boost::thread snapshotThread;
+    std::string snapshotFile;
+    double snapshotInterval;
+
+    void runHttp();
+    void runSnapshot();
+    void writeSnapshot();
+};
+
+} // namespace Metrics
+
+#endif /* !METRICS_H */
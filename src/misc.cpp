@@ -38,6 +38,12 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/exception/all.hpp>
+#if HAVE_SYSCONF
+# include <unistd.h>
+#endif
+#if _WIN32
+# include <windows.h>
+#endif
 
 static boost::filesystem::path tmpFileDir;
 
@@ -94,3 +100,19 @@ void setTmpFileDir(const boost::filesystem::path &path)
 {
     tmpFileDir = path;
 }
+
+std::tr1::uint64_t getPhysicalMemory()
+{
+#if _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return status.ullTotalPhys;
+#elif HAVE_SYSCONF && defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+        return std::tr1::uint64_t(pages) * pageSize;
+#endif
+    return 0;
+}
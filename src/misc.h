@@ -211,4 +211,10 @@ void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &o
  */
 void setTmpFileDir(const boost::filesystem::path &tmpFileDir);
 
+/**
+ * Return the amount of physical memory in the machine, in bytes, or 0 if it
+ * cannot be determined.
+ */
+std::tr1::uint64_t getPhysicalMemory();
+
 #endif /* MLSGPU_MISC_H */
@@ -35,12 +35,14 @@
 #include <CL/cl.hpp>
 #include <stdexcept>
 #include <algorithm>
+#include <vector>
 #include <boost/math/constants/constants.hpp>
 #include "errors.h"
 #include "mls.h"
 #include "clh.h"
 #include "misc.h"
 #include "statistics.h"
+#include "tr1_cstdint.h"
 
 std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
 {
@@ -53,8 +55,13 @@ std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
 const Grid::size_type MlsFunctor::wgs[3] = {8, 8, 8};
 const int MlsFunctor::subsamplingMin = 3; // must be at least log2 of highest wgs
 
-MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape)
-    : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time"))
+const cl_uint MlsFunctor::zero = 0;
+
+MlsFunctor::MlsFunctor(
+    const cl::Context &context, MlsShape shape,
+    Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth)
+    : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time")),
+    findBlocksTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.findBlocks.time"))
 {
     // These would ideally be static assertions, but C++ doesn't allow that
     MLSGPU_ASSERT((1U << subsamplingMin) >= *std::max_element(wgs, wgs + 3), std::length_error);
@@ -68,6 +75,16 @@ MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape)
 
     cl::Program program = CLH::build(context, "kernels/mls.cl", defines);
     kernel = cl::Kernel(program, "processCorners");
+    findBlocksKernel = cl::Kernel(program, "findBlocks");
+
+    // If this section is modified, remember to update resourceUsage below
+    maxBlocks = divUp(maxWidth, wgs[0]) * divUp(maxHeight, wgs[1]) * divUp(maxDepth, wgs[2]);
+    blocks = cl::Buffer(context, CL_MEM_READ_WRITE, maxBlocks * sizeof(cl_uint));
+    numBlocks = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    findBlocksKernel.setArg(1, blocks);
+    findBlocksKernel.setArg(2, numBlocks);
+    kernel.setArg(10, blocks);
+    kernel.setArg(11, numBlocks);
 
     setBoundaryLimit(1.0f);
 }
@@ -76,21 +93,29 @@ void MlsFunctor::set(const Grid::difference_type offset[3],
                      const cl::Buffer &splats,
                      const cl::Buffer &commands,
                      const cl::Buffer &start,
-                     unsigned int subsamplingShift)
+                     unsigned int subsamplingShift,
+                     std::size_t startBase)
 {
     cl_int3 offset3 = {{ offset[0], offset[1], offset[2] }};
 
     kernel.setArg(1, splats);
     kernel.setArg(2, commands);
     kernel.setArg(3, start);
-    kernel.setArg(4, 3 * subsamplingShift);
-    kernel.setArg(5, offset3);
+    kernel.setArg(4, cl_uint(startBase));
+    kernel.setArg(5, 3 * subsamplingShift);
+    kernel.setArg(6, offset3);
+
+    findBlocksKernel.setArg(3, start);
+    findBlocksKernel.setArg(4, cl_uint(startBase));
+    findBlocksKernel.setArg(5, 3 * subsamplingShift);
 }
 
 void MlsFunctor::set(const Grid::difference_type offset[3],
-                     const SplatTreeCL &tree, unsigned int subsamplingShift)
+                     const SplatTreeCL &tree, unsigned int subsamplingShift,
+                     std::size_t batchIndex)
 {
-    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift);
+    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift,
+        tree.getStartOffset(batchIndex));
 }
 
 const Grid::size_type *MlsFunctor::alignment() const
@@ -98,6 +123,17 @@ const Grid::size_type *MlsFunctor::alignment() const
     return wgs;
 }
 
+CLH::ResourceUsage MlsFunctor::resourceUsage(
+    Grid::size_type width, Grid::size_type height, Grid::size_type depth)
+{
+    const std::tr1::uint64_t maxBlocks =
+        std::tr1::uint64_t(divUp(width, wgs[0])) * divUp(height, wgs[1]) * divUp(depth, wgs[2]);
+    CLH::ResourceUsage ans;
+    ans.addBuffer("blocks", maxBlocks * sizeof(cl_uint));
+    ans.addBuffer("numBlocks", sizeof(cl_uint));
+    return ans;
+}
+
 void MlsFunctor::enqueue(
     const cl::CommandQueue &queue,
     const cl::Image2D &distance,
@@ -114,24 +150,43 @@ void MlsFunctor::enqueue(
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_WIDTH>() >= width, std::length_error);
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_HEIGHT>() >= swathe.zStride * (swathe.zLast + 1) + swathe.zBias, std::length_error);
 
-    kernel.setArg(0, distance);
-    kernel.setArg(6, cl_uint(swathe.zStride));
-    kernel.setArg(7, cl_int(swathe.zBias));
-
     const std::size_t wgs3 = wgs[0] * wgs[1] * wgs[2];
-    const std::size_t blocks[3] =
+    const std::size_t dims[3] =
     {
         width / wgs[0],
         height / wgs[1],
         divUp(swathe.zLast - swathe.zFirst + 1, wgs[2])
     };
-
+    const std::size_t swatheBlocks = dims[0] * dims[1] * dims[2];
+    MLSGPU_ASSERT(swatheBlocks <= maxBlocks, std::length_error);
+
+    findBlocksKernel.setArg(0, distance);
+    findBlocksKernel.setArg(6, cl_uint(swathe.zStride));
+    findBlocksKernel.setArg(7, cl_int(swathe.zBias));
+
+    cl::Event zeroEvent, findEvent;
+    std::vector<cl::Event> wait(1);
+    queue.enqueueWriteBuffer(numBlocks, CL_FALSE, 0, sizeof(cl_uint), &zero,
+                             events, &zeroEvent);
+    wait[0] = zeroEvent;
     CLH::enqueueNDRangeKernel(queue,
-                              kernel,
+                              findBlocksKernel,
                               cl::NDRange(0, 0, swathe.zFirst),
-                              cl::NDRange(wgs3 * blocks[0], blocks[1], blocks[2]),
+                              cl::NDRange(wgs3 * dims[0], dims[1], dims[2]),
                               cl::NDRange(wgs3, 1, 1),
-                              events, event, &kernelTime);
+                              &wait, &findEvent, &findBlocksTime);
+    wait[0] = findEvent;
+
+    kernel.setArg(0, distance);
+    kernel.setArg(7, cl_uint(swathe.zStride));
+    kernel.setArg(8, cl_int(swathe.zBias));
+
+    CLH::enqueueNDRangeKernel(queue,
+                              kernel,
+                              cl::NullRange,
+                              cl::NDRange(wgs3 * swatheBlocks),
+                              cl::NDRange(wgs3),
+                              &wait, event, &kernelTime);
 }
 
 void MlsFunctor::setBoundaryLimit(float limit)
@@ -140,5 +195,5 @@ void MlsFunctor::setBoundaryLimit(float limit)
     // uniform distribution of samples and a straight boundary
     const float boundaryScale = (sqrt(6.0f) * 512) / (693 * boost::math::constants::pi<float>());
     const float gamma = boundaryScale * limit;
-    kernel.setArg(8, 1.0f - gamma * gamma);
+    kernel.setArg(9, 1.0f - gamma * gamma);
 }
@@ -86,11 +86,44 @@ private:
      */
     cl::Kernel kernel;
 
+    /**
+     * Kernel generated from @ref findBlocks.
+     */
+    cl::Kernel findBlocksKernel;
+
+    /**
+     * List of occupied blocks found by @ref findBlocksKernel. It is
+     * allocated for the largest swathe passed to the constructor.
+     */
+    cl::Buffer blocks;
+
+    /**
+     * Capacity of @ref blocks, in elements.
+     */
+    std::size_t maxBlocks;
+
+    /**
+     * Number of elements in @ref blocks written by @ref findBlocksKernel.
+     * It stays on the device and is read by @ref kernel.
+     */
+    cl::Buffer numBlocks;
+
+    /**
+     * Source for zeroing @ref numBlocks. It is never modified, so it can
+     * be used in non-blocking writes.
+     */
+    static const cl_uint zero;
+
     /**
      * Measures device time spent in @ref kernel.
      */
     Statistics::Variable &kernelTime;
 
+    /**
+     * Measures device time spent in @ref findBlocksKernel.
+     */
+    Statistics::Variable &findBlocksTime;
+
     /**
      * Specify the parameters. This is a private variant that
      * does not require the buffers to be stored in a @ref SplatTreeCL, and
@@ -100,7 +133,8 @@ private:
              const cl::Buffer &splats,
              const cl::Buffer &commands,
              const cl::Buffer &start,
-             unsigned int subsamplingShift);
+             unsigned int subsamplingShift,
+             std::size_t startBase = 0);
 public:
     /**
      * Work group size for @ref kernel.
@@ -116,8 +150,11 @@ public:
      * Constructor. It compiles the kernel, so it can throw a compilation error.
      * @param context   The context in which the function operates.
      * @param shape     The shape to fit to the data.
+     * @param maxWidth, maxHeight Maximum swathe dimensions, before rounding up to @ref wgs.
+     * @param maxDepth  Maximum number of slices in a swathe.
      */
-    MlsFunctor(const cl::Context &context, MlsShape shape);
+    MlsFunctor(const cl::Context &context, MlsShape shape,
+               Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth);
 
     /**
      * Specify the parameters. This must be called before using this object as a functor.
@@ -129,18 +166,38 @@ public:
      * @param offset           Offset between world coordinates and region-relative coordinates.
      * @param tree             Octree containing input splats.
      * @param subsamplingShift Subsampling shift passed when building @a tree.
+     * @param batchIndex       Index of the octree to use if @a tree was built
+     *                         with @ref SplatTreeCL::enqueueBuildBatch.
      *
      * @pre
      * - @a tree was constructed with the same @a offset and @a subsamplingShift.
      */
     void set(const Grid::difference_type offset[3],
-             const SplatTreeCL &tree, unsigned int subsamplingShift);
+             const SplatTreeCL &tree, unsigned int subsamplingShift,
+             std::size_t batchIndex = 0);
 
     virtual const Grid::size_type *alignment() const;
 
     /**
+     * Estimates the device resources needed for the list of occupied blocks.
+     *
+     * @param width, height  Maximum swathe dimensions, before rounding up to @ref wgs.
+     * @param depth          Maximum number of slices in a swathe.
+     */
+    static CLH::ResourceUsage resourceUsage(
+        Grid::size_type width, Grid::size_type height, Grid::size_type depth);
+
+    /**
+     * Computes the signed distance function for a swathe. This is done in two
+     * passes: the first identifies the blocks of @ref wgs corners that are
+     * touched by some octree cell and writes NaN to the rest, and the second
+     * runs the full MLS fit over just the occupied blocks. The second pass is
+     * launched for every block and reads the number of occupied blocks on the
+     * device, so this function does not block.
+     *
      * @pre The tree passed to @ref set was constructed with dimensions at least
      * equal to @a size rounded up to multiples of @ref wgs.
+     * @pre The swathe is no larger than the maximum passed to the constructor.
      */
     virtual void enqueue(
         const cl::CommandQueue &queue,
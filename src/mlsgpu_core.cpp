@@ -40,6 +40,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/ref.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <memory>
 #include <string>
 #include <iterator>
@@ -49,6 +50,7 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <limits>
 #include "mlsgpu_core.h"
@@ -67,6 +69,9 @@
 #include "bucket.h"
 #include "splat_set.h"
 #include "decache.h"
+#include "synthetic.h"
+#include "block_compress.h"
+#include "misc.h"
 
 namespace po = boost::program_options;
 
@@ -99,7 +104,11 @@ static void addStatisticsOptions(po::options_description &opts)
         (Option::statistics,                          "Print information about internal statistics")
         (Option::statisticsFile, po::value<std::string>(), "Direct statistics to file instead of stdout (implies --statistics)")
         (Option::statisticsCL,                             "Collect timings for OpenCL commands")
-        (Option::timeplot, po::value<std::string>(),       "Write timing data to file");
+        (Option::timeplot, po::value<std::string>(),       "Write timing data to file")
+        (Option::timeplotBinary,                           "Write timing data in compact binary form")
+        (Option::metricsPort, po::value<int>(),            "Serve live statistics in Prometheus format on this localhost port")
+        (Option::metricsFile, po::value<std::string>(),    "Periodically write live statistics to file as JSON")
+        (Option::metricsInterval, po::value<double>()->default_value(5.0), "Seconds between writes to --metrics-file");
     opts.add(statistics);
 }
 
@@ -109,9 +118,19 @@ static void addAdvancedOptions(po::options_description &opts)
     advanced.add_options()
         (Option::levels,       po::value<int>()->default_value(6), "Levels in octree")
         (Option::subsampling,  po::value<int>()->default_value(3), "Subsampling of octree")
+        (Option::subsamplingModel, po::value<std::string>(), "Choose subsampling per bucket, refining the model in this file")
+        (Option::halfDistance, "Store the signed distance function in half precision")
+        (Option::packMesh,     "Quantise meshes on the device to reduce transfer sizes")
+        (Option::overlapSwathes, "Overlap marching cubes swathes (uses more device memory)")
+        (Option::deviceWeld,   "Weld adjacent buckets of the same chunk on the device")
+        (Option::decimate,     po::value<int>()->default_value(0), "Simplify the mesh by merging vertices in cubes of this many cells (0 to disable)")
         (Option::maxSplit,     po::value<int>()->default_value(1024 * 1024 * 1024), "Maximum fan-out in partitioning")
         (Option::leafCells,    po::value<int>()->default_value(63), "Leaf size for initial histogram")
         (Option::deviceThreads, po::value<int>()->default_value(1), "Number of threads per device for submitting OpenCL work")
+        (Option::mesherThreads, po::value<int>()->default_value(1), "Number of threads for labelling mesh components")
+        (Option::writeThreads, po::value<int>()->default_value(1), "Number of output files to write concurrently")
+        (Option::tmpCompress,  "Compress temporary files")
+        (Option::mesher,       po::value<Choice<MesherTypeWrapper> >(), "Mesher class (ooc | stream); the default depends on other options")
         (Option::reader,       po::value<Choice<ReaderTypeWrapper> >()->default_value(SYSCALL_READER), "File reader class (syscall | stream | mmap)")
         (Option::writer,       po::value<Choice<WriterTypeWrapper> >()->default_value(SYSCALL_WRITER), "File writer class (syscall | stream)")
 #ifdef _OPENMP
@@ -119,6 +138,7 @@ static void addAdvancedOptions(po::options_description &opts)
 #endif
         (Option::decache,      "Try to evict input files from OS cache for benchmarking")
         (Option::checkpoint,   po::value<std::string>(), "Checkpoint state prior to writing output")
+        (Option::checkpointInterval, po::value<double>()->default_value(0.0), "Also checkpoint during the pass, every this many seconds (0 to disable)")
         (Option::resume,       po::value<std::string>(), "Restart from checkpoint");
     opts.add(advanced);
 }
@@ -131,7 +151,8 @@ static void addMemoryOptions(po::options_description &opts, bool isMPI)
         (Option::memHostSplats,   po::value<Capacity>()->default_value(512 * 1024 * 1024), "Memory for splats on the CPU")
         (Option::memBucketSplats, po::value<Capacity>()->default_value(64 * 1024 * 1024),  "Memory for splats in a single bucket")
         (Option::memMesh,         po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for raw mesh data on the CPU")
-        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU");
+        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU")
+        (Option::memTotal,        po::value<Capacity>(),   "Total CPU memory budget, used to choose values for the other --mem-* options");
     if (isMPI)
         memory.add_options()
             (Option::memGather,   po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for buffering raw mesh data on the slaves");
@@ -377,6 +398,11 @@ static std::size_t getMeshHostMemory(const po::variables_map &vm)
     return getMeshMemoryCells(vm) * scale;
 }
 
+static cl_channel_type getDistanceType(const po::variables_map &vm)
+{
+    return vm.count(Option::halfDistance) ? CL_HALF_FLOAT : CL_FLOAT;
+}
+
 static std::size_t getMaxHostSplats(const po::variables_map &vm)
 {
     std::size_t mem = vm[Option::memHostSplats].as<Capacity>();
@@ -395,18 +421,45 @@ static std::size_t getMaxBucketSplats(const po::variables_map &vm)
     return mem / sizeof(Splat);
 }
 
-void validateOptions(const po::variables_map &vm, bool isMPI)
+/**
+ * Host memory held by the asynchronous writer while the output is written.
+ * Each write thread may hold one allocation that has not yet been pushed,
+ * plus one more to let the writes overlap.
+ */
+static std::tr1::uint64_t getWriteMemory(const po::variables_map &vm)
+{
+    return std::tr1::uint64_t(vm[Option::writeThreads].as<int>() + 1) * OOCMesher::maxWriteBytes;
+}
+
+/// Total host memory implied by the --mem-* options and the output buffers
+static std::tr1::uint64_t getHostMemory(const po::variables_map &vm, bool isMPI)
+{
+    std::tr1::uint64_t total = 0;
+    total += vm[Option::memLoadSplats].as<Capacity>();
+    total += vm[Option::memHostSplats].as<Capacity>();
+    total += vm[Option::memMesh].as<Capacity>();
+    total += vm[Option::memReorder].as<Capacity>();
+    if (isMPI)
+        total += vm[Option::memGather].as<Capacity>();
+    total += getWriteMemory(vm);
+    // Whole output chunks buffered by StreamMesher, up to --mem-mesh. The
+    // streaming mesher is only chosen automatically for a single device.
+    if (!isMPI && getMesherType(vm, 1) == STREAM_MESHER)
+        total += vm[Option::memMesh].as<Capacity>();
+    return total;
+}
+
+/**
+ * Range-checks the options that determine buffer sizes, so that @ref
+ * resourceUsage and the memory budget can safely be computed from them.
+ *
+ * @throw invalid_option if any of them is out of range.
+ */
+static void validateSizeOptions(const po::variables_map &vm)
 {
     const int levels = vm[Option::levels].as<int>();
     const int subsampling = vm[Option::subsampling].as<int>();
-    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
-    const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
-    const std::size_t maxHostSplats = getMaxHostSplats(vm);
     const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
-    const int deviceThreads = vm[Option::deviceThreads].as<int>();
-    const double pruneThreshold = vm[Option::fitPrune].as<double>();
-
-    const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
 
     int maxLevels = std::min(
             std::size_t(Marching::MAX_DIMENSION_LOG2 + 1),
@@ -423,14 +476,6 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
         msg << "Value of --subsampling must be at least " << MlsFunctor::subsamplingMin;
         throw invalid_option(msg.str());
     }
-    if (maxBucketSplats < 1)
-        throw invalid_option(std::string("Value of --") + Option::memBucketSplats + " must be positive");
-    if (maxLoadSplats < maxBucketSplats)
-        throw invalid_option(std::string("Value of --") + Option::memLoadSplats
-                             + " must be at least that of --" + Option::memBucketSplats);
-    if (maxHostSplats < maxBucketSplats)
-        throw invalid_option(std::string("Value of --") + Option::memHostSplats
-                             + " must be at least that of --" + Option::memBucketSplats);
     if (maxSplit < 8)
         throw invalid_option(std::string("Value of --") + Option::maxSplit + " must be at least 8");
     if (subsampling > Marching::MAX_DIMENSION_LOG2 + 1 - levels)
@@ -441,11 +486,71 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
         throw invalid_option(std::string("Sum of --") + Option::subsampling
                              + " and --" + Option::levels + " is too small");
 
-    if (deviceThreads < 1)
+    if (vm[Option::deviceThreads].as<int>() < 1)
         throw invalid_option(std::string("Value of --") + Option::deviceThreads + " must be at least 1");
+    if (vm[Option::mesherThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::mesherThreads + " must be at least 1");
+    if (vm[Option::writeThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::writeThreads + " must be at least 1");
+    if (vm[Option::decimate].as<int>() < 0)
+        throw invalid_option(std::string("Value of --") + Option::decimate + " must be non-negative");
+}
+
+void validateOptions(const po::variables_map &vm, bool isMPI)
+{
+    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
+    const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
+    const std::size_t maxHostSplats = getMaxHostSplats(vm);
+    const double pruneThreshold = vm[Option::fitPrune].as<double>();
+
+    const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
+
+    validateSizeOptions(vm);
+    if (maxBucketSplats < 1)
+        throw invalid_option(std::string("Value of --") + Option::memBucketSplats + " must be positive");
+    if (maxLoadSplats < maxBucketSplats)
+        throw invalid_option(std::string("Value of --") + Option::memLoadSplats
+                             + " must be at least that of --" + Option::memBucketSplats);
+    if (maxHostSplats < maxBucketSplats)
+        throw invalid_option(std::string("Value of --") + Option::memHostSplats
+                             + " must be at least that of --" + Option::memBucketSplats);
+    if (vm.count(Option::tmpCompress) && !BlockCompress::haveCodec())
+        throw invalid_option(std::string("--") + Option::tmpCompress + " is not supported by this build");
+    if (vm.count(Option::mesher)
+        && MesherType(vm[Option::mesher].as<Choice<MesherTypeWrapper> >()) == STREAM_MESHER)
+    {
+        if (isMPI)
+            throw invalid_option(std::string("--") + Option::mesher + "=stream is not supported with MPI");
+        if (pruneThreshold != 0.0)
+            throw invalid_option(std::string("--") + Option::mesher + "=stream requires --" + Option::fitPrune + "=0");
+        if (vm.count(Option::checkpoint) || vm.count(Option::resume))
+            throw invalid_option(std::string("--") + Option::mesher + "=stream does not support checkpointing");
+    }
     if (!(pruneThreshold >= 0.0 && pruneThreshold <= 1.0))
         throw invalid_option(std::string("Value of --") + Option::fitPrune + " must be in [0, 1]");
 
+    if (vm.count(Option::metricsPort))
+    {
+        const int port = vm[Option::metricsPort].as<int>();
+        if (port < 1 || port > 65535)
+            throw invalid_option(std::string("Value of --") + Option::metricsPort + " must be in the range 1 to 65535");
+        if (!Metrics::Exporter::haveHttp())
+            throw invalid_option(std::string("--") + Option::metricsPort + " is not supported by this build");
+    }
+    if (!(vm[Option::metricsInterval].as<double>() > 0.0))
+        throw invalid_option(std::string("Value of --") + Option::metricsInterval + " must be positive");
+
+    const double checkpointInterval = vm[Option::checkpointInterval].as<double>();
+    if (!(checkpointInterval >= 0.0))
+        throw invalid_option(std::string("Value of --") + Option::checkpointInterval + " must be non-negative");
+    if (checkpointInterval > 0.0)
+    {
+        if (isMPI)
+            throw invalid_option(std::string("--") + Option::checkpointInterval + " is not supported with MPI");
+        if (!vm.count(Option::checkpoint))
+            throw invalid_option(std::string("--") + Option::checkpointInterval + " requires --" + Option::checkpoint);
+    }
+
     if (memMesh < getMeshHostMemory(vm))
         throw invalid_option(std::string("Value of --") + Option::memMesh + " is too small");
     if (isMPI)
@@ -454,6 +559,178 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
         if (memGather < getMeshHostMemory(vm))
             throw invalid_option(std::string("Value of --") + Option::memGather + " is too small");
     }
+
+    const std::tr1::uint64_t hostMemory = getHostMemory(vm, isMPI);
+    const std::tr1::uint64_t physical = getPhysicalMemory();
+    if (physical > 0 && hostMemory > physical)
+        Log::log[Log::warn] << "Warning: arguments require host memory of " << Capacity(hostMemory)
+            << ", which exceeds the physical memory (" << Capacity(physical) << ")\n";
+}
+
+namespace
+{
+
+/// A host memory option considered by @ref applyMemoryBudget
+struct MemoryShare
+{
+    const char *option;             ///< Name of the option
+    std::tr1::uint64_t minimum;     ///< Smallest value accepted by @ref validateOptions
+    std::tr1::uint64_t weight;      ///< Default value, used as the weight for the split
+    std::tr1::uint64_t value;       ///< Chosen value
+    bool fixed;                     ///< Whether @ref value is final
+    unsigned int copies;            ///< Number of buffers of size @ref value that are allocated
+
+    MemoryShare(const po::variables_map &vm, const char *option, std::tr1::uint64_t minimum,
+                unsigned int copies = 1)
+        : option(option), minimum(minimum),
+        weight(vm[option].as<Capacity>() * copies),
+        value(vm[option].as<Capacity>()),
+        fixed(!vm[option].defaulted()),
+        copies(copies)
+    {
+    }
+};
+
+} // anonymous namespace
+
+/// Replace the value of a @ref Capacity option
+static void setCapacity(po::variables_map &vm, const char *option, std::tr1::uint64_t value)
+{
+    vm.find(option)->second.value() = Capacity(value);
+}
+
+/**
+ * Halve --mem-bucket-splats (if not given explicitly) until the device
+ * resources fit in the largest allocation and 80% of the memory of every
+ * device.
+ */
+static void fitDeviceMemory(po::variables_map &vm, const std::vector<cl::Device> &devices)
+{
+    if (devices.empty() || !vm[Option::memBucketSplats].defaulted())
+        return;
+
+    std::tr1::uint64_t maxAlloc = std::numeric_limits<std::tr1::uint64_t>::max();
+    std::tr1::uint64_t maxTotal = std::numeric_limits<std::tr1::uint64_t>::max();
+    BOOST_FOREACH(const cl::Device &device, devices)
+    {
+        maxAlloc = std::min(maxAlloc, std::tr1::uint64_t(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()));
+        maxTotal = std::min(maxTotal, std::tr1::uint64_t(device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() * 0.8));
+    }
+
+    const std::tr1::uint64_t minBucket = 4 * 1024 * 1024;
+    std::tr1::uint64_t bucket = vm[Option::memBucketSplats].as<Capacity>();
+    while (bucket / 2 >= minBucket)
+    {
+        const CLH::ResourceUsage usage = resourceUsage(vm);
+        if (usage.getMaxMemory() <= maxAlloc && usage.getTotalMemory() <= maxTotal)
+            break;
+        bucket /= 2;
+        setCapacity(vm, Option::memBucketSplats, bucket);
+    }
+}
+
+void applyMemoryBudget(po::variables_map &vm, const std::vector<cl::Device> &devices, bool isMPI, int rank)
+{
+    if (!vm.count(Option::memTotal))
+        return;
+
+    // The sizes below are computed from these, so they must be sane first
+    validateSizeOptions(vm);
+    fitDeviceMemory(vm, devices);
+
+    const std::tr1::uint64_t budget = vm[Option::memTotal].as<Capacity>();
+    const std::tr1::uint64_t bucket = vm[Option::memBucketSplats].as<Capacity>();
+    const std::tr1::uint64_t mesh = getMeshHostMemory(vm);
+    // StreamMesher buffers whole chunks in as much memory again as --mem-mesh
+    const bool streamChunks = !isMPI && getMesherType(vm, devices.empty() ? 1 : devices.size()) == STREAM_MESHER;
+    std::vector<MemoryShare> shares;
+    shares.push_back(MemoryShare(vm, Option::memLoadSplats, bucket));
+    shares.push_back(MemoryShare(vm, Option::memHostSplats, bucket));
+    shares.push_back(MemoryShare(vm, Option::memMesh, mesh, streamChunks ? 2 : 1));
+    shares.push_back(MemoryShare(vm, Option::memReorder, mesh));
+    if (isMPI)
+        shares.push_back(MemoryShare(vm, Option::memGather, mesh));
+
+    // Buffers whose size is not set by an option
+    const std::tr1::uint64_t reserved = getWriteMemory(vm);
+    std::tr1::uint64_t needed = reserved;
+    BOOST_FOREACH(const MemoryShare &s, shares)
+        needed += (s.fixed ? s.value : s.minimum) * s.copies;
+    if (needed > budget)
+    {
+        std::ostringstream msg;
+        msg << "Value of --" << Option::memTotal << " is too small (at least "
+            << Capacity(roundUp(needed, std::tr1::uint64_t(1024 * 1024))) << " is needed)";
+        throw invalid_option(msg.str());
+    }
+
+    /* Split the remaining budget in proportion to the defaults. Any share
+     * that falls below its minimum is clamped and the rest is split again.
+     * This terminates because each pass either clamps a share or finishes.
+     */
+    while (true)
+    {
+        std::tr1::uint64_t fixedTotal = reserved, weightTotal = 0;
+        BOOST_FOREACH(const MemoryShare &s, shares)
+        {
+            if (s.fixed)
+                fixedTotal += s.value * s.copies;
+            else
+                weightTotal += s.weight;
+        }
+        if (weightTotal == 0)
+            break;
+
+        const double available = budget - fixedTotal;
+        bool clamped = false;
+        BOOST_FOREACH(MemoryShare &s, shares)
+        {
+            if (s.fixed)
+                continue;
+            s.value = std::tr1::uint64_t(available * s.weight / weightTotal / s.copies);
+            s.value -= s.value % (1024 * 1024);
+            if (s.value < s.minimum)
+            {
+                s.value = s.minimum;
+                s.fixed = true;
+                clamped = true;
+            }
+        }
+        if (!clamped)
+            break;
+    }
+
+    BOOST_FOREACH(const MemoryShare &s, shares)
+        setCapacity(vm, s.option, s.value);
+
+    if (rank == 0)
+    {
+        Log::log[Log::info] << "Memory budget of " << Capacity(budget) << ":";
+        BOOST_FOREACH(const MemoryShare &s, shares)
+            Log::log[Log::info] << " --" << s.option << "=" << Capacity(s.value);
+        if (!devices.empty())
+            Log::log[Log::info] << " --" << Option::memBucketSplats << "=" << Capacity(bucket);
+        Log::log[Log::info] << " (plus " << Capacity(reserved) << " for output buffers)\n";
+    }
+
+    const std::tr1::uint64_t physical = getPhysicalMemory();
+    if (physical > 0 && budget > physical)
+        Log::log[Log::warn] << "Warning: --" << Option::memTotal << " exceeds the physical memory ("
+            << Capacity(physical) << ")\n";
+}
+
+void startMetrics(const po::variables_map &vm, Metrics::Exporter &exporter, int rank)
+{
+    if (vm.count(Option::metricsPort))
+        exporter.listen(vm[Option::metricsPort].as<int>() + std::max(rank, 0));
+    if (vm.count(Option::metricsFile))
+    {
+        std::ostringstream name;
+        name << vm[Option::metricsFile].as<std::string>();
+        if (rank >= 0)
+            name << "." << rank;
+        exporter.snapshot(name.str(), vm[Option::metricsInterval].as<double>());
+    }
 }
 
 void setLogLevel(const po::variables_map &vm)
@@ -479,7 +756,9 @@ CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
     CLH::ResourceUsage totalUsage = DeviceWorkerGroup::resourceUsage(
         deviceThreads, deviceSpare, cl::Device(),
         maxBucketSplats, maxCells,
-        getMeshMemory(vm), levels);
+        getMeshMemory(vm), levels, getDistanceType(vm),
+        vm.count(Option::packMesh), vm.count(Option::deviceWeld),
+        vm[Option::decimate].as<int>(), vm.count(Option::overlapSwathes));
     return totalUsage;
 }
 
@@ -549,9 +828,21 @@ void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float
     std::tr1::uint64_t totalBytes = 0;
     BOOST_FOREACH(const boost::filesystem::path &path, paths)
     {
-        if (vm.count(Option::decache))
-            decache(path.string());
-        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(readerType, path.string(), smooth, maxRadius));
+        const std::string name = path.string();
+        std::auto_ptr<FastPly::Reader> reader;
+        if (boost::algorithm::starts_with(name, Synthetic::inputPrefix))
+        {
+            const std::string description = name.substr(std::strlen(Synthetic::inputPrefix));
+            reader.reset(new FastPly::Reader(
+                    Synthetic::PlyReaderFactory(Synthetic::parseParams(description)),
+                    name, smooth, maxRadius));
+        }
+        else
+        {
+            if (vm.count(Option::decache))
+                decache(name);
+            reader.reset(new FastPly::Reader(readerType, name, smooth, maxRadius));
+        }
         if (reader->size() > SplatSet::FileSet::maxFileSplats)
         {
             std::ostringstream msg;
@@ -693,12 +984,74 @@ MesherBase::Namer getNamer(const po::variables_map &vm, const std::string &out)
         return TrivialNamer(out);
 }
 
+MesherType getMesherType(const po::variables_map &vm, std::size_t numDevices)
+{
+    if (vm.count(Option::mesher))
+        return vm[Option::mesher].as<Choice<MesherTypeWrapper> >();
+    if (numDevices == 1
+        && vm[Option::fitPrune].as<double>() == 0.0
+        && vm.count(Option::split)
+        && !vm.count(Option::checkpoint)
+        && !vm.count(Option::resume))
+        return STREAM_MESHER;
+    else
+        return OOC_MESHER;
+}
+
 void setMesherOptions(const po::variables_map &vm, MesherBase &mesher)
 {
     const double pruneThreshold = vm[Option::fitPrune].as<double>();
     const std::size_t memReorder = vm[Option::memReorder].as<Capacity>();
     mesher.setPruneThreshold(pruneThreshold);
     mesher.setReorderCapacity(memReorder);
+    mesher.setWriteThreads(vm[Option::writeThreads].as<int>());
+    mesher.setTmpCompression(vm.count(Option::tmpCompress));
+}
+
+SubsamplingModel *createSubsamplingModel(const po::variables_map &vm)
+{
+    if (!vm.count(Option::subsamplingModel))
+        return NULL;
+
+    /* Larger values are always legal, since they only reduce the number
+     * of levels needed. Smaller values are only used for sub-items that
+     * still fit in the octree.
+     */
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const std::string filename = vm[Option::subsamplingModel].as<std::string>();
+    std::auto_ptr<SubsamplingModel> model(new SubsamplingModel(
+            MlsFunctor::subsamplingMin, subsampling + 2, subsampling));
+    std::ifstream in(filename.c_str());
+    if (in)
+    {
+        try
+        {
+            model->load(in);
+        }
+        catch (std::runtime_error &e)
+        {
+            Log::log[Log::warn] << "Could not load `" << filename << "' (" << e.what() << "), ignoring\n";
+        }
+    }
+    return model.release();
+}
+
+void writeSubsamplingModel(const SubsamplingModel &model, const std::string &filename)
+{
+    try
+    {
+        std::ofstream out;
+        out.exceptions(std::ios::failbit | std::ios::badbit);
+        out.open(filename.c_str());
+        model.save(out);
+        out.close();
+    }
+    catch (std::ios::failure &)
+    {
+        // The output is already complete, so losing the model is not fatal
+        Log::log[Log::warn] << "Could not save `" << filename << "' ("
+            << std::strerror(errno) << "), ignoring\n";
+    }
 }
 
 SlaveWorkers::SlaveWorkers(
@@ -732,12 +1085,22 @@ SlaveWorkers::SlaveWorkers(
             maxBucketSplats, blockCells,
             getMeshMemory(vm),
             levels, subsampling,
-            boundaryLimit, shape);
+            boundaryLimit, shape, getDistanceType(vm),
+            vm.count(Option::packMesh), vm.count(Option::deviceWeld),
+            vm[Option::decimate].as<int>(), vm.count(Option::overlapSwathes));
         deviceWorkerGroups.push_back(dwg);
         deviceWorkerGroupPtrs.push_back(dwg);
     }
     copyGroup.reset(new CopyGroup(deviceWorkerGroupPtrs, maxHostSplats));
     loader.reset(new BucketLoader(maxLoadSplats, *copyGroup, tworker));
+
+    subsamplingModel.reset(createSubsamplingModel(vm));
+    if (subsamplingModel)
+    {
+        subsamplingModelFile = vm[Option::subsamplingModel].as<std::string>();
+        for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
+            deviceWorkerGroups[i].setSubsamplingModel(subsamplingModel.get());
+    }
 }
 
 void SlaveWorkers::start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress)
@@ -757,3 +1120,9 @@ void SlaveWorkers::stop()
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].stop();
 }
+
+void SlaveWorkers::saveSubsamplingModel()
+{
+    if (subsamplingModel)
+        writeSubsamplingModel(*subsamplingModel, subsamplingModelFile);
+}
@@ -38,6 +38,7 @@
 #include <exception>
 #include <vector>
 #include <utility>
+#include <string>
 #include "splat_set.h"
 #include "workers.h"
 #include "bucket.h"
@@ -46,6 +47,8 @@
 #include "grid.h"
 #include "progress.h"
 #include "timeplot.h"
+#include "metrics.h"
+#include "subsampling_model.h"
 #include <CL/cl.hpp>
 
 namespace CLH
@@ -77,17 +80,32 @@ namespace Option
     const char * const statisticsFile = "statistics-file";
     const char * const statisticsCL = "statistics-cl";
     const char * const timeplot = "timeplot";
+    const char * const timeplotBinary = "timeplot-binary";
+    const char * const metricsPort = "metrics-port";
+    const char * const metricsFile = "metrics-file";
+    const char * const metricsInterval = "metrics-interval";
 
     const char * const maxSplit = "max-split";
     const char * const levels = "levels";
     const char * const subsampling = "subsampling";
+    const char * const subsamplingModel = "subsampling-model";
+    const char * const halfDistance = "half-distance";
+    const char * const packMesh = "pack-mesh";
+    const char * const overlapSwathes = "overlap-swathes";
+    const char * const deviceWeld = "device-weld";
+    const char * const decimate = "decimate";
     const char * const leafCells = "leaf-cells";
     const char * const deviceThreads = "device-threads";
+    const char * const mesherThreads = "mesher-threads";
+    const char * const writeThreads = "write-threads";
+    const char * const tmpCompress = "tmp-compress";
+    const char * const mesher = "mesher";
     const char * const reader = "reader";
     const char * const writer = "writer";
     const char * const ompThreads = "omp-threads";
     const char * const decache = "decache";
     const char * const checkpoint = "checkpoint";
+    const char * const checkpointInterval = "checkpoint-interval";
     const char * const resume = "resume";
 
     const char * const memLoadSplats = "mem-load-splats";
@@ -96,6 +114,7 @@ namespace Option
     const char * const memMesh = "mem-mesh";
     const char * const memReorder = "mem-reorder";
     const char * const memGather = "mem-gather";
+    const char * const memTotal = "mem-total";
 };
 
 /**
@@ -125,6 +144,46 @@ void writeStatistics(const boost::program_options::variables_map &vm, bool force
  */
 void validateOptions(const boost::program_options::variables_map &vm, bool isMPI);
 
+/**
+ * Start the metrics exports requested on the command line, if any.
+ *
+ * @param vm       Command-line options.
+ * @param exporter Exporter to start.
+ * @param rank     MPI rank, which is added to the port and appended to the
+ *                 file name so that processes on the same host do not
+ *                 collide, or -1 if not using MPI.
+ */
+void startMetrics(const boost::program_options::variables_map &vm, Metrics::Exporter &exporter, int rank = -1);
+
+/**
+ * If --mem-total was given, choose values for the memory options that were
+ * left at their defaults. The host memory options are scaled in proportion
+ * to their defaults so that, together with those given explicitly and the
+ * fixed output writer buffers, they sum to the budget, subject to the
+ * minimums that @ref validateOptions enforces. When @ref StreamMesher will be
+ * used, --mem-mesh is counted twice, since it also bounds the chunk buffers.
+ * If @a devices is non-empty, --mem-bucket-splats is also reduced until
+ * @ref resourceUsage (which includes any decimation and packing buffers) fits
+ * comfortably on every device.
+ *
+ * This must be called before @ref validateOptions. The options from which
+ * the sizes are computed (such as --levels and --subsampling) are
+ * range-checked first, so bad values give an @ref invalid_option rather than
+ * an assertion failure or overflow.
+ *
+ * @param vm      Command-line options, which are modified in place.
+ * @param devices Devices that will be used, or empty to leave device memory alone.
+ * @param isMPI   Whether MPI-related options are expected.
+ * @param rank    MPI rank of this process. The chosen split is only logged on rank 0.
+ *
+ * @throw invalid_option if the budget cannot accommodate the minimums.
+ */
+void applyMemoryBudget(
+    boost::program_options::variables_map &vm,
+    const std::vector<cl::Device> &devices,
+    bool isMPI,
+    int rank = 0);
+
 /**
  * Set the logging level based on the command-line options.
  */
@@ -150,10 +209,12 @@ CLH::ResourceUsage resourceUsage(const boost::program_options::variables_map &vm
 void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsage);
 
 /**
- * Put the input files named in @a vm into @a files.
+ * Put the input files named in @a vm into @a files. Names starting with
+ * @ref Synthetic::inputPrefix describe generated clouds rather than files.
  *
  * @throw boost::exception   if there was a problem reading the files.
- * @throw std::runtime_error if there are too many files or splats.
+ * @throw std::runtime_error if there are too many files or splats, or a
+ * synthetic cloud description is invalid.
  */
 void prepareInputs(SplatSet::FileSet &files, const boost::program_options::variables_map &vm, float smooth, float maxRadius);
 
@@ -213,6 +274,19 @@ void doBucket(
  */
 void setWriterComments(const boost::program_options::variables_map &vm, FastPly::Writer &writer);
 
+/**
+ * Choose the mesher class from the command-line options. If it is not given
+ * explicitly, @ref STREAM_MESHER is chosen when there is a single device, no
+ * pruning is requested, the output is split (so that each chunk is bounded in
+ * size) and there is no checkpointing; otherwise @ref OOC_MESHER is used.
+ * With several devices, chunks complete out of order and more of them must be
+ * buffered, so the streaming mesher is only used if requested.
+ *
+ * @param vm         Command-line options
+ * @param numDevices Number of devices that will produce meshes
+ */
+MesherType getMesherType(const boost::program_options::variables_map &vm, std::size_t numDevices);
+
 /**
  * Set mesher options based on command-line options.
  */
@@ -223,6 +297,20 @@ void setMesherOptions(const boost::program_options::variables_map &vm, MesherBas
  */
 MesherBase::Namer getNamer(const boost::program_options::variables_map &vm, const std::string &out);
 
+/**
+ * Creates the model requested with @c --subsampling-model, loading any fit
+ * data already in the file. A file that cannot be read is logged and ignored.
+ *
+ * @return The new model, or @c NULL if the option was not given.
+ */
+SubsamplingModel *createSubsamplingModel(const boost::program_options::variables_map &vm);
+
+/**
+ * Saves a subsampling model to @a filename. Failure is logged as a warning
+ * rather than thrown, since the mesh is unaffected.
+ */
+void writeSubsamplingModel(const SubsamplingModel &model, const std::string &filename);
+
 /**
  * Collects together the workers that run on the slave side in MPI, without
  * using any MPI-specific code.
@@ -234,6 +322,10 @@ public:
     boost::ptr_vector<DeviceWorkerGroup> deviceWorkerGroups;
     boost::scoped_ptr<CopyGroup> copyGroup;
     boost::scoped_ptr<BucketLoader> loader;
+    /// Model for adaptive subsampling, if enabled with --subsampling-model
+    boost::scoped_ptr<SubsamplingModel> subsamplingModel;
+    /// File from which @ref subsamplingModel was loaded and to which it is saved
+    std::string subsamplingModelFile;
 
     SlaveWorkers(
         Timeplot::Worker &tworker,
@@ -243,7 +335,19 @@ public:
 
     void start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress);
 
+    /**
+     * Stops the workers. This may be called several times per pass (for
+     * checkpoints), so it does not save the subsampling model.
+     */
     void stop();
+
+    /**
+     * Saves the subsampling model to @ref subsamplingModelFile, if there is
+     * one. This should be called once, after the final @ref stop. It is not
+     * used under MPI, where the ranks' models are combined and saved by the
+     * root (see @ref SubsamplingModel::saveRecorded).
+     */
+    void saveSubsamplingModel();
 };
 
 #endif /* !MLSGPU_CORE_H */
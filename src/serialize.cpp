@@ -271,11 +271,15 @@ void recv(BucketCollector::Bin &bin, MPI_Comm comm, int source)
 
 void send(const MesherWork &work, MPI_Comm comm, int dest)
 {
+    /* A shallow copy, so that a packed mesh can be expanded in place before
+     * it is sent.
+     */
+    HostKeyMesh mesh = work.mesh;
     std::size_t sizes[3] =
     {
-        work.mesh.numVertices(),
-        work.mesh.numTriangles(),
-        work.mesh.numInternalVertices()
+        mesh.numVertices(),
+        mesh.numTriangles(),
+        mesh.numInternalVertices()
     };
 
     send(work.chunkId, comm, dest);
@@ -283,17 +287,19 @@ void send(const MesherWork &work, MPI_Comm comm, int dest)
 
     if (work.hasEvents)
         work.trianglesEvent.wait();
-    MPI_Send(const_cast<cl_uint *>(&work.mesh.triangles[0][0]), 3 * work.mesh.numTriangles(),
+    mesh.unpackTriangles();
+    MPI_Send(&mesh.triangles[0][0], 3 * mesh.numTriangles(),
              mpi_type_traits<cl_uint>::type(), dest, MLSGPU_TAG_WORK, comm);
 
     if (work.hasEvents)
         work.vertexKeysEvent.wait();
-    MPI_Send(const_cast<cl_ulong *>(&work.mesh.vertexKeys[0]), work.mesh.numExternalVertices(),
+    MPI_Send(&mesh.vertexKeys[0], mesh.numExternalVertices(),
              mpi_type_traits<cl_ulong>::type(), dest, MLSGPU_TAG_WORK, comm);
 
     if (work.hasEvents)
         work.verticesEvent.wait();
-    MPI_Send(const_cast<cl_float *>(&work.mesh.vertices[0][0]), 3 * work.mesh.numVertices(),
+    mesh.unpackVertices();
+    MPI_Send(&mesh.vertices[0][0], 3 * mesh.numVertices(),
              mpi_type_traits<cl_float>::type(), dest, MLSGPU_TAG_WORK, comm);
 }
 
@@ -0,0 +1,1289 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref Simulate::extractWorkload and @ref Simulate::simulate.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "simulate.h"
+#include "timeplot.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "errors.h"
+#include "tr1_cstdint.h"
+
+namespace Simulate
+{
+
+namespace
+{
+
+typedef std::vector<Timeplot::TraceEvent> Events;
+
+static bool startsWith(const std::string &s, const char *prefix)
+{
+    return s.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+static double duration(const Timeplot::TraceEvent &e)
+{
+    return e.stop - e.start;
+}
+
+static std::size_t splatsForBytes(const Timeplot::TraceEvent &e)
+{
+    return e.value ? std::size_t(*e.value / sizeof(Splat)) : 0;
+}
+
+/// One call to the bucket loader, as recorded on the main thread
+struct LoadRecord
+{
+    double bucketCost;       ///< Bucketing time preceding the call
+    double mergeCost;        ///< Time merging ranges
+    double loadCost;         ///< Time in the load action
+    double loadStart;        ///< Start of the first load segment
+    double loadStop;         ///< End of the last load segment
+    double readCost;         ///< Reader thread time during the load
+    double readBytes;        ///< Bytes allocated by the reader thread during the load
+    std::size_t firstBin;    ///< Index of the first bin written
+    std::size_t lastBin;     ///< One past the index of the last bin written
+
+    LoadRecord() : bucketCost(0.0), mergeCost(0.0), loadCost(0.0),
+        loadStart(0.0), loadStop(0.0), readCost(0.0), readBytes(0.0),
+        firstBin(0), lastBin(0) {}
+};
+
+/// A group of bins sent to the device by the copy thread
+struct ItemRecord
+{
+    std::size_t firstBin;    ///< Index of the first bin in the item
+    std::size_t lastBin;     ///< One past the index of the last bin in the item
+    double transferCost;     ///< Time waiting for the transfer
+
+    ItemRecord() : firstBin(0), lastBin(0), transferCost(0.0) {}
+};
+
+/// Processing of one item by a device worker
+struct DeviceRecord
+{
+    double popped;                   ///< Time at which the item was popped
+    double cost;                     ///< Total compute time
+    bool computed;                   ///< Whether any compute was recorded
+    std::vector<double> meshOffsets; ///< Compute time before each mesh was emitted
+    std::vector<std::size_t> meshBytes; ///< Size of each mesh
+    std::vector<double> pushTimes;   ///< Time at which each mesh was pushed
+
+    explicit DeviceRecord(double popped) : popped(popped), cost(0.0), computed(false) {}
+};
+
+/// Processing of one mesh by a mesher thread
+struct MesherRecord
+{
+    double inputStart;       ///< Start of the first input segment
+    double prepareCost;      ///< Time in the prepare functor
+    double inputCost;        ///< Time in the input functor
+    bool started;            ///< Whether any input was recorded
+
+    MesherRecord() : inputStart(0.0), prepareCost(0.0), inputCost(0.0), started(false) {}
+};
+
+static bool devicePoppedLess(const DeviceRecord &a, const DeviceRecord &b)
+{
+    return a.popped < b.popped;
+}
+
+static bool mesherStartLess(const MesherRecord &a, const MesherRecord &b)
+{
+    return a.inputStart < b.inputStart;
+}
+
+/// Identifies a mesh by push time, device record and index within the record
+typedef std::pair<double, std::pair<std::size_t, std::size_t> > MeshPush;
+
+/**
+ * Parse the bucketing pass on the main thread. The pass starts after the
+ * last @c init or @c bbox event, and ends at the first @c write without a
+ * value (which is the final output) since the bucket loader's writes always
+ * have values. A @c compute immediately followed by @c load is the loader
+ * merging ranges; other @c compute events are the bucketer.
+ */
+static void parseMain(const Events &events, std::vector<LoadRecord> &loads,
+                      std::vector<Bin> &bins, double &passStart)
+{
+    std::size_t first = 0;
+    for (std::size_t i = 0; i < events.size(); i++)
+        if (events[i].action == "init" || events[i].action == "bbox")
+            first = i + 1;
+    std::size_t last = first;
+    while (last < events.size() && !(events[last].action == "write" && !events[last].value))
+        last++;
+    if (first == last)
+        throw std::runtime_error("Trace does not contain a bucketing pass");
+    passStart = events[first].start;
+
+    double pendingBucket = 0.0;
+    for (std::size_t i = first; i < last; i++)
+    {
+        const Timeplot::TraceEvent &e = events[i];
+        if (e.action == "compute")
+        {
+            if (i + 1 < last && events[i + 1].action == "load")
+            {
+                if (!loads.empty())
+                    loads.back().lastBin = bins.size();
+                loads.push_back(LoadRecord());
+                loads.back().bucketCost = pendingBucket;
+                loads.back().mergeCost = duration(e);
+                loads.back().loadStart = events[i + 1].start;
+                loads.back().firstBin = bins.size();
+                pendingBucket = 0.0;
+            }
+            else
+                pendingBucket += duration(e);
+        }
+        else if (e.action == "load" && !loads.empty())
+        {
+            loads.back().loadCost += duration(e);
+            loads.back().loadStop = e.stop;
+        }
+        else if (e.action == "write" && !loads.empty())
+        {
+            bins.push_back(Bin());
+            bins.back().splats = splatsForBytes(e);
+            bins.back().writeCost = duration(e);
+        }
+    }
+    if (loads.empty() || bins.empty())
+        throw std::runtime_error("Trace does not contain any bins");
+    loads.back().lastBin = bins.size();
+    loads.back().bucketCost += pendingBucket;
+}
+
+/**
+ * Attribute the reader thread's work to the load during which it happened.
+ * Reader events outside any load (such as those for the bounding box) are
+ * ignored.
+ */
+static void parseReader(const Events &events, std::vector<LoadRecord> &loads)
+{
+    std::size_t lastBytes = 0;
+    for (Events::const_iterator e = events.begin(); e != events.end(); ++e)
+    {
+        if (e->action == "get")
+        {
+            lastBytes = e->value ? *e->value : 0;
+            continue;
+        }
+        const double mid = 0.5 * (e->start + e->stop);
+        std::size_t lo = 0, hi = loads.size();
+        while (hi - lo > 1)
+        {
+            std::size_t m = (lo + hi) / 2;
+            if (loads[m].loadStart <= mid)
+                lo = m;
+            else
+                hi = m;
+        }
+        LoadRecord &load = loads[lo];
+        if (mid < load.loadStart || mid > load.loadStop)
+            continue;
+        load.readCost += duration(*e);
+        if (e->action == "load")
+            load.readBytes += lastBytes;
+    }
+}
+
+/**
+ * Parse the copy thread. A @c pop starts a new bin, whose @c compute
+ * segments give its cost. A @c get with a value is a device item being
+ * taken, which happens before the bin being processed (if any) is copied,
+ * and the following @c write is the wait for its transfer.
+ */
+static void parseCopy(const Events &events, std::vector<Bin> &bins, std::vector<ItemRecord> &items)
+{
+    std::size_t numBins = 0;
+    std::size_t assigned = 0;
+    bool open = false;
+    for (Events::const_iterator e = events.begin(); e != events.end(); ++e)
+    {
+        if (e->action == "pop")
+            open = false;
+        else if (e->action == "compute")
+        {
+            if (!open)
+            {
+                if (numBins == bins.size())
+                    throw std::runtime_error("Trace has more bins on the copy thread than the main thread");
+                numBins++;
+                open = true;
+            }
+            bins[numBins - 1].copyCost += duration(*e);
+        }
+        else if (e->action == "get" && e->value)
+        {
+            ItemRecord item;
+            item.firstBin = assigned;
+            item.lastBin = open ? numBins - 1 : numBins;
+            assigned = item.lastBin;
+            items.push_back(item);
+        }
+        else if (e->action == "write" && !items.empty())
+            items.back().transferCost += duration(*e);
+    }
+    if (numBins != bins.size() || assigned != bins.size())
+        throw std::runtime_error("Trace is incomplete: not every bin was copied to the device");
+}
+
+/**
+ * Parse a device worker. Each @c pop starts an item, during which @c get
+ * events with values are the allocations for the meshes, and @c push events
+ * hand them over to the mesher.
+ */
+static void parseDevice(const std::string &name, const Events &events, std::vector<DeviceRecord> &records)
+{
+    double lastStop = -std::numeric_limits<double>::infinity();
+    DeviceRecord *cur = NULL;
+    for (Events::const_iterator e = events.begin(); e != events.end(); ++e)
+    {
+        /* The text format only has about six significant figures, so allow
+         * for rounding when detecting overlaps.
+         */
+        if (e->start < lastStop - 1e-5 * std::abs(lastStop) - 1e-9)
+            throw std::runtime_error("Trace has overlapping events for " + name
+                                     + ": it must be recorded with a single device");
+        lastStop = e->stop;
+
+        if (e->action == "pop")
+        {
+            records.push_back(DeviceRecord(e->stop));
+            cur = &records.back();
+        }
+        else if (cur == NULL)
+            continue;
+        else if (e->action == "compute")
+        {
+            cur->cost += duration(*e);
+            cur->computed = true;
+        }
+        else if (e->action == "get" && e->value)
+        {
+            cur->meshOffsets.push_back(cur->cost);
+            cur->meshBytes.push_back(*e->value);
+        }
+        else if (e->action == "push")
+            cur->pushTimes.push_back(e->stop);
+    }
+    // The final pop returns the shutdown signal rather than an item
+    if (!records.empty() && !records.back().computed)
+        records.pop_back();
+}
+
+/**
+ * Parse a mesher thread. The @c order events are time spent waiting for
+ * earlier meshes, and everything else except @c prepare is the input
+ * functor.
+ */
+static void parseMesher(const Events &events, std::vector<MesherRecord> &records, double &lastStop)
+{
+    MesherRecord *cur = NULL;
+    for (Events::const_iterator e = events.begin(); e != events.end(); ++e)
+    {
+        if (e->action == "pop")
+        {
+            records.push_back(MesherRecord());
+            cur = &records.back();
+            continue;
+        }
+        lastStop = std::max(lastStop, e->stop);
+        if (cur == NULL || e->action == "order")
+            continue;
+        else if (e->action == "prepare")
+            cur->prepareCost += duration(*e);
+        else
+        {
+            if (!cur->started)
+                cur->inputStart = e->start;
+            cur->started = true;
+            cur->inputCost += duration(*e);
+        }
+    }
+    if (!records.empty() && !records.back().started)
+        records.pop_back();
+}
+
+/// Shares a cost between the bins of a group in proportion to their splats
+static double share(const std::vector<Bin> &bins, std::size_t first, std::size_t last, std::size_t idx)
+{
+    std::size_t total = 0;
+    for (std::size_t i = first; i < last; i++)
+        total += bins[i].splats;
+    if (total == 0)
+        return 1.0 / (last - first);
+    return double(bins[idx].splats) / total;
+}
+
+/**
+ * A simulated thread. It is resumed by the @ref Engine whenever it may be
+ * able to make progress, and runs until it needs to wait for something or
+ * for simulated time to pass.
+ */
+class Process : public boost::noncopyable
+{
+public:
+    virtual ~Process() {}
+    virtual void resume() = 0;
+};
+
+/// Event queue for the simulation
+class Engine : public boost::noncopyable
+{
+private:
+    struct Wakeup
+    {
+        double time;
+        std::tr1::uint64_t seq;  ///< Breaks ties in scheduling order, for determinism
+        Process *process;
+
+        bool operator<(const Wakeup &other) const
+        {
+            // Inverted, since std::priority_queue is a max-heap
+            return time > other.time || (time == other.time && seq > other.seq);
+        }
+    };
+
+    std::priority_queue<Wakeup> queue;
+    double now;
+    std::tr1::uint64_t nextSeq;
+
+public:
+    Engine() : now(0.0), nextSeq(0) {}
+
+    double getTime() const { return now; }
+
+    /// Resume @a process after @a delay seconds
+    void schedule(Process *process, double delay)
+    {
+        Wakeup w;
+        w.time = now + std::max(delay, 0.0);
+        w.seq = nextSeq++;
+        w.process = process;
+        queue.push(w);
+    }
+
+    /// Run until no process has anything further to do
+    void run()
+    {
+        while (!queue.empty())
+        {
+            Wakeup w = queue.top();
+            queue.pop();
+            now = w.time;
+            w.process->resume();
+        }
+    }
+};
+
+/**
+ * Processes waiting for a condition. Like a condition variable, waiters
+ * are all woken and must check the condition again.
+ */
+class WaitList
+{
+private:
+    std::vector<Process *> waiters;
+
+public:
+    void wait(Process *process) { waiters.push_back(process); }
+
+    void notify(Engine &engine)
+    {
+        for (std::size_t i = 0; i < waiters.size(); i++)
+            engine.schedule(waiters[i], 0.0);
+        waiters.clear();
+    }
+};
+
+/// Blocking queue between stages
+template<typename T>
+class Queue
+{
+public:
+    std::deque<T> items;
+    bool stopped;
+    WaitList waiters;
+
+    Queue() : stopped(false) {}
+
+    void push(Engine &engine, const T &item)
+    {
+        items.push_back(item);
+        waiters.notify(engine);
+    }
+
+    void stop(Engine &engine)
+    {
+        stopped = true;
+        waiters.notify(engine);
+    }
+};
+
+/**
+ * Model of the allocation policy of @ref CircularBufferBase: allocations are
+ * contiguous, and space is only reclaimed from the oldest allocation.
+ */
+class RingPool
+{
+public:
+    typedef std::tr1::uint64_t Handle;
+
+    WaitList waiters;   ///< Processes waiting for space
+
+    explicit RingPool(std::size_t size) : size(size), tail(0), firstFree(0) {}
+
+    std::size_t getSize() const { return size; }
+
+    /// Allocate @a n bytes if possible without waiting
+    bool tryAllocate(std::size_t n, Handle &handle)
+    {
+        while (!slots.empty() && slots.front().freed)
+        {
+            slots.pop_front();
+            tail++;
+        }
+
+        std::size_t pos = size;
+        if (slots.empty())
+            pos = 0;
+        else
+        {
+            std::size_t end = slots.front().start;
+            if (firstFree <= end)
+            {
+                if (end - firstFree >= n)
+                    pos = firstFree;
+            }
+            else if (size - firstFree >= n)
+                pos = firstFree;
+            else if (end >= n)
+                pos = 0;
+        }
+        if (pos == size)
+            return false;
+
+        Slot slot;
+        slot.start = pos;
+        slot.freed = false;
+        slots.push_back(slot);
+        firstFree = pos + n;
+        handle = tail + slots.size() - 1;
+        return true;
+    }
+
+    void free(Engine &engine, Handle handle)
+    {
+        slots[handle - tail].freed = true;
+        waiters.notify(engine);
+    }
+
+private:
+    struct Slot
+    {
+        std::size_t start;
+        bool freed;
+    };
+
+    const std::size_t size;
+    std::deque<Slot> slots;   ///< Live allocations, oldest first
+    Handle tail;              ///< Handle of the first element of @ref slots
+    std::size_t firstFree;    ///< End of the newest allocation
+};
+
+/// A chunk of file data read by the reader thread
+struct Chunk
+{
+    std::size_t bytes;
+    double readCost;
+    double decodeCost;
+};
+
+/// A call to the bucket loader
+struct Batch
+{
+    std::size_t firstBin, lastBin;
+    double cost;                ///< Bucketing and merging time before loading
+    std::vector<Chunk> chunks;
+};
+
+/// A bin in the host buffer, waiting for the copy thread
+struct HostBin
+{
+    std::size_t bin;
+    RingPool::Handle handle;
+};
+
+/// A mesh in the mesh buffer, waiting for a mesher thread
+struct MeshItem
+{
+    const Mesh *mesh;
+    RingPool::Handle handle;
+    std::tr1::uint64_t seq;
+};
+
+/// State of one simulated device
+struct Device
+{
+    std::size_t freeSlots;      ///< Items that the copy thread can take
+    std::size_t unallocated;    ///< As for @ref DeviceWorkerGroup::unallocated
+    std::size_t running;        ///< Workers that have not shut down
+    Queue<std::vector<std::size_t> > queue;  ///< Items, as lists of bin indices
+};
+
+class Pipeline;
+
+/// Base for the processes of a @ref Pipeline
+class Stage : public Process
+{
+protected:
+    Pipeline &pipeline;
+    StageResult &result;
+    int state;
+
+    /// Spend @a time working, then resume
+    void work(double time);
+
+public:
+    Stage(Pipeline &pipeline, StageResult &result, int state)
+        : pipeline(pipeline), result(result), state(state) {}
+};
+
+class MainProcess : public Stage
+{
+    enum { START_BATCH, START_LOAD, NEXT_CHUNK, DECODED, NEXT_BIN, WRITTEN, DONE };
+    std::size_t batch, chunk, bin;
+    RingPool::Handle handle;
+public:
+    MainProcess(Pipeline &pipeline, StageResult &result)
+        : Stage(pipeline, result, START_BATCH), batch(0), chunk(0), bin(0), handle(0) {}
+    virtual void resume();
+};
+
+class ReaderProcess : public Stage
+{
+    enum { IDLE, NEXT_CHUNK, READ };
+    const Batch *batch;
+    std::size_t chunk;
+    RingPool::Handle handle;
+public:
+    ReaderProcess(Pipeline &pipeline, StageResult &result)
+        : Stage(pipeline, result, IDLE), batch(NULL), chunk(0), handle(0) {}
+    void start(const Batch &batch);
+    virtual void resume();
+};
+
+class CopyProcess : public Stage
+{
+    enum { POP, COPY, COPIED, FLUSH, TRANSFERRED, FINAL_FLUSH, STOP, DONE };
+    HostBin current;
+    std::vector<std::size_t> buffered;
+    std::size_t bufferedSplats;
+    int afterFlush;
+public:
+    CopyProcess(Pipeline &pipeline, StageResult &result)
+        : Stage(pipeline, result, POP), bufferedSplats(0), afterFlush(POP) {}
+    virtual void resume();
+};
+
+class DeviceProcess : public Stage
+{
+    enum { POP, START_BIN, NEXT_MESH, ALLOCATE, BIN_DONE, DONE };
+    Device &device;
+    std::vector<std::size_t> item;
+    std::size_t pos, mesh;
+    double elapsed;
+public:
+    DeviceProcess(Pipeline &pipeline, StageResult &result, Device &device)
+        : Stage(pipeline, result, POP), device(device), pos(0), mesh(0), elapsed(0.0) {}
+    virtual void resume();
+};
+
+class MesherProcess : public Stage
+{
+    enum { POP, PREPARED, INPUT_DONE, DONE };
+    MeshItem current;
+public:
+    MesherProcess(Pipeline &pipeline, StageResult &result)
+        : Stage(pipeline, result, POP) {}
+    virtual void resume();
+};
+
+/// Shared state of the simulated pipeline
+class Pipeline : public boost::noncopyable
+{
+public:
+    Engine engine;
+    const Workload &workload;
+    const Config &config;
+    std::vector<Batch> batches;
+
+    RingPool readerPool;
+    RingPool hostPool;
+    RingPool meshPool;
+    Queue<RingPool::Handle> readQueue;
+    Queue<HostBin> copyQueue;
+    Queue<MeshItem> meshQueue;
+    boost::ptr_vector<Device> devices;
+    WaitList slotWaiters;          ///< Copy thread waiting for a device slot
+    WaitList orderWaiters;         ///< Mesher threads waiting for their turn
+    std::tr1::uint64_t nextPush;   ///< Sequence number for the next mesh
+    std::tr1::uint64_t nextInput;  ///< Sequence number of the next mesh to input
+    std::size_t runningDevices;    ///< Devices with workers that have not shut down
+    std::size_t finished;          ///< Processes that have finished
+    std::size_t deviceItems;
+
+    Result result;
+    boost::ptr_vector<Process> processes;
+    ReaderProcess *reader;
+
+    Pipeline(const Workload &workload, const Config &config);
+};
+
+void Stage::work(double time)
+{
+    time = std::max(time, 0.0);
+    result.busy += time;
+    pipeline.engine.schedule(this, time);
+}
+
+void MainProcess::resume()
+{
+    while (true)
+    {
+        switch (state)
+        {
+        case START_BATCH:
+            if (batch == pipeline.batches.size())
+            {
+                pipeline.copyQueue.stop(pipeline.engine);
+                pipeline.finished++;
+                state = DONE;
+                return;
+            }
+            state = START_LOAD;
+            work(pipeline.batches[batch].cost);
+            return;
+        case START_LOAD:
+            pipeline.reader->start(pipeline.batches[batch]);
+            chunk = 0;
+            state = NEXT_CHUNK;
+            break;
+        case NEXT_CHUNK:
+            if (chunk == pipeline.batches[batch].chunks.size())
+            {
+                bin = pipeline.batches[batch].firstBin;
+                state = NEXT_BIN;
+                break;
+            }
+            if (pipeline.readQueue.items.empty())
+            {
+                pipeline.readQueue.waiters.wait(this);
+                return;
+            }
+            handle = pipeline.readQueue.items.front();
+            pipeline.readQueue.items.pop_front();
+            state = DECODED;
+            work(pipeline.batches[batch].chunks[chunk].decodeCost);
+            return;
+        case DECODED:
+            pipeline.readerPool.free(pipeline.engine, handle);
+            chunk++;
+            state = NEXT_CHUNK;
+            break;
+        case NEXT_BIN:
+            if (bin == pipeline.batches[batch].lastBin)
+            {
+                batch++;
+                state = START_BATCH;
+                break;
+            }
+            if (!pipeline.hostPool.tryAllocate(pipeline.workload.bins[bin].splats * sizeof(Splat), handle))
+            {
+                pipeline.hostPool.waiters.wait(this);
+                return;
+            }
+            state = WRITTEN;
+            work(pipeline.workload.bins[bin].writeCost);
+            return;
+        case WRITTEN:
+            {
+                HostBin item;
+                item.bin = bin;
+                item.handle = handle;
+                pipeline.copyQueue.push(pipeline.engine, item);
+            }
+            bin++;
+            state = NEXT_BIN;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+void ReaderProcess::start(const Batch &batch)
+{
+    this->batch = &batch;
+    chunk = 0;
+    state = NEXT_CHUNK;
+    pipeline.engine.schedule(this, 0.0);
+}
+
+void ReaderProcess::resume()
+{
+    while (true)
+    {
+        switch (state)
+        {
+        case NEXT_CHUNK:
+            if (chunk == batch->chunks.size())
+            {
+                state = IDLE;
+                return;
+            }
+            if (!pipeline.readerPool.tryAllocate(batch->chunks[chunk].bytes, handle))
+            {
+                pipeline.readerPool.waiters.wait(this);
+                return;
+            }
+            state = READ;
+            work(batch->chunks[chunk].readCost);
+            return;
+        case READ:
+            pipeline.readQueue.push(pipeline.engine, handle);
+            chunk++;
+            state = NEXT_CHUNK;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+void CopyProcess::resume()
+{
+    const std::vector<Bin> &bins = pipeline.workload.bins;
+    const std::size_t maxItemSplats = pipeline.config.memBucketSplats / sizeof(Splat);
+    while (true)
+    {
+        switch (state)
+        {
+        case POP:
+            if (pipeline.copyQueue.items.empty())
+            {
+                if (pipeline.copyQueue.stopped)
+                    state = FINAL_FLUSH;
+                else
+                {
+                    pipeline.copyQueue.waiters.wait(this);
+                    return;
+                }
+                break;
+            }
+            current = pipeline.copyQueue.items.front();
+            pipeline.copyQueue.items.pop_front();
+            if (!buffered.empty() && bufferedSplats + bins[current.bin].splats > maxItemSplats)
+            {
+                afterFlush = COPY;
+                state = FLUSH;
+            }
+            else
+                state = COPY;
+            break;
+        case COPY:
+            state = COPIED;
+            work(bins[current.bin].copyCost);
+            return;
+        case COPIED:
+            pipeline.hostPool.free(pipeline.engine, current.handle);
+            buffered.push_back(current.bin);
+            bufferedSplats += bins[current.bin].splats;
+            state = POP;
+            break;
+        case FLUSH:
+            {
+                // Same choice as CopyGroup: the free device with the most unallocated space
+                Device *target = NULL;
+                std::size_t best = 0;
+                for (std::size_t i = 0; i < pipeline.devices.size(); i++)
+                {
+                    Device &d = pipeline.devices[i];
+                    if (d.freeSlots > 0 && d.unallocated >= best)
+                    {
+                        best = d.unallocated;
+                        target = &d;
+                    }
+                }
+                if (target == NULL)
+                {
+                    pipeline.slotWaiters.wait(this);
+                    return;
+                }
+                target->freeSlots--;
+                target->unallocated -= bufferedSplats;
+                target->queue.push(pipeline.engine, buffered);
+                pipeline.deviceItems++;
+
+                double transferCost = 0.0;
+                for (std::size_t i = 0; i < buffered.size(); i++)
+                    transferCost += bins[buffered[i]].transferCost;
+                state = TRANSFERRED;
+                work(transferCost);
+                return;
+            }
+        case TRANSFERRED:
+            buffered.clear();
+            bufferedSplats = 0;
+            state = afterFlush;
+            break;
+        case FINAL_FLUSH:
+            if (!buffered.empty())
+            {
+                afterFlush = STOP;
+                state = FLUSH;
+            }
+            else
+                state = STOP;
+            break;
+        case STOP:
+            for (std::size_t i = 0; i < pipeline.devices.size(); i++)
+                pipeline.devices[i].queue.stop(pipeline.engine);
+            pipeline.finished++;
+            state = DONE;
+            return;
+        default:
+            return;
+        }
+    }
+}
+
+void DeviceProcess::resume()
+{
+    while (true)
+    {
+        switch (state)
+        {
+        case POP:
+            if (device.queue.items.empty())
+            {
+                if (device.queue.stopped)
+                {
+                    pipeline.finished++;
+                    state = DONE;
+                    if (--device.running == 0 && --pipeline.runningDevices == 0)
+                        pipeline.meshQueue.stop(pipeline.engine);
+                }
+                else
+                    device.queue.waiters.wait(this);
+                return;
+            }
+            item = device.queue.items.front();
+            device.queue.items.pop_front();
+            pos = 0;
+            state = START_BIN;
+            break;
+        case START_BIN:
+            if (pos == item.size())
+            {
+                device.freeSlots++;
+                pipeline.slotWaiters.notify(pipeline.engine);
+                state = POP;
+                break;
+            }
+            mesh = 0;
+            elapsed = 0.0;
+            state = NEXT_MESH;
+            break;
+        case NEXT_MESH:
+            {
+                const Bin &bin = pipeline.workload.bins[item[pos]];
+                if (mesh == bin.meshes.size())
+                {
+                    state = BIN_DONE;
+                    work(bin.deviceCost - elapsed);
+                    return;
+                }
+                state = ALLOCATE;
+                const double offset = bin.meshes[mesh].offset;
+                if (offset > elapsed)
+                {
+                    work(offset - elapsed);
+                    elapsed = offset;
+                    return;
+                }
+                break;
+            }
+        case ALLOCATE:
+            {
+                const Mesh &m = pipeline.workload.bins[item[pos]].meshes[mesh];
+                MeshItem out;
+                if (!pipeline.meshPool.tryAllocate(m.bytes, out.handle))
+                {
+                    pipeline.meshPool.waiters.wait(this);
+                    return;
+                }
+                out.mesh = &m;
+                out.seq = pipeline.nextPush++;
+                pipeline.meshQueue.push(pipeline.engine, out);
+                mesh++;
+                state = NEXT_MESH;
+                break;
+            }
+        case BIN_DONE:
+            device.unallocated += pipeline.workload.bins[item[pos]].splats;
+            pos++;
+            state = START_BIN;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+void MesherProcess::resume()
+{
+    while (true)
+    {
+        switch (state)
+        {
+        case POP:
+            if (pipeline.meshQueue.items.empty())
+            {
+                if (pipeline.meshQueue.stopped)
+                {
+                    pipeline.finished++;
+                    state = DONE;
+                }
+                else
+                    pipeline.meshQueue.waiters.wait(this);
+                return;
+            }
+            current = pipeline.meshQueue.items.front();
+            pipeline.meshQueue.items.pop_front();
+            state = PREPARED;
+            work(current.mesh->prepareCost);
+            return;
+        case PREPARED:
+            if (pipeline.nextInput != current.seq)
+            {
+                pipeline.orderWaiters.wait(this);
+                return;
+            }
+            state = INPUT_DONE;
+            work(current.mesh->inputCost);
+            return;
+        case INPUT_DONE:
+            pipeline.nextInput++;
+            pipeline.orderWaiters.notify(pipeline.engine);
+            pipeline.meshPool.free(pipeline.engine, current.handle);
+            state = POP;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+Pipeline::Pipeline(const Workload &workload, const Config &config)
+    : workload(workload), config(config),
+    readerPool(config.readerBuffer), hostPool(config.memHostSplats), meshPool(config.memMesh),
+    nextPush(0), nextInput(0), runningDevices(config.devices), finished(0), deviceItems(0),
+    reader(NULL)
+{
+}
+
+/**
+ * Group the bins into batches as @ref BucketCollector does, and split the
+ * data to read for each into chunks as the reader thread does.
+ */
+static void makeBatches(const Workload &workload, const Config &config, std::vector<Batch> &batches)
+{
+    const std::size_t maxLoadSplats = config.memLoadSplats / sizeof(Splat);
+    const std::size_t maxChunk = config.readerBuffer / 8;
+    const std::vector<Bin> &bins = workload.bins;
+
+    std::size_t first = 0;
+    while (first < bins.size())
+    {
+        std::size_t last = first;
+        std::size_t splats = 0;
+        while (last < bins.size() && (last == first || splats + bins[last].splats <= maxLoadSplats))
+        {
+            splats += bins[last].splats;
+            last++;
+        }
+
+        Batch batch;
+        batch.firstBin = first;
+        batch.lastBin = last;
+        batch.cost = 0.0;
+        double readBytes = 0.0, readCost = 0.0, decodeCost = 0.0;
+        for (std::size_t i = first; i < last; i++)
+        {
+            batch.cost += bins[i].bucketCost + bins[i].mergeCost;
+            readBytes += bins[i].readBytes;
+            readCost += bins[i].readCost;
+            decodeCost += bins[i].decodeCost;
+        }
+        std::size_t numChunks = std::size_t(std::ceil(readBytes / maxChunk));
+        if (numChunks == 0 && readCost + decodeCost > 0.0)
+            numChunks = 1;
+        for (std::size_t i = 0; i < numChunks; i++)
+        {
+            Chunk chunk;
+            chunk.bytes = std::min(maxChunk, std::max(std::size_t(1), std::size_t(std::ceil(readBytes / numChunks))));
+            chunk.readCost = readCost / numChunks;
+            chunk.decodeCost = decodeCost / numChunks;
+            batch.chunks.push_back(chunk);
+        }
+        batches.push_back(batch);
+        first = last;
+    }
+}
+
+} // anonymous namespace
+
+Workload extractWorkload(const Timeplot::Trace &trace)
+{
+    Workload workload;
+    std::vector<Bin> &bins = workload.bins;
+
+    Timeplot::Trace::const_iterator mainPos = trace.find("main");
+    if (mainPos == trace.end())
+        throw std::runtime_error("Trace has no events for the main thread");
+    std::vector<LoadRecord> loads;
+    double passStart;
+    parseMain(mainPos->second, loads, bins, passStart);
+
+    Timeplot::Trace::const_iterator readerPos = trace.find("reader");
+    if (readerPos != trace.end())
+        parseReader(readerPos->second, loads);
+
+    std::vector<ItemRecord> items;
+    std::vector<DeviceRecord> deviceRecords;
+    std::vector<MesherRecord> mesherRecords;
+    double passStop = mainPos->second.back().stop;
+    bool haveCopy = false;
+    for (Timeplot::Trace::const_iterator i = trace.begin(); i != trace.end(); ++i)
+    {
+        if (startsWith(i->first, "copy."))
+        {
+            if (haveCopy)
+                throw std::runtime_error("Trace has more than one copy thread");
+            parseCopy(i->second, bins, items);
+            haveCopy = true;
+        }
+        else if (startsWith(i->first, "device."))
+            parseDevice(i->first, i->second, deviceRecords);
+        else if (startsWith(i->first, "mesher."))
+            parseMesher(i->second, mesherRecords, passStop);
+    }
+    if (!haveCopy)
+        throw std::runtime_error("Trace has no events for the copy thread");
+    if (deviceRecords.size() != items.size())
+        throw std::runtime_error("Trace is incomplete: "
+                                 + boost::lexical_cast<std::string>(items.size()) + " device items were sent but "
+                                 + boost::lexical_cast<std::string>(deviceRecords.size()) + " were processed");
+    std::stable_sort(deviceRecords.begin(), deviceRecords.end(), devicePoppedLess);
+    std::stable_sort(mesherRecords.begin(), mesherRecords.end(), mesherStartLess);
+
+    /* Meshes are input in the order they were pushed, so matching up the
+     * pushes with the inputs gives the mesher costs for each mesh.
+     */
+    std::vector<MeshPush> pushes;
+    for (std::size_t i = 0; i < deviceRecords.size(); i++)
+    {
+        const DeviceRecord &r = deviceRecords[i];
+        if (r.pushTimes.size() != r.meshBytes.size())
+            throw std::runtime_error("Trace is inconsistent: mesh allocations and pushes do not match");
+        for (std::size_t j = 0; j < r.pushTimes.size(); j++)
+            pushes.push_back(MeshPush(r.pushTimes[j], std::make_pair(i, j)));
+    }
+    if (pushes.size() != mesherRecords.size())
+        throw std::runtime_error("Trace is incomplete: "
+                                 + boost::lexical_cast<std::string>(pushes.size()) + " meshes were produced but "
+                                 + boost::lexical_cast<std::string>(mesherRecords.size()) + " were consumed");
+    std::stable_sort(pushes.begin(), pushes.end());
+    std::vector<std::vector<const MesherRecord *> > mesherFor(deviceRecords.size());
+    for (std::size_t i = 0; i < deviceRecords.size(); i++)
+        mesherFor[i].resize(deviceRecords[i].meshBytes.size());
+    for (std::size_t i = 0; i < pushes.size(); i++)
+        mesherFor[pushes[i].second.first][pushes[i].second.second] = &mesherRecords[i];
+
+    // Share the costs of each load between its bins
+    for (std::size_t i = 0; i < loads.size(); i++)
+    {
+        const LoadRecord &load = loads[i];
+        const double decodeCost = std::max(load.loadCost - load.readCost, 0.0);
+        for (std::size_t j = load.firstBin; j < load.lastBin; j++)
+        {
+            const double f = share(bins, load.firstBin, load.lastBin, j);
+            bins[j].bucketCost = f * load.bucketCost;
+            bins[j].mergeCost = f * load.mergeCost;
+            bins[j].readBytes = f * load.readBytes;
+            bins[j].readCost = f * load.readCost;
+            bins[j].decodeCost = f * decodeCost;
+        }
+    }
+
+    /* Share the costs of each device item between its bins, and assign each
+     * mesh to the bin that was being processed when it was emitted,
+     * assuming that the device time is spread evenly over the splats.
+     */
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        const ItemRecord &item = items[i];
+        const DeviceRecord &r = deviceRecords[i];
+        if (item.firstBin == item.lastBin)
+            continue;
+        double binStart = 0.0;
+        std::size_t mesh = 0;
+        for (std::size_t j = item.firstBin; j < item.lastBin; j++)
+        {
+            const double f = share(bins, item.firstBin, item.lastBin, j);
+            bins[j].deviceCost = f * r.cost;
+            bins[j].transferCost = f * item.transferCost;
+            const double binEnd = (j + 1 == item.lastBin)
+                ? std::numeric_limits<double>::infinity() : binStart + bins[j].deviceCost;
+            while (mesh < r.meshOffsets.size() && r.meshOffsets[mesh] < binEnd)
+            {
+                Mesh m;
+                m.bytes = r.meshBytes[mesh];
+                m.offset = std::min(std::max(r.meshOffsets[mesh] - binStart, 0.0), bins[j].deviceCost);
+                m.prepareCost = mesherFor[i][mesh]->prepareCost;
+                m.inputCost = mesherFor[i][mesh]->inputCost;
+                bins[j].meshes.push_back(m);
+                mesh++;
+            }
+            binStart += bins[j].deviceCost;
+        }
+    }
+
+    workload.recordedTime = passStop - passStart;
+    return workload;
+}
+
+Config::Config()
+    : memLoadSplats(256 * 1024 * 1024),
+    memHostSplats(512 * 1024 * 1024),
+    memBucketSplats(64 * 1024 * 1024),
+    memMesh(512 * 1024 * 1024),
+    readerBuffer(SplatSet::FileSet::DEFAULT_BUFFER_SIZE),
+    devices(1),
+    deviceThreads(1),
+    deviceSpare(1),
+    mesherThreads(1)
+{
+}
+
+Result simulate(const Workload &workload, const Config &config)
+{
+    MLSGPU_ASSERT(config.devices > 0, std::invalid_argument);
+    MLSGPU_ASSERT(config.deviceThreads > 0, std::invalid_argument);
+    MLSGPU_ASSERT(config.mesherThreads > 0, std::invalid_argument);
+    MLSGPU_ASSERT(config.readerBuffer >= 8, std::invalid_argument);
+
+    std::size_t maxSplats = 0;
+    std::size_t maxMesh = 0;
+    for (std::size_t i = 0; i < workload.bins.size(); i++)
+    {
+        const Bin &bin = workload.bins[i];
+        maxSplats = std::max(maxSplats, bin.splats);
+        for (std::size_t j = 0; j < bin.meshes.size(); j++)
+            maxMesh = std::max(maxMesh, bin.meshes[j].bytes);
+    }
+    if (maxSplats > config.memLoadSplats / sizeof(Splat))
+        throw std::runtime_error("--mem-load-splats is too small for the largest recorded bin");
+    if (maxSplats > config.memHostSplats / sizeof(Splat))
+        throw std::runtime_error("--mem-host-splats is too small for the largest recorded bin");
+    if (maxSplats > config.memBucketSplats / sizeof(Splat))
+        throw std::runtime_error("--mem-bucket-splats is too small for the largest recorded bin");
+    if (maxMesh > config.memMesh)
+        throw std::runtime_error("--mem-mesh is too small for the largest recorded mesh");
+
+    Pipeline p(workload, config);
+    makeBatches(workload, config, p.batches);
+
+    p.result.stages.push_back(StageResult("main", 1));
+    p.result.stages.push_back(StageResult("reader", 1));
+    p.result.stages.push_back(StageResult("copy", 1));
+    p.result.stages.push_back(StageResult("device", config.devices * config.deviceThreads));
+    p.result.stages.push_back(StageResult("mesher", config.mesherThreads));
+    std::vector<StageResult> &stages = p.result.stages;
+
+    p.processes.push_back(new MainProcess(p, stages[0]));
+    p.reader = new ReaderProcess(p, stages[1]);
+    p.processes.push_back(p.reader);
+    p.processes.push_back(new CopyProcess(p, stages[2]));
+    for (std::size_t i = 0; i < config.devices; i++)
+    {
+        Device *d = new Device;
+        d->freeSlots = config.deviceThreads + config.deviceSpare;
+        d->unallocated = d->freeSlots * (config.memBucketSplats / sizeof(Splat));
+        d->running = config.deviceThreads;
+        p.devices.push_back(d);
+        for (std::size_t j = 0; j < config.deviceThreads; j++)
+            p.processes.push_back(new DeviceProcess(p, stages[3], *d));
+    }
+    for (std::size_t i = 0; i < config.mesherThreads; i++)
+        p.processes.push_back(new MesherProcess(p, stages[4]));
+
+    for (std::size_t i = 0; i < p.processes.size(); i++)
+        if (&p.processes[i] != p.reader)
+            p.engine.schedule(&p.processes[i], 0.0);
+    p.engine.run();
+
+    // The reader never finishes, since it is idle between batches
+    if (p.finished + 1 != p.processes.size())
+        throw std::runtime_error("Simulated pipeline deadlocked");
+
+    p.result.time = p.engine.getTime();
+    p.result.loadBatches = p.batches.size();
+    p.result.deviceItems = p.deviceItems;
+    return p.result;
+}
+
+} // namespace Simulate
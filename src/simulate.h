@@ -0,0 +1,169 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Discrete-event simulation of the bucketing pass, driven by the costs
+ * recorded in a timeplot trace.
+ */
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "timeplot.h"
+
+/**
+ * Predicts how long the bucketing pass would take with different pipeline
+ * settings. A trace recorded with --timeplot (or --timeplot-binary) is
+ * reduced to a @ref Workload: the sequence of buckets (bins) emitted by the
+ * bucketer, with the time each stage spent on each of them. This is then
+ * replayed through a model of the worker groups and buffers set up by
+ * @ref SlaveWorkers:
+ *  - the main thread buckets, then for each batch of up to
+ *    --mem-load-splats splats merges the ranges, loads the splats (decoding
+ *    chunks produced by a reader thread through a circular buffer) and
+ *    copies each bin into the --mem-host-splats buffer;
+ *  - the copy thread packs bins into items of up to --mem-bucket-splats
+ *    splats and hands each to the device with a free slot and the most
+ *    unallocated space;
+ *  - each device has --device-threads workers sharing one more item slot
+ *    than there are workers, and emits meshes into the --mem-mesh buffer;
+ *  - the mesher threads prepare meshes concurrently but consume them in
+ *    order.
+ *
+ * Costs that are recorded per item are replayed exactly. Where a stage
+ * processes a group of bins at once (a load batch or a device item), its
+ * cost is shared between the bins in proportion to their splats, so that
+ * the groups can be re-formed for different capacities. The bins themselves
+ * are fixed by the recording, so the prediction for a different
+ * --mem-bucket-splats only accounts for the change in device items, and
+ * all simulated devices run at the speed of the recorded one.
+ */
+namespace Simulate
+{
+
+/// A mesh emitted by a device for a bin, and the costs of consuming it.
+struct Mesh
+{
+    std::size_t bytes;     ///< Space taken in the mesh buffer
+    double offset;         ///< Device time from the start of the bin until the mesh is emitted
+    double prepareCost;    ///< Time for the mesher's prepare functor (runs concurrently)
+    double inputCost;      ///< Time for the mesher's input functor (runs in order)
+
+    Mesh() : bytes(0), offset(0.0), prepareCost(0.0), inputCost(0.0) {}
+};
+
+/// A bin produced by the bucketer, with the time each stage spends on it.
+struct Bin
+{
+    std::size_t splats;    ///< Number of splats in the bin
+    double bucketCost;     ///< Main thread time in the bucketer
+    double mergeCost;      ///< Main thread time merging ranges before loading
+    double readBytes;      ///< Bytes read from the input files
+    double readCost;       ///< Reader thread time
+    double decodeCost;     ///< Main thread time decoding splats, beyond waiting for the reader
+    double writeCost;      ///< Main thread time copying the bin into the host buffer
+    double copyCost;       ///< Copy thread time copying the bin to pinned memory
+    double transferCost;   ///< Copy thread time waiting for the transfer to the device
+    double deviceCost;     ///< Device worker time
+    std::vector<Mesh> meshes; ///< Meshes emitted while processing the bin
+
+    Bin() : splats(0), bucketCost(0.0), mergeCost(0.0), readBytes(0.0), readCost(0.0),
+        decodeCost(0.0), writeCost(0.0), copyCost(0.0), transferCost(0.0), deviceCost(0.0) {}
+};
+
+/// Everything extracted from a trace
+struct Workload
+{
+    std::vector<Bin> bins;   ///< Bins in the order they were emitted
+    double recordedTime;     ///< Elapsed time of the recorded pass
+
+    Workload() : recordedTime(0.0) {}
+};
+
+/**
+ * Extract a workload from the bucketing pass of a trace. The trace must
+ * have been recorded with a single device, since workers on different
+ * devices share names. Multi-device traces can be replayed with
+ * utils/simulate.py instead.
+ *
+ * @throw std::runtime_error if the trace is incomplete or inconsistent.
+ */
+Workload extractWorkload(const Timeplot::Trace &trace);
+
+/**
+ * Pipeline settings to simulate. Memory sizes are in bytes, as for the
+ * corresponding command-line options, and default to the same values.
+ */
+struct Config
+{
+    std::size_t memLoadSplats;    ///< --mem-load-splats
+    std::size_t memHostSplats;    ///< --mem-host-splats
+    std::size_t memBucketSplats;  ///< --mem-bucket-splats
+    std::size_t memMesh;          ///< --mem-mesh
+    std::size_t readerBuffer;     ///< Size of the reader thread's buffer
+    std::size_t devices;          ///< Number of devices
+    std::size_t deviceThreads;    ///< --device-threads
+    std::size_t deviceSpare;      ///< Item slots per device beyond @ref deviceThreads
+    std::size_t mesherThreads;    ///< --mesher-threads
+
+    Config();
+};
+
+/// Time accounted to one stage of the simulated pipeline
+struct StageResult
+{
+    std::string name;      ///< Name of the stage
+    std::size_t workers;   ///< Number of threads in the stage
+    double busy;           ///< Total time the threads spent working
+
+    StageResult(const std::string &name, std::size_t workers)
+        : name(name), workers(workers), busy(0.0) {}
+};
+
+/// Outcome of @ref simulate
+struct Result
+{
+    double time;                      ///< Predicted elapsed time of the pass
+    std::size_t loadBatches;          ///< Number of batches loaded by the main thread
+    std::size_t deviceItems;          ///< Number of items sent to devices
+    std::vector<StageResult> stages;  ///< Busy time per stage
+
+    Result() : time(0.0), loadBatches(0), deviceItems(0) {}
+};
+
+/**
+ * Replay @a workload through the pipeline described by @a config.
+ *
+ * @throw std::runtime_error if a buffer in @a config is too small for the
+ * largest recorded allocation.
+ */
+Result simulate(const Workload &workload, const Config &config);
+
+} // namespace Simulate
+
+#endif /* !SIMULATE_H */
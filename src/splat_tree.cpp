@@ -27,9 +27,20 @@
 #if HAVE_CONFIG_H
 # include <config.h>
 #endif
+#ifdef _OPENMP
+# include <omp.h>
+#else
+# ifndef omp_get_num_threads
+#  define omp_get_num_threads() (1)
+# endif
+# ifndef omp_get_thread_num
+#  define omp_get_thread_num() (0)
+# endif
+#endif
 #include <vector>
 #include "tr1_cstdint.h"
 #include <algorithm>
+#include <cassert>
 #include <stdexcept>
 #include <limits>
 #include "errors.h"
@@ -62,6 +73,124 @@ struct Entry
     }
 };
 
+/**
+ * Computes an exclusive prefix sum of @a in into @a out, using all OpenMP
+ * threads. The result does not depend on the number of threads.
+ *
+ * @return The sum of all the elements.
+ */
+template<typename T>
+T parallelExclusiveScan(const std::vector<T> &in, std::vector<T> &out)
+{
+    const std::size_t n = in.size();
+    out.resize(n);
+    std::vector<T> partial;
+    T total = T();
+#ifdef _OPENMP
+#pragma omp parallel shared(in, out, partial, total)
+#endif
+    {
+        const std::size_t nThreads = omp_get_num_threads();
+        const std::size_t tid = omp_get_thread_num();
+#ifdef _OPENMP
+#pragma omp single
+#endif
+        {
+            partial.resize(nThreads + 1);
+        }
+        const std::size_t first = n * tid / nThreads;
+        const std::size_t last = n * (tid + 1) / nThreads;
+        T sum = T();
+        for (std::size_t i = first; i < last; i++)
+            sum += in[i];
+        partial[tid + 1] = sum;
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        {
+            partial[0] = T();
+            for (std::size_t i = 1; i <= nThreads; i++)
+                partial[i] += partial[i - 1];
+            total = partial[nThreads];
+        }
+        sum = partial[tid];
+        for (std::size_t i = first; i < last; i++)
+        {
+            T next = sum + in[i];
+            out[i] = sum;
+            sum = next;
+        }
+    }
+    return total;
+}
+
+/**
+ * Stable least-significant-digit radix sort of key/value pairs, using all
+ * OpenMP threads. Each thread histograms and scatters a contiguous slice of
+ * the input, and the slices are ordered by thread index within each digit,
+ * so the result is identical to a serial stable sort.
+ *
+ * @param keys, values  The data to sort (sorted in place).
+ * @param bits          Only the low @a bits bits of the keys are considered.
+ */
+template<typename Key, typename Value>
+void parallelRadixSort(std::vector<Key> &keys, std::vector<Value> &values, unsigned int bits)
+{
+    static const unsigned int digitBits = 8;
+    static const std::size_t radix = std::size_t(1) << digitBits;
+
+    const std::size_t n = keys.size();
+    std::vector<Key> tmpKeys(n);
+    std::vector<Value> tmpValues(n);
+    std::vector<std::size_t> offsets;
+
+    for (unsigned int shift = 0; shift < bits; shift += digitBits)
+    {
+#ifdef _OPENMP
+#pragma omp parallel shared(keys, values, tmpKeys, tmpValues, offsets, shift)
+#endif
+        {
+            const std::size_t nThreads = omp_get_num_threads();
+            const std::size_t tid = omp_get_thread_num();
+#ifdef _OPENMP
+#pragma omp single
+#endif
+            {
+                offsets.assign(nThreads * radix, 0);
+            }
+            const std::size_t first = n * tid / nThreads;
+            const std::size_t last = n * (tid + 1) / nThreads;
+            std::size_t *hist = &offsets[tid * radix];
+            for (std::size_t i = first; i < last; i++)
+                hist[(keys[i] >> shift) & (radix - 1)]++;
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+            {
+                // Digit-major, thread-minor exclusive scan
+                std::size_t sum = 0;
+                for (std::size_t d = 0; d < radix; d++)
+                    for (std::size_t t = 0; t < nThreads; t++)
+                    {
+                        std::size_t next = sum + offsets[t * radix + d];
+                        offsets[t * radix + d] = sum;
+                        sum = next;
+                    }
+            }
+            for (std::size_t i = first; i < last; i++)
+            {
+                std::size_t pos = hist[(keys[i] >> shift) & (radix - 1)]++;
+                tmpKeys[pos] = keys[i];
+                tmpValues[pos] = values[i];
+            }
+        }
+        keys.swap(tmpKeys);
+        values.swap(tmpValues);
+    }
+}
+
 } // anonymous namespace
 
 SplatTree::code_type SplatTree::makeCode(code_type x, code_type y, code_type z)
@@ -113,7 +242,75 @@ static bool splatCellIntersect(const Splat &splat, const Grid::difference_type c
     return dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2] <= splat.radius * splat.radius * 1.00001;
 }
 
-void SplatTree::initialize()
+unsigned int SplatTree::makeEntries(std::size_t splatId, unsigned int &level, code_type codes[]) const
+{
+    const Splat &splat = splats[splatId];
+    const float radius = splat.radius;
+    Grid::difference_type ilo[3], ihi[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        ilo[i] = Grid::RoundDown::convert(splat.position[i] - radius) - offset[i];
+        ihi[i] = Grid::RoundDown::convert(splat.position[i] + radius) - offset[i];
+    }
+
+    // Start with the deepest level, then coarsen until we don't
+    // take more than maxAmplify cells.
+    unsigned int shift = 0;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        ilo[i] = std::max(std::min(ilo[i], (Grid::difference_type) size[i] - 1), Grid::difference_type(0));
+        ihi[i] = std::max(std::min(ihi[i], (Grid::difference_type) size[i] - 1), Grid::difference_type(0));
+    }
+    while (true)
+    {
+        size_t sz[3];
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            sz[i] = (ihi[i] >> shift) - (ilo[i] >> shift) + 1;
+        }
+        if (sz[0] <= maxAmplify && sz[1] <= maxAmplify && sz[2] <= maxAmplify
+            && sz[0] * sz[1] * sz[2] <= maxAmplify)
+            break;
+        shift++;
+    }
+
+    // Check we haven't gone right past the coarsest level
+    assert(shift < numLevels);
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        ilo[i] >>= shift;
+        ihi[i] >>= shift;
+    }
+
+    level = shift;
+    unsigned int n = 0;
+    for (Grid::difference_type z = ilo[2]; z <= ihi[2]; z++)
+        for (Grid::difference_type y = ilo[1]; y <= ihi[1]; y++)
+            for (Grid::difference_type x = ilo[0]; x <= ihi[0]; x++)
+            {
+                Grid::difference_type c0[3], c1[3];
+                c0[0] = x << shift;
+                c0[1] = y << shift;
+                c0[2] = z << shift;
+                for (unsigned int i = 0; i < 3; i++)
+                {
+                    c1[i] = std::min((Grid::difference_type) size[i], c0[i] + (1 << shift));
+                    // bias both c0 and c1 back into splat coordinate system
+                    c0[i] += offset[i];
+                    c1[i] += offset[i];
+                }
+                if (splatCellIntersect(splat, c0, c1))
+                {
+                    // Check that the sphere hits the cell, not just the bbox
+                    // This is also where splats outside the grid get rejected
+                    codes[n++] = makeCode(x, y, z);
+                }
+            }
+    return n;
+}
+
+void SplatTree::initialize(BuildMethod method)
 {
     // Compute the number of levels and related data
     code_type maxSize = *std::max_element(size, size + 3);
@@ -122,78 +319,34 @@ void SplatTree::initialize()
         maxLevel++;
     numLevels = maxLevel + 1;
 
+    switch (method)
+    {
+    case BUILD_SERIAL:
+        initializeSerial();
+        break;
+    case BUILD_PARALLEL:
+        initializeParallel();
+        break;
+    }
+}
+
+void SplatTree::initializeSerial()
+{
     /* Make a list of all octree entries, initially ordered by splat ID.
      */
     std::vector<Entry> entries;
     entries.reserve(maxAmplify * splats.size());
     for (std::size_t splatId = 0; splatId < splats.size(); splatId++)
     {
-        const Splat &splat = splats[splatId];
-        const float radius = splat.radius;
-        Grid::difference_type ilo[3], ihi[3];
-        for (unsigned int i = 0; i < 3; i++)
-        {
-            ilo[i] = Grid::RoundDown::convert(splat.position[i] - radius) - offset[i];
-            ihi[i] = Grid::RoundDown::convert(splat.position[i] + radius) - offset[i];
-        }
-
-        // Start with the deepest level, then coarsen until we don't
-        // take more than maxAmplify cells.
-        unsigned int shift = 0;
-        for (unsigned int i = 0; i < 3; i++)
-        {
-            ilo[i] = std::max(std::min(ilo[i], (Grid::difference_type) size[i] - 1), Grid::difference_type(0));
-            ihi[i] = std::max(std::min(ihi[i], (Grid::difference_type) size[i] - 1), Grid::difference_type(0));
-        }
-        while (true)
-        {
-            size_t sz[3];
-            for (unsigned int i = 0; i < 3; i++)
-            {
-                sz[i] = (ihi[i] >> shift) - (ilo[i] >> shift) + 1;
-            }
-            if (sz[0] <= maxAmplify && sz[1] <= maxAmplify && sz[2] <= maxAmplify
-                && sz[0] * sz[1] * sz[2] <= maxAmplify)
-                break;
-            shift++;
-        }
-
-        // Check we haven't gone right past the coarsest level
-        assert(shift < numLevels);
-
-        for (unsigned int i = 0; i < 3; i++)
-        {
-            ilo[i] >>= shift;
-            ihi[i] >>= shift;
-        }
-
-        // Create entries for sorting
+        code_type codes[maxAmplify];
         Entry e;
         e.splatId = splatId;
-        e.level = shift;
-        for (Grid::difference_type z = ilo[2]; z <= ihi[2]; z++)
-            for (Grid::difference_type y = ilo[1]; y <= ihi[1]; y++)
-                for (Grid::difference_type x = ilo[0]; x <= ihi[0]; x++)
-                {
-                    Grid::difference_type c0[3], c1[3];
-                    c0[0] = x << shift;
-                    c0[1] = y << shift;
-                    c0[2] = z << shift;
-                    for (unsigned int i = 0; i < 3; i++)
-                    {
-                        c1[i] = std::min((Grid::difference_type) size[i], c0[i] + (1 << shift));
-                        // bias both c0 and c1 back into splat coordinate system
-                        c0[i] += offset[i];
-                        c1[i] += offset[i];
-                    }
-                    if (splatCellIntersect(splat, c0, c1))
-                    {
-                        // Check that the sphere hits the cell, not just the bbox
-                        // This is also where splats outside the grid get rejected
-                        e.code = makeCode(x, y, z);
-                        entries.push_back(e);
-                    }
-                }
+        unsigned int n = makeEntries(splatId, e.level, codes);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            e.code = codes[i];
+            entries.push_back(e);
+        }
     }
     stable_sort(entries.begin(), entries.end());
 
@@ -263,3 +416,142 @@ void SplatTree::initialize()
     command_type *realStart = allocateStart(start[0].size());
     std::copy(start[0].begin(), start[0].end(), realStart);
 }
+
+void SplatTree::initializeParallel()
+{
+    /* The (level, code) pairs are packed into a single key by giving each
+     * level a contiguous range, finest level first. This is the same layout
+     * used for the start array, so the key is also the index into it.
+     */
+    std::vector<std::size_t> levelOffset(numLevels + 1);
+    levelOffset[0] = 0;
+    for (unsigned int i = 0; i < numLevels; i++)
+        levelOffset[i + 1] = levelOffset[i] + (std::size_t(1) << (3 * (numLevels - 1 - i)));
+    const std::size_t numStart = levelOffset[numLevels];
+    unsigned int keyBits = 0;
+    while ((std::tr1::uint64_t(1) << keyBits) < numStart)
+        keyBits++;
+
+    /* Write up to maxAmplify entries per splat into fixed slots, then compact
+     * them. This keeps the entries ordered by splat ID, which the stable sort
+     * relies on to match the serial builder.
+     */
+    const std::size_t numSplats = splats.size();
+    std::vector<code_type> slotKeys(numSplats * maxAmplify);
+    std::vector<std::size_t> slotCount(numSplats);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (std::size_t splatId = 0; splatId < numSplats; splatId++)
+    {
+        unsigned int level;
+        code_type *codes = &slotKeys[splatId * maxAmplify];
+        unsigned int n = makeEntries(splatId, level, codes);
+        for (unsigned int i = 0; i < n; i++)
+            codes[i] += levelOffset[level];
+        slotCount[splatId] = n;
+    }
+
+    std::vector<std::size_t> slotOffset;
+    const std::size_t numEntries = parallelExclusiveScan(slotCount, slotOffset);
+    std::vector<code_type> keys(numEntries);
+    std::vector<command_type> splatIds(numEntries);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (std::size_t splatId = 0; splatId < numSplats; splatId++)
+    {
+        for (std::size_t i = 0; i < slotCount[splatId]; i++)
+        {
+            keys[slotOffset[splatId] + i] = slotKeys[splatId * maxAmplify + i];
+            splatIds[slotOffset[splatId] + i] = splatId;
+        }
+    }
+    std::vector<code_type>().swap(slotKeys);
+
+    parallelRadixSort(keys, splatIds, keyBits);
+
+    /* Each distinct key gets a header and a jump/terminate command around
+     * its splat IDs. An entry's position in the command array is thus its own
+     * index, plus one, plus two for every key preceding its own.
+     * keysBefore counts the keys that start before an entry, which includes
+     * its own key unless it is the first entry for that key.
+     */
+    std::vector<std::size_t> isFirst(numEntries), keysBefore;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (std::size_t i = 0; i < numEntries; i++)
+        isFirst[i] = (i == 0 || keys[i] != keys[i - 1]) ? 1 : 0;
+    const std::size_t numKeys = parallelExclusiveScan(isFirst, keysBefore);
+
+    // Matches the size computed by the serial builder, including when there are no entries
+    const std::size_t numCommands = numEntries + 2 * std::max(numKeys, std::size_t(1));
+    command_type *commands = allocateCommands(numCommands);
+
+    std::vector<command_type> start(numStart + 1, -1);
+    std::vector<command_type> jumpPos(numStart, -1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (std::size_t i = 0; i < numEntries; i++)
+    {
+        const std::size_t group = keysBefore[i] + isFirst[i] - 1;
+        const command_type pos = i + 1 + 2 * group;
+        commands[pos] = splatIds[i];
+        if (isFirst[i])
+            start[keys[i]] = pos - 1;
+        if (i + 1 == numEntries || keys[i] != keys[i + 1])
+            jumpPos[keys[i]] = pos + 1;
+    }
+
+    // build jumps and start array. The last element of start is a sentinel for the root.
+    for (int level = numLevels - 1; level >= 0; level--)
+    {
+        const std::size_t levelSize = levelOffset[level + 1] - levelOffset[level];
+        const std::size_t cur = levelOffset[level];
+        const std::size_t up = levelOffset[level + 1];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (std::size_t code = 0; code < levelSize; code++)
+        {
+            command_type upStart = start[up + (code >> 3)];
+            if (jumpPos[cur + code] != -1)
+            {
+                commands[jumpPos[cur + code]] = upStart;
+                commands[start[cur + code]] = jumpPos[cur + code];
+            }
+            else
+            {
+                start[cur + code] = upStart;
+            }
+        }
+    }
+
+    // Transfer start array to backing store
+    command_type *realStart = allocateStart(levelOffset[1]);
+    std::copy(start.begin(), start.begin() + levelOffset[1], realStart);
+}
+
+SplatTreeHost::SplatTreeHost(
+    const std::vector<Splat> &splats,
+    const Grid::size_type size[3],
+    const Grid::difference_type offset[3],
+    BuildMethod method)
+    : SplatTree(splats, size, offset)
+{
+    initialize(method);
+}
+
+SplatTree::command_type *SplatTreeHost::allocateCommands(std::size_t size)
+{
+    commands.resize(size);
+    return &commands[0];
+}
+
+SplatTree::command_type *SplatTreeHost::allocateStart(std::size_t size)
+{
+    start.resize(size);
+    return &start[0];
+}
@@ -94,9 +94,36 @@ public:
      */
     typedef std::tr1::uint32_t code_type;
 
+    /**
+     * Algorithms available to @ref initialize. They produce identical output.
+     */
+    enum BuildMethod
+    {
+        BUILD_SERIAL,      ///< Single-threaded, using a comparison sort
+        BUILD_PARALLEL     ///< Multi-threaded (with OpenMP), using a radix sort
+    };
+
 private:
     unsigned int numLevels; ///< Number of levels in the octree.
 
+    /**
+     * Determines the octree cells that a splat will be entered into.
+     *
+     * @param splatId        Index of the splat in @ref splats.
+     * @param[out] level     The octree level for the entries (0 is finest).
+     * @param[out] codes     Position codes of the cells within the level.
+     * @return The number of elements written to @a codes.
+     *
+     * @pre @ref numLevels has been set.
+     */
+    unsigned int makeEntries(std::size_t splatId, unsigned int &level, code_type codes[]) const;
+
+    /// Implementation of @ref initialize for @ref BUILD_SERIAL.
+    void initializeSerial();
+
+    /// Implementation of @ref initialize for @ref BUILD_PARALLEL.
+    void initializeParallel();
+
 protected:
     /**
      * The backing store of splats. These should not be changed after
@@ -126,8 +153,10 @@ protected:
      * into the allocated arrays, not read from them. Thus, it is
      * suitable for use with non-standard memory types with poor
      * read performance.
+     *
+     * @param method   The algorithm to use. The output does not depend on it.
      */
-    void initialize();
+    void initialize(BuildMethod method = BUILD_PARALLEL);
 
     /**
      * Allocate the command array.
@@ -180,4 +209,34 @@ public:
     static code_type makeCode(code_type x, code_type y, code_type z);
 };
 
+/**
+ * Concrete implementation of @ref SplatTree that stores the data in host
+ * memory.
+ */
+class SplatTreeHost : public SplatTree
+{
+private:
+    std::vector<command_type> commands;   ///< Backing store for the command array
+    std::vector<command_type> start;      ///< Backing store for the start array
+
+protected:
+    virtual command_type *allocateCommands(std::size_t size);
+    virtual command_type *allocateStart(std::size_t size);
+
+public:
+    /**
+     * Constructor. The octree is built immediately.
+     *
+     * @param splats, size, offset  See @ref SplatTree::SplatTree.
+     * @param method                Algorithm for building the tree.
+     */
+    SplatTreeHost(const std::vector<Splat> &splats,
+                  const Grid::size_type size[3],
+                  const Grid::difference_type offset[3],
+                  BuildMethod method = BUILD_PARALLEL);
+
+    const std::vector<command_type> &getCommands() const { return commands; }
+    const std::vector<command_type> &getStart() const { return start; }
+};
+
 #endif /* !SPLAT_TREE_H */
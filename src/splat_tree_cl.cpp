@@ -82,6 +82,8 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
     ans.addBuffer("entryKeys", (maxSplats * 8) * sizeof(code_type));
     // entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
     ans.addBuffer("entryValues", (maxSplats * 8) * sizeof(command_type));
+    // batchInfo = cl::Buffer(context, CL_MEM_READ_ONLY, MAX_BATCH * sizeof(cl_int4));
+    ans.addBuffer("batchInfo", MAX_BATCH * sizeof(cl_int4));
 
     // TODO: add in constant overheads for the scan and sort primitives
 
@@ -92,12 +94,13 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
                          std::size_t maxLevels, std::size_t maxSplats)
     :
     writeEntriesKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeEntries.time")),
+    writeEntriesBatchKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeEntriesBatch.time")),
     countCommandsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.countCommands.time")),
     writeSplatIdsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeSplatIds.time")),
     writeStartKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStart.time")),
     writeStartTopKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStartTop.time")),
     fillKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.fill.time")),
-    maxSplats(maxSplats), maxLevels(maxLevels), numSplats(0),
+    maxSplats(maxSplats), maxLevels(maxLevels), numSplats(0), treeStride(0),
     sort(context, device, clogs::TYPE_UINT, clogs::TYPE_INT),
     scan(context, device, clogs::TYPE_UINT)
 {
@@ -121,6 +124,7 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
     entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
     entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
+    batchInfo = cl::Buffer(context, CL_MEM_READ_ONLY, MAX_BATCH * sizeof(cl_int4));
 
     // Ensure that commands will be big enough to act as a temporary buffer
     BOOST_STATIC_ASSERT(sizeof(command_type) >= sizeof(code_type));
@@ -133,6 +137,7 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
 
     cl::Program program = CLH::build(context, "kernels/octree.cl", defines);
     writeEntriesKernel = cl::Kernel(program, "writeEntries");
+    writeEntriesBatchKernel = cl::Kernel(program, "writeEntriesBatch");
     countCommandsKernel = cl::Kernel(program, "countCommands");
     writeSplatIdsKernel = cl::Kernel(program, "writeSplatIds");
     fillKernel = cl::Kernel(program, "fill");
@@ -172,6 +177,37 @@ void SplatTreeCL::enqueueWriteEntries(
                               events, event, &writeEntriesKernelTime);
 }
 
+void SplatTreeCL::enqueueWriteEntriesBatch(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &keys,
+    const cl::Buffer &values,
+    const cl::Buffer &splats,
+    command_type firstSplat,
+    command_type numSplats,
+    std::size_t numTrees,
+    std::size_t minShift,
+    std::size_t maxShift,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    writeEntriesBatchKernel.setArg(0, keys);
+    writeEntriesBatchKernel.setArg(1, values);
+    writeEntriesBatchKernel.setArg(2, splats);
+    writeEntriesBatchKernel.setArg(3, batchInfo);
+    writeEntriesBatchKernel.setArg(4, (cl_uint) numTrees);
+    writeEntriesBatchKernel.setArg(5, cl::__local(sizeof(code_type) * (maxShift + 1)));
+    writeEntriesBatchKernel.setArg(6, (cl_uint) minShift);
+    writeEntriesBatchKernel.setArg(7, (cl_uint) maxShift);
+    writeEntriesBatchKernel.setArg(8, (cl_uint) firstSplat);
+
+    CLH::enqueueNDRangeKernel(queue,
+                              writeEntriesBatchKernel,
+                              cl::NullRange,
+                              cl::NDRange(numSplats),
+                              cl::NullRange,
+                              events, event, &writeEntriesBatchKernelTime);
+}
+
 void SplatTreeCL::enqueueCountCommands(
     const cl::CommandQueue &queue,
     const cl::Buffer &indicator,
@@ -266,46 +302,42 @@ void SplatTreeCL::enqueueWriteStart(
 }
 
 
-void SplatTreeCL::enqueueBuild(
-    const cl::CommandQueue &queue,
-    const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
-    const Grid::size_type size[3], const Grid::difference_type offset[3],
-    unsigned int subsamplingShift,
-    const std::vector<cl::Event> *events,
-    cl::Event *event)
+std::size_t SplatTreeCL::computeLevelOffsets(
+    std::size_t minShift, std::size_t maxShift, std::size_t numTrees)
 {
-    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
-    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
-    Grid::size_type maxSize = Grid::size_type(1U) << (maxLevels + subsamplingShift - 1);
-    MLSGPU_ASSERT(size[0] <= maxSize && size[1] <= maxSize && size[2] <= maxSize,
-                  std::length_error);
-    unsigned int maxShift = maxLevels + subsamplingShift - 1;
-    unsigned int minShift = std::min(subsamplingShift, maxShift);
-    // TODO: this will always construct a full-size octree, even if size[] only
-    // specifies a much smaller space. At a minimum, it should be possible to make
-    // levelOffsets more compact.
-
-    this->numSplats = numSplats;
     std::size_t pos = 0;
     levelOffsets.resize(maxShift + 1);
     for (std::size_t i = minShift; i <= maxShift; i++)
     {
         levelOffsets[i] = pos;
-        pos += 1U << (3 * (maxShift - i));
+        pos += numTrees << (3 * (maxShift - i));
     }
-    std::size_t numStart = pos;
+    treeStride = std::size_t(1) << (3 * (maxShift - minShift));
+    return pos;
+}
 
+void SplatTreeCL::enqueueBuildCommands(
+    const cl::CommandQueue &queue,
+    std::size_t numEntries, std::size_t numStart, std::size_t numTrees,
+    std::size_t minShift, std::size_t maxShift,
+    const cl::Event &writeEntriesEvent,
+    cl::Event *event)
+{
     std::vector<cl::Event> wait(1);
-
-    cl::Event writeEntriesEvent, sortEvent, countEvent, scanEvent,
+    cl::Event sortEvent, countEvent, scanEvent,
         writeSplatIdsEvent, levelEvent, fillJumpPosEvent;
-    this->splats = splats;
+
+    /* Invalid entries have a key of UINT_MAX. Only the low bits are sorted,
+     * so there must be enough that the truncated form still sorts after all
+     * valid keys.
+     */
+    unsigned int sortBits = 1;
+    while ((std::tr1::uint64_t(1) << sortBits) <= numStart)
+        sortBits++;
 
     // TODO: revisit this dependency tracking
-    const std::size_t numEntries = numSplats * 8;
-    enqueueWriteEntries(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats, offset, minShift, maxShift, events, &writeEntriesEvent);
     wait[0] = writeEntriesEvent;
-    sort.enqueue(queue, entryKeys, entryValues, numEntries, 3 * (maxShift - minShift) + 1, &wait, &sortEvent);
+    sort.enqueue(queue, entryKeys, entryValues, numEntries, sortBits, &wait, &sortEvent);
     wait[0] = sortEvent;
     enqueueCountCommands(queue, commandMap, entryKeys, numEntries, &wait, &countEvent);
     wait[0] = countEvent;
@@ -319,7 +351,7 @@ void SplatTreeCL::enqueueBuild(
 
     for (int i = maxShift; i >= int(minShift); i--)
     {
-        std::size_t levelSize = std::size_t(1) << (3 * (maxShift - i));
+        std::size_t levelSize = numTrees << (3 * (maxShift - i));
         bool havePrev = (i != int(maxShift));
         enqueueWriteStart(queue, start, commands, jumpPos,
                           levelOffsets[i],
@@ -334,6 +366,100 @@ void SplatTreeCL::enqueueBuild(
         *event = wait[0];
 }
 
+void SplatTreeCL::enqueueBuild(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
+    const Grid::size_type size[3], const Grid::difference_type offset[3],
+    unsigned int subsamplingShift,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
+    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
+    Grid::size_type maxSize = Grid::size_type(1U) << (maxLevels + subsamplingShift - 1);
+    MLSGPU_ASSERT(size[0] <= maxSize && size[1] <= maxSize && size[2] <= maxSize,
+                  std::length_error);
+    unsigned int maxShift = maxLevels + subsamplingShift - 1;
+    unsigned int minShift = std::min(subsamplingShift, maxShift);
+    // TODO: this will always construct a full-size octree, even if size[] only
+    // specifies a much smaller space. At a minimum, it should be possible to make
+    // levelOffsets more compact.
+
+    this->numSplats = numSplats;
+    std::size_t numStart = computeLevelOffsets(minShift, maxShift, 1);
+
+    cl::Event writeEntriesEvent;
+    this->splats = splats;
+
+    const std::size_t numEntries = numSplats * 8;
+    enqueueWriteEntries(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats, offset, minShift, maxShift, events, &writeEntriesEvent);
+    enqueueBuildCommands(queue, numEntries, numStart, 1, minShift, maxShift, writeEntriesEvent, event);
+}
+
+std::size_t SplatTreeCL::levelsForSize(const Grid::size_type size[3], unsigned int subsamplingShift)
+{
+    Grid::size_type maxSize = std::max(std::max(size[0], size[1]), size[2]);
+    std::size_t levels = 1;
+    while ((Grid::size_type(1U) << (levels + subsamplingShift - 1)) < maxSize)
+        levels++;
+    return levels;
+}
+
+std::size_t SplatTreeCL::maxBatchTrees(std::size_t levels) const
+{
+    MLSGPU_ASSERT(1 <= levels && levels <= maxLevels, std::length_error);
+    const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
+    const std::tr1::uint64_t treeStart = (std::tr1::uint64_t(1) << (3 * levels)) / 7;
+    return std::min(std::tr1::uint64_t(MAX_BATCH), maxStart / treeStart);
+}
+
+void SplatTreeCL::enqueueBuildBatch(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats,
+    const std::vector<BatchItem> &items,
+    std::size_t levels,
+    unsigned int subsamplingShift,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(!items.empty() && items.size() <= maxBatchTrees(levels), std::length_error);
+    const std::size_t firstSplat = items[0].firstSplat;
+    const std::size_t numTrees = items.size();
+
+    std::vector<cl_int4> hBatchInfo(numTrees);
+    std::size_t numSplats = 0;
+    for (std::size_t i = 0; i < numTrees; i++)
+    {
+        const BatchItem &item = items[i];
+        MLSGPU_ASSERT(item.firstSplat == firstSplat + numSplats, std::invalid_argument);
+        for (unsigned int j = 0; j < 3; j++)
+            hBatchInfo[i].s[j] = item.offset[j];
+        hBatchInfo[i].s[3] = numSplats;
+        numSplats += item.numSplats;
+    }
+    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
+    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
+
+    unsigned int maxShift = levels + subsamplingShift - 1;
+    unsigned int minShift = subsamplingShift;
+
+    this->numSplats = numSplats;
+    std::size_t numStart = computeLevelOffsets(minShift, maxShift, numTrees);
+
+    /* The table is tiny, so a blocking write is cheaper than keeping the host
+     * copy alive until the transfer completes.
+     */
+    queue.enqueueWriteBuffer(batchInfo, CL_TRUE, 0, numTrees * sizeof(cl_int4), &hBatchInfo[0]);
+
+    cl::Event writeEntriesEvent;
+    this->splats = splats;
+
+    const std::size_t numEntries = numSplats * 8;
+    enqueueWriteEntriesBatch(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats,
+                             numTrees, minShift, maxShift, events, &writeEntriesEvent);
+    enqueueBuildCommands(queue, numEntries, numStart, numTrees, minShift, maxShift, writeEntriesEvent, event);
+}
+
 void SplatTreeCL::clearSplats()
 {
     splats = cl::Buffer();
@@ -55,6 +55,11 @@ public:
     /**
      * Type used to represent values in the command table.
      * It needs enough bits to represent splat values and jump values.
+     *
+     * A 16-bit encoding (splat IDs relative to a page number stored at the
+     * head of each run) was measured and rejected: in the worst case every
+     * cell needs a run per page, so the table must be sized far beyond the
+     * splat count, and device usage grew from 69.5 to 112.6 MB at 7 levels.
      */
     typedef std::tr1::int32_t command_type;
 
@@ -88,13 +93,32 @@ public:
         MAX_SPLATS = 0x7FFFFFFF / 16
     };
 
+    enum
+    {
+        /**
+         * The maximum number of octrees that can be built together by
+         * @ref enqueueBuildBatch.
+         */
+        MAX_BATCH = 4096
+    };
+
+    /**
+     * Description of one octree in a batch built by @ref enqueueBuildBatch.
+     */
+    struct BatchItem
+    {
+        std::size_t firstSplat;            ///< Index of the first splat to use
+        std::size_t numSplats;             ///< Number of splats to use
+        Grid::difference_type offset[3];   ///< Offset of the octree within the overall grid
+    };
+
 private:
     /**
      * @name
      * @{
      * Kernels implementing the internal operations.
      */
-    cl::Kernel writeEntriesKernel, countCommandsKernel, writeSplatIdsKernel;
+    cl::Kernel writeEntriesKernel, writeEntriesBatchKernel, countCommandsKernel, writeSplatIdsKernel;
     cl::Kernel writeStartKernel, writeStartTopKernel;
     cl::Kernel fillKernel;
     /** @} */
@@ -105,6 +129,7 @@ private:
      * Statistics measuring time spent in each kernel.
      */
     Statistics::Variable &writeEntriesKernelTime;
+    Statistics::Variable &writeEntriesBatchKernelTime;
     Statistics::Variable &countCommandsKernelTime;
     Statistics::Variable &writeSplatIdsKernelTime;
     Statistics::Variable &writeStartKernelTime;
@@ -137,6 +162,7 @@ private:
     cl::Buffer jumpPos;      ///< Position in command array of jump command for each key (-1 if not present)
     cl::Buffer entryKeys;    ///< Sort keys for entries
     cl::Buffer entryValues;  ///< Splat IDs for entries
+    cl::Buffer batchInfo;    ///< Per-octree bias and first splat for @ref enqueueBuildBatch
     /** @} */
 
     std::size_t maxSplats;   ///< Maximum splats for which memory has been allocated
@@ -144,6 +170,33 @@ private:
 
     std::size_t numSplats;   ///< Number of splats in the octree
     std::vector<std::size_t> levelOffsets; ///< Start of each level in compacted arrays
+    std::size_t treeStride;  ///< Start array elements per octree in the finest level
+
+    /**
+     * Computes @ref levelOffsets and @ref treeStride for @a numTrees octrees
+     * with the given range of shifts.
+     *
+     * @return The total number of elements in the start array.
+     */
+    std::size_t computeLevelOffsets(std::size_t minShift, std::size_t maxShift, std::size_t numTrees);
+
+    /**
+     * Enqueues the parts of the build that follow @ref writeEntries or
+     * @ref writeEntriesBatch. These are independent of the number of octrees.
+     *
+     * @param queue         The command queue for the building operations.
+     * @param numEntries    Number of entries written (8 per splat).
+     * @param numStart      Total size of the start array, as returned by @ref computeLevelOffsets.
+     * @param numTrees      Number of octrees being built.
+     * @param minShift, maxShift Range of shifts passed to the entry-writing kernel.
+     * @param writeEntriesEvent Event signaled when the entries are written.
+     * @param[out] event    Event that fires when the octree is ready to use (or @c NULL).
+     */
+    void enqueueBuildCommands(const cl::CommandQueue &queue,
+                              std::size_t numEntries, std::size_t numStart, std::size_t numTrees,
+                              std::size_t minShift, std::size_t maxShift,
+                              const cl::Event &writeEntriesEvent,
+                              cl::Event *event);
 
     clogs::Radixsort sort;   ///< Sorter for sorting the entries
     clogs::Scan scan;        ///< Scanner for computing @ref commandMap
@@ -161,6 +214,19 @@ private:
                              const std::vector<cl::Event> *events,
                              cl::Event *event);
 
+    /// Wrapper to call @ref writeEntriesBatch
+    void enqueueWriteEntriesBatch(const cl::CommandQueue &queue,
+                                  const cl::Buffer &keys,
+                                  const cl::Buffer &values,
+                                  const cl::Buffer &splats,
+                                  command_type firstSplat,
+                                  command_type numSplats,
+                                  std::size_t numTrees,
+                                  std::size_t minShift,
+                                  std::size_t maxShift,
+                                  const std::vector<cl::Event> *events,
+                                  cl::Event *event);
+
     /// Wrapper to call @ref countCommands
     void enqueueCountCommands(const cl::CommandQueue &queue,
                               const cl::Buffer &indicator,
@@ -271,6 +337,65 @@ public:
                       const std::vector<cl::Event> *events = NULL,
                       cl::Event *event = NULL);
 
+    /**
+     * Computes the smallest number of levels for an octree covering @a size
+     * cells with the given subsampling. This is suitable to pass to
+     * @ref enqueueBuildBatch.
+     */
+    static std::size_t levelsForSize(const Grid::size_type size[3], unsigned int subsamplingShift);
+
+    /**
+     * Returns the maximum number of octrees with @a levels levels that can be
+     * built in a single call to @ref enqueueBuildBatch. This is limited by the
+     * memory allocated for a full-size octree, so it is 1 when @a levels is
+     * the value passed to the constructor.
+     *
+     * @pre 1 <= @a levels <= @a maxLevels passed to the constructor.
+     */
+    std::size_t maxBatchTrees(std::size_t levels) const;
+
+    /**
+     * Asynchronously builds several independent octrees with a single set of
+     * kernel launches. This is much more efficient than calling @ref
+     * enqueueBuild for each one when the octrees are small, since the cost is
+     * then dominated by launch overheads and by processing the unused parts
+     * of a full-size octree.
+     *
+     * The splats for the octrees must be stored consecutively in @a splats, in
+     * the same order as @a items. After the build, octree @a i is traversed
+     * by passing @ref getStartOffset(@a i) to @ref MlsFunctor::set.
+     *
+     * The same restrictions on concurrent use apply as for @ref enqueueBuild.
+     *
+     * @param queue         The command queue for the building operations.
+     * @param splats        The splats to use in the octrees.
+     * @param items         The splat range and offset for each octree.
+     * @param levels        The number of levels in each octree.
+     * @param subsamplingShift Number of fine levels to drop.
+     * @param events        Events to wait for (or @c NULL).
+     * @param[out] event    Event that fires when the octrees are ready to use (or @c NULL).
+     *
+     * @pre
+     * - @a items is non-empty and contains at most @ref maxBatchTrees(@a levels) elements.
+     * - <code>items[i + 1].firstSplat == items[i].firstSplat + items[i].numSplats</code>.
+     * - The total number of splats is at most @a maxSplats.
+     * - 1 <= @a levels <= @a maxLevels passed to the constructor.
+     */
+    void enqueueBuildBatch(const cl::CommandQueue &queue,
+                           const cl::Buffer &splats,
+                           const std::vector<BatchItem> &items,
+                           std::size_t levels,
+                           unsigned int subsamplingShift,
+                           const std::vector<cl::Event> *events = NULL,
+                           cl::Event *event = NULL);
+
+    /**
+     * Returns the position in the start array of the first cell for octree
+     * @a tree of the most recent build. For @ref enqueueBuild this is always
+     * zero.
+     */
+    std::size_t getStartOffset(std::size_t tree) const { return tree * treeStride; }
+
     /**
      * @name Getters for the buffers and images needed to use the octree.
      * These can be called at any time, and remain valid across a call to
@@ -292,6 +417,9 @@ public:
      */
     void clearSplats();
 
+    /// Get the maximum number of levels supported by the octree.
+    std::size_t getMaxLevels() const { return maxLevels; }
+
     /// Get the number of levels currently in the octree.
     std::size_t getNumLevels() const { return levelOffsets.size(); }
 };
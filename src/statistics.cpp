@@ -37,18 +37,44 @@
 #include <string>
 #include <stdexcept>
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <utility>
 #include <queue>
 #include <sstream>
 #include <boost/foreach.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/static_assert.hpp>
 #include <boost/ptr_container/serialize_ptr_map.hpp>
 #include "statistics.h"
 
 namespace Statistics
 {
 
+namespace detail
+{
+
+#if _MSC_VER
+# define STATISTICS_THREAD_LOCAL __declspec(thread)
+#else
+# define STATISTICS_THREAD_LOCAL __thread
+#endif
+
+/// One more than the shard assigned to this thread, or zero if not yet assigned
+static STATISTICS_THREAD_LOCAL unsigned int threadShard = 0;
+
+/// Counter used to assign shards round-robin
+static Atomic<unsigned int> nextShard(0);
+
+unsigned int currentShard()
+{
+    if (threadShard == 0)
+        threadShard = nextShard.fetchAdd(1) % numShards + 1;
+    return threadShard - 1;
+}
+
+} // namespace detail
+
 Statistic::Statistic(const std::string &name) : name(name)
 {
 }
@@ -92,61 +118,133 @@ void Statistic::serialize(Archive &ar, const unsigned int)
 }
 
 
-Counter::Counter(const std::string &name) : Statistic(name), total(0)
+Counter::Counter(const std::string &name) : Statistic(name)
 {
 }
 
 void Counter::write(std::ostream &o) const
 {
-    o << total;
+    o << getTotal();
 }
 
 void Counter::add(unsigned long long incr)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    total += incr;
+    shards[detail::currentShard()].total.fetchAdd(incr);
 }
 
 unsigned long long Counter::getTotal() const
 {
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < detail::numShards; i++)
+        total += shards[i].total.load();
     return total;
 }
 
 void Counter::merge(const Statistic &other)
 {
     const Counter &stat = dynamic_cast<const Counter &>(other);
-    total += stat.total;
+    shards[0].total.fetchAdd(stat.getTotal());
+}
+
+template<typename Archive>
+void Counter::save(Archive &ar, const unsigned int) const
+{
+    ar & boost::serialization::base_object<Statistic>(*this);
+    unsigned long long total = getTotal();
+    ar & total;
 }
 
 template<typename Archive>
-void Counter::serialize(Archive &ar, const unsigned int)
+void Counter::load(Archive &ar, const unsigned int)
 {
     ar & boost::serialization::base_object<Statistic>(*this);
+    unsigned long long total;
     ar & total;
+    shards[0].total.store(total);
+    for (unsigned int i = 1; i < detail::numShards; i++)
+        shards[i].total.store(0);
+}
+
+
+namespace
+{
+
+BOOST_STATIC_ASSERT(sizeof(double) == sizeof(std::tr1::uint64_t));
+
+/// Reads a double stored as its bit pattern
+double loadDouble(const Atomic<std::tr1::uint64_t> &bits)
+{
+    const std::tr1::uint64_t raw = bits.load();
+    double value;
+    std::memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+/// Writes a double as its bit pattern
+void storeDouble(Atomic<std::tr1::uint64_t> &bits, double value)
+{
+    std::tr1::uint64_t raw;
+    std::memcpy(&raw, &value, sizeof(raw));
+    bits.store(raw);
+}
+
+/// Atomically adds @a delta to a double stored as its bit pattern
+void addDouble(Atomic<std::tr1::uint64_t> &bits, double delta)
+{
+    std::tr1::uint64_t expected = bits.load();
+    while (true)
+    {
+        double value;
+        std::memcpy(&value, &expected, sizeof(value));
+        value += delta;
+        std::tr1::uint64_t desired;
+        std::memcpy(&desired, &value, sizeof(desired));
+        if (bits.compareExchange(expected, desired))
+            return;
+    }
 }
 
+} // anonymous namespace
 
-Variable::Variable(const std::string &name) : Statistic(name), sum(0.0), sum2(0.0), n(0)
+Variable::Variable(const std::string &name) : Statistic(name)
 {
 }
 
 void Variable::add(double value)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    sum += value;
-    sum2 += value * value;
-    n++;
+    Shard &shard = shards[detail::currentShard()];
+    addDouble(shard.sum, value);
+    addDouble(shard.sum2, value * value);
+    shard.n.fetchAdd(1);
+}
+
+void Variable::totals(double &sum, double &sum2, unsigned long long &n) const
+{
+    sum = 0.0;
+    sum2 = 0.0;
+    n = 0;
+    for (unsigned int i = 0; i < detail::numShards; i++)
+    {
+        const Shard &shard = shards[i];
+        sum += loadDouble(shard.sum);
+        sum2 += loadDouble(shard.sum2);
+        n += shard.n.load();
+    }
 }
 
 unsigned long long Variable::getNumSamples() const
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
+    double sum, sum2;
+    unsigned long long n;
+    totals(sum, sum2, n);
     return n;
 }
 
 double Variable::getMean() const
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
+    double sum, sum2;
+    unsigned long long n;
+    totals(sum, sum2, n);
     if (n < 1)
         throw std::length_error("Cannot compute mean without at least 1 sample");
     return sum / n;
@@ -157,7 +255,7 @@ double Variable::getStddev() const
     return std::sqrt(getVariance());
 }
 
-double Variable::getVarianceUnlocked() const
+double Variable::getVariance(double sum, double sum2, unsigned long long n)
 {
     if (n < 2)
         throw std::length_error("Cannot compute variance without at least 2 samples");
@@ -168,100 +266,134 @@ double Variable::getVarianceUnlocked() const
 
 double Variable::getVariance() const
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    return getVarianceUnlocked();
+    double sum, sum2;
+    unsigned long long n;
+    totals(sum, sum2, n);
+    return getVariance(sum, sum2, n);
 }
 
 void Variable::write(std::ostream &o) const
 {
+    double sum, sum2;
+    unsigned long long n;
+    totals(sum, sum2, n);
     if (n >= 1)
         o << sum << " : " << sum / n << ' ';
     if (n >= 2)
-        o << "+/- " << std::sqrt(getVarianceUnlocked()) << ' ';
+        o << "+/- " << std::sqrt(getVariance(sum, sum2, n)) << ' ';
     o << "[" << n << "]";
 }
 
 void Variable::merge(const Statistic &other)
 {
     const Variable &stat = dynamic_cast<const Variable &>(other);
-    sum += stat.sum;
-    sum2 += stat.sum2;
-    n += stat.n;
+    double sum, sum2;
+    unsigned long long n;
+    stat.totals(sum, sum2, n);
+
+    Shard &shard = shards[0];
+    addDouble(shard.sum, sum);
+    addDouble(shard.sum2, sum2);
+    shard.n.fetchAdd(n);
 }
 
 template<typename Archive>
-void Variable::serialize(Archive &ar, const unsigned int)
+void Variable::save(Archive &ar, const unsigned int) const
 {
     ar & boost::serialization::base_object<Statistic>(*this);
+    double sum, sum2;
+    unsigned long long n;
+    totals(sum, sum2, n);
     ar & sum;
     ar & sum2;
     ar & n;
 }
 
-
-Peak::Peak(const std::string &name) : Statistic(name), current(0), peak (0)
+template<typename Archive>
+void Variable::load(Archive &ar, const unsigned int)
 {
+    ar & boost::serialization::base_object<Statistic>(*this);
+    double sum, sum2;
+    unsigned long long n;
+    ar & sum;
+    ar & sum2;
+    ar & n;
+    storeDouble(shards[0].sum, sum);
+    storeDouble(shards[0].sum2, sum2);
+    shards[0].n.store(n);
+    for (unsigned int i = 1; i < detail::numShards; i++)
+    {
+        storeDouble(shards[i].sum, 0.0);
+        storeDouble(shards[i].sum2, 0.0);
+        shards[i].n.store(0);
+    }
 }
 
-void Peak::write(std::ostream &o) const
+
+Peak::Peak(const std::string &name) : Statistic(name), current(0), peak(0)
 {
-    o << peak;
 }
 
-void Peak::set(value_type x)
+void Peak::write(std::ostream &o) const
 {
-    current = x;
-    if (peak < current)
-        peak = current;
+    o << peak.load();
 }
 
 Peak &Peak::operator+=(value_type x)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    set(current + x);
+    peak.fetchMax(current.fetchAdd(x) + x);
     return *this;
 }
 
 Peak &Peak::operator-=(value_type x)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    set(current - x);
+    peak.fetchMax(current.fetchSub(x) - x);
     return *this;
 }
 
 Peak &Peak::operator=(value_type x)
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    set(x);
+    current.store(x);
+    peak.fetchMax(x);
     return *this;
 }
 
 Peak::value_type Peak::get() const
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    return current;
+    return current.load();
 }
 
 /// Retrieves the highest value that has been set.
 Peak::value_type Peak::getMax() const
 {
-    boost::lock_guard<boost::mutex> lock(mutex);
-    return peak;
+    return peak.load();
 }
 
 void Peak::merge(const Statistic &other)
 {
     const Peak &stat = dynamic_cast<const Peak &>(other);
-    if (stat.peak > peak)
-        peak = stat.peak;
+    peak.fetchMax(stat.peak.load());
+}
+
+template<typename Archive>
+void Peak::save(Archive &ar, const unsigned int) const
+{
+    ar & boost::serialization::base_object<Statistic>(*this);
+    value_type c = current.load();
+    value_type p = peak.load();
+    ar & c;
+    ar & p;
 }
 
 template<typename Archive>
-void Peak::serialize(Archive &ar, const unsigned int)
+void Peak::load(Archive &ar, const unsigned int)
 {
     ar & boost::serialization::base_object<Statistic>(*this);
-    ar & current;
-    ar & peak;
+    value_type c, p;
+    ar & c;
+    ar & p;
+    current.store(c);
+    peak.store(p);
 }
 
 
@@ -355,12 +487,12 @@ std::ostream &operator<<(std::ostream &o, const Registry &reg)
  */
 template void Statistic::serialize(boost::archive::text_oarchive &ar, const unsigned int version);
 template void Statistic::serialize(boost::archive::text_iarchive &ar, const unsigned int version);
-template void Counter::serialize(boost::archive::text_oarchive &ar, const unsigned int version);
-template void Counter::serialize(boost::archive::text_iarchive &ar, const unsigned int version);
-template void Variable::serialize(boost::archive::text_oarchive &ar, const unsigned int version);
-template void Variable::serialize(boost::archive::text_iarchive &ar, const unsigned int version);
-template void Peak::serialize(boost::archive::text_oarchive &ar, const unsigned int version);
-template void Peak::serialize(boost::archive::text_iarchive &ar, const unsigned int version);
+template void Counter::save(boost::archive::text_oarchive &ar, const unsigned int version) const;
+template void Counter::load(boost::archive::text_iarchive &ar, const unsigned int version);
+template void Variable::save(boost::archive::text_oarchive &ar, const unsigned int version) const;
+template void Variable::load(boost::archive::text_iarchive &ar, const unsigned int version);
+template void Peak::save(boost::archive::text_oarchive &ar, const unsigned int version) const;
+template void Peak::load(boost::archive::text_iarchive &ar, const unsigned int version);
 template void Registry::serialize(boost::archive::text_oarchive &ar, const unsigned int version);
 template void Registry::serialize(boost::archive::text_iarchive &ar, const unsigned int version);
 
@@ -28,6 +28,11 @@
  *  - Variables, which model a random variable and determine mean and standard deviation
  *  - Peaks, which measure the highest value of some variable (useful for e.g. memory allocation)
  *
+ * Counters and variables are split into shards, with each thread updating
+ * its own shard, so that threads do not contend on the same cache line. The
+ * shards are combined when the statistic is read. All three are updated with
+ * atomic operations rather than locks.
+ *
  * It also provides utility classes for interacting with timers.
  */
 
@@ -38,6 +43,7 @@
 # include <config.h>
 #endif
 
+#include <cstddef>
 #include <string>
 #include <ostream>
 #include <iterator>
@@ -55,6 +61,7 @@
 #include <memory>
 #include "timer.h"
 #include "tr1_cstdint.h"
+#include "atomic.h"
 
 class TestCounter;
 class TestVariable;
@@ -66,6 +73,22 @@ class TestPeak;
 namespace Statistics
 {
 
+namespace detail
+{
+    /// Number of shards in a @ref Counter or @ref Variable
+    static const unsigned int numShards = 16;
+
+    /// Size to which shards are padded, to keep them on separate cache lines
+    static const std::size_t shardAlign = 64;
+
+    /**
+     * Returns the shard that the calling thread should update. Threads are
+     * assigned shards round-robin on first use, so a shard is only shared
+     * once there are more than @ref numShards threads.
+     */
+    unsigned int currentShard();
+} // namespace detail
+
 /**
  * Object that holds accumulated data about a statistic. This is a virtual base
  * class that is subclassed to define different types of statistics. All subclasses
@@ -134,12 +157,24 @@ class Counter : public Statistic
     friend class ::TestCounter;
     friend class boost::serialization::access;
 private:
-    unsigned long long total;
+    /// Per-thread partial count
+    struct Shard
+    {
+        Atomic<unsigned long long> total;
+        char pad[detail::shardAlign - sizeof(unsigned long long)];
+    };
+
+    Shard shards[detail::numShards];
 
     Counter() : Statistic("") {} // for serialization
 
     template<typename Archive>
-    void serialize(Archive &ar, const unsigned int);
+    void save(Archive &ar, const unsigned int) const;
+
+    template<typename Archive>
+    void load(Archive &ar, const unsigned int);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 
 protected:
     virtual void write(std::ostream &o) const;
@@ -164,16 +199,37 @@ class Variable : public Statistic
     friend class ::TestVariable;
     friend class boost::serialization::access;
 private:
-    double sum;             ///< sum of samples
-    double sum2;            ///< sum of squares of samples
-    unsigned long long n;   ///< number of samples
+    /**
+     * Per-thread partial sums. The sums are doubles stored as their bit
+     * patterns, so that they can be updated with compare-and-swap. The fields
+     * are updated independently, so a reader that races with @ref add may
+     * see a sample that is only partly added.
+     */
+    struct Shard
+    {
+        Atomic<std::tr1::uint64_t> sum;     ///< sum of samples
+        Atomic<std::tr1::uint64_t> sum2;    ///< sum of squares of samples
+        Atomic<unsigned long long> n;       ///< number of samples
+        char pad[detail::shardAlign - 3 * sizeof(std::tr1::uint64_t)];
+    };
+
+    Shard shards[detail::numShards];
 
-    double getVarianceUnlocked() const;  ///< compute variance with the caller taking the lock
+    /// Combine the shards
+    void totals(double &sum, double &sum2, unsigned long long &n) const;
+
+    /// Compute variance from totals
+    static double getVariance(double sum, double sum2, unsigned long long n);
 
     Variable() : Statistic("") {} // for serialization
 
     template<typename Archive>
-    void serialize(Archive &ar, const unsigned int);
+    void save(Archive &ar, const unsigned int) const;
+
+    template<typename Archive>
+    void load(Archive &ar, const unsigned int);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 
 protected:
     virtual void write(std::ostream &o) const;
@@ -181,7 +237,7 @@ protected:
 public:
     Variable(const std::string &name);
 
-    /// Add a sample of the variable
+    /// Add a sample of the variable (lock-free)
     void add(double value);
 
     unsigned long long getNumSamples() const;   ///< Return the number of calls to @ref add
@@ -207,7 +263,7 @@ public:
 /**
  * Statistic class that measures the maximum value a variable takes. In the initial
  * state, the current value and the maximum are default-initialized. It is operated
- * on using @c =, @c += and @c -=.
+ * on using @c =, @c += and @c -=, which are lock-free.
  */
 class Peak : public Statistic
 {
@@ -217,24 +273,22 @@ public:
     typedef std::tr1::int64_t value_type;
 
 private:
-    value_type current;
-    value_type peak;
+    Atomic<value_type> current;
+    Atomic<value_type> peak;
 
-    Peak() : Statistic("") {} // for serialization
+    Peak() : Statistic(""), current(0), peak(0) {} // for serialization
 
     template<typename Archive>
-    void serialize(Archive &ar, const unsigned int);
+    void save(Archive &ar, const unsigned int) const;
+
+    template<typename Archive>
+    void load(Archive &ar, const unsigned int);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 
 protected:
     virtual void write(std::ostream &o) const;
 
-    /**
-     * Replaces the current value.
-     *
-     * @pre The caller must hold the lock.
-     */
-    void set(value_type x);
-
 public:
     /**
      * Construct, setting a name and default-initializing the current and maximum values.
@@ -379,6 +433,14 @@ public:
      * @}
      */
 
+    /**
+     * Call @a f on each statistic, in lexicographical order by name. Unlike
+     * the iterators, this is safe while other threads are adding statistics,
+     * but @a f must not access the registry.
+     */
+    template<typename Func>
+    void forEach(Func f) const;
+
     /**
      * Merge in samples from another registry. Statistics with the same
      * name are matched up. They must then have the same type, or else
@@ -419,6 +481,14 @@ T &Registry::getStatistic(const std::string &name)
     }
 }
 
+template<typename Func>
+void Registry::forEach(Func f) const
+{
+    boost::lock_guard<boost::mutex> _(mutex);
+    for (const_iterator i = begin(); i != end(); ++i)
+        f(*i);
+}
+
 /**
  * Retrieves a named statistic from the default registry.
  * This is shorthand for <code>Registry::getInstance().getStatistic<T>(name)</code>.
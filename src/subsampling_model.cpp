@@ -0,0 +1,310 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref SubsamplingModel.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <limits>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/locks.hpp>
+#include "subsampling_model.h"
+#include "splat_tree_cl.h"
+#include "errors.h"
+#include "statistics.h"
+
+/// Identifies the format written by @ref SubsamplingModel::save
+static const char * const modelMagic = "mlsgpu-subsampling-model";
+/// Version of the format written by @ref SubsamplingModel::save
+static const int modelVersion = 1;
+
+namespace
+{
+
+/// Parses fit data in the format written by @ref writeSums
+void readSums(
+    std::istream &in,
+    double xtx[SubsamplingModel::NUM_FEATURES][SubsamplingModel::NUM_FEATURES],
+    double xty[SubsamplingModel::NUM_FEATURES],
+    std::tr1::uint64_t &samples)
+{
+    const int n = SubsamplingModel::NUM_FEATURES;
+    std::string magic;
+    int version;
+
+    in >> magic >> version >> samples;
+    if (!in || magic != modelMagic || version != modelVersion)
+        throw std::runtime_error("Subsampling model has an unrecognised format");
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            in >> xtx[i][j];
+    for (int i = 0; i < n; i++)
+        in >> xty[i];
+    if (!in)
+        throw std::runtime_error("Subsampling model is truncated or corrupt");
+}
+
+/// Writes fit data in a form that can be read by @ref readSums
+void writeSums(
+    std::ostream &out,
+    const double xtx[SubsamplingModel::NUM_FEATURES][SubsamplingModel::NUM_FEATURES],
+    const double xty[SubsamplingModel::NUM_FEATURES],
+    std::tr1::uint64_t samples)
+{
+    const int n = SubsamplingModel::NUM_FEATURES;
+    std::streamsize oldPrecision = out.precision(17);
+    out << modelMagic << ' ' << modelVersion << '\n' << samples << '\n';
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+            out << (j > 0 ? " " : "") << xtx[i][j];
+        out << '\n';
+    }
+    for (int i = 0; i < n; i++)
+        out << (i > 0 ? " " : "") << xty[i];
+    out << '\n';
+    out.precision(oldPrecision);
+}
+
+} // anonymous namespace
+
+SubsamplingModel::SubsamplingModel(int minShift, int maxShift, int defaultShift)
+    : minShift(minShift), maxShift(maxShift), defaultShift(defaultShift),
+    samples(0), recordedSamples(0), calls(0)
+{
+    MLSGPU_ASSERT(minShift <= defaultShift && defaultShift <= maxShift, std::invalid_argument);
+    for (int i = 0; i < NUM_FEATURES; i++)
+    {
+        for (int j = 0; j < NUM_FEATURES; j++)
+            xtx[i][j] = recordedXtx[i][j] = 0.0;
+        xty[i] = recordedXty[i] = 0.0;
+    }
+    for (int s = minShift; s <= maxShift; s++)
+    {
+        timeStats.push_back(&Statistics::getStatistic<Statistics::Variable>(
+                "device.subsampling." + boost::lexical_cast<std::string>(s) + ".time"));
+    }
+}
+
+void SubsamplingModel::features(
+    std::size_t numSplats, const Grid::size_type size[3], int shift, double out[NUM_FEATURES])
+{
+    const double vertices = double(size[0]) * size[1] * size[2];
+    const double cellVertices = std::ldexp(1.0, 3 * shift);
+    const std::size_t levels = SplatTreeCL::levelsForSize(size, shift);
+
+    /* Assuming uniform density, each vertex tests the splats in a cell of
+     * cellVertices vertices, but no more than all of them.
+     */
+    out[0] = numSplats * std::min(cellVertices, vertices);
+    out[1] = std::ldexp(1.0, 3 * levels) / 7.0;
+    out[2] = vertices;
+    out[3] = numSplats;
+}
+
+bool SubsamplingModel::solve(double coef[NUM_FEATURES]) const
+{
+    if (samples < MIN_SAMPLES)
+        return false;
+
+    /* The features have wildly different scales, so the problem is first
+     * normalised to a unit diagonal. A small ridge term keeps it solvable
+     * when some features have not varied (e.g. only one shift seen).
+     */
+    const double ridge = 1e-6;
+    double scale[NUM_FEATURES];
+    double a[NUM_FEATURES][NUM_FEATURES + 1];
+    for (int i = 0; i < NUM_FEATURES; i++)
+        scale[i] = xtx[i][i] > 0.0 ? 1.0 / std::sqrt(xtx[i][i]) : 0.0;
+    for (int i = 0; i < NUM_FEATURES; i++)
+    {
+        for (int j = 0; j < NUM_FEATURES; j++)
+            a[i][j] = xtx[i][j] * scale[i] * scale[j];
+        a[i][i] += ridge + (scale[i] == 0.0 ? 1.0 : 0.0);
+        a[i][NUM_FEATURES] = xty[i] * scale[i];
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int i = 0; i < NUM_FEATURES; i++)
+    {
+        int pivot = i;
+        for (int j = i + 1; j < NUM_FEATURES; j++)
+            if (std::abs(a[j][i]) > std::abs(a[pivot][i]))
+                pivot = j;
+        for (int k = 0; k <= NUM_FEATURES; k++)
+            std::swap(a[i][k], a[pivot][k]);
+        for (int j = i + 1; j < NUM_FEATURES; j++)
+        {
+            double f = a[j][i] / a[i][i];
+            for (int k = i; k <= NUM_FEATURES; k++)
+                a[j][k] -= f * a[i][k];
+        }
+    }
+    for (int i = NUM_FEATURES - 1; i >= 0; i--)
+    {
+        double sum = a[i][NUM_FEATURES];
+        for (int j = i + 1; j < NUM_FEATURES; j++)
+            sum -= a[i][j] * coef[j];
+        coef[i] = sum / a[i][i];
+    }
+
+    /* Every term is a cost, so a negative coefficient is just noise.
+     * Clamping is cheaper than a true non-negative least squares fit and
+     * good enough for ranking the candidates.
+     */
+    for (int i = 0; i < NUM_FEATURES; i++)
+        coef[i] = std::max(coef[i] * scale[i], 0.0);
+    return true;
+}
+
+int SubsamplingModel::choose(std::size_t numSplats, const Grid::size_type size[3], std::size_t maxLevels)
+{
+    std::vector<int> candidates;
+    for (int s = minShift; s <= maxShift; s++)
+        if (SplatTreeCL::levelsForSize(size, s) <= maxLevels)
+            candidates.push_back(s);
+    if (candidates.empty())
+        return defaultShift;
+
+    double coef[NUM_FEATURES];
+    bool fitted;
+    std::tr1::uint64_t call;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        call = calls++;
+        fitted = solve(coef);
+    }
+
+    if (call % EXPLORE_INTERVAL == EXPLORE_INTERVAL - 1)
+        return candidates[(call / EXPLORE_INTERVAL) % candidates.size()];
+    if (!fitted)
+        return defaultShift;
+
+    int best = defaultShift;
+    double bestTime = std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < candidates.size(); i++)
+    {
+        double f[NUM_FEATURES];
+        features(numSplats, size, candidates[i], f);
+        double t = 0.0;
+        for (int j = 0; j < NUM_FEATURES; j++)
+            t += coef[j] * f[j];
+        if (t < bestTime)
+        {
+            bestTime = t;
+            best = candidates[i];
+        }
+    }
+    return best;
+}
+
+void SubsamplingModel::record(int shift, const double f[NUM_FEATURES], double seconds)
+{
+    MLSGPU_ASSERT(minShift <= shift && shift <= maxShift, std::out_of_range);
+    timeStats[shift - minShift]->add(seconds);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (int i = 0; i < NUM_FEATURES; i++)
+    {
+        for (int j = 0; j < NUM_FEATURES; j++)
+        {
+            xtx[i][j] += f[i] * f[j];
+            recordedXtx[i][j] += f[i] * f[j];
+        }
+        xty[i] += f[i] * seconds;
+        recordedXty[i] += f[i] * seconds;
+    }
+    samples++;
+    recordedSamples++;
+}
+
+double SubsamplingModel::predict(const double f[NUM_FEATURES]) const
+{
+    double coef[NUM_FEATURES];
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (!solve(coef))
+            return -1.0;
+    }
+    double t = 0.0;
+    for (int i = 0; i < NUM_FEATURES; i++)
+        t += coef[i] * f[i];
+    return t;
+}
+
+std::tr1::uint64_t SubsamplingModel::getSamples() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return samples;
+}
+
+void SubsamplingModel::load(std::istream &in)
+{
+    double newXtx[NUM_FEATURES][NUM_FEATURES];
+    double newXty[NUM_FEATURES];
+    std::tr1::uint64_t newSamples;
+    readSums(in, newXtx, newXty, newSamples);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::copy(&newXtx[0][0], &newXtx[0][0] + NUM_FEATURES * NUM_FEATURES, &xtx[0][0]);
+    std::copy(newXty, newXty + NUM_FEATURES, xty);
+    samples = newSamples;
+}
+
+void SubsamplingModel::merge(std::istream &in)
+{
+    double newXtx[NUM_FEATURES][NUM_FEATURES];
+    double newXty[NUM_FEATURES];
+    std::tr1::uint64_t newSamples;
+    readSums(in, newXtx, newXty, newSamples);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (int i = 0; i < NUM_FEATURES; i++)
+    {
+        for (int j = 0; j < NUM_FEATURES; j++)
+            xtx[i][j] += newXtx[i][j];
+        xty[i] += newXty[i];
+    }
+    samples += newSamples;
+}
+
+void SubsamplingModel::save(std::ostream &out) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    writeSums(out, xtx, xty, samples);
+}
+
+void SubsamplingModel::saveRecorded(std::ostream &out) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    writeSums(out, recordedXtx, recordedXty, recordedSamples);
+}
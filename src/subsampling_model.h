@@ -0,0 +1,185 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Cost model for choosing the octree subsampling per bucket.
+ */
+
+#ifndef SUBSAMPLING_MODEL_H
+#define SUBSAMPLING_MODEL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "tr1_cstdint.h"
+#include "grid.h"
+#include "statistics.h"
+
+/**
+ * Chooses the octree subsampling shift for each bucket, based on a linear
+ * model of the device time. The model has the form
+ * \f[ t = \sum_i c_i f_i \f]
+ * where the features \f$f_i\f$ are computed by @ref features from the
+ * number of splats, the size of the region and the candidate shift. The
+ * coefficients are fitted by least squares to the times passed to @ref
+ * record. The sums that define the fit can be saved and loaded, so that the
+ * model continues to be refined across runs.
+ *
+ * Until enough samples are available, the default shift is used. Even once
+ * the model is fitted, every @ref EXPLORE_INTERVAL-th choice cycles through
+ * the other legal shifts, so that the fit stays well-conditioned.
+ *
+ * All public methods are thread-safe.
+ */
+class SubsamplingModel : public boost::noncopyable
+{
+public:
+    enum
+    {
+        /// Number of terms in the model
+        NUM_FEATURES = 4,
+        /// Number of samples needed before the model is used
+        MIN_SAMPLES = 16,
+        /// Interval between exploratory choices
+        EXPLORE_INTERVAL = 16
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param minShift      Smallest shift to consider.
+     * @param maxShift      Largest shift to consider.
+     * @param defaultShift  Shift to use until the model has been fitted.
+     *
+     * @pre @a minShift <= @a defaultShift <= @a maxShift.
+     */
+    SubsamplingModel(int minShift, int maxShift, int defaultShift);
+
+    /**
+     * Computes the features for a bucket. The terms approximate, respectively,
+     * the number of splat-corner tests in MLS, the size of the octree start
+     * array, the number of corners and the number of splats.
+     *
+     * @param numSplats     Number of splats in the bucket.
+     * @param size          Number of vertices to process in each dimension.
+     * @param shift         Candidate subsampling shift.
+     * @param[out] out      The features.
+     */
+    static void features(std::size_t numSplats, const Grid::size_type size[3], int shift,
+                         double out[NUM_FEATURES]);
+
+    /**
+     * Chooses the shift for a bucket.
+     *
+     * @param numSplats     Number of splats in the bucket.
+     * @param size          Number of vertices to process in each dimension.
+     * @param maxLevels     Number of levels available in the octree. Shifts
+     *                      that would need more levels are not considered.
+     */
+    int choose(std::size_t numSplats, const Grid::size_type size[3], std::size_t maxLevels);
+
+    /**
+     * Adds a measurement to the model.
+     *
+     * @param shift         The shift that was used.
+     * @param f             Features for the work that was timed (features of
+     *                      several buckets may be summed).
+     * @param seconds       Time taken.
+     */
+    void record(int shift, const double f[NUM_FEATURES], double seconds);
+
+    /**
+     * Predicts the time for a set of features, using the current fit. If
+     * there are not enough samples, returns a negative value.
+     */
+    double predict(const double f[NUM_FEATURES]) const;
+
+    /// Returns the number of samples used in the fit.
+    std::tr1::uint64_t getSamples() const;
+
+    /**
+     * Replaces the accumulated fit data with data previously written with
+     * @ref save.
+     *
+     * @throw std::runtime_error if the data is malformed.
+     */
+    void load(std::istream &in);
+
+    /// Writes the accumulated fit data in a form understood by @ref load.
+    void save(std::ostream &out) const;
+
+    /**
+     * Writes only the fit data passed to @ref record by this object, in the
+     * same format as @ref save. This allows several models that started
+     * from the same file to be combined with @ref merge without counting
+     * the loaded data more than once.
+     */
+    void saveRecorded(std::ostream &out) const;
+
+    /**
+     * Adds fit data previously written with @ref save or @ref saveRecorded
+     * to the accumulated fit data.
+     *
+     * @throw std::runtime_error if the data is malformed.
+     */
+    void merge(std::istream &in);
+
+private:
+    const int minShift, maxShift, defaultShift;
+
+    /// Mutex protecting the fit data
+    mutable boost::mutex mutex;
+
+    /// Sum of outer products of the features
+    double xtx[NUM_FEATURES][NUM_FEATURES];
+    /// Sum of features scaled by the times
+    double xty[NUM_FEATURES];
+    /// Number of samples in the sums
+    std::tr1::uint64_t samples;
+    /// Part of @ref xtx contributed by @ref record
+    double recordedXtx[NUM_FEATURES][NUM_FEATURES];
+    /// Part of @ref xty contributed by @ref record
+    double recordedXty[NUM_FEATURES];
+    /// Part of @ref samples contributed by @ref record
+    std::tr1::uint64_t recordedSamples;
+    /// Number of calls to @ref choose, used to schedule exploration
+    std::tr1::uint64_t calls;
+
+    /// Time taken with each shift (indexed by shift - @ref minShift)
+    std::vector<Statistics::Variable *> timeStats;
+
+    /**
+     * Solves the least squares problem for the coefficients. The mutex must
+     * be held by the caller.
+     *
+     * @return false if there are not enough samples.
+     */
+    bool solve(double coef[NUM_FEATURES]) const;
+};
+
+#endif /* !SUBSAMPLING_MODEL_H */
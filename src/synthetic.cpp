@@ -0,0 +1,681 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of the synthetic point cloud generator.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <locale>
+#include <boost/lexical_cast.hpp>
+#include <boost/tr1/random.hpp>
+#include "tr1_cstdint.h"
+#include "synthetic.h"
+#include "errors.h"
+
+namespace Synthetic
+{
+
+const char * const inputPrefix = "synthetic:";
+
+namespace
+{
+
+const float pi = 3.14159265358979323846f;
+
+/// Cells along each side of a patch that may contain a hole
+const int holeCells = 8;
+/// Radius of a hole, as a fraction of a hole cell
+const float holeRadius = 0.35f;
+/// Maximum displacement of a hole center from its cell center, as a fraction of a cell
+const float holeJitter = 0.1f;
+/// Number of times a sample in a hole is moved along its row before falling back
+const int holeRetries = 4;
+/// Spatial frequency of the density variation, in cycles per patch
+const int densityCycles = 2;
+
+/// Finalizer from SplitMix64, which turns a counter into well-mixed bits
+inline std::tr1::uint64_t mix(std::tr1::uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/// Pseudo-random bits that depend only on the arguments
+inline std::tr1::uint64_t hash(std::tr1::uint32_t seed, std::tr1::uint64_t id, unsigned int salt)
+{
+    return mix(mix(id + 0x9e3779b97f4a7c15ULL * (salt + 1)) ^ (std::tr1::uint64_t(seed) << 32 | salt));
+}
+
+/// Uniform value in [0, 1) from hash bits
+inline float unit(std::tr1::uint64_t h)
+{
+    return (h >> 40) * (1.0f / 16777216.0f);
+}
+
+/// Approximately normally-distributed value with zero mean and unit variance
+inline float gaussian(std::tr1::uint32_t seed, std::tr1::uint64_t id, unsigned int salt)
+{
+    const std::tr1::uint64_t h = hash(seed, id, salt);
+    // Sum of four 16-bit uniforms, which has variance 4/12
+    float sum = 0.0f;
+    for (int i = 0; i < 4; i++)
+        sum += ((h >> (16 * i)) & 0xffff) * (1.0f / 65536.0f);
+    return (sum - 2.0f) * 1.7320508f;
+}
+
+/// Warp applied to each parameter to vary the sampling density
+inline float warp(float t, float d)
+{
+    const float w = 2.0f * pi * densityCycles;
+    return t - d * std::sin(w * t) / w;
+}
+
+/// Derivative of @ref warp
+inline float warpDerivative(float t, float d)
+{
+    return 1.0f - d * std::cos(2.0f * pi * densityCycles * t);
+}
+
+inline float length(const float v[3])
+{
+    return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+inline void normalize(float v[3])
+{
+    const float l = length(v);
+    for (int i = 0; i < 3; i++)
+        v[i] /= l;
+}
+
+inline void cross(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+bool cpuLittleEndian()
+{
+    std::tr1::uint32_t x = 0x12345678;
+    std::tr1::uint8_t y[4];
+
+    std::memcpy(y, &x, 4);
+    return y[0] == 0x78;
+}
+
+/// Parse a floating-point value for key @a key in the range [@a lo, @a hi]
+float parseFloat(const std::string &key, const std::string &value, float lo, float hi)
+{
+    float ans;
+    try
+    {
+        ans = boost::lexical_cast<float>(value);
+    }
+    catch (boost::bad_lexical_cast &e)
+    {
+        throw std::runtime_error("Synthetic cloud: invalid value for " + key + ": " + value);
+    }
+    if (!(ans >= lo && ans <= hi))
+        throw std::runtime_error("Synthetic cloud: value for " + key + " is out of range: " + value);
+    return ans;
+}
+
+} // anonymous namespace
+
+Params::Params()
+    : scene(SCENE_TERRAIN), order(ORDER_SCAN), numSplats(1000000), seed(1),
+    size(1000.0f), density(0.0f), holes(0.0f), noise(0.0f), radiusScale(1.5f)
+{
+}
+
+Params parseParams(const std::string &description)
+{
+    Params params;
+    const std::string::size_type colon = description.find(':');
+    const std::string scene = description.substr(0, colon);
+    if (scene == "terrain")
+        params.scene = SCENE_TERRAIN;
+    else if (scene == "facades")
+        params.scene = SCENE_FACADES;
+    else if (scene == "spheres")
+        params.scene = SCENE_SPHERES;
+    else
+        throw std::runtime_error("Synthetic cloud: unknown scene " + scene);
+
+    if (colon == std::string::npos)
+        return params;
+
+    std::istringstream in(description.substr(colon + 1));
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        const std::string::size_type eq = item.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("Synthetic cloud: expected key=value, not " + item);
+        const std::string key = item.substr(0, eq);
+        const std::string value = item.substr(eq + 1);
+        if (key == "splats")
+        {
+            // Parse as double so that exponent notation can be used
+            double n;
+            try
+            {
+                n = boost::lexical_cast<double>(value);
+            }
+            catch (boost::bad_lexical_cast &e)
+            {
+                throw std::runtime_error("Synthetic cloud: invalid value for splats: " + value);
+            }
+            if (!(n >= 1.0 && n <= 9007199254740992.0 && n == std::floor(n)))
+                throw std::runtime_error("Synthetic cloud: value for splats is out of range: " + value);
+            params.numSplats = std::tr1::uint64_t(n);
+        }
+        else if (key == "seed")
+        {
+            try
+            {
+                params.seed = boost::lexical_cast<std::tr1::uint32_t>(value);
+            }
+            catch (boost::bad_lexical_cast &e)
+            {
+                throw std::runtime_error("Synthetic cloud: invalid value for seed: " + value);
+            }
+        }
+        else if (key == "size")
+            params.size = parseFloat(key, value, 1e-3f, 1e9f);
+        else if (key == "density")
+            params.density = parseFloat(key, value, 0.0f, 0.95f);
+        else if (key == "holes")
+            params.holes = parseFloat(key, value, 0.0f, 1.0f);
+        else if (key == "noise")
+            params.noise = parseFloat(key, value, 0.0f, 10.0f);
+        else if (key == "radius")
+            params.radiusScale = parseFloat(key, value, 1e-3f, 100.0f);
+        else if (key == "order")
+        {
+            if (value == "scan")
+                params.order = ORDER_SCAN;
+            else if (value == "random")
+                params.order = ORDER_RANDOM;
+            else
+                throw std::runtime_error("Synthetic cloud: unknown order " + value);
+        }
+        else
+            throw std::runtime_error("Synthetic cloud: unknown key " + key);
+    }
+    return params;
+}
+
+Generator::Generator(const Params &params) : params(params), permuteBits(1)
+{
+    MLSGPU_ASSERT(params.numSplats > 0, std::invalid_argument);
+
+    // The layout is chosen by a separate engine so that it depends only on the seed
+    std::tr1::mt19937 engine(params.seed);
+    std::tr1::uniform_real<float> dist(0.0f, 1.0f);
+    std::tr1::variate_generator<std::tr1::mt19937 &, std::tr1::uniform_real<float> > gen(engine, dist);
+    const float size = params.size;
+
+    switch (params.scene)
+    {
+    case SCENE_TERRAIN:
+        {
+            for (int i = 0; i < 6; i++)
+            {
+                const float wavelength = size / (2 << i) * (0.75f + 0.5f * gen());
+                const float angle = 2.0f * pi * gen();
+                Wave w;
+                w.kx = 2.0f * pi / wavelength * std::cos(angle);
+                w.ky = 2.0f * pi / wavelength * std::sin(angle);
+                w.phase = 2.0f * pi * gen();
+                w.amplitude = wavelength * 0.05f;
+                waves.push_back(w);
+            }
+            const float origin[3] = {0.0f, 0.0f, 0.0f};
+            addHeightfield(origin, size, size);
+        }
+        break;
+    case SCENE_FACADES:
+        {
+            /* A grid of blocks, each with one building. The ground around
+             * each building is split into four strips so that no ground is
+             * sampled inside the building.
+             */
+            const int blocks = 8;
+            const float cell = size / blocks;
+            for (int by = 0; by < blocks; by++)
+                for (int bx = 0; bx < blocks; bx++)
+                {
+                    const float cx = bx * cell;
+                    const float cy = by * cell;
+                    const float w = cell * (0.4f + 0.4f * gen());
+                    const float d = cell * (0.4f + 0.4f * gen());
+                    const float h = cell * (0.3f + 1.7f * gen());
+                    const float x0 = cx + (cell - w) * gen();
+                    const float y0 = cy + (cell - d) * gen();
+                    const float x1 = x0 + w;
+                    const float y1 = y0 + d;
+
+                    const float south[3] = {cx, cy, 0.0f}, southU[3] = {cell, 0.0f, 0.0f}, southV[3] = {0.0f, y0 - cy, 0.0f};
+                    const float north[3] = {cx, y1, 0.0f}, northU[3] = {cell, 0.0f, 0.0f}, northV[3] = {0.0f, cy + cell - y1, 0.0f};
+                    const float west[3] = {cx, y0, 0.0f}, westU[3] = {x0 - cx, 0.0f, 0.0f}, westV[3] = {0.0f, d, 0.0f};
+                    const float east[3] = {x1, y0, 0.0f}, eastU[3] = {cx + cell - x1, 0.0f, 0.0f}, eastV[3] = {0.0f, d, 0.0f};
+                    addPlane(south, southU, southV);
+                    addPlane(north, northU, northV);
+                    addPlane(west, westU, westV);
+                    addPlane(east, eastU, eastV);
+
+                    // Axes are ordered so that U x V points out of the building
+                    const float alongX[3] = {w, 0.0f, 0.0f};
+                    const float alongY[3] = {0.0f, d, 0.0f};
+                    const float up[3] = {0.0f, 0.0f, h};
+                    const float roof[3] = {x0, y0, h};
+                    const float corner[3] = {x0, y0, 0.0f};
+                    const float cornerX[3] = {x1, y0, 0.0f};
+                    const float cornerY[3] = {x0, y1, 0.0f};
+                    addPlane(roof, alongX, alongY);
+                    addPlane(corner, alongX, up);       // facing -y
+                    addPlane(cornerY, up, alongX);      // facing +y
+                    addPlane(corner, up, alongY);       // facing -x
+                    addPlane(cornerX, alongY, up);      // facing +x
+                }
+        }
+        break;
+    case SCENE_SPHERES:
+        {
+            const int count = 64;
+            for (int i = 0; i < count; i++)
+            {
+                const float radius = size * (0.02f + 0.06f * gen());
+                const float center[3] = {size * gen(), size * gen(), radius + size * 0.1f * gen()};
+                addSphere(center, radius);
+            }
+        }
+        break;
+    }
+
+    assignSplats();
+
+    if (params.order == ORDER_RANDOM)
+    {
+        while ((std::tr1::uint64_t(1) << (2 * permuteBits)) < params.numSplats)
+            permuteBits++;
+    }
+}
+
+void Generator::addPlane(const float origin[3], const float axisU[3], const float axisV[3])
+{
+    Patch p;
+    p.type = PATCH_PLANE;
+    float n[3];
+    cross(axisU, axisV, n);
+    p.area = length(n);
+    if (!(p.area > 0.0f))
+        return;
+    for (int i = 0; i < 3; i++)
+    {
+        p.origin[i] = origin[i];
+        p.axisU[i] = axisU[i];
+        p.axisV[i] = axisV[i];
+    }
+    p.radius = 0.0f;
+    patches.push_back(p);
+}
+
+void Generator::addHeightfield(const float origin[3], float sizeU, float sizeV)
+{
+    Patch p;
+    p.type = PATCH_HEIGHTFIELD;
+    for (int i = 0; i < 3; i++)
+    {
+        p.origin[i] = origin[i];
+        p.axisU[i] = 0.0f;
+        p.axisV[i] = 0.0f;
+    }
+    p.axisU[0] = sizeU;
+    p.axisV[1] = sizeV;
+    p.radius = 0.0f;
+    p.area = sizeU * sizeV;  // ignores the slope, which is modest
+    patches.push_back(p);
+}
+
+void Generator::addSphere(const float center[3], float radius)
+{
+    Patch p;
+    p.type = PATCH_SPHERE;
+    for (int i = 0; i < 3; i++)
+    {
+        p.origin[i] = center[i];
+        p.axisU[i] = 0.0f;
+        p.axisV[i] = 0.0f;
+    }
+    p.radius = radius;
+    p.area = 4.0f * pi * radius * radius;
+    patches.push_back(p);
+}
+
+void Generator::assignSplats()
+{
+    double totalArea = 0.0;
+    for (std::size_t i = 0; i < patches.size(); i++)
+        totalArea += patches[i].area;
+
+    double cumArea = 0.0;
+    for (std::size_t i = 0; i < patches.size(); i++)
+    {
+        patches[i].firstSplat = std::tr1::uint64_t(params.numSplats * (cumArea / totalArea));
+        cumArea += patches[i].area;
+    }
+    for (std::size_t i = 0; i < patches.size(); i++)
+    {
+        Patch &p = patches[i];
+        const std::tr1::uint64_t end = i + 1 < patches.size() ? patches[i + 1].firstSplat : params.numSplats;
+        p.numSplats = end - p.firstSplat;
+
+        // Choose rows and columns to roughly match the aspect ratio
+        double aspect = 1.0;
+        if (p.type != PATCH_SPHERE)
+            aspect = length(p.axisU) / length(p.axisV);
+        p.columns = std::tr1::uint64_t(std::sqrt(double(p.numSplats) * aspect) + 0.5);
+        p.columns = std::max(p.columns, std::tr1::uint64_t(1));
+        p.rows = std::max((p.numSplats + p.columns - 1) / p.columns, std::tr1::uint64_t(1));
+        p.spacing = p.numSplats > 0 ? std::sqrt(p.area / p.numSplats) : 0.0f;
+    }
+}
+
+std::tr1::uint64_t Generator::permute(std::tr1::uint64_t id) const
+{
+    if (params.order != ORDER_RANDOM)
+        return id;
+
+    /* A four-round Feistel network is a bijection on [0, 4^permuteBits).
+     * Cycle-walking restricts it to a bijection on [0, numSplats). Since the
+     * domain is less than four times too large, few iterations are needed.
+     */
+    const std::tr1::uint64_t mask = (std::tr1::uint64_t(1) << permuteBits) - 1;
+    std::tr1::uint64_t x = id;
+    do
+    {
+        std::tr1::uint64_t left = x >> permuteBits;
+        std::tr1::uint64_t right = x & mask;
+        for (unsigned int round = 0; round < 4; round++)
+        {
+            const std::tr1::uint64_t f = hash(params.seed, right, 100 + round) & mask;
+            const std::tr1::uint64_t next = left ^ f;
+            left = right;
+            right = next;
+        }
+        x = (left << permuteBits) | right;
+    } while (x >= params.numSplats);
+    return x;
+}
+
+float Generator::height(float x, float y, float &dx, float &dy) const
+{
+    float h = 0.0f;
+    dx = 0.0f;
+    dy = 0.0f;
+    for (std::size_t i = 0; i < waves.size(); i++)
+    {
+        const Wave &w = waves[i];
+        const float arg = w.kx * x + w.ky * y + w.phase;
+        const float c = w.amplitude * std::cos(arg);
+        h += w.amplitude * std::sin(arg);
+        dx += c * w.kx;
+        dy += c * w.ky;
+    }
+    return h;
+}
+
+bool Generator::inHole(std::size_t p, float u, float v) const
+{
+    if (params.holes <= 0.0f)
+        return false;
+    const int cu = std::min(int(u * holeCells), holeCells - 1);
+    const int cv = std::min(int(v * holeCells), holeCells - 1);
+    const std::tr1::uint64_t cellId = (std::tr1::uint64_t(p) * holeCells + cv) * holeCells + cu;
+    const std::tr1::uint64_t h = hash(params.seed, cellId, 10);
+    if (unit(h) >= params.holes)
+        return false;
+    // Center is jittered by the high and low bits of a second hash
+    const std::tr1::uint64_t j = hash(params.seed, cellId, 11);
+    const float centerU = cu + 0.5f + holeJitter * (2.0f * unit(j) - 1.0f);
+    const float centerV = cv + 0.5f + holeJitter * (2.0f * unit(j << 24) - 1.0f);
+    const float du = u * holeCells - centerU;
+    const float dv = v * holeCells - centerV;
+    return du * du + dv * dv < holeRadius * holeRadius;
+}
+
+Splat Generator::operator()(std::tr1::uint64_t id) const
+{
+    MLSGPU_ASSERT(id < params.numSplats, std::out_of_range);
+    const std::tr1::uint64_t k = permute(id);
+
+    // Find the last patch starting at or before k (skipping empty patches)
+    std::size_t lo = 0, hi = patches.size();
+    while (hi - lo > 1)
+    {
+        std::size_t mid = (lo + hi) / 2;
+        if (patches[mid].firstSplat <= k)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const Patch &p = patches[lo];
+    const std::tr1::uint64_t local = k - p.firstSplat;
+    const std::tr1::uint64_t row = local / p.columns;
+    const std::tr1::uint64_t col = local % p.columns;
+
+    float u = (col + unit(hash(params.seed, k, 0))) / p.columns;
+    const float v = (row + unit(hash(params.seed, k, 1))) / p.rows;
+    if (inHole(lo, u, v))
+    {
+        // Try elsewhere on the same row
+        int attempt;
+        for (attempt = 0; attempt < holeRetries; attempt++)
+        {
+            u = unit(hash(params.seed, k, 2 + attempt));
+            if (!inHole(lo, u, v))
+                break;
+        }
+        if (attempt == holeRetries)
+        {
+            /* Holes never reach the boundaries between hole cells, so
+             * moving to one of those is guaranteed to succeed.
+             */
+            const float gap = 0.5f - holeRadius - holeJitter;
+            u = std::floor(u * holeCells + 0.5f);
+            u += gap * (2.0f * unit(hash(params.seed, k, 2 + holeRetries)) - 1.0f);
+            u = std::min(std::max(u, 0.0f), holeCells - gap) / holeCells;
+        }
+    }
+
+    const float d = params.density;
+    const float wu = warp(u, d);
+    const float wv = warp(v, d);
+    const float spacing = p.spacing * std::sqrt(warpDerivative(u, d) * warpDerivative(v, d));
+
+    Splat s;
+    float *pos = s.position;
+    float *n = s.normal;
+    switch (p.type)
+    {
+    case PATCH_PLANE:
+        for (int i = 0; i < 3; i++)
+            pos[i] = p.origin[i] + wu * p.axisU[i] + wv * p.axisV[i];
+        cross(p.axisU, p.axisV, n);
+        break;
+    case PATCH_HEIGHTFIELD:
+        {
+            float dx, dy;
+            pos[0] = p.origin[0] + wu * p.axisU[0];
+            pos[1] = p.origin[1] + wv * p.axisV[1];
+            pos[2] = p.origin[2] + height(pos[0], pos[1], dx, dy);
+            n[0] = -dx;
+            n[1] = -dy;
+            n[2] = 1.0f;
+        }
+        break;
+    case PATCH_SPHERE:
+        {
+            // Archimedes' projection, which preserves area
+            const float z = 1.0f - 2.0f * wv;
+            const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            const float phi = 2.0f * pi * wu;
+            n[0] = r * std::cos(phi);
+            n[1] = r * std::sin(phi);
+            n[2] = z;
+            for (int i = 0; i < 3; i++)
+                pos[i] = p.origin[i] + p.radius * n[i];
+        }
+        break;
+    }
+    normalize(n);
+
+    if (params.noise > 0.0f)
+    {
+        const float offset = params.noise * spacing * gaussian(params.seed, k, 20);
+        for (int i = 0; i < 3; i++)
+        {
+            pos[i] += offset * n[i];
+            n[i] += 0.5f * params.noise * gaussian(params.seed, k, 21 + i);
+        }
+        normalize(n);
+    }
+
+    s.radius = params.radiusScale * spacing;
+    s.quality = 1.0f / (s.radius * s.radius);
+    return s;
+}
+
+void Generator::generate(std::tr1::uint64_t first, std::tr1::uint64_t last, Splat *out, bool useOMP) const
+{
+    MLSGPU_ASSERT(first <= last && last <= params.numSplats, std::out_of_range);
+    const std::size_t n = last - first;
+    (void) useOMP;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (useOMP && n > 16384)
+#endif
+    for (std::size_t i = 0; i < n; i++)
+        out[i] = (*this)(first + i);
+}
+
+Set::Set(const Params &params) : generator(new Generator(params))
+{
+}
+
+PlyReader::PlyReader(boost::shared_ptr<const Generator> generator)
+    : generator(generator)
+{
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out << "ply\n"
+        << (cpuLittleEndian() ? "format binary_little_endian 1.0\n" : "format binary_big_endian 1.0\n")
+        << "comment synthetic cloud\n"
+        << "element vertex " << generator->size() << "\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+    header = out.str();
+}
+
+void PlyReader::openImpl(const boost::filesystem::path &path)
+{
+    (void) path;
+    // No action required
+}
+
+void PlyReader::closeImpl()
+{
+    // No action required
+}
+
+std::size_t PlyReader::readImpl(void *buffer, std::size_t count, offset_type offset) const
+{
+    const offset_type size = sizeImpl();
+    if (offset >= size)
+        return 0;
+    if (count > size - offset)
+        count = size - offset;
+
+    char *out = static_cast<char *>(buffer);
+    std::size_t done = 0;
+    if (offset < header.size())
+    {
+        done = std::min(count, std::size_t(header.size() - offset));
+        std::memcpy(out, header.data() + offset, done);
+    }
+
+    if (done < count)
+    {
+        // Generate every vertex overlapping the rest of the request
+        const offset_type start = offset + done - header.size();
+        const offset_type end = offset + count - header.size();
+        const std::tr1::uint64_t first = start / vertexSize;
+        const std::tr1::uint64_t last = (end + vertexSize - 1) / vertexSize;
+        std::vector<Splat> splats(last - first);
+        generator->generate(first, last, &splats[0]);
+
+        std::vector<char> raw(splats.size() * vertexSize);
+        for (std::size_t i = 0; i < splats.size(); i++)
+        {
+            char *v = &raw[i * vertexSize];
+            std::memcpy(v, splats[i].position, 3 * sizeof(float));
+            std::memcpy(v + 3 * sizeof(float), splats[i].normal, 3 * sizeof(float));
+            std::memcpy(v + 6 * sizeof(float), &splats[i].radius, sizeof(float));
+        }
+        std::memcpy(out + done, &raw[start - first * vertexSize], count - done);
+    }
+    return count;
+}
+
+BinaryReader::offset_type PlyReader::sizeImpl() const
+{
+    return header.size() + generator->size() * vertexSize;
+}
+
+PlyReaderFactory::PlyReaderFactory(const Params &params)
+    : generator(new Generator(params))
+{
+}
+
+} // namespace Synthetic
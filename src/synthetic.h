@@ -0,0 +1,346 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Procedural generation of large point clouds for scale testing.
+ */
+
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/function.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include "tr1_cstdint.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "binary_io.h"
+
+/**
+ * Deterministic generator of oriented splats sampled from procedural scenes.
+ *
+ * Every splat is a pure function of the parameters and its index, so any
+ * range of a cloud can be produced independently and in any order. This
+ * allows clouds of billions of splats to be streamed through the pipeline
+ * (including by several MPI processes) without storing them.
+ *
+ * A cloud can be described by a string of the form
+ * <code>scene[:key=value[,key=value...]]</code>, which is accepted as an
+ * input file name of the form <code>synthetic:scene:...</code> by
+ * @ref prepareInputs. See @ref parseParams for the keys.
+ */
+namespace Synthetic
+{
+
+/// Prefix that marks an input file name as a synthetic cloud
+extern const char * const inputPrefix;
+
+/// Surface that is sampled
+enum Scene
+{
+    SCENE_TERRAIN,     ///< Rolling height field
+    SCENE_FACADES,     ///< Ground plane with a grid of box-shaped buildings
+    SCENE_SPHERES      ///< Scattered spheres of varying size
+};
+
+/// Order in which the splats are produced
+enum Order
+{
+    /**
+     * One surface patch at a time, in rows, similar to the order of a
+     * scanner.
+     */
+    ORDER_SCAN,
+    /// A pseudo-random permutation of the scan order, with no spatial coherence
+    ORDER_RANDOM
+};
+
+/// Description of a cloud
+struct Params
+{
+    Scene scene;
+    Order order;
+    std::tr1::uint64_t numSplats;   ///< Number of splats, including any in holes
+    std::tr1::uint32_t seed;        ///< Seed for all pseudo-random choices
+    float size;                     ///< Side length of the scene's bounding square
+    /**
+     * Amplitude of sample density variation, in [0, 1). Zero gives uniform
+     * sampling, while values close to 1 give sampling that is sparse in some
+     * areas and dense in others. Radii grow to match the local spacing.
+     */
+    float density;
+    /**
+     * Probability, in [0, 1], that each cell of an 8&times;8 grid on every
+     * patch contains a circular hole. Samples that would fall in a hole are
+     * moved elsewhere along the same row, so holes do not change the number
+     * of splats.
+     */
+    float holes;
+    /// Standard deviation of noise, as a fraction of the local sample spacing
+    float noise;
+    /// Ratio of splat radius to the local sample spacing
+    float radiusScale;
+
+    /// Constructs the default parameters (a noiseless terrain of one million splats)
+    Params();
+};
+
+/**
+ * Parse a cloud description of the form <code>scene[:key=value,...]</code>.
+ * The scene is one of <code>terrain</code>, <code>facades</code> or
+ * <code>spheres</code>. The keys are <code>splats</code>, <code>seed</code>,
+ * <code>size</code>, <code>density</code>, <code>holes</code>,
+ * <code>noise</code>, <code>radius</code> (for @ref Params::radiusScale) and
+ * <code>order</code> (<code>scan</code> or <code>random</code>). The number of
+ * splats may be written in exponent form, e.g. <code>splats=2e9</code>.
+ *
+ * @throw std::runtime_error if the description is malformed or a value is
+ * out of range.
+ */
+Params parseParams(const std::string &description);
+
+/**
+ * Produces the splats of a cloud. Construction does a small amount of work
+ * that depends only on the scene; generating splats is thread-safe.
+ */
+class Generator
+{
+public:
+    explicit Generator(const Params &params);
+
+    /// Parameters passed to the constructor
+    const Params &getParams() const { return params; }
+
+    /// Number of splats in the cloud
+    std::tr1::uint64_t size() const { return params.numSplats; }
+
+    /**
+     * Generate splat @a id. The result is always finite.
+     *
+     * @pre @a id &lt; @ref size().
+     */
+    Splat operator()(std::tr1::uint64_t id) const;
+
+    /**
+     * Generate the splats with IDs in [@a first, @a last) into @a out. Large
+     * ranges are generated in parallel if OpenMP is enabled and @a useOMP is
+     * true.
+     *
+     * @pre @a first &lt;= @a last &lt;= @ref size().
+     */
+    void generate(std::tr1::uint64_t first, std::tr1::uint64_t last, Splat *out,
+                  bool useOMP = true) const;
+
+private:
+    /// Kind of parametric surface used by a @ref Patch
+    enum PatchType
+    {
+        PATCH_PLANE,
+        PATCH_HEIGHTFIELD,
+        PATCH_SPHERE
+    };
+
+    /// A parametric surface, mapped from [0, 1)<sup>2</sup>
+    struct Patch
+    {
+        PatchType type;
+        /**
+         * For planes and height fields, the origin. For spheres, the
+         * center.
+         */
+        float origin[3];
+        float axisU[3];                 ///< Extent along u (planes, height fields)
+        float axisV[3];                 ///< Extent along v (planes, height fields)
+        float radius;                   ///< Sphere radius
+        float area;                     ///< Approximate surface area
+        std::tr1::uint64_t firstSplat;  ///< First splat sampled from this patch
+        std::tr1::uint64_t numSplats;   ///< Number of splats sampled from this patch
+        std::tr1::uint64_t columns;     ///< Samples per row in scan order
+        std::tr1::uint64_t rows;        ///< Rows in scan order
+        float spacing;                  ///< Mean distance between samples
+    };
+
+    Params params;
+    std::vector<Patch> patches;
+    /// Bits in each half of the permutation used by @ref ORDER_RANDOM
+    unsigned int permuteBits;
+
+    void addPlane(const float origin[3], const float axisU[3], const float axisV[3]);
+    void addHeightfield(const float origin[3], float sizeU, float sizeV);
+    void addSphere(const float center[3], float radius);
+
+    /// Divide the splats between the patches in proportion to their area
+    void assignSplats();
+
+    /// Map a position in the scan order to a position in the output order
+    std::tr1::uint64_t permute(std::tr1::uint64_t id) const;
+
+    /// Height of the terrain at (@a x, @a y), and its gradient
+    float height(float x, float y, float &dx, float &dy) const;
+
+    /// Whether (@a u, @a v) on patch @a p is in a hole
+    bool inHole(std::size_t p, float u, float v) const;
+
+    /// Component of the terrain height function
+    struct Wave
+    {
+        float kx, ky;        ///< Wave vector
+        float phase;
+        float amplitude;
+    };
+    std::vector<Wave> waves;
+};
+
+/**
+ * Model of @ref SplatSet::SubsettableConcept that generates its splats on
+ * demand. Splat IDs are the indices in the generator.
+ */
+class Set
+{
+public:
+    explicit Set(const Params &params);
+
+    SplatSet::splat_id maxSplats() const { return generator->size(); }
+
+    SplatSet::SplatStream *makeSplatStream(bool useOMP = true) const
+    {
+        return makeSplatStream(&SplatSet::detail::rangeAll, &SplatSet::detail::rangeAll + 1, useOMP);
+    }
+
+    template<typename RangeIterator>
+    SplatSet::SplatStream *makeSplatStream(RangeIterator firstRange, RangeIterator lastRange, bool useOMP = false) const
+    {
+        return new MySplatStream<RangeIterator>(*generator, firstRange, lastRange, useOMP);
+    }
+
+    SplatSet::BlobStream *makeBlobStream(const Grid &grid, Grid::size_type bucketSize) const
+    {
+        return new SplatSet::SimpleBlobStream(makeSplatStream(), grid, bucketSize);
+    }
+
+private:
+    boost::shared_ptr<const Generator> generator;
+
+    template<typename RangeIterator>
+    class MySplatStream : public SplatSet::SplatStream
+    {
+    public:
+        virtual std::size_t read(Splat *splats, SplatSet::splat_id *splatIds, std::size_t count);
+
+        MySplatStream(const Generator &generator,
+                      RangeIterator firstRange, RangeIterator lastRange, bool useOMP)
+            : generator(generator), curRange(firstRange), lastRange(lastRange),
+            useOMP(useOMP)
+        {
+            if (curRange != lastRange)
+                cur = curRange->first;
+        }
+
+    private:
+        const Generator &generator;
+        RangeIterator curRange, lastRange;
+        SplatSet::splat_id cur;   ///< Next splat to generate (undefined if stream is empty)
+        bool useOMP;
+    };
+};
+
+/**
+ * A @ref BinaryReader that presents a cloud as a binary PLY file, so that it
+ * can be read by @ref FastPly::Reader and hence @ref SplatSet::FileSet.
+ */
+class PlyReader : public BinaryReader
+{
+public:
+    explicit PlyReader(boost::shared_ptr<const Generator> generator);
+
+    /// Bytes per vertex in the file
+    static const std::size_t vertexSize = 7 * sizeof(float);
+
+private:
+    boost::shared_ptr<const Generator> generator;
+    std::string header;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buffer, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+};
+
+/**
+ * Factory for @ref PlyReader, suitable for passing to the @ref FastPly::Reader
+ * constructor. All the readers share one generator.
+ */
+class PlyReaderFactory
+{
+public:
+    typedef BinaryReader *result_type;
+
+    explicit PlyReaderFactory(const Params &params);
+
+    BinaryReader *operator()() const
+    {
+        return new PlyReader(generator);
+    }
+
+private:
+    boost::shared_ptr<const Generator> generator;
+};
+
+template<typename RangeIterator>
+std::size_t Set::MySplatStream<RangeIterator>::read(
+    Splat *splats, SplatSet::splat_id *splatIds, std::size_t count)
+{
+    std::size_t oldCount = count;
+    while (count > 0 && curRange != lastRange)
+    {
+        SplatSet::splat_id end = std::min(SplatSet::splat_id(curRange->second), generator.size());
+        if (cur < end)
+        {
+            std::size_t n = std::min(SplatSet::splat_id(count), end - cur);
+            generator.generate(cur, cur + n, splats, useOMP);
+            if (splatIds != NULL)
+                for (std::size_t i = 0; i < n; i++)
+                    *splatIds++ = cur + i;
+            splats += n;
+            cur += n;
+            count -= n;
+        }
+        if (cur >= end)
+        {
+            ++curRange;
+            if (curRange != lastRange)
+                cur = curRange->first;
+        }
+    }
+    return oldCount - count;
+}
+
+} // namespace Synthetic
+
+#endif /* !SYNTHETIC_H */
@@ -31,37 +31,309 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
 #include <cerrno>
-#include <cassert>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/exception/all.hpp>
 #include "timeplot.h"
 #include "statistics.h"
 #include "timer.h"
 #include "errors.h"
+#include "atomic.h"
+#include "thread_name.h"
+#include "tr1_cstdint.h"
+#include "tr1_unordered_map.h"
 
 namespace Timeplot
 {
 
+namespace detail
+{
+
+/// Record types in the binary format
+enum RecordType
+{
+    RECORD_NAME = 1,
+    RECORD_EVENT = 2
+};
+
+/// Event record in the binary format
+struct Record
+{
+    std::tr1::uint32_t type;       ///< Always @ref RECORD_EVENT
+    std::tr1::uint32_t worker;     ///< Name ID of the worker
+    std::tr1::uint32_t action;     ///< Name ID of the action
+    std::tr1::uint32_t hasValue;   ///< Non-zero if @ref value is meaningful
+    double start;                  ///< Start time, in seconds since @ref init
+    double stop;                   ///< End time, in seconds since @ref init
+    std::tr1::uint64_t value;      ///< Value set by @ref Action::setValue
+};
+
+/**
+ * Ring of records for one worker. Only the worker pushes and only the
+ * flusher drains, so no locking is needed.
+ */
+class TraceBuffer : public boost::noncopyable
+{
+public:
+    /// Name ID of the owning worker
+    const std::tr1::uint32_t workerId;
+
+    /// Cache of name IDs, only accessed by the owning worker
+    std::tr1::unordered_map<std::string, std::tr1::uint32_t> names;
+
+    explicit TraceBuffer(std::tr1::uint32_t workerId)
+        : workerId(workerId), records(new Record[capacity]), head(0), tail(0) {}
+
+    /// Append a record, returning @c false if the ring is full
+    bool push(const Record &record)
+    {
+        std::size_t h = head.load();
+        if (h - tail.load() == capacity)
+            return false;
+        records[h % capacity] = record;
+        head.store(h + 1);
+        return true;
+    }
+
+    /// Move all available records to @a out
+    void drain(std::vector<Record> &out)
+    {
+        std::size_t t = tail.load();
+        std::size_t h = head.load();
+        for (; t != h; t++)
+            out.push_back(records[t % capacity]);
+        tail.store(t);
+    }
+
+private:
+    /// Number of records in the ring
+    static const std::size_t capacity = 8192;
+
+    boost::scoped_array<Record> records;
+    Atomic<std::size_t> head;      ///< Number of records pushed
+    Atomic<std::size_t> tail;      ///< Number of records drained
+};
+
+} // namespace detail
+
+namespace
+{
+
+/**
+ * State for binary output. The mutex is taken only when names are interned,
+ * when workers are created or destroyed, and by the flusher.
+ *
+ * Each @ref open starts a new session. @ref close frees the rings of the
+ * session, so a worker must check that its ring belongs to the current
+ * session (see @ref getSession) before using it.
+ */
+class BinaryTrace : public boost::noncopyable
+{
+public:
+    BinaryTrace() : openFlag(0), session(0), namesWritten(0), stopping(false), dropped(NULL) {}
+
+    ~BinaryTrace()
+    {
+        close();
+    }
+
+    void open(const std::string &filename);
+
+    /**
+     * Stop the flusher, write out everything that remains and free the
+     * rings. No other thread may record events concurrently.
+     */
+    void close();
+
+    /// Whether binary output is active
+    bool isOpen() const { return openFlag.load() != 0; }
+
+    /// Identifies the current session; it changes on every @ref open and @ref close
+    unsigned int getSession() const { return session.load(); }
+
+    /// Obtain an ID for a name
+    std::tr1::uint32_t intern(const std::string &name);
+
+    /// Create and register a ring for a worker
+    detail::TraceBuffer *attach(const std::string &workerName);
+
+    /**
+     * Unregister a ring, writing out its records. It is ignored if the ring
+     * was already freed by @ref close.
+     */
+    void detach(detail::TraceBuffer *buffer);
+
+    /// Count a record that could not be buffered
+    void drop() { dropped->add(); }
+
+private:
+    Atomic<unsigned int> openFlag;                  ///< Non-zero between @ref open and @ref close
+    Atomic<unsigned int> session;                   ///< Value returned by @ref getSession
+    boost::mutex mutex;
+    std::ofstream out;
+    std::vector<detail::TraceBuffer *> buffers;
+    std::vector<std::string> names;                 ///< Names indexed by ID minus one
+    std::tr1::unordered_map<std::string, std::tr1::uint32_t> nameIds;
+    std::size_t namesWritten;                       ///< Names already in the file
+    std::vector<detail::Record> batch;              ///< Records waiting to be written
+
+    boost::thread flusher;
+    boost::condition_variable stopCondition;
+    bool stopping;
+    Statistics::Counter *dropped;
+
+    /// Write out names and @ref batch. The caller must hold the mutex.
+    void writeLocked();
+
+    /// Flusher thread body
+    void run();
+};
+
+void BinaryTrace::open(const std::string &filename)
+{
+    out.open(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!out)
+        throw std::ios::failure("Could not open timeplot file");
+    const char magic[8] = {'M', 'L', 'S', 'G', 'P', 'U', 'T', 'P'};
+    const std::tr1::uint32_t version = 1;
+    const std::tr1::uint32_t byteOrder = 0x01020304;
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char *>(&byteOrder), sizeof(byteOrder));
+
+    dropped = &Statistics::getStatistic<Statistics::Counter>("timeplot.dropped");
+    stopping = false;
+    flusher = boost::thread(&BinaryTrace::run, this);
+    session.fetchAdd(1);
+    openFlag.store(1);
+}
+
+void BinaryTrace::close()
+{
+    if (!isOpen())
+        return;
+    openFlag.store(0);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+        stopCondition.notify_all();
+    }
+    flusher.join();
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (std::size_t i = 0; i < buffers.size(); i++)
+        buffers[i]->drain(batch);
+    writeLocked();
+    out.close();
+
+    for (std::size_t i = 0; i < buffers.size(); i++)
+        delete buffers[i];
+    buffers.clear();
+    names.clear();
+    nameIds.clear();
+    namesWritten = 0;
+    session.fetchAdd(1);
+}
+
+std::tr1::uint32_t BinaryTrace::intern(const std::string &name)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::tr1::unordered_map<std::string, std::tr1::uint32_t>::const_iterator pos = nameIds.find(name);
+    if (pos != nameIds.end())
+        return pos->second;
+    names.push_back(name);
+    std::tr1::uint32_t id = names.size();
+    nameIds[name] = id;
+    return id;
+}
+
+detail::TraceBuffer *BinaryTrace::attach(const std::string &workerName)
+{
+    detail::TraceBuffer *buffer = new detail::TraceBuffer(intern(workerName));
+    boost::lock_guard<boost::mutex> lock(mutex);
+    buffers.push_back(buffer);
+    return buffer;
+}
+
+void BinaryTrace::detach(detail::TraceBuffer *buffer)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::vector<detail::TraceBuffer *>::iterator pos = std::find(buffers.begin(), buffers.end(), buffer);
+    if (pos == buffers.end())
+        return;
+    buffer->drain(batch);
+    buffers.erase(pos);
+    delete buffer;
+}
+
+void BinaryTrace::writeLocked()
+{
+    /* The records were drained before the names are written, and a name is
+     * always interned before any record referencing it is pushed, so every
+     * referenced name is written first.
+     */
+    for (; namesWritten < names.size(); namesWritten++)
+    {
+        const std::string &name = names[namesWritten];
+        const std::tr1::uint32_t header[3] = {
+            detail::RECORD_NAME, std::tr1::uint32_t(namesWritten + 1), std::tr1::uint32_t(name.size())
+        };
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out.write(name.data(), name.size());
+    }
+    if (!batch.empty())
+        out.write(reinterpret_cast<const char *>(&batch[0]), batch.size() * sizeof(batch[0]));
+    batch.clear();
+}
+
+void BinaryTrace::run()
+{
+    thread_set_name("timeplot");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        stopCondition.timed_wait(lock, boost::posix_time::milliseconds(20));
+        for (std::size_t i = 0; i < buffers.size(); i++)
+            buffers[i]->drain(batch);
+        writeLocked();
+    }
+}
+
+} // anonymous namespace
+
 static bool hasFile = false;
 static boost::mutex outputMutex;
 static Timer::timestamp startTime = Timer::currentTime();
 static std::ofstream log;
+static BinaryTrace binaryTrace;
 
-void init(const std::string &filename)
+void init(const std::string &filename, bool binary)
 {
-    MLSGPU_ASSERT(!hasFile, state_error);
+    MLSGPU_ASSERT(!hasFile && !binaryTrace.isOpen(), state_error);
     startTime = Timer::currentTime();
     try
     {
-        log.open(filename.c_str());
-        if (!log)
-            throw std::ios::failure("Could not open timeplot file");
-        log << std::fixed;
-        log.precision(9);
-        hasFile = true;
+        if (binary)
+            binaryTrace.open(filename);
+        else
+        {
+            log.open(filename.c_str());
+            if (!log)
+                throw std::ios::failure("Could not open timeplot file");
+            log << std::fixed;
+            log.precision(9);
+            hasFile = true;
+        }
     }
     catch (std::ios::failure &e)
     {
@@ -71,16 +343,86 @@ void init(const std::string &filename)
     }
 }
 
-Worker::Worker(const std::string &name) : name(name), currentAction(NULL)
+void close()
+{
+    binaryTrace.close();
+    boost::lock_guard<boost::mutex> lock(outputMutex);
+    if (hasFile)
+    {
+        hasFile = false;
+        log.close();
+    }
+}
+
+Closer::~Closer()
+{
+    close();
+}
+
+Worker::Worker(const std::string &name) : name(name), currentAction(NULL), trace(NULL), traceSession(0)
 {
 }
 
 Worker::Worker(const std::string &name, int idx)
     : name(name + "." + boost::lexical_cast<std::string>(idx)),
-    currentAction(NULL)
+    currentAction(NULL), trace(NULL), traceSession(0)
 {
 }
 
+Worker::~Worker()
+{
+    if (trace != NULL && traceSession == binaryTrace.getSession())
+        binaryTrace.detach(trace);
+}
+
+void Worker::record(
+    const std::string &actionName, std::tr1::uint32_t &nameId,
+    Timer::timestamp start, Timer::timestamp stop,
+    const boost::optional<std::size_t> &value)
+{
+    if (hasFile)
+    {
+        boost::lock_guard<boost::mutex> lock(outputMutex);
+        log << "EVENT " << name << ' ' << actionName << ' '
+            << Timer::getElapsed(startTime, start) << ' '
+            << Timer::getElapsed(startTime, stop) << '\n';
+        if (value)
+            log << "VALUE " << *value << '\n';
+    }
+    else if (binaryTrace.isOpen())
+    {
+        const unsigned int session = binaryTrace.getSession();
+        if (trace == NULL || traceSession != session)
+        {
+            // Any previous ring was freed when its session was closed
+            trace = binaryTrace.attach(name);
+            traceSession = session;
+        }
+        if (nameId == 0)
+        {
+            std::tr1::unordered_map<std::string, std::tr1::uint32_t>::const_iterator pos
+                = trace->names.find(actionName);
+            if (pos != trace->names.end())
+                nameId = pos->second;
+            else
+            {
+                nameId = binaryTrace.intern(actionName);
+                trace->names[actionName] = nameId;
+            }
+        }
+
+        detail::Record r;
+        r.type = detail::RECORD_EVENT;
+        r.worker = trace->workerId;
+        r.action = nameId;
+        r.hasValue = value ? 1 : 0;
+        r.start = Timer::getElapsed(startTime, start);
+        r.stop = Timer::getElapsed(startTime, stop);
+        r.value = value ? *value : 0;
+        if (!trace->push(r))
+            binaryTrace.drop();
+    }
+}
 Action *Worker::start(Action *current, Timer::timestamp time)
 {
     Action *ret = currentAction;
@@ -106,6 +448,7 @@ const std::string &Worker::getName() const
 
 void Action::init()
 {
+    nameId = 0;
     start = Timer::currentTime();
     running = true;
     elapsed = 0.0;
@@ -136,16 +479,7 @@ void Action::pause(Timer::timestamp time)
     MLSGPU_ASSERT(running, state_error);
     running = false;
     elapsed += Timer::getElapsed(start, time);
-
-    if (hasFile)
-    {
-        boost::lock_guard<boost::mutex> lock(outputMutex);
-        log << "EVENT " << worker.getName() << ' ' << name << ' '
-            << Timer::getElapsed(startTime, start) << ' '
-            << Timer::getElapsed(startTime, time) << '\n';
-        if (value)
-            log << "VALUE " << *value << '\n';
-    }
+    worker.record(name, nameId, start, time, value);
 }
 
 void Action::resume(Timer::timestamp time)
@@ -172,15 +506,151 @@ Action::~Action()
 
 void recordEvent(const std::string &name, Worker &worker)
 {
-    if (hasFile)
+    if (hasFile || binaryTrace.isOpen())
     {
-        boost::lock_guard<boost::mutex> lock(outputMutex);
         Timer::timestamp now = Timer::currentTime();
-        double t = Timer::getElapsed(startTime, now);
-        log << "EVENT " << worker.getName() << ' ' << name << ' '
-            << t << ' '
-            << t << '\n';
+        std::tr1::uint32_t nameId = 0;
+        worker.record(name, nameId, now, now, boost::none);
+    }
+}
+
+namespace
+{
+
+/// Orders events by stop time, for @ref readTrace
+static bool eventStopLess(const TraceEvent &a, const TraceEvent &b)
+{
+    return a.stop < b.stop;
+}
+
+/**
+ * Read the records of a binary trace, after the magic string.
+ */
+static void readBinaryTrace(std::istream &in, Trace &trace)
+{
+    std::tr1::uint32_t header[2];
+    if (!in.read(reinterpret_cast<char *>(header), sizeof(header)))
+        throw std::runtime_error("Binary timeplot file is truncated");
+    if (header[1] != 0x01020304)
+        throw std::runtime_error("Binary timeplot file has a different byte order");
+    if (header[0] != 1)
+        throw std::runtime_error("Binary timeplot file has an unsupported version");
+
+    std::vector<std::string> names(1);
+    std::vector<std::vector<TraceEvent> *> workers(1, (std::vector<TraceEvent> *) NULL);
+    std::tr1::uint32_t type;
+    while (in.read(reinterpret_cast<char *>(&type), sizeof(type)))
+    {
+        if (type == detail::RECORD_NAME)
+        {
+            std::tr1::uint32_t fields[2];
+            if (!in.read(reinterpret_cast<char *>(fields), sizeof(fields)))
+                throw std::runtime_error("Binary timeplot file is truncated");
+            std::string name(fields[1], '\0');
+            if (fields[1] > 0 && !in.read(&name[0], fields[1]))
+                throw std::runtime_error("Binary timeplot file is truncated");
+            if (fields[0] != names.size())
+                throw std::runtime_error("Binary timeplot file has names out of order");
+            names.push_back(name);
+            workers.push_back(NULL);
+        }
+        else if (type == detail::RECORD_EVENT)
+        {
+            detail::Record r;
+            r.type = type;
+            const std::size_t rest = sizeof(r) - sizeof(type);
+            if (!in.read(reinterpret_cast<char *>(&r) + sizeof(type), rest))
+                throw std::runtime_error("Binary timeplot file is truncated");
+            if (r.worker == 0 || r.worker >= names.size()
+                || r.action == 0 || r.action >= names.size())
+                throw std::runtime_error("Binary timeplot file references an undefined name");
+            if (workers[r.worker] == NULL)
+                workers[r.worker] = &trace[names[r.worker]];
+
+            TraceEvent event;
+            event.action = names[r.action];
+            event.start = r.start;
+            event.stop = r.stop;
+            if (r.hasValue)
+                event.value = r.value;
+            workers[r.worker]->push_back(event);
+        }
+        else
+            throw std::runtime_error("Binary timeplot file has an unknown record type");
+    }
+    if (!in.eof())
+        throw std::runtime_error("Error reading binary timeplot file");
+}
+
+/**
+ * Parse one line of a text trace. Lines that are not recognised are ignored.
+ *
+ * @param line          The line to parse.
+ * @param trace         Trace to which events are added.
+ * @param[in,out] last  Events of the worker of the previous @c EVENT line,
+ *                      to which a @c VALUE line applies.
+ */
+static void readTextLine(const std::string &line, Trace &trace, std::vector<TraceEvent> *&last)
+{
+    std::istringstream fields(line);
+    std::string keyword;
+    fields >> keyword;
+    if (keyword == "EVENT")
+    {
+        std::string worker;
+        TraceEvent event;
+        if (!(fields >> worker >> event.action >> event.start >> event.stop))
+            throw std::runtime_error("Malformed EVENT line in timeplot file");
+        last = &trace[worker];
+        last->push_back(event);
+    }
+    else if (keyword == "VALUE")
+    {
+        std::tr1::uint64_t value;
+        if (last == NULL || !(fields >> value))
+            throw std::runtime_error("Malformed VALUE line in timeplot file");
+        last->back().value = value;
+    }
+}
+
+/**
+ * Read the lines of a text trace. The first few characters have already
+ * been consumed while detecting the format, and are passed in @a prefix.
+ */
+static void readTextTrace(std::istream &in, const std::string &prefix, Trace &trace)
+{
+    std::vector<TraceEvent> *last = NULL;
+    std::string::size_type pos = 0, eol;
+    while ((eol = prefix.find('\n', pos)) != std::string::npos)
+    {
+        readTextLine(prefix.substr(pos, eol - pos), trace, last);
+        pos = eol + 1;
     }
+
+    std::string line = prefix.substr(pos);
+    std::string rest;
+    if (std::getline(in, rest))
+        line += rest;
+    readTextLine(line, trace, last);
+    while (std::getline(in, line))
+        readTextLine(line, trace, last);
+}
+
+} // anonymous namespace
+
+void readTrace(std::istream &in, Trace &trace)
+{
+    static const char magic[8] = {'M', 'L', 'S', 'G', 'P', 'U', 'T', 'P'};
+    char start[sizeof(magic)];
+    in.read(start, sizeof(start));
+    const std::size_t got = in.gcount();
+    if (got == sizeof(magic) && std::memcmp(start, magic, sizeof(magic)) == 0)
+        readBinaryTrace(in, trace);
+    else
+        readTextTrace(in, std::string(start, got), trace);
+
+    for (Trace::iterator i = trace.begin(); i != trace.end(); ++i)
+        std::stable_sort(i->second.begin(), i->second.end(), eventStopLess);
 }
 
 } // namespace Timeplot
@@ -33,8 +33,12 @@
 #include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
 #include <string>
+#include <map>
+#include <vector>
+#include <istream>
 #include "timer.h"
 #include "statistics.h"
+#include "tr1_cstdint.h"
 
 /**
  * Record timing information. The start and end times for various events are
@@ -54,6 +58,18 @@
  * not enforced), it is guaranteed that two events for the same worker will not
  * overlap in time. An action is something currently being undertaken by a
  * worker.
+ *
+ * Writing text requires a global lock for every event. Alternatively, a
+ * compact binary trace can be written. Each worker then appends fixed-size
+ * records to its own lock-free ring buffer, which is drained by a background
+ * thread. If a ring fills up, records are dropped and counted in the
+ * @c timeplot.dropped statistic. The file consists of a header (the 8 bytes
+ * <code>MLSGPUTP</code>, a 32-bit version number and the 32-bit value
+ * 0x01020304 to identify the byte order), followed by name records (type 1:
+ * ID, length and bytes) and event records (type 2: worker name ID, action
+ * name ID, whether there is a value, start and stop times as doubles, and a
+ * 64-bit value). Names are always defined before they are referenced.
+ * <code>utils/timeplot_convert.py</code> converts it to the text format.
  */
 namespace Timeplot
 {
@@ -64,13 +80,39 @@ namespace Timeplot
  * be updated as normal.
  *
  * @param filename          File to which the data are written.
+ * @param binary            Write the binary format rather than text.
  * @throw std::ios::failure if the file could not be opened.
- * @pre @ref init has not already been called.
+ * @pre @ref init has not already been called, unless @ref close has been
+ * called since.
+ */
+void init(const std::string &filename, bool binary = false);
+
+/**
+ * Write out any buffered data, close the file and free the buffers. This
+ * should be called at shutdown, once all worker threads have finished. After
+ * it returns, no further timeplot data is written until @ref init is called
+ * again. It does nothing if @ref init was not called.
  */
-void init(const std::string &filename);
+void close();
+
+/**
+ * Calls @ref close on destruction, so that the trace is completed on every
+ * exit path, including exceptions. Construct it just before calling @ref
+ * init, in the scope that owns the worker threads.
+ */
+class Closer : public boost::noncopyable
+{
+public:
+    ~Closer();
+};
 
 class Action;
 
+namespace detail
+{
+    class TraceBuffer;
+} // namespace detail
+
 /**
  * Encapsulates a worker. Workers perform actions, which must start and stop in
  * LIFO order i.e. it emulates a call stack. However, only the leaf action is
@@ -86,6 +128,12 @@ private:
     /// The top of the stack, or @c NULL if there is no current action
     Action *currentAction;
 
+    /// Ring for binary records, created on first use (or @c NULL)
+    detail::TraceBuffer *trace;
+
+    /// Binary trace session that owns @ref trace
+    unsigned int traceSession;
+
     /**
      * Called by @ref Action to push itself onto the stack. It returns the previous
      * action, which it must save and pass back to @ref stop. That is, the stack is
@@ -123,8 +171,24 @@ public:
      */
     Worker(const std::string &name, int idx);
 
+    /// Destructor. Any buffered binary records are handed over to be written.
+    ~Worker();
+
     /// Get the name of the worker
     const std::string &getName() const;
+
+    /**
+     * Record an event. This is the implementation of @ref Timeplot::recordEvent
+     * and of @ref Action.
+     *
+     * @param name       Action name.
+     * @param nameId     Cached ID for @a name in the binary trace (0 if not yet known).
+     * @param start,stop Start and end of the event.
+     * @param value      Optional value to attach.
+     */
+    void record(const std::string &name, std::tr1::uint32_t &nameId,
+                Timer::timestamp start, Timer::timestamp stop,
+                const boost::optional<std::size_t> &value);
 };
 
 /**
@@ -150,6 +214,7 @@ private:
     Timer::timestamp start;  ///< Time of the last resume, or of construction
 
     boost::optional<std::size_t> value;  ///< User-supplied value
+    std::tr1::uint32_t nameId;           ///< Cached ID of @ref name in the binary trace
 
     /// Second-phase initialization, shared by several constructors
     void init();
@@ -213,6 +278,33 @@ public:
  */
 void recordEvent(const std::string &name, Worker &worker);
 
+/**
+ * An event read back from a trace by @ref readTrace.
+ */
+struct TraceEvent
+{
+    std::string action;                         ///< Name of the action
+    double start;                               ///< Start time, in seconds
+    double stop;                                ///< Stop time, in seconds
+    boost::optional<std::tr1::uint64_t> value;  ///< Value, if one was recorded
+};
+
+/// Events read back from a trace, keyed by worker name
+typedef std::map<std::string, std::vector<TraceEvent> > Trace;
+
+/**
+ * Read back a trace in either the text or the binary format, which is
+ * detected automatically. The events of each worker are sorted by stop time,
+ * which is the order in which they were recorded. Workers that share a name
+ * (such as successive reader threads) are merged.
+ *
+ * @param in       Stream containing the trace, opened in binary mode.
+ * @param[out] trace Events, which are appended to any already present.
+ * @throw std::runtime_error if the trace is malformed, or is binary and was
+ * written with a different byte order.
+ */
+void readTrace(std::istream &in, Trace &trace);
+
 } // namespace Timeplot
 
 #endif /* !TIMEPLOT_H */
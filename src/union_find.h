@@ -88,10 +88,28 @@ public:
         return -parentSize;
     }
 
+    /**
+     * Raw encoding of the node (its parent, or its negated size if it is a
+     * root), for storing the structure in binary files.
+     */
+    size_type encoded() const
+    {
+        return parentSize;
+    }
+
+    /// Restore a node from a value returned by @ref encoded.
+    void setEncoded(size_type e)
+    {
+        parentSize = e;
+    }
+
 private:
     template<typename NodeVector>
         friend typename NodeVector::iterator::value_type::size_type
         findRoot(const NodeVector &nodes, typename NodeVector::iterator::value_type::size_type id);
+    template<typename NodeVector>
+        friend typename NodeVector::iterator::value_type::size_type
+        findRootConst(const NodeVector &nodes, typename NodeVector::iterator::value_type::size_type id);
     template<typename NodeVector>
         friend bool merge(NodeVector &nodes,
                           typename NodeVector::iterator::value_type::size_type a,
@@ -180,6 +198,39 @@ findRoot(const NodeVector &nodes, typename NodeVector::iterator::value_type::siz
     return root;
 }
 
+/**
+ * Determines the root node of the component of a given node, without path
+ * compression. Unlike @ref findRoot, it does not modify @a nodes, and so may
+ * be called concurrently from multiple threads. It is only efficient if the
+ * paths have already been compressed (see @ref flatten).
+ *
+ * @param nodes        Random access container of nodes giving a union-find structure.
+ * @param id           Index of the query node.
+ * @return Index of the unique root node that is in the same component as @a id.
+ */
+template<typename NodeVector>
+typename NodeVector::iterator::value_type::size_type
+findRootConst(const NodeVector &nodes, typename NodeVector::iterator::value_type::size_type id)
+{
+    while (!nodes[id].isRoot())
+        id = nodes[id].parent();
+    return id;
+}
+
+/**
+ * Compresses all paths, so that every node is either a root or a child of
+ * a root.
+ *
+ * @param nodes        Random access container of nodes giving a union-find structure.
+ */
+template<typename NodeVector>
+void flatten(const NodeVector &nodes)
+{
+    typedef typename NodeVector::iterator::value_type::size_type size_type;
+    for (size_type i = 0; i < size_type(nodes.size()); i++)
+        findRoot(nodes, i);
+}
+
 /**
  * Combine two components. It is legal to call this function when the given
  * nodes are already in the same component.
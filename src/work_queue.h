@@ -38,9 +38,11 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/noncopyable.hpp>
 #include "errors.h"
+#include "atomic.h"
 
 /**
  * Thread-safe queue, supporting multiple producers and multiple consumers. The
@@ -167,4 +169,381 @@ void WorkQueue<ValueType>::stop()
     dataCondition.notify_all(); // wake up any consumers waiting on an empty queue
 }
 
+/**
+ * Bounded thread-safe queue, supporting multiple producers and multiple
+ * consumers without locks on the fast path. It provides the same interface
+ * and stop/start semantics as @ref WorkQueue, but @ref push blocks when the
+ * queue is full. Batch versions of @ref push and @ref pop are also provided,
+ * which wake waiting threads at most once per batch.
+ *
+ * The queue is an array of cells, each tagged with a sequence number that
+ * indicates whether it is ready to be written or read for a given lap of the
+ * ring. A thread that finds nothing to do spins briefly and then parks on a
+ * condition variable; the other side only takes the mutex to wake it if some
+ * thread has announced that it is parked.
+ *
+ * As for @ref WorkQueue, the assignment operator of the value type must not
+ * throw. Popped cells are overwritten with a default-constructed value so
+ * that smart pointers are released promptly.
+ *
+ * @param ValueType   The type of data stored in the queue.
+ */
+template<typename ValueType>
+class LockFreeWorkQueue : public boost::noncopyable
+{
+public:
+    typedef ValueType value_type;
+    typedef std::size_t size_type;
+
+    /**
+     * Add an item to the queue. This will block if the queue is full.
+     *
+     * @pre The queue is not stopped.
+     */
+    void push(const value_type &item);
+
+    /**
+     * Add a sequence of items to the queue. Items are added in order, but
+     * items from other producers may be interleaved. Consumers are woken once
+     * at the end of the batch, or earlier if the queue fills up, so the batch
+     * may be larger than the capacity.
+     *
+     * @pre The queue is not stopped.
+     */
+    template<typename InputIterator>
+    void push(InputIterator first, InputIterator last);
+
+    /**
+     * Extract an item from the queue. This will block if the queue is empty.
+     *
+     * If the queue has been marked stopped and there is no more data in the
+     * queue, it will return a default-constructed value.
+     */
+    value_type pop();
+
+    /**
+     * Extract up to @a maxItems items from the queue. This blocks until at
+     * least one is available, but does not wait for more.
+     *
+     * @return The number of items written to @a out, which is zero only if the
+     * queue has been stopped and drained.
+     */
+    template<typename OutputIterator>
+    size_type pop(OutputIterator out, size_type maxItems);
+
+    /**
+     * Determine whether calling @ref pop will block. In a multithreaded
+     * environment the result should of course be considered immediately stale.
+     * Note that if the queue has been stopped then this will return @c false.
+     */
+    bool empty();
+
+    /**
+     * Return the number of items in the queue, including any that are still
+     * being pushed. This does not block, and like @ref empty the result is
+     * immediately stale.
+     */
+    size_type size() const;
+
+    /**
+     * Indicate that there will be no more data added. It is not safe to call
+     * this simultaneously with @ref push.
+     */
+    void stop();
+
+    /**
+     * Indicate that there will be new data added. This should only be called
+     * when there is only a single thread active. It is not necessary to call
+     * it initially, as this is the initial state.
+     */
+    void start();
+
+    /**
+     * Constructor.
+     *
+     * @param capacity   Maximum number of items in the queue. It is rounded up
+     *                   to a power of 2.
+     * @pre @a capacity &gt; 0
+     */
+    explicit LockFreeWorkQueue(size_type capacity = 4096);
+
+private:
+    /// Element of the ring
+    struct Cell
+    {
+        /**
+         * Equal to the enqueue position when the cell may be written, and
+         * one more than that when it may be read.
+         */
+        Atomic<size_type> seq;
+        value_type value;
+    };
+
+    /// Number of times to poll before parking
+    static const int spinCount = 64;
+
+    boost::scoped_array<Cell> cells;
+    size_type mask;                      ///< Number of cells minus one
+
+    Atomic<size_type> enqueuePos;        ///< Position of the next push
+    char pad1[64];                       ///< Keeps producers and consumers on separate cache lines
+    Atomic<size_type> dequeuePos;        ///< Position of the next pop
+    char pad2[64];
+
+    Atomic<unsigned int> stopped;        ///< Non-zero once @ref stop is called
+    Atomic<unsigned int> popWaiters;     ///< Consumers parked or about to park
+    Atomic<unsigned int> pushWaiters;    ///< Producers parked or about to park
+
+    boost::mutex mutex;                  ///< Used only for parking
+    boost::condition_variable dataCondition;    ///< Signalled when items are added or on stop
+    boost::condition_variable spaceCondition;   ///< Signalled when items are removed
+
+    /// Push without blocking or waking consumers
+    bool tryPush(const value_type &item);
+
+    /// Pop without blocking or waking producers
+    bool tryPop(value_type &item);
+
+    /// Push, blocking while the queue is full, without waking consumers
+    void pushWait(const value_type &item);
+
+    /**
+     * Pop, blocking while the queue is empty and not stopped.
+     * @return false if the queue was stopped and drained
+     */
+    bool popWait(value_type &item);
+
+    /// Wake consumers if any are parked
+    void wakeConsumers(bool all);
+
+    /// Wake producers if any are parked
+    void wakeProducers();
+};
+
+template<typename ValueType>
+LockFreeWorkQueue<ValueType>::LockFreeWorkQueue(size_type capacity)
+    : mask(0), enqueuePos(0), dequeuePos(0), stopped(0), popWaiters(0), pushWaiters(0)
+{
+    MLSGPU_ASSERT(capacity > 0, std::invalid_argument);
+    size_type size = 1;
+    while (size < capacity)
+        size *= 2;
+    cells.reset(new Cell[size]);
+    for (size_type i = 0; i < size; i++)
+        cells[i].seq.store(i);
+    mask = size - 1;
+}
+
+template<typename ValueType>
+bool LockFreeWorkQueue<ValueType>::tryPush(const ValueType &item)
+{
+    size_type pos = enqueuePos.load();
+    while (true)
+    {
+        Cell &cell = cells[pos & mask];
+        std::ptrdiff_t dif = std::ptrdiff_t(cell.seq.load()) - std::ptrdiff_t(pos);
+        if (dif == 0)
+        {
+            if (enqueuePos.compareExchange(pos, pos + 1))
+            {
+                cell.value = item;
+                cell.seq.store(pos + 1);
+                return true;
+            }
+        }
+        else if (dif < 0)
+            return false; // full
+        else
+            pos = enqueuePos.load();
+    }
+}
+
+template<typename ValueType>
+bool LockFreeWorkQueue<ValueType>::tryPop(ValueType &item)
+{
+    size_type pos = dequeuePos.load();
+    while (true)
+    {
+        Cell &cell = cells[pos & mask];
+        std::ptrdiff_t dif = std::ptrdiff_t(cell.seq.load()) - std::ptrdiff_t(pos + 1);
+        if (dif == 0)
+        {
+            if (dequeuePos.compareExchange(pos, pos + 1))
+            {
+                item = cell.value;
+                cell.value = value_type();
+                cell.seq.store(pos + mask + 1);
+                return true;
+            }
+        }
+        else if (dif < 0)
+            return false; // empty
+        else
+            pos = dequeuePos.load();
+    }
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::wakeConsumers(bool all)
+{
+    if (popWaiters.load() > 0)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (all)
+            dataCondition.notify_all();
+        else
+            dataCondition.notify_one();
+    }
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::wakeProducers()
+{
+    if (pushWaiters.load() > 0)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        spaceCondition.notify_all();
+    }
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::pushWait(const ValueType &item)
+{
+    MLSGPU_ASSERT(!stopped.load(), state_error);
+    for (int i = 0; i < spinCount; i++)
+    {
+        if (tryPush(item))
+            return;
+        if (i >= spinCount / 2)
+            boost::this_thread::yield();
+    }
+
+    /* Announce ourselves before the final check, so that a consumer that
+     * frees a cell after the check is guaranteed to see us and wake us.
+     */
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pushWaiters.fetchAdd(1);
+    while (!tryPush(item))
+        spaceCondition.wait(lock);
+    pushWaiters.fetchSub(1);
+}
+
+template<typename ValueType>
+bool LockFreeWorkQueue<ValueType>::popWait(ValueType &item)
+{
+    for (int i = 0; i < spinCount; i++)
+    {
+        if (tryPop(item))
+            return true;
+        if (stopped.load())
+            return tryPop(item); // pick up anything pushed before the stop
+        if (i >= spinCount / 2)
+            boost::this_thread::yield();
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    popWaiters.fetchAdd(1);
+    bool found;
+    while (true)
+    {
+        found = tryPop(item);
+        if (found)
+            break;
+        if (stopped.load())
+        {
+            found = tryPop(item);
+            break;
+        }
+        dataCondition.wait(lock);
+    }
+    popWaiters.fetchSub(1);
+    return found;
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::push(const ValueType &item)
+{
+    pushWait(item);
+    wakeConsumers(false);
+}
+
+template<typename ValueType>
+template<typename InputIterator>
+void LockFreeWorkQueue<ValueType>::push(InputIterator first, InputIterator last)
+{
+    if (first == last)
+        return;
+    for (; first != last; ++first)
+    {
+        if (!tryPush(*first))
+        {
+            /* The queue is full. Consumers are normally only woken once the
+             * batch is complete, but they must be woken now to drain the
+             * items already pushed, or we would wait for space forever.
+             */
+            wakeConsumers(true);
+            pushWait(*first);
+        }
+    }
+    wakeConsumers(true);
+}
+
+template<typename ValueType>
+ValueType LockFreeWorkQueue<ValueType>::pop()
+{
+    value_type ans = value_type();
+    if (popWait(ans))
+        wakeProducers();
+    return ans;
+}
+
+template<typename ValueType>
+template<typename OutputIterator>
+typename LockFreeWorkQueue<ValueType>::size_type
+LockFreeWorkQueue<ValueType>::pop(OutputIterator out, size_type maxItems)
+{
+    if (maxItems == 0)
+        return 0;
+    value_type item = value_type();
+    if (!popWait(item))
+        return 0;
+    *out++ = item;
+    size_type n = 1;
+    while (n < maxItems && tryPop(item))
+    {
+        *out++ = item;
+        n++;
+    }
+    wakeProducers();
+    return n;
+}
+
+template<typename ValueType>
+bool LockFreeWorkQueue<ValueType>::empty()
+{
+    return !stopped.load() && enqueuePos.load() == dequeuePos.load();
+}
+
+template<typename ValueType>
+typename LockFreeWorkQueue<ValueType>::size_type LockFreeWorkQueue<ValueType>::size() const
+{
+    // Both positions only increase, so reading dequeuePos first cannot give a negative size
+    const size_type dequeued = dequeuePos.load();
+    return enqueuePos.load() - dequeued;
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::start()
+{
+    stopped.store(0);
+}
+
+template<typename ValueType>
+void LockFreeWorkQueue<ValueType>::stop()
+{
+    stopped.store(1);
+    boost::lock_guard<boost::mutex> lock(mutex);
+    dataCondition.notify_all(); // wake up any consumers waiting on an empty queue
+}
+
 #endif /* !WORK_QUEUE_H */
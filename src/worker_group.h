@@ -39,6 +39,7 @@
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <cstdlib>
 #include <cstddef>
 #include <stdexcept>
@@ -48,6 +49,7 @@
 #include "errors.h"
 #include "thread_name.h"
 #include "timeplot.h"
+#include "metrics.h"
 
 /**
  * Base class from which workers may derive. They are not required to do so,
@@ -107,9 +109,10 @@ public:
  * but are provided to allow for additional setup for cleanup, particularly when
  * the whole group is reused in multiple passes.
  *
- * At construction, the worker group is given a number of threads. There is no
- * bound on queue size, so if necessary some external mechanism must be used to
- * block producers from flooding the queue.
+ * At construction, the worker group is given a number of threads. The queue
+ * is bounded only as a safety net (producers block if it fills up), so if
+ * necessary some external mechanism must be used to block producers from
+ * flooding the queue. Subclasses usually do this in @ref get.
  *
  * The @ref start and @ref stop functions are not thread-safe: they should
  * only be called by a single manager thread. The other functions are
@@ -236,7 +239,9 @@ protected:
         firstPopStat(Statistics::getStatistic<Statistics::Variable>(name + ".pop.first")),
         popStat(Statistics::getStatistic<Statistics::Variable>(name + ".pop")),
         getStat(Statistics::getStatistic<Statistics::Variable>(name + ".get")),
-        computeStat(Statistics::getStatistic<Statistics::Variable>(name + ".compute"))
+        computeStat(Statistics::getStatistic<Statistics::Variable>(name + ".compute")),
+        queueGauge(name + ".queue",
+                   boost::bind(&LockFreeWorkQueue<boost::shared_ptr<WorkItem> >::size, &workQueue))
     {
         MLSGPU_ASSERT(numWorkers > 0, std::invalid_argument);
         workers.reserve(numWorkers);
@@ -309,7 +314,7 @@ private:
     /**
      * Queue of items waiting to be processed.
      */
-    WorkQueue<boost::shared_ptr<WorkItem> > workQueue;
+    LockFreeWorkQueue<boost::shared_ptr<WorkItem> > workQueue;
 
     Statistics::Variable &firstPopStat;
     Statistics::Variable &popStat;
@@ -318,6 +323,9 @@ protected:
 private:
     Statistics::Variable &computeStat;
 
+    /// Exports the number of items in @ref workQueue
+    Metrics::Gauge queueGauge;
+
     /**
      * Take shutdown actions prior to joining the worker threads. This is a hook
      * that subclasses may override.
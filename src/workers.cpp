@@ -34,6 +34,7 @@
 
 #include <cstddef>
 #include <vector>
+#include <algorithm>
 #include <CL/cl.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
@@ -56,33 +57,171 @@
 #include "errors.h"
 #include "thread_name.h"
 #include "misc.h"
+#include "timer.h"
+#include "subsampling_model.h"
 
-MesherGroupBase::Worker::Worker(MesherGroup &owner)
-    : WorkerBase("mesher", 0), owner(owner) {}
+MesherGroupBase::Worker::Worker(MesherGroup &owner, int idx)
+    : WorkerBase("mesher", idx), owner(owner) {}
 
 void MesherGroupBase::Worker::operator()(WorkItem &item)
 {
-    Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    owner.input(item.work, getTimeplotWorker());
-    owner.meshBuffer.free(item.alloc);
+    if (owner.prepare && !item.work.chunkEnd)
+    {
+        Timeplot::Action timer("prepare", getTimeplotWorker(), owner.prepareStat);
+        owner.prepare(item.work, components);
+    }
+
+    bool failed;
+    {
+        Timeplot::Action timer("order", getTimeplotWorker(), owner.orderStat);
+        boost::unique_lock<boost::mutex> lock(owner.inputMutex);
+        while (owner.nextInput != item.seq)
+            owner.inputCondition.wait(lock);
+        failed = owner.error;
+    }
+
+    /* The sequence must advance even if the input functor throws, otherwise
+     * the other workers would wait forever. Once it has failed its state is
+     * unreliable, so later items are skipped and the first exception is
+     * rethrown by stop().
+     */
+    boost::exception_ptr error;
+    if (!failed)
+    {
+        try
+        {
+            Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
+            owner.input(item.work, getTimeplotWorker());
+        }
+        catch (...)
+        {
+            error = boost::current_exception();
+        }
+    }
+    item.work.components = NULL;
+
+    {
+        boost::lock_guard<boost::mutex> lock(owner.inputMutex);
+        if (error)
+            owner.error = error;
+        owner.nextInput++;
+    }
+    owner.inputCondition.notify_all();
+    if (!item.work.chunkEnd)
+        owner.meshBuffer.free(item.alloc);
 }
 
-MesherGroup::MesherGroup(std::size_t memMesh)
-    : WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>(
-        "mesher", 1),
-    meshBuffer("mem.MesherGroup.mesh", memMesh)
+MesherGroup::MesherGroup(std::size_t memMesh, std::size_t numWorkers)
+    : Base("mesher", numWorkers),
+    meshBuffer("mem.MesherGroup.mesh", memMesh, true),
+    nextPush(0), nextInput(0),
+    prepareStat(Statistics::getStatistic<Statistics::Variable>("mesher.prepare")),
+    orderStat(Statistics::getStatistic<Statistics::Variable>("mesher.order"))
 {
-    addWorker(new Worker(*this));
+    for (std::size_t i = 0; i < numWorkers; i++)
+        addWorker(new Worker(*this, i));
 }
 
 boost::shared_ptr<MesherGroup::WorkItem> MesherGroup::get(Timeplot::Worker &tworker, std::size_t size)
 {
-    boost::shared_ptr<WorkItem> item = WorkerGroup<WorkItem, Worker, MesherGroup>::get(tworker, size);
+    boost::shared_ptr<WorkItem> item = Base::get(tworker, size);
     std::size_t rounded = roundUp(size, sizeof(cl_ulong)); // to ensure alignment
     item->alloc = meshBuffer.allocate(tworker, rounded, &getStat);
     return item;
 }
 
+void MesherGroup::push(Timeplot::Worker &tworker, boost::shared_ptr<WorkItem> item)
+{
+    /* The queue is FIFO, so assigning the sequence number under the same
+     * lock as the push guarantees that items are popped in sequence order.
+     * Thus the lowest outstanding item is always held by a consumer that is
+     * not waiting, and the consumers cannot deadlock.
+     */
+    boost::lock_guard<boost::mutex> lock(pushMutex);
+    item->seq = nextPush++;
+    Base::push(tworker, item);
+}
+
+void MesherGroup::pushChunkEnd(Timeplot::Worker &tworker, const ChunkId &chunkId)
+{
+    // Bypasses get, since there is no mesh data to allocate
+    boost::shared_ptr<WorkItem> item = Base::get(tworker, 0);
+    item->work.chunkId = chunkId;
+    item->work.chunkEnd = true;
+    push(tworker, item);
+}
+
+void MesherGroup::start()
+{
+    nextPush = 0;
+    nextInput = 0;
+    error = boost::exception_ptr();
+    Base::start();
+}
+
+void MesherGroup::stopPostJoin()
+{
+    if (error)
+    {
+        boost::exception_ptr e = error;
+        error = boost::exception_ptr();
+        boost::rethrow_exception(e);
+    }
+}
+
+
+ChunkTracker::ChunkTracker(MesherGroup &mesherGroup)
+    : mesherGroup(mesherGroup), closed(0)
+{
+}
+
+void ChunkTracker::add(const ChunkId &chunkId)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    MLSGPU_ASSERT(chunkId.gen >= closed, state_error);
+    Pending &p = pending[chunkId.gen];
+    p.chunkId = chunkId;
+    p.bins++;
+}
+
+void ChunkTracker::done(Timeplot::Worker &tworker, const ChunkId &chunkId)
+{
+    bool complete;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::map<ChunkId::gen_type, Pending>::iterator pos = pending.find(chunkId.gen);
+        MLSGPU_ASSERT(pos != pending.end() && pos->second.bins > 0, state_error);
+        complete = --pos->second.bins == 0 && chunkId.gen < closed;
+        if (complete)
+            pending.erase(pos);
+    }
+    // The caller has already pushed all the meshes of the bin
+    if (complete)
+        mesherGroup.pushChunkEnd(tworker, chunkId);
+}
+
+void ChunkTracker::close(Timeplot::Worker &tworker, ChunkId::gen_type completeChunks)
+{
+    std::vector<ChunkId> complete;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        closed = std::max(closed, completeChunks);
+        std::map<ChunkId::gen_type, Pending>::iterator pos = pending.begin();
+        while (pos != pending.end() && pos->first < closed)
+        {
+            if (pos->second.bins == 0)
+            {
+                complete.push_back(pos->second.chunkId);
+                pending.erase(pos++);
+            }
+            else
+                ++pos;
+        }
+    }
+    for (std::size_t i = 0; i < complete.size(); i++)
+        mesherGroup.pushChunkEnd(tworker, complete[i]);
+}
+
 
 DeviceWorkerGroup::DeviceWorkerGroup(
     std::size_t numWorkers, std::size_t spare,
@@ -91,17 +230,28 @@ DeviceWorkerGroup::DeviceWorkerGroup(
     std::size_t maxBucketSplats, Grid::size_type maxCells,
     std::size_t meshMemory,
     int levels, int subsampling, float boundaryLimit,
-    MlsShape shape)
+    MlsShape shape, cl_channel_type distanceType,
+    bool packMesh, bool deviceWeld,
+    int decimateCells, bool overlapSwathes)
 :
     Base("device", numWorkers),
     progress(NULL), outputGenerator(outputGenerator),
     context(context), device(device),
     maxBucketSplats(maxBucketSplats), maxCells(maxCells), meshMemory(meshMemory),
     subsampling(subsampling),
+    distanceType(distanceType),
+    packMesh(packMesh),
+    deviceWeld(deviceWeld),
+    decimateCells(decimateCells),
+    overlapSwathes(overlapSwathes),
+    subsamplingModel(NULL),
+    chunkTracker(NULL),
     copyQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE),
     itemPool(),
     popMutex(NULL),
-    popCondition(NULL)
+    popCondition(NULL),
+    unallocated_(0),
+    unallocatedGauge("device.unallocated", boost::bind(&DeviceWorkerGroup::unallocated, this))
 {
     for (std::size_t i = 0; i < numWorkers; i++)
     {
@@ -118,7 +268,8 @@ DeviceWorkerGroup::DeviceWorkerGroup(
 
     CLH::ResourceUsage usage = resourceUsage(
         numWorkers, spare, device,
-        maxBucketSplats, maxCells, meshMemory, levels);
+        maxBucketSplats, maxCells, meshMemory, levels, distanceType,
+        packMesh, deviceWeld, decimateCells, overlapSwathes);
     usage.addStatistics(Statistics::Registry::getInstance(), "mem.device.");
 }
 
@@ -181,12 +332,21 @@ Grid::size_type DeviceWorkerGroupBase::computeMaxSwathe(
     return chunks * zAlign;
 }
 
+void DeviceWorkerGroupBase::weldCapacity(
+    std::size_t meshMemory, std::size_t &maxVertices, std::size_t &maxTriangles)
+{
+    const std::size_t meshCells = meshMemory / Marching::MAX_CELL_BYTES;
+    maxVertices = meshCells * Marching::MAX_CELL_VERTICES;
+    maxTriangles = meshCells * (Marching::MAX_CELL_INDICES / 3);
+}
+
 CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
     std::size_t numWorkers, std::size_t spare,
     const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
     std::size_t meshMemory,
-    int levels)
+    int levels, cl_channel_type distanceType,
+    bool packMesh, bool deviceWeld, int decimateCells, bool overlapSwathes)
 {
     Grid::size_type block = maxCells + 1;
     Grid::size_type maxSwathe = computeMaxSwathe(
@@ -195,8 +355,17 @@ CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
     CLH::ResourceUsage workerUsage;
     workerUsage += Marching::resourceUsage(
         device, block, block, block,
-        maxSwathe, meshMemory, MlsFunctor::wgs);
+        maxSwathe, meshMemory, MlsFunctor::wgs, distanceType, overlapSwathes);
+    workerUsage += MlsFunctor::resourceUsage(block, block, maxSwathe);
     workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats);
+    std::size_t maxVertices, maxTriangles;
+    weldCapacity(meshMemory, maxVertices, maxTriangles);
+    if (deviceWeld)
+        workerUsage += MeshWelder::resourceUsage(maxVertices, maxTriangles);
+    if (packMesh)
+        workerUsage += PackMeshFilter::resourceUsage(maxVertices, maxTriangles);
+    if (decimateCells > 0)
+        workerUsage += DecimateFilter::resourceUsage(maxVertices, maxTriangles);
 
     const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
     CLH::ResourceUsage itemUsage;
@@ -214,14 +383,36 @@ DeviceWorkerGroupBase::Worker::Worker(
     owner(owner),
     queue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
     tree(context, device, levels, owner.maxBucketSplats),
-    input(context, shape),
+    input(context, shape, owner.maxCells + 1, owner.maxCells + 1,
+          computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, MlsFunctor::wgs[1], MlsFunctor::wgs[2])),
     marching(context, device, owner.maxCells + 1, owner.maxCells + 1, owner.maxCells + 1,
              computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, input.alignment()[1], input.alignment()[2]),
-             owner.meshMemory, input.alignment()),
-    scaleBias(context)
+             owner.meshMemory, input.alignment(), owner.distanceType, owner.overlapSwathes),
+    scaleBias(context),
+    batchStat(Statistics::getStatistic<Statistics::Variable>("device.batch"))
 {
     input.setBoundaryLimit(boundaryLimit);
+    std::size_t maxVertices, maxTriangles;
+    weldCapacity(owner.meshMemory, maxVertices, maxTriangles);
+    if (owner.decimateCells > 0)
+    {
+        // Must come before the scale-bias, as it works in grid coordinates
+        decimate.reset(new DecimateFilter(context, device, owner.decimateCells, maxVertices, maxTriangles));
+        filterChain.addFilter(boost::ref(*decimate));
+    }
     filterChain.addFilter(boost::ref(scaleBias));
+    if (owner.packMesh)
+        packMesh.reset(new PackMeshFilter(context, maxVertices, maxTriangles));
+    if (owner.deviceWeld)
+    {
+        welder.reset(new MeshWelder(context, device, maxVertices, maxTriangles));
+        welder->setOutput(boost::ref(weldOutput));
+        filterChain.setOutput(boost::ref(*welder));
+        if (packMesh)
+            weldOutput.addFilter(boost::ref(*packMesh));
+    }
+    else if (packMesh)
+        filterChain.addFilter(boost::ref(*packMesh));
 }
 
 void DeviceWorkerGroupBase::Worker::start()
@@ -229,52 +420,108 @@ void DeviceWorkerGroupBase::Worker::start()
     scaleBias.setScaleBias(owner.fullGrid);
 }
 
-void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
+/**
+ * Computes the octree dimensions needed for a sub-item. These are the
+ * number of vertices rounded up to a multiple of the granularity used for
+ * MLS.
+ */
+static void subItemTreeSize(const DeviceWorkerGroup::SubItem &sub, Grid::size_type expandedSize[3])
 {
-    Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    BOOST_FOREACH(const SubItem &sub, work.subItems)
+    for (int i = 0; i < 3; i++)
+        expandedSize[i] = roundUp(sub.grid.numVertices(i), MlsFunctor::wgs[i]);
+}
+
+int DeviceWorkerGroupBase::Worker::chooseSubsampling(const SubItem &sub)
+{
+    if (owner.subsamplingModel == NULL)
+        return owner.subsampling;
+    Grid::size_type expandedSize[3];
+    subItemTreeSize(sub, expandedSize);
+    return owner.subsamplingModel->choose(sub.numSplats, expandedSize, tree.getMaxLevels());
+}
+
+void DeviceWorkerGroupBase::Worker::processBatch(
+    WorkItem &work, std::size_t first, std::size_t last, std::size_t levels, int subsampling)
+{
+    Timer timer;
+    batch.clear();
+    for (std::size_t i = first; i < last; i++)
     {
+        const SubItem &sub = work.subItems[i];
+        SplatTreeCL::BatchItem item;
+        item.firstSplat = sub.firstSplat;
+        item.numSplats = sub.numSplats;
+        for (int j = 0; j < 3; j++)
+            item.offset[j] = sub.grid.getExtent(j).first;
+        batch.push_back(item);
+    }
+    batchStat.add(last - first);
+
+    cl::Event treeBuildEvent;
+    std::vector<cl::Event> wait(1);
+
+    wait[0] = work.copyEvent;
+    tree.enqueueBuildBatch(queue, work.splats, batch, levels, subsampling, &wait, &treeBuildEvent);
+    wait[0] = treeBuildEvent;
+
+    // Bounding box of the sub-items accumulated in the welder
+    float runLower[3] = {}, runUpper[3] = {};
+    for (std::size_t i = first; i < last; i++)
+    {
+        const SubItem &sub = work.subItems[i];
+        const bool newRun = i == first || sub.chunkId.gen != work.subItems[i - 1].chunkId.gen;
         cl_uint3 keyOffset;
-        for (int i = 0; i < 3; i++)
-            keyOffset.s[i] = sub.grid.getExtent(i).first;
-        // same thing, just as a different type for a different API
-        Grid::difference_type offset[3] =
-        {
-            (Grid::difference_type) keyOffset.s[0],
-            (Grid::difference_type) keyOffset.s[1],
-            (Grid::difference_type) keyOffset.s[2]
-        };
+        for (int j = 0; j < 3; j++)
+            keyOffset.s[j] = sub.grid.getExtent(j).first;
 
         Grid::size_type size[3];
-        for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
         {
             /* Note: numVertices not numCells, because Marching does per-vertex queries.
              * So we need information about the cell that is just beyond the last vertex,
              * just to avoid special-casing it.
              */
-            size[i] = sub.grid.numVertices(i);
+            size[j] = sub.grid.numVertices(j);
         }
 
-        /* We need to round up the octree size to a multiple of the granularity used for MLS. */
-        Grid::size_type expandedSize[3];
-        for (int i = 0; i < 3; i++)
-            expandedSize[i] = roundUp(size[i], MlsFunctor::wgs[i]);
-
-        filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
+        if (welder && newRun)
+        {
+            // Only sub-items of the same chunk can be welded together
+            welder->flush(queue, NULL, NULL);
+            weldOutput.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
+        }
 
-        cl::Event treeBuildEvent;
-        std::vector<cl::Event> wait(1);
+        if (packMesh)
+        {
+            // Every vertex lies within the box spanned by the grid vertices
+            float lower[3], upper[3];
+            owner.fullGrid.getVertex(keyOffset.s[0], keyOffset.s[1], keyOffset.s[2], lower);
+            owner.fullGrid.getVertex(keyOffset.s[0] + size[0] - 1,
+                                     keyOffset.s[1] + size[1] - 1,
+                                     keyOffset.s[2] + size[2] - 1, upper);
+            if (welder)
+            {
+                // The packed mesh may contain any of the sub-items in the run
+                for (int j = 0; j < 3; j++)
+                {
+                    if (!newRun)
+                    {
+                        lower[j] = std::min(lower[j], runLower[j]);
+                        upper[j] = std::max(upper[j], runUpper[j]);
+                    }
+                    runLower[j] = lower[j];
+                    runUpper[j] = upper[j];
+                }
+            }
+            packMesh->setBox(lower, upper);
+        }
 
-        wait[0] = work.copyEvent;
-        tree.enqueueBuild(queue, work.splats, sub.firstSplat, sub.numSplats,
-                          expandedSize, offset, owner.subsampling, &wait, &treeBuildEvent);
-        wait[0] = treeBuildEvent;
+        if (!welder)
+            filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
 
-        input.set(offset, tree, owner.subsampling);
+        input.set(batch[i - first].offset, tree, subsampling, i - first);
         marching.generate(queue, input, filterChain, size, keyOffset, &wait);
 
-        tree.clearSplats();
-
         if (owner.progress != NULL)
             *owner.progress += sub.progressSplats;
 
@@ -283,6 +530,71 @@ void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
             owner.unallocated_ += sub.numSplats;
         }
     }
+    if (welder)
+        welder->flush(queue, NULL, NULL);
+
+    tree.clearSplats();
+
+    if (owner.subsamplingModel != NULL)
+    {
+        /* Marching::generate waits for the device, so the elapsed time covers
+         * the octree build and the corner evaluation for the whole batch.
+         */
+        double f[SubsamplingModel::NUM_FEATURES] = {};
+        for (std::size_t i = first; i < last; i++)
+        {
+            Grid::size_type expandedSize[3];
+            double subF[SubsamplingModel::NUM_FEATURES];
+            subItemTreeSize(work.subItems[i], expandedSize);
+            SubsamplingModel::features(work.subItems[i].numSplats, expandedSize, subsampling, subF);
+            for (int j = 0; j < SubsamplingModel::NUM_FEATURES; j++)
+                f[j] += subF[j];
+        }
+        owner.subsamplingModel->record(subsampling, f, timer.getElapsed());
+    }
+}
+
+void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
+{
+    Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
+
+    /* Sub-items are grouped greedily into runs whose octrees can all be
+     * built together. Large sub-items need a full-size octree and so end up
+     * in a run on their own, while sparse regions with many tiny buckets
+     * share the launch overheads of the octree construction. A run also
+     * requires all its sub-items to use the same subsampling.
+     */
+    const std::size_t numSubItems = work.subItems.size();
+    shifts.resize(numSubItems);
+    for (std::size_t i = 0; i < numSubItems; i++)
+        shifts[i] = chooseSubsampling(work.subItems[i]);
+
+    std::size_t first = 0;
+    while (first < numSubItems)
+    {
+        const int subsampling = shifts[first];
+        Grid::size_type expandedSize[3];
+        subItemTreeSize(work.subItems[first], expandedSize);
+        std::size_t levels = SplatTreeCL::levelsForSize(expandedSize, subsampling);
+        std::size_t last = first + 1;
+        while (last < numSubItems && shifts[last] == subsampling)
+        {
+            subItemTreeSize(work.subItems[last], expandedSize);
+            std::size_t newLevels = std::max(levels, SplatTreeCL::levelsForSize(expandedSize, subsampling));
+            if (last - first + 1 > tree.maxBatchTrees(newLevels))
+                break;
+            levels = newLevels;
+            last++;
+        }
+        processBatch(work, first, last, levels, subsampling);
+        first = last;
+    }
+
+    if (owner.chunkTracker != NULL)
+    {
+        for (std::size_t i = 0; i < numSubItems; i++)
+            owner.chunkTracker->done(getTimeplotWorker(), work.subItems[i].chunkId);
+    }
 }
 
 CopyGroup::CopyGroup(
@@ -293,7 +605,7 @@ CopyGroup::CopyGroup(
         "copy", 1),
     outGroups(outGroups),
     maxDeviceItemSplats(outGroups[0]->getMaxItemSplats()),
-    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat)),
+    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat), true),
     writeStat(Statistics::getStatistic<Statistics::Variable>("copy.write")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("copy.splats")),
     sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size"))
@@ -40,6 +40,7 @@
 #include <boost/thread/thread.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
@@ -47,6 +48,7 @@
 #include <stdexcept>
 #include <utility>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <cstdlib>
 #include <CL/cl.hpp>
@@ -56,8 +58,10 @@
 #include "mesh.h"
 #include "mesher.h"
 #include "mesh_filter.h"
+#include "mesh_welder.h"
 #include "grid.h"
 #include "progress.h"
+#include "subsampling_model.h"
 #include "work_queue.h"
 #include "bucket.h"
 #include "splat.h"
@@ -68,6 +72,7 @@
 #include "allocator.h"
 #include "worker_group.h"
 #include "timeplot.h"
+#include "metrics.h"
 
 class MesherGroup;
 
@@ -78,25 +83,30 @@ public:
     {
         MesherWork work;
         CircularBuffer::Allocation alloc; ///< Allocation backing the mesh data
+        std::tr1::uint64_t seq;           ///< Position of the item in the order it was pushed
     };
 
     class Worker : public WorkerBase
     {
     private:
         MesherGroup &owner;
+        /// Storage for the results of the prepare functor
+        MeshComponents components;
 
     public:
         typedef void result_type;
 
-        explicit Worker(MesherGroup &owner);
+        Worker(MesherGroup &owner, int idx);
         void operator()(WorkItem &work);
     };
 };
 
 /**
- * Object for handling asynchronous meshing. It always uses one consumer thread, since
- * the operation is fundamentally not thread-safe. However, there may be multiple
- * producers.
+ * Object for handling asynchronous meshing. There may be multiple producers
+ * and multiple consumer threads. If a prepare functor is set, the consumers
+ * run it concurrently. The input functor is fundamentally not thread-safe,
+ * so its calls are serialized, and are made in the order in which the items
+ * were pushed. The result is thus independent of the number of consumers.
  */
 class MesherGroup : protected MesherGroupBase,
     public WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>
@@ -107,18 +117,65 @@ public:
     /// Set the functor to use for processing data received from the output functor.
     void setInputFunctor(const MesherBase::InputFunctor &input) { this->input = input; }
 
+    /**
+     * Set the thread-safe functor to run on each item before the input
+     * functor. It may be empty, in which case it is skipped.
+     */
+    void setPrepareFunctor(const MesherBase::PrepareFunctor &prepare) { this->prepare = prepare; }
+
     boost::shared_ptr<WorkItem> get(Timeplot::Worker &tworker, std::size_t size);
 
+    /// Enqueue an item of work, recording its position in the input order.
+    void push(Timeplot::Worker &tworker, boost::shared_ptr<WorkItem> item);
+
+    /**
+     * Enqueue a @ref MesherWork::chunkEnd notice for a chunk. It reaches the
+     * input functor after every item pushed before it.
+     */
+    void pushChunkEnd(Timeplot::Worker &tworker, const ChunkId &chunkId);
+
+    /// @copydoc WorkerGroup::start
+    void start();
+
+    /**
+     * Rethrow the first exception thrown by the input functor, if any. This
+     * should not be called directly (it is called by @ref WorkerGroup).
+     */
+    void stopPostJoin();
+
     /**
      * Constructor.
      *
      * @param memMesh Memory (in bytes) to allocate for holding queued mesh data.
+     * @param numWorkers Number of consumer threads.
      */
-    explicit MesherGroup(const std::size_t memMesh);
+    explicit MesherGroup(const std::size_t memMesh, std::size_t numWorkers = 1);
 private:
+    typedef WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup> Base;
+
     MesherBase::InputFunctor input;
+    MesherBase::PrepareFunctor prepare;
     CircularBuffer meshBuffer;
 
+    /// Mutex held while assigning @ref WorkItem::seq and enqueuing the item
+    boost::mutex pushMutex;
+    /// Sequence number to assign to the next pushed item
+    std::tr1::uint64_t nextPush;
+
+    /// Mutex protecting @ref nextInput
+    boost::mutex inputMutex;
+    /// Condition signaled when @ref nextInput changes
+    boost::condition_variable inputCondition;
+    /// Sequence number of the next item to pass to the input functor
+    std::tr1::uint64_t nextInput;
+    /// First exception thrown by the input functor (protected by @ref inputMutex)
+    boost::exception_ptr error;
+
+    /// Time spent in the prepare functor
+    Statistics::Variable &prepareStat;
+    /// Time spent waiting for earlier items to be passed to the input functor
+    Statistics::Variable &orderStat;
+
     friend class MesherGroupBase::Worker;
 
     void outputFunc(
@@ -130,6 +187,48 @@ private:
         cl::Event *event);
 };
 
+/**
+ * Counts the bins of each chunk that are still in the pipeline, and sends a
+ * @ref MesherWork::chunkEnd notice through a @ref MesherGroup once a chunk
+ * can receive no more meshes. This lets a mesher complete chunks in any
+ * order without draining the device workers at each chunk boundary.
+ *
+ * A chunk is complete once it has been closed (no more bins will be added)
+ * and every bin added for it has been reported done. Bins must be reported
+ * done only after all their meshes have been pushed to the mesher group, so
+ * that the notice is ordered after them.
+ */
+class ChunkTracker : public boost::noncopyable
+{
+public:
+    explicit ChunkTracker(MesherGroup &mesherGroup);
+
+    /// Record that a bin for @a chunkId has entered the pipeline.
+    void add(const ChunkId &chunkId);
+
+    /// Record that a bin for @a chunkId has left the device workers.
+    void done(Timeplot::Worker &tworker, const ChunkId &chunkId);
+
+    /**
+     * Record that no more bins will be added for chunks with generation less
+     * than @a completeChunks.
+     */
+    void close(Timeplot::Worker &tworker, ChunkId::gen_type completeChunks);
+
+private:
+    /// Bins outstanding for a chunk
+    struct Pending
+    {
+        ChunkId chunkId;
+        std::size_t bins;
+    };
+
+    MesherGroup &mesherGroup;
+    boost::mutex mutex;                              ///< Protects the fields below
+    std::map<ChunkId::gen_type, Pending> pending;    ///< Chunks with bins added
+    ChunkId::gen_type closed;                        ///< Generations below this are closed
+};
+
 
 class DeviceWorkerGroup;
 
@@ -154,6 +253,12 @@ protected:
     static Grid::size_type computeMaxSwathe(
         Grid::size_type yMax, Grid::size_type y, Grid::size_type yAlign, Grid::size_type zAlign);
 
+    /**
+     * Compute the capacity of the @ref MeshWelder for a given mesh memory
+     * budget. It matches the largest mesh @ref Marching can emit at once.
+     */
+    static void weldCapacity(std::size_t meshMemory, std::size_t &maxVertices, std::size_t &maxTriangles);
+
 public:
     /// Data about a single bucket.
     struct SubItem
@@ -189,8 +294,46 @@ public:
         SplatTreeCL tree;
         MlsFunctor input;
         Marching marching;
+        /// Simplifies meshes before output (@c NULL unless decimation is enabled)
+        boost::scoped_ptr<DecimateFilter> decimate;
         ScaleBiasFilter scaleBias;
+        /// Quantises meshes before read-back (@c NULL unless packing is enabled)
+        boost::scoped_ptr<PackMeshFilter> packMesh;
         MeshFilterChain filterChain;
+        /// Merges meshes of adjacent sub-items (@c NULL unless device welding is enabled)
+        boost::scoped_ptr<MeshWelder> welder;
+        /// Filters applied to the output of @ref welder
+        MeshFilterChain weldOutput;
+
+        /// Octree descriptions for the batch being built by @ref processBatch
+        std::vector<SplatTreeCL::BatchItem> batch;
+        /// Statistic for the number of sub-items per octree batch
+        Statistics::Variable &batchStat;
+
+        /// Subsampling shift chosen for each sub-item of the current work item
+        std::vector<int> shifts;
+
+        /**
+         * Chooses the subsampling shift for a sub-item. If the owner has a
+         * @ref SubsamplingModel it is consulted, otherwise the global value is
+         * used.
+         */
+        int chooseSubsampling(const SubItem &sub);
+
+        /**
+         * Process a run of sub-items. The octrees for all of them are built
+         * with a single call to @ref SplatTreeCL::enqueueBuildBatch, after
+         * which each is passed through @ref Marching separately, with the
+         * output routed to the chunk of that sub-item.
+         *
+         * @param work          The work item containing the sub-items.
+         * @param first, last   Half-open range of sub-items to process.
+         * @param levels        Number of octree levels, which must be at
+         *                      least @ref SplatTreeCL::levelsForSize for each sub-item.
+         * @param subsampling   Subsampling shift for all the octrees.
+         */
+        void processBatch(WorkItem &work, std::size_t first, std::size_t last,
+                          std::size_t levels, int subsampling);
 
     public:
         typedef void result_type;
@@ -237,6 +380,16 @@ private:
     const Grid::size_type maxCells;
     const std::size_t meshMemory;
     const int subsampling;
+    const cl_channel_type distanceType; ///< Channel type for @ref Marching distance images
+    const bool packMesh;                ///< Whether to pack meshes before reading them back
+    const bool deviceWeld;              ///< Whether to weld sub-items of the same chunk on the device
+    const int decimateCells;            ///< Size of the @ref DecimateFilter cells (0 to disable)
+    const bool overlapSwathes;          ///< Whether @ref Marching pipelines swathes through a second image
+
+    /// Model for choosing subsampling per sub-item (may be @c NULL)
+    SubsamplingModel *subsamplingModel;
+    /// Tracker notified as sub-items complete (may be @c NULL)
+    ChunkTracker *chunkTracker;
 
     cl::CommandQueue copyQueue;   ///< Queue for transferring data to the device
 
@@ -253,6 +406,8 @@ private:
     std::size_t unallocated_;
     /// Mutex protecting @ref unallocated_.
     boost::mutex unallocatedMutex;
+    /// Exports @ref unallocated
+    Metrics::Gauge unallocatedGauge;
 
     friend class DeviceWorkerGroupBase::Worker;
 
@@ -277,6 +432,11 @@ public:
      * @param subsampling        Octree subsampling level.
      * @param boundaryLimit      Tuning factor for boundary pruning.
      * @param shape              The shape to fit to the data
+     * @param distanceType       Channel type for the signed distance image (see @ref Marching::Marching).
+     * @param packMesh           If true, meshes are packed with @ref PackMeshFilter before being read back.
+     * @param deviceWeld         If true, consecutive sub-items of the same chunk are merged with @ref MeshWelder.
+     * @param decimateCells      If positive, meshes are simplified with @ref DecimateFilter using cells of this size.
+     * @param overlapSwathes     If true, @ref Marching overlaps swathes using a second distance image (see @ref Marching::Marching).
      */
     DeviceWorkerGroup(
         std::size_t numWorkers, std::size_t spare,
@@ -285,7 +445,9 @@ public:
         std::size_t maxBucketSplats, Grid::size_type maxCells,
         std::size_t meshMemory,
         int levels, int subsampling, float boundaryLimit,
-        MlsShape shape);
+        MlsShape shape, cl_channel_type distanceType = CL_FLOAT,
+        bool packMesh = false, bool deviceWeld = false,
+        int decimateCells = 0, bool overlapSwathes = false);
 
     /// Returns total resources that would be used by all workers and workitems
     static CLH::ResourceUsage resourceUsage(
@@ -293,7 +455,9 @@ public:
         const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
         std::size_t meshMemory,
-        int levels);
+        int levels, cl_channel_type distanceType = CL_FLOAT,
+        bool packMesh = false, bool deviceWeld = false,
+        int decimateCells = 0, bool overlapSwathes = false);
 
     /**
      * @copydoc WorkerGroup::start
@@ -308,6 +472,21 @@ public:
      */
     void setProgress(ProgressMeter *progress) { this->progress = progress; }
 
+    /**
+     * Sets a model used to choose the subsampling for each sub-item, and
+     * which is updated with the time taken. If it is @c NULL (the default),
+     * the @a subsampling passed to the constructor is used throughout. The
+     * model may be shared between groups.
+     */
+    void setSubsamplingModel(SubsamplingModel *model) { subsamplingModel = model; }
+
+    /**
+     * Sets a tracker to notify with @ref ChunkTracker::done once all the
+     * meshes of each sub-item have been output. If it is @c NULL (the
+     * default), nothing is notified. The tracker may be shared between groups.
+     */
+    void setChunkTracker(ChunkTracker *tracker) { chunkTracker = tracker; }
+
     /**
      * Set a condition variable that will be signaled when space becomes
      * available in the item pool. The condition will be signaled with
@@ -32,6 +32,8 @@
 #include <locale>
 #include <sstream>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 #include "../src/binary_io.h"
 #include "memory_reader.h"
 #include "memory_writer.h"
@@ -42,8 +44,15 @@ MemoryWriter::MemoryWriter(
 {
 }
 
+/**
+ * Mutex protecting the outputs map, so that several writers may open files
+ * concurrently. Writes do not need it, since each goes to its own string.
+ */
+static boost::mutex outputsMutex;
+
 void MemoryWriter::openImpl(const boost::filesystem::path &filename)
 {
+    boost::lock_guard<boost::mutex> lock(outputsMutex);
     curOutput = &outputs[filename.string()];
     // Clear any previous data that might have been written
     curOutput->clear();
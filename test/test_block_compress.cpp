@@ -0,0 +1,244 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref block_compress.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <ios>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/tr1/random.hpp>
+#include "../src/block_compress.h"
+#include "../src/binary_io.h"
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+
+class TestBlockCompress : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestBlockCompress);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testXorDelta);
+    CPPUNIT_TEST(testDelta);
+    CPPUNIT_TEST(testRandomAccess);
+    CPPUNIT_TEST(testAppend);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::filesystem::path path;   ///< Compressed file used by the test
+
+    /// Words in each record of the test data
+    static const std::size_t recordWords = 3;
+
+    /**
+     * Generate @a records records of smoothly varying data, so that the
+     * filters have something to work with.
+     */
+    static std::vector<std::tr1::uint32_t> makeData(std::size_t records, std::tr1::uint32_t seed);
+
+    /// Write @a data to @ref path, appending if @a append is true
+    void writeData(const std::vector<std::tr1::uint32_t> &data, BlockCompress::Filter filter,
+                   bool append, std::size_t blockBytes);
+
+    /// Open @ref path with a @ref BlockCompress::Reader
+    BinaryReader *openReader() const;
+
+    /// Write @a data with @a filter and check that it reads back
+    void roundTrip(BlockCompress::Filter filter);
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testEmpty();         ///< Test a file with no blocks
+    void testXorDelta();      ///< Test round trip with @ref BlockCompress::FILTER_XOR_DELTA
+    void testDelta();         ///< Test round trip with @ref BlockCompress::FILTER_DELTA
+    void testRandomAccess();  ///< Test reads that are not aligned to records or blocks
+    void testAppend();        ///< Test appending blocks from a second writer
+    void testCorrupt();       ///< Test reading a file that was not written by the writer
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBlockCompress, TestSet::perBuild());
+
+void TestBlockCompress::setUp()
+{
+    path = boost::filesystem::temp_directory_path()
+        / boost::filesystem::unique_path("mlsgpu-test-%%%%-%%%%-%%%%-%%%%");
+}
+
+void TestBlockCompress::tearDown()
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+}
+
+std::vector<std::tr1::uint32_t> TestBlockCompress::makeData(std::size_t records, std::tr1::uint32_t seed)
+{
+    std::tr1::mt19937 engine(seed);
+    std::vector<std::tr1::uint32_t> data(records * recordWords);
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        std::tr1::uint32_t prev = i >= recordWords ? data[i - recordWords] : seed;
+        data[i] = prev + (engine() & 0xff);
+    }
+    return data;
+}
+
+void TestBlockCompress::writeData(
+    const std::vector<std::tr1::uint32_t> &data, BlockCompress::Filter filter,
+    bool append, std::size_t blockBytes)
+{
+    std::ios::openmode mode = std::ios::out | std::ios::binary;
+    if (append)
+        mode |= std::ios::app;
+    boost::filesystem::ofstream out(path, mode);
+    BlockCompress::Writer writer(out, recordWords * 4, filter, blockBytes);
+    // Write in uneven pieces to exercise the buffering
+    std::size_t pos = 0;
+    std::size_t step = 1;
+    while (pos < data.size())
+    {
+        std::size_t n = std::min(step * recordWords, data.size() - pos);
+        writer.write(&data[pos], n * sizeof(data[0]));
+        pos += n;
+        step = step * 3 % 101;
+    }
+    writer.flush();
+    out.close();
+    CPPUNIT_ASSERT(out);
+}
+
+BinaryReader *TestBlockCompress::openReader() const
+{
+    std::auto_ptr<BinaryReader> reader(new BlockCompress::Reader(createReader(SYSCALL_READER)));
+    reader->open(path);
+    return reader.release();
+}
+
+void TestBlockCompress::roundTrip(BlockCompress::Filter filter)
+{
+    const std::vector<std::tr1::uint32_t> data = makeData(10000, 1);
+    writeData(data, filter, false, 4096);
+
+    boost::scoped_ptr<BinaryReader> reader(openReader());
+    CPPUNIT_ASSERT_EQUAL(BinaryReader::offset_type(data.size() * 4), reader->size());
+    std::vector<std::tr1::uint32_t> actual(data.size());
+    CPPUNIT_ASSERT_EQUAL(data.size() * 4, reader->read(&actual[0], data.size() * 4, 0));
+    CPPUNIT_ASSERT(data == actual);
+
+    if (BlockCompress::haveCodec())
+    {
+        // The data is very regular, so it should compress well
+        CPPUNIT_ASSERT(boost::filesystem::file_size(path) < data.size() * 4 / 2);
+    }
+}
+
+void TestBlockCompress::testEmpty()
+{
+    writeData(std::vector<std::tr1::uint32_t>(), BlockCompress::FILTER_NONE, false, 4096);
+    CPPUNIT_ASSERT_EQUAL(boost::uintmax_t(0), boost::filesystem::file_size(path));
+
+    boost::scoped_ptr<BinaryReader> reader(openReader());
+    CPPUNIT_ASSERT_EQUAL(BinaryReader::offset_type(0), reader->size());
+    char buffer[4];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reader->read(buffer, sizeof(buffer), 0));
+}
+
+void TestBlockCompress::testXorDelta()
+{
+    roundTrip(BlockCompress::FILTER_XOR_DELTA);
+}
+
+void TestBlockCompress::testDelta()
+{
+    roundTrip(BlockCompress::FILTER_DELTA);
+}
+
+void TestBlockCompress::testRandomAccess()
+{
+    const std::vector<std::tr1::uint32_t> data = makeData(5000, 2);
+    const char *raw = reinterpret_cast<const char *>(&data[0]);
+    const std::size_t bytes = data.size() * 4;
+    writeData(data, BlockCompress::FILTER_DELTA, false, 1000);
+
+    boost::scoped_ptr<BinaryReader> reader(openReader());
+    std::tr1::mt19937 engine(3);
+    std::vector<char> buffer;
+    for (int i = 0; i < 200; i++)
+    {
+        std::size_t offset = engine() % bytes;
+        std::size_t count = engine() % 5000;
+        buffer.resize(count + 1);
+        std::size_t expected = std::min(count, bytes - offset);
+        CPPUNIT_ASSERT_EQUAL(expected, reader->read(&buffer[0], count, offset));
+        CPPUNIT_ASSERT(std::equal(raw + offset, raw + offset + expected, buffer.begin()));
+    }
+
+    // Reads past the end
+    buffer.resize(8);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reader->read(&buffer[0], 8, bytes));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reader->read(&buffer[0], 8, bytes + 100));
+}
+
+void TestBlockCompress::testAppend()
+{
+    const std::vector<std::tr1::uint32_t> data1 = makeData(1234, 4);
+    const std::vector<std::tr1::uint32_t> data2 = makeData(567, 5);
+    writeData(data1, BlockCompress::FILTER_XOR_DELTA, false, 4096);
+    writeData(data2, BlockCompress::FILTER_XOR_DELTA, true, 4096);
+
+    std::vector<std::tr1::uint32_t> expected(data1);
+    expected.insert(expected.end(), data2.begin(), data2.end());
+
+    boost::scoped_ptr<BinaryReader> reader(openReader());
+    CPPUNIT_ASSERT_EQUAL(BinaryReader::offset_type(expected.size() * 4), reader->size());
+    std::vector<std::tr1::uint32_t> actual(expected.size());
+    CPPUNIT_ASSERT_EQUAL(expected.size() * 4, reader->read(&actual[0], expected.size() * 4, 0));
+    CPPUNIT_ASSERT(expected == actual);
+}
+
+void TestBlockCompress::testCorrupt()
+{
+    {
+        boost::filesystem::ofstream out(path);
+        out << "This is not a compressed file\n";
+    }
+    CPPUNIT_ASSERT_THROW(boost::scoped_ptr<BinaryReader> reader(openReader()), std::runtime_error);
+
+    // A valid file with the final block truncated
+    const std::vector<std::tr1::uint32_t> data = makeData(1000, 6);
+    writeData(data, BlockCompress::FILTER_DELTA, false, 4096);
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    CPPUNIT_ASSERT_THROW(boost::scoped_ptr<BinaryReader> reader(openReader()), std::runtime_error);
+}
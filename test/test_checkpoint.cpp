@@ -0,0 +1,161 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref checkpoint.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+#include <ios>
+#include <boost/filesystem.hpp>
+#include "../src/checkpoint.h"
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+
+class TestCheckpoint : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCheckpoint);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testUncommitted);
+    CPPUNIT_TEST(testBadSection);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST(testMissing);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::filesystem::path path;   ///< Checkpoint file used by the test
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testRoundTrip();     ///< Test writing and reading back sections
+    void testUncommitted();   ///< Test that an uncommitted writer leaves the old file intact
+    void testBadSection();    ///< Test requesting sections that don't exist or have the wrong type
+    void testCorrupt();       ///< Test reading a file that is not a checkpoint
+    void testMissing();       ///< Test reading a file that does not exist
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCheckpoint, TestSet::perBuild());
+
+void TestCheckpoint::setUp()
+{
+    path = boost::filesystem::temp_directory_path()
+        / boost::filesystem::unique_path("mlsgpu-test-%%%%-%%%%-%%%%-%%%%");
+}
+
+void TestCheckpoint::tearDown()
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+}
+
+void TestCheckpoint::testRoundTrip()
+{
+    const std::tr1::uint64_t big[3] = {1, 0x123456789ULL, 5};
+    const char name[] = {'a', 'b', 'c'};
+    {
+        Checkpoint::Writer writer(path, Checkpoint::KIND_PASS);
+        writer.addSection(name, 3);
+        writer.addSection(big, 3);
+        writer.addSection<std::tr1::uint32_t>(NULL, 0);
+        writer.commit();
+    }
+    CPPUNIT_ASSERT(!boost::filesystem::exists(path.string() + ".tmp"));
+
+    Checkpoint::Reader reader(path);
+    CPPUNIT_ASSERT_EQUAL(Checkpoint::KIND_PASS, reader.getKind());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), reader.numSections());
+
+    std::size_t count;
+    const char *name2 = reader.section<char>(0, count);
+    CPPUNIT_ASSERT_EQUAL(std::string("abc"), std::string(name2, count));
+
+    const std::tr1::uint64_t *big2 = reader.section<std::tr1::uint64_t>(1, count);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), count);
+    // Sections must be aligned so that they can be used in place
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reinterpret_cast<std::size_t>(big2) % Checkpoint::ALIGNMENT);
+    for (int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT_EQUAL(big[i], big2[i]);
+
+    reader.section<std::tr1::uint32_t>(2, count);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), count);
+}
+
+void TestCheckpoint::testUncommitted()
+{
+    {
+        Checkpoint::Writer writer(path, Checkpoint::KIND_FINAL);
+        writer.commit();
+    }
+    {
+        Checkpoint::Writer writer(path, Checkpoint::KIND_PASS);
+        const int data = 1;
+        writer.addSection(&data, 1);
+        // Destroyed without commit, as if an exception were thrown
+    }
+    CPPUNIT_ASSERT(!boost::filesystem::exists(path.string() + ".tmp"));
+
+    Checkpoint::Reader reader(path);
+    CPPUNIT_ASSERT_EQUAL(Checkpoint::KIND_FINAL, reader.getKind());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), reader.numSections());
+}
+
+void TestCheckpoint::testBadSection()
+{
+    {
+        Checkpoint::Writer writer(path, Checkpoint::KIND_FINAL);
+        const std::tr1::uint32_t data[2] = {1, 2};
+        writer.addSection(data, 2);
+        writer.commit();
+    }
+    Checkpoint::Reader reader(path);
+    std::size_t count;
+    CPPUNIT_ASSERT_THROW(reader.section<std::tr1::uint64_t>(0, count), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(reader.section<std::tr1::uint32_t>(1, count), std::runtime_error);
+}
+
+void TestCheckpoint::testCorrupt()
+{
+    {
+        boost::filesystem::ofstream out(path);
+        out << "This is not a checkpoint file, although it is long enough to have a header\n";
+    }
+    CPPUNIT_ASSERT_THROW(Checkpoint::Reader reader(path), std::runtime_error);
+
+    {
+        boost::filesystem::ofstream out(path);
+        out << "MLSGPUCK";
+    }
+    CPPUNIT_ASSERT_THROW(Checkpoint::Reader reader(path), std::runtime_error);
+}
+
+void TestCheckpoint::testMissing()
+{
+    CPPUNIT_ASSERT_THROW(Checkpoint::Reader reader(path), std::ios::failure);
+}
@@ -59,6 +59,8 @@ class TestCircularBuffer : public CppUnit::TestFixture
     CPPUNIT_TEST(testZero);
 #endif
     CPPUNIT_TEST(testUnallocated);
+    CPPUNIT_TEST(testMaxAllocations);
+    CPPUNIT_TEST(testHugePages);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -69,7 +71,9 @@ private:
     void testTooLarge();        ///< Test exception handling when asking for too much memory
     void testOverflow();        ///< Test exception handling when total size overflows
     void testZero();            ///< Test that an exception is thrown when asking for zero elements
-    void testUnallocated();     ///< Test @ref CircularBufferBase::unallocated
+    void testUnallocated();     ///< Test @ref CircularBufferBase::unallocated and @ref CircularBufferBase::approxUnallocated
+    void testMaxAllocations();  ///< Test blocking when all allocation slots are in use
+    void testHugePages();       ///< Test a buffer that requests huge pages
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCircularBuffer, TestSet::perBuild());
 
@@ -110,7 +114,7 @@ void TestCircularBuffer::testStatistics()
     CircularBuffer buffer("test", 1000);
 
     std::size_t newMem = allStat.get();
-    // Can't make this an exact test, because the linked list can also allocate
+    // Can't make this an exact test, because the allocation slots are also counted
     CPPUNIT_ASSERT(newMem >= oldMem + 1000);
 }
 
@@ -284,6 +288,7 @@ void TestCircularBuffer::testUnallocated()
 
     buffer.free(a2); // does not make more space available until a1 freed
     MLSGPU_ASSERT_EQUAL(6, buffer.unallocated());
+    MLSGPU_ASSERT_EQUAL(7, buffer.approxUnallocated()); // but is counted immediately
 
     CircularBuffer::Allocation a3 = buffer.allocate(worker, 5);
     MLSGPU_ASSERT_EQUAL(1, buffer.unallocated());
@@ -293,8 +298,42 @@ void TestCircularBuffer::testUnallocated()
 
     CircularBuffer::Allocation a4 = buffer.allocate(worker, 3); // wastes 1 slot at end
     MLSGPU_ASSERT_EQUAL(1, buffer.unallocated());
+    MLSGPU_ASSERT_EQUAL(2, buffer.approxUnallocated());
 
     buffer.free(a3);
     buffer.free(a4);
     MLSGPU_ASSERT_EQUAL(10, buffer.unallocated());
+    MLSGPU_ASSERT_EQUAL(10, buffer.approxUnallocated());
+}
+
+void TestCircularBuffer::testMaxAllocations()
+{
+    Timeplot::Worker worker("test");
+    CircularBufferBase buffer("test", 100, 2);
+
+    CircularBufferBase::Allocation a1 = buffer.allocate(worker, 1);
+    CircularBufferBase::Allocation a2 = buffer.allocate(worker, 1);
+    MLSGPU_ASSERT_EQUAL(98, buffer.unallocated());
+
+    // Both slots are in use, so this must wait for a1 to be freed
+    boost::thread thread(boost::bind(&CircularBufferBase::free, &buffer, a1));
+    CircularBufferBase::Allocation a3 = buffer.allocate(worker, 1);
+    thread.join();
+    MLSGPU_ASSERT_EQUAL(2, a3.get());   // Follows a2, which is still live
+    buffer.free(a2);
+    buffer.free(a3);
+    MLSGPU_ASSERT_EQUAL(100, buffer.unallocated());
+}
+
+void TestCircularBuffer::testHugePages()
+{
+    Timeplot::Worker worker("test");
+    const std::size_t size = 8 * 1024 * 1024;
+    CircularBuffer buffer("test", size, true);
+    CircularBuffer::Allocation alloc = buffer.allocate(worker, size / 2);
+    char *ptr = static_cast<char *>(alloc.get());
+    CPPUNIT_ASSERT(ptr != NULL);
+    std::fill(ptr, ptr + size / 2, 1);
+    buffer.free(alloc);
+    MLSGPU_ASSERT_EQUAL(size, buffer.unallocated());
 }
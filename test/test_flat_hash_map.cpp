@@ -0,0 +1,162 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref flat_hash_map.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <map>
+#include <utility>
+#include <stdexcept>
+#include <boost/tr1/random.hpp>
+#include "../src/flat_hash_map.h"
+#include "../src/statistics.h"
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+
+class TestFlatHashMap : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestFlatHashMap);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testInsert);
+    CPPUNIT_TEST(testEmptyKey);
+    CPPUNIT_TEST(testClear);
+    CPPUNIT_TEST(testReserve);
+    CPPUNIT_TEST(testRandom);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef FlatHashMap<std::tr1::int32_t> map_type;
+
+public:
+    void testEmpty();       ///< Test a map with nothing inserted
+    void testInsert();      ///< Test @ref FlatHashMap::insert and @ref FlatHashMap::operator[]
+    void testEmptyKey();    ///< Test that the reserved key is rejected
+    void testClear();       ///< Test @ref FlatHashMap::clear
+    void testReserve();     ///< Test @ref FlatHashMap::reserve
+    void testRandom();      ///< Compare against @c std::map with enough keys to force growth
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFlatHashMap, TestSet::perBuild());
+
+void TestFlatHashMap::testEmpty()
+{
+    const map_type m("mem.TestFlatHashMap");
+    CPPUNIT_ASSERT(m.empty());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), m.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), m.bucket_count());
+    CPPUNIT_ASSERT(m.begin() == m.end());
+    CPPUNIT_ASSERT(m.find(5) == m.end());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), m.count(5));
+}
+
+void TestFlatHashMap::testInsert()
+{
+    map_type m("mem.TestFlatHashMap");
+    std::pair<map_type::iterator, bool> added;
+
+    added = m.insert(std::make_pair(UINT64_C(0x8000000000000000), 3));
+    CPPUNIT_ASSERT(added.second);
+    CPPUNIT_ASSERT_EQUAL(UINT64_C(0x8000000000000000), added.first->first);
+    CPPUNIT_ASSERT_EQUAL(3, added.first->second);
+
+    added = m.insert(std::make_pair(UINT64_C(0x8000000000000000), 4));
+    CPPUNIT_ASSERT(!added.second);
+    CPPUNIT_ASSERT_EQUAL(3, added.first->second);
+
+    m[0] = 7;
+    m[0]++;
+    CPPUNIT_ASSERT_EQUAL(8, m[0]);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), m.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), m.count(0));
+    CPPUNIT_ASSERT(m.find(1) == m.end());
+
+    std::size_t n = 0;
+    for (map_type::const_iterator i = m.begin(); i != m.end(); ++i)
+        n++;
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), n);
+
+    CPPUNIT_ASSERT(Statistics::getStatistic<Statistics::Peak>("mem.TestFlatHashMap").getMax() > 0);
+}
+
+void TestFlatHashMap::testEmptyKey()
+{
+    map_type m("mem.TestFlatHashMap");
+    CPPUNIT_ASSERT_THROW(m.insert(std::make_pair(map_type::EMPTY_KEY, 1)), std::invalid_argument);
+    CPPUNIT_ASSERT(m.find(map_type::EMPTY_KEY) == m.end());
+    CPPUNIT_ASSERT(m.empty());
+}
+
+void TestFlatHashMap::testClear()
+{
+    map_type m("mem.TestFlatHashMap");
+    for (int i = 0; i < 100; i++)
+        m[i * 3] = i;
+    const std::size_t buckets = m.bucket_count();
+    m.clear();
+    CPPUNIT_ASSERT(m.empty());
+    CPPUNIT_ASSERT(m.begin() == m.end());
+    CPPUNIT_ASSERT(m.find(3) == m.end());
+    CPPUNIT_ASSERT_EQUAL(buckets, m.bucket_count());
+}
+
+void TestFlatHashMap::testReserve()
+{
+    map_type m("mem.TestFlatHashMap");
+    m[1] = 1;
+    m.reserve(1000);
+    const std::size_t buckets = m.bucket_count();
+    CPPUNIT_ASSERT(buckets >= 1000);
+    CPPUNIT_ASSERT_EQUAL(1, m[1]);
+    for (int i = 0; i < 1000; i++)
+        m[i] = i;
+    CPPUNIT_ASSERT_EQUAL(buckets, m.bucket_count());
+}
+
+void TestFlatHashMap::testRandom()
+{
+    std::tr1::mt19937 engine;
+    map_type m("mem.TestFlatHashMap");
+    std::map<std::tr1::uint64_t, std::tr1::int32_t> expected;
+    for (int i = 0; i < 20000; i++)
+    {
+        // Keys are clustered in the low bits, like vertex keys
+        std::tr1::uint64_t key = (std::tr1::uint64_t(engine() & 0x3f) << 42) | (engine() & 0xfff);
+        std::tr1::int32_t value = i;
+        bool added = m.insert(std::make_pair(key, value)).second;
+        bool expectedAdded = expected.insert(std::make_pair(key, value)).second;
+        CPPUNIT_ASSERT_EQUAL(expectedAdded, added);
+    }
+    CPPUNIT_ASSERT_EQUAL(expected.size(), m.size());
+
+    std::size_t n = 0;
+    for (map_type::const_iterator i = m.begin(); i != m.end(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(expected[i->first], i->second);
+        n++;
+    }
+    CPPUNIT_ASSERT_EQUAL(expected.size(), n);
+}
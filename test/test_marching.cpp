@@ -188,6 +188,8 @@ class TestMarching : public CLH::Test::TestFixture
     CPPUNIT_TEST(testCopySlice);
     CPPUNIT_TEST(testSphere);
     CPPUNIT_TEST(testTruncatedSphere);
+    CPPUNIT_TEST(testSphereHalf);
+    CPPUNIT_TEST(testSphereOverlap);
     CPPUNIT_TEST(testAlternating);
     CPPUNIT_TEST_SUITE_END();
 
@@ -236,7 +238,8 @@ private:
     void testGenerate(
         Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
         Grid::size_type width, Grid::size_type height, Grid::size_type depth,
-        Marching::Generator &generator, const std::string &filename);
+        Marching::Generator &generator, const std::string &filename,
+        cl_channel_type distanceType = CL_FLOAT, bool overlapSwathes = false);
 
     void testConstructor();     ///< Basic sanity tests on the tables
     void testComputeKey();      ///< Test @ref computeKey helper function
@@ -244,6 +247,8 @@ private:
     void testCopySlice();       ///< Test @ref copySlice, both kernel and wrapper function
     void testSphere();          ///< Builds a sphere
     void testTruncatedSphere(); ///< Builds a sphere that is truncated by the bounding box
+    void testSphereHalf();      ///< Builds a sphere using a half-precision distance image
+    void testSphereOverlap();   ///< Builds a sphere with swathes overlapped
     void testAlternating();     ///< Build a structure with lots of geometry
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMarching, TestSet::perCommit());
@@ -534,7 +539,7 @@ void TestMarching::testCopySlice()
         cl::NDRange(2, 2),
         cl::NDRange(2, 1));
     queue.enqueueBarrier();
-    marching.copySlice(queue, image, 2, 0, params, NULL, NULL);
+    marching.copySlice(queue, image, 2, image, 0, params, NULL, NULL);
     queue.finish();
 
     memset(values, 0, sizeof(values));
@@ -551,7 +556,9 @@ void TestMarching::testGenerate(
     Grid::size_type maxWidth, Grid::size_type maxHeight, Grid::size_type maxDepth,
     Grid::size_type width, Grid::size_type height, Grid::size_type depth,
     Marching::Generator &generator,
-    const std::string &filename)
+    const std::string &filename,
+    cl_channel_type distanceType,
+    bool overlapSwathes)
 {
     Timeplot::Worker tworker("test");
 
@@ -562,7 +569,7 @@ void TestMarching::testGenerate(
     Marching marching(context, device, maxWidth, maxHeight, maxDepth,
                       swathe,
                       (maxWidth - 1) * (maxHeight - 1) * Marching::MAX_CELL_BYTES,
-                      generator.alignment());
+                      generator.alignment(), distanceType, overlapSwathes);
 
     /*** Pass 1: write to file ***/
 
@@ -620,6 +627,34 @@ void TestMarching::testTruncatedSphere()
                  generator, "tsphere.ply");
 }
 
+void TestMarching::testSphereHalf()
+{
+    const Grid::size_type maxWidth = 83;
+    const Grid::size_type maxHeight = 78;
+    const Grid::size_type maxDepth = 66;
+    const Grid::size_type width = 71;
+    const Grid::size_type height = 75;
+    const Grid::size_type depth = 60;
+
+    SphereGenerator generator(context, maxWidth, maxHeight, maxDepth, 30.0, 41.5, 27.75, 25.3);
+    testGenerate(maxWidth, maxHeight, maxDepth, width, height, depth,
+                 generator, "sphere-half.ply", CL_HALF_FLOAT);
+}
+
+void TestMarching::testSphereOverlap()
+{
+    const Grid::size_type maxWidth = 83;
+    const Grid::size_type maxHeight = 78;
+    const Grid::size_type maxDepth = 66;
+    const Grid::size_type width = 71;
+    const Grid::size_type height = 75;
+    const Grid::size_type depth = 60;
+
+    SphereGenerator generator(context, maxWidth, maxHeight, maxDepth, 30.0, 41.5, 27.75, 25.3);
+    testGenerate(maxWidth, maxHeight, maxDepth, width, height, depth,
+                 generator, "sphere-overlap.ply", CL_FLOAT, true);
+}
+
 void TestMarching::testAlternating()
 {
     const Grid::size_type width = 32;
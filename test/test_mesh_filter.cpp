@@ -31,6 +31,7 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <vector>
+#include <algorithm>
 #include <boost/ref.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <CL/cl.hpp>
@@ -359,3 +360,274 @@ void TestScaleBiasFilter::testEmpty()
     MLSGPU_ASSERT_EQUAL(0, outMesh.numInternalVertices());
     MLSGPU_ASSERT_EQUAL(0, outMesh.numTriangles());
 }
+
+class TestDecimateFilter : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestDecimateFilter);
+    CPPUNIT_TEST(testPlane);
+    CPPUNIT_TEST(testAllExternal);
+    CPPUNIT_TEST(testDuplicates);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    void testPlane();         ///< Simplifies a planar grid with a locked border
+    void testAllExternal();   ///< Mesh with nothing that can be merged
+    void testDuplicates();    ///< Overlapping triangles that collapse onto the same clusters
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestDecimateFilter, TestSet::perBuild());
+
+void TestDecimateFilter::testPlane()
+{
+    const unsigned int S = 9;  // vertices along each side
+    std::vector<boost::array<cl_float, 3> > inVertices;
+    std::vector<cl_ulong> inVertexKeys;
+    std::vector<cl_uint> index(S * S);
+
+    // Internal vertices first, then the border
+    for (int pass = 0; pass < 2; pass++)
+        for (unsigned int y = 0; y < S; y++)
+            for (unsigned int x = 0; x < S; x++)
+            {
+                bool border = x == 0 || y == 0 || x == S - 1 || y == S - 1;
+                if (border == (pass == 1))
+                {
+                    boost::array<cl_float, 3> v;
+                    v[0] = x + 0.25f;
+                    v[1] = y + 0.25f;
+                    v[2] = 2.5f;
+                    index[y * S + x] = inVertices.size();
+                    inVertices.push_back(v);
+                    inVertexKeys.push_back(x * 100 + y);
+                }
+            }
+    const std::size_t numInternal = (S - 2) * (S - 2);
+
+    std::vector<boost::array<cl_uint, 3> > inTriangles;
+    for (unsigned int y = 0; y + 1 < S; y++)
+        for (unsigned int x = 0; x + 1 < S; x++)
+        {
+            boost::array<cl_uint, 3> t;
+            t[0] = index[y * S + x]; t[1] = index[y * S + x + 1]; t[2] = index[(y + 1) * S + x];
+            inTriangles.push_back(t);
+            t[0] = index[y * S + x + 1]; t[1] = index[(y + 1) * S + x + 1]; t[2] = index[(y + 1) * S + x];
+            inTriangles.push_back(t);
+        }
+
+    const std::size_t N = inVertices.size();
+    const std::size_t T = inTriangles.size();
+    DeviceKeyMesh inMesh;
+    inMesh.assign(N, T, numInternal);
+    inMesh.vertices = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * 3 * sizeof(cl_float),
+                                 &inVertices[0][0]);
+    inMesh.triangles = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, T * 3 * sizeof(cl_uint),
+                                  &inTriangles[0][0]);
+    inMesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(cl_ulong),
+                                   &inVertexKeys[0]);
+
+    DecimateFilter filter(context, device, 4.0f, N, T);
+    DeviceKeyMesh outMesh;
+    std::vector<cl::Event> wait(1);
+    std::vector<cl::Event> readWait(3);
+    filter(queue, inMesh, NULL, &wait[0], outMesh);
+
+    boost::scoped_array<char> buffer(new char[outMesh.getHostBytes()]);
+    HostKeyMesh result(buffer.get(), outMesh);
+    enqueueReadMesh(queue, outMesh, result, &wait, &readWait[0], &readWait[1], &readWait[2]);
+    cl::Event::waitForEvents(readWait);
+
+    // The internal vertices fall into 2x2 cells; the border is untouched
+    const std::size_t numExternal = N - numInternal;
+    MLSGPU_ASSERT_EQUAL(4, result.numInternalVertices());
+    MLSGPU_ASSERT_EQUAL(4 + numExternal, result.numVertices());
+    for (std::size_t i = 0; i < result.numVertices(); i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(2.5, result.vertices[i][2], 1e-4);
+    for (std::size_t i = 0; i < numExternal; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(inVertexKeys[numInternal + i], result.vertexKeys[i]);
+        CPPUNIT_ASSERT_EQUAL(inVertices[numInternal + i][0], result.vertices[4 + i][0]);
+        CPPUNIT_ASSERT_EQUAL(inVertices[numInternal + i][1], result.vertices[4 + i][1]);
+    }
+
+    CPPUNIT_ASSERT(result.numTriangles() > 0);
+    CPPUNIT_ASSERT(result.numTriangles() < T);
+    for (std::size_t i = 0; i < result.numTriangles(); i++)
+    {
+        const boost::array<cl_uint, 3> &t = result.triangles[i];
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT(t[j] < result.numVertices());
+        CPPUNIT_ASSERT(t[0] != t[1] && t[0] != t[2] && t[1] != t[2]);
+    }
+}
+
+void TestDecimateFilter::testAllExternal()
+{
+    DecimateFilter filter(context, device, 4.0f, 5, 3);
+    DeviceKeyMesh inMesh, outMesh;
+    inMesh.assign(5, 3, 0);
+    inMesh.vertices = createBuffer(CL_MEM_READ_WRITE, inMesh.numVertices() * 3 * sizeof(cl_float));
+    inMesh.vertexKeys = createBuffer(CL_MEM_READ_WRITE, inMesh.numVertices() * sizeof(cl_ulong));
+    inMesh.triangles = createBuffer(CL_MEM_READ_WRITE, inMesh.numTriangles() * 3 * sizeof(cl_uint));
+
+    cl::Event done;
+    filter(queue, inMesh, NULL, &done, outMesh);
+    done.wait();
+    MLSGPU_ASSERT_EQUAL(5, outMesh.numVertices());
+    MLSGPU_ASSERT_EQUAL(0, outMesh.numInternalVertices());
+    MLSGPU_ASSERT_EQUAL(3, outMesh.numTriangles());
+    CPPUNIT_ASSERT(outMesh.vertices() == inMesh.vertices());
+}
+
+void TestDecimateFilter::testDuplicates()
+{
+    /* Two vertices in each of the cells A=(0,0), B=(1,0), C=(0,1) and
+     * D=(1,1), which become clusters 0-3 in that order.
+     */
+    const cl_float inVertices[8][3] =
+    {
+        { 0.5f, 0.5f, 0.5f }, { 1.5f, 1.5f, 0.5f },     // A
+        { 4.5f, 0.5f, 0.5f }, { 5.5f, 1.5f, 0.5f },     // B
+        { 0.5f, 4.5f, 0.5f }, { 1.5f, 5.5f, 0.5f },     // C
+        { 4.5f, 4.5f, 0.5f }, { 5.5f, 5.5f, 0.5f }      // D
+    };
+    const cl_uint inTriangles[6][3] =
+    {
+        { 0, 2, 4 },        // ABC
+        { 1, 3, 5 },        // ABC again: a duplicate
+        { 1, 4, 2 },        // ACB: folded over the first, so they cancel
+        { 2, 6, 4 },        // BDC
+        { 3, 5, 7 },        // BCD: folded over BDC, so both go
+        { 0, 1, 2 }         // AAB: collapses
+    };
+    const cl_ulong inVertexKeys[8] = {};
+    const std::size_t N = 8;
+    const std::size_t T = 6;
+
+    DeviceKeyMesh inMesh;
+    inMesh.assign(N, T, N);
+    inMesh.vertices = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(inVertices),
+                                 const_cast<cl_float *>(&inVertices[0][0]));
+    inMesh.triangles = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(inTriangles),
+                                  const_cast<cl_uint *>(&inTriangles[0][0]));
+    inMesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(inVertexKeys),
+                                   const_cast<cl_ulong *>(inVertexKeys));
+
+    DecimateFilter filter(context, device, 4.0f, N, T);
+    DeviceKeyMesh outMesh;
+    std::vector<cl::Event> wait(1);
+    std::vector<cl::Event> readWait(3);
+    filter(queue, inMesh, NULL, &wait[0], outMesh);
+
+    boost::scoped_array<char> buffer(new char[outMesh.getHostBytes()]);
+    HostKeyMesh result(buffer.get(), outMesh);
+    enqueueReadMesh(queue, outMesh, result, &wait, &readWait[0], &readWait[1], &readWait[2]);
+    cl::Event::waitForEvents(readWait);
+
+    // ABC appears twice in one orientation and once in the other
+    MLSGPU_ASSERT_EQUAL(4, result.numVertices());
+    MLSGPU_ASSERT_EQUAL(1, result.numTriangles());
+    MLSGPU_ASSERT_EQUAL(0, result.triangles[0][0]);
+    MLSGPU_ASSERT_EQUAL(1, result.triangles[0][1]);
+    MLSGPU_ASSERT_EQUAL(2, result.triangles[0][2]);
+}
+
+class TestPackMeshFilter : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestPackMeshFilter);
+    CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    void testSimple();        ///< Round trip through the filter, @ref enqueueReadMesh and unpacking
+    void testEmpty();         ///< Passes an empty mesh through the filter
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestPackMeshFilter, TestSet::perCommit());
+
+void TestPackMeshFilter::testSimple()
+{
+    PackMeshFilter filter(context, 5, 2);
+    const float lower[3] = {-10.0f, 0.0f, 5.0f};
+    const float upper[3] = {10.0f, 5.0f, 6.0f};
+    filter.setBox(lower, upper);
+
+    const unsigned int N = 5;
+    const unsigned int T = 2;
+    std::vector<boost::array<cl_float, 3> > inVertices(N);
+    std::vector<boost::array<cl_uint, 3> > inTriangles(T);
+    std::vector<cl_ulong> inVertexKeys(N);
+
+    inVertices[0][0] = -10.0f;  inVertices[0][1] = 0.0f;   inVertices[0][2] = 5.0f;
+    inVertices[1][0] = 10.0f;   inVertices[1][1] = 5.0f;   inVertices[1][2] = 6.0f;
+    inVertices[2][0] = 1.2345f; inVertices[2][1] = 2.5f;   inVertices[2][2] = 5.75f;
+    inVertices[3][0] = -3.3f;   inVertices[3][1] = 4.999f; inVertices[3][2] = 5.001f;
+    inVertices[4][0] = -20.0f;  inVertices[4][1] = 1.0f;   inVertices[4][2] = 5.5f; // outside box
+
+    inTriangles[0][0] = 0; inTriangles[0][1] = 1; inTriangles[0][2] = 2;
+    inTriangles[1][0] = 4; inTriangles[1][1] = 3; inTriangles[1][2] = 2;
+
+    for (unsigned int i = 0; i < N; i++)
+        inVertexKeys[i] = 0xDEADBEEF0000ULL + i;
+
+    DeviceKeyMesh inMesh;
+    inMesh.assign(N, T, 1);
+    inMesh.vertices = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * 3 * sizeof(cl_float),
+                                 &inVertices[0][0]);
+    inMesh.triangles = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, T * 3 * sizeof(cl_uint),
+                                  &inTriangles[0][0]);
+    inMesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(cl_ulong),
+                                   &inVertexKeys[0]);
+
+    DeviceKeyMesh outMesh;
+    std::vector<cl::Event> wait(1);
+    std::vector<cl::Event> readWait(3);
+    filter(queue, inMesh, NULL, &wait[0], outMesh);
+    CPPUNIT_ASSERT(outMesh.packing.vertices);
+    CPPUNIT_ASSERT(outMesh.packing.triangles);
+
+    boost::scoped_array<char> buffer(new char[outMesh.getHostBytes()]);
+    HostKeyMesh result(buffer.get(), outMesh);
+    enqueueReadMesh(queue, outMesh, result, &wait, &readWait[0], &readWait[1], &readWait[2]);
+    cl::Event::waitForEvents(readWait);
+    CPPUNIT_ASSERT(result.packing.vertices);
+    CPPUNIT_ASSERT(result.packing.triangles);
+    result.unpackVertices();
+    result.unpackTriangles();
+    CPPUNIT_ASSERT(!result.packing.vertices);
+    CPPUNIT_ASSERT(!result.packing.triangles);
+
+    MLSGPU_ASSERT_EQUAL(N, result.numVertices());
+    MLSGPU_ASSERT_EQUAL(N - 1, result.numExternalVertices());
+    MLSGPU_ASSERT_EQUAL(T, result.numTriangles());
+    const float tol = 20.0f / MeshPacking::maxValue();
+    for (unsigned int i = 0; i < N; i++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            float expected = std::min(std::max(inVertices[i][j], lower[j]), upper[j]);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, result.vertices[i][j], tol);
+        }
+    }
+    for (unsigned int i = 1; i < N; i++)
+        CPPUNIT_ASSERT_EQUAL(inVertexKeys[i], result.vertexKeys[i - 1]);
+    for (unsigned int i = 0; i < T; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(inTriangles[i][0], result.triangles[i][0]);
+        CPPUNIT_ASSERT_EQUAL(inTriangles[i][1], result.triangles[i][1]);
+        CPPUNIT_ASSERT_EQUAL(inTriangles[i][2], result.triangles[i][2]);
+    }
+}
+
+void TestPackMeshFilter::testEmpty()
+{
+    PackMeshFilter filter(context, 1, 1);
+    DeviceKeyMesh inMesh, outMesh;
+
+    inMesh.assign(0, 0, 0);
+
+    cl::Event done;
+    filter(queue, inMesh, NULL, &done, outMesh);
+    done.wait();
+    MLSGPU_ASSERT_EQUAL(0, outMesh.numVertices());
+    MLSGPU_ASSERT_EQUAL(0, outMesh.numInternalVertices());
+    MLSGPU_ASSERT_EQUAL(0, outMesh.numTriangles());
+}
@@ -0,0 +1,236 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref MeshWelder.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/ref.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include <CL/cl.hpp>
+#include "testutil.h"
+#include "test_clh.h"
+#include "../src/mesh.h"
+#include "../src/mesh_welder.h"
+
+namespace
+{
+
+/// Host copy of a mesh received from the welder
+struct CollectedMesh
+{
+    std::size_t numInternalVertices;
+    std::vector<boost::array<cl_float, 3> > vertices;
+    std::vector<cl_ulong> vertexKeys;   ///< Keys of external vertices only
+    std::vector<boost::array<cl_uint, 3> > triangles;
+};
+
+/// Output functor that stores every mesh it receives
+class CollectOutput
+{
+private:
+    std::vector<CollectedMesh> *out;
+public:
+    typedef void result_type;
+
+    explicit CollectOutput(std::vector<CollectedMesh> *out) : out(out) {}
+
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &dMesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event) const
+    {
+        boost::scoped_array<char> buffer(new char[dMesh.getHostBytes()]);
+        HostKeyMesh hMesh(buffer.get(), dMesh);
+        std::vector<cl::Event> wait(3);
+        enqueueReadMesh(queue, dMesh, hMesh, events, &wait[0], &wait[1], &wait[2]);
+        cl::Event::waitForEvents(wait);
+
+        CollectedMesh m;
+        m.numInternalVertices = hMesh.numInternalVertices();
+        m.vertices.assign(hMesh.vertices, hMesh.vertices + hMesh.numVertices());
+        m.vertexKeys.assign(hMesh.vertexKeys, hMesh.vertexKeys + hMesh.numExternalVertices());
+        m.triangles.assign(hMesh.triangles, hMesh.triangles + hMesh.numTriangles());
+        out->push_back(m);
+        CLH::enqueueMarkerWithWaitList(queue, NULL, event);
+    }
+};
+
+} // anonymous namespace
+
+class TestMeshWelder : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestMeshWelder);
+    CPPUNIT_TEST(testWeld);
+    CPPUNIT_TEST(testOverflow);
+    CPPUNIT_TEST(testPassThrough);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /**
+     * Creates a mesh with one internal vertex at (@a base, 0, 0) and two
+     * external vertices with the given keys, at (key, 1, 2). There is one
+     * triangle (0, 1, 2).
+     */
+    DeviceKeyMesh makeMesh(float base, cl_ulong key1, cl_ulong key2);
+
+    std::vector<CollectedMesh> results;
+
+public:
+    virtual void tearDown();
+
+    void testWeld();          ///< Two meshes with a shared vertex
+    void testOverflow();      ///< Flush triggered by the capacity
+    void testPassThrough();   ///< Mesh too large to accumulate at all
+    void testEmpty();         ///< Flush with nothing accumulated
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMeshWelder, TestSet::perBuild());
+
+void TestMeshWelder::tearDown()
+{
+    results.clear();
+    CLH::Test::TestFixture::tearDown();
+}
+
+DeviceKeyMesh TestMeshWelder::makeMesh(float base, cl_ulong key1, cl_ulong key2)
+{
+    const cl_float vertices[9] =
+    {
+        base, 0.0f, 0.0f,
+        float(key1), 1.0f, 2.0f,
+        float(key2), 1.0f, 2.0f
+    };
+    const cl_ulong keys[3] = { 0, key1, key2 };
+    const cl_uint triangles[3] = { 0, 1, 2 };
+
+    DeviceKeyMesh mesh;
+    mesh.vertices = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               sizeof(vertices), const_cast<cl_float *>(vertices));
+    mesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(keys), const_cast<cl_ulong *>(keys));
+    mesh.triangles = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(triangles), const_cast<cl_uint *>(triangles));
+    mesh.assign(3, 1, 1);
+    return mesh;
+}
+
+void TestMeshWelder::testWeld()
+{
+    MeshWelder welder(context, device, 100, 100);
+    welder.setOutput(CollectOutput(&results));
+
+    welder(queue, makeMesh(10.0f, 200, 100), NULL, NULL);
+    welder(queue, makeMesh(20.0f, 300, 200), NULL, NULL);
+    CPPUNIT_ASSERT(results.empty());
+    welder.flush(queue, NULL, NULL);
+    queue.finish();
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), results.size());
+    const CollectedMesh &m = results[0];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), m.numInternalVertices);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(5), m.vertices.size());
+    CPPUNIT_ASSERT_EQUAL(10.0f, m.vertices[0][0]);
+    CPPUNIT_ASSERT_EQUAL(20.0f, m.vertices[1][0]);
+    // External vertices come out sorted by key, once each
+    const cl_ulong expectedKeys[3] = { 100, 200, 300 };
+    MLSGPU_ASSERT_EQUAL(3, m.vertexKeys.size());
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(expectedKeys[i], m.vertexKeys[i]);
+        CPPUNIT_ASSERT_EQUAL(float(expectedKeys[i]), m.vertices[2 + i][0]);
+        CPPUNIT_ASSERT_EQUAL(1.0f, m.vertices[2 + i][1]);
+        CPPUNIT_ASSERT_EQUAL(2.0f, m.vertices[2 + i][2]);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), m.triangles.size());
+    CPPUNIT_ASSERT_EQUAL(cl_uint(0), m.triangles[0][0]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(3), m.triangles[0][1]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(2), m.triangles[0][2]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(1), m.triangles[1][0]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(4), m.triangles[1][1]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(3), m.triangles[1][2]);
+}
+
+void TestMeshWelder::testOverflow()
+{
+    MeshWelder welder(context, device, 4, 100);
+    welder.setOutput(CollectOutput(&results));
+
+    welder(queue, makeMesh(10.0f, 200, 100), NULL, NULL);
+    welder(queue, makeMesh(20.0f, 300, 200), NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), results.size());
+    welder.flush(queue, NULL, NULL);
+    queue.finish();
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), results.size());
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(std::size_t(1), results[i].numInternalVertices);
+        CPPUNIT_ASSERT_EQUAL(std::size_t(3), results[i].vertices.size());
+        CPPUNIT_ASSERT_EQUAL(std::size_t(1), results[i].triangles.size());
+    }
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(100), results[0].vertexKeys[0]);
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(200), results[0].vertexKeys[1]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(2), results[0].triangles[0][1]);
+    CPPUNIT_ASSERT_EQUAL(cl_uint(1), results[0].triangles[0][2]);
+}
+
+void TestMeshWelder::testPassThrough()
+{
+    MeshWelder welder(context, device, 2, 100);
+    welder.setOutput(CollectOutput(&results));
+
+    welder(queue, makeMesh(10.0f, 200, 100), NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), results.size());
+    // The mesh is passed on untouched
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(200), results[0].vertexKeys[0]);
+    CPPUNIT_ASSERT_EQUAL(cl_ulong(100), results[0].vertexKeys[1]);
+
+    welder.flush(queue, NULL, NULL);
+    queue.finish();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), results.size());
+}
+
+void TestMeshWelder::testEmpty()
+{
+    MeshWelder welder(context, device, 100, 100);
+    welder.setOutput(CollectOutput(&results));
+
+    cl::Event done;
+    welder.flush(queue, NULL, &done);
+    done.wait();
+    CPPUNIT_ASSERT(results.empty());
+}
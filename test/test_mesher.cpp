@@ -58,6 +58,7 @@
 #include "testutil.h"
 #include "../src/fast_ply.h"
 #include "../src/mesher.h"
+#include "../src/block_compress.h"
 #include "test_clh.h"
 #include "memory_reader.h"
 #include "memory_writer.h"
@@ -127,12 +128,17 @@ class TestMesherBase : public CLH::Test::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestMesherBase);
     CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testPrepared);
     CPPUNIT_TEST(testNoInternal);
     CPPUNIT_TEST(testNoExternal);
     CPPUNIT_TEST(testEmpty);
     CPPUNIT_TEST(testWeld);
     CPPUNIT_TEST(testPrune);
     CPPUNIT_TEST(testChunk);
+    CPPUNIT_TEST(testChunkThreads);
+    CPPUNIT_TEST(testCheckpointPass);
+    CPPUNIT_TEST(testCompressed);
+    CPPUNIT_TEST(testCheckpointCompressed);
     // CPPUNIT_TEST(testRandom); // Moved to TestMesherBaseSlow
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 private:
@@ -147,6 +153,12 @@ private:
 protected:
     virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer) = 0;
 
+    /// Whether the mesher supports @ref MesherBase::setPruneThreshold
+    virtual bool canPrune() const { return true; }
+
+    /// Whether the mesher supports checkpointing
+    virtual bool canCheckpoint() const { return true; }
+
     MesherBase *mesherFactory(FastPly::Writer &writer)
     {
         return mesherFactory(writer, TrivialNamer(""));
@@ -155,6 +167,7 @@ protected:
     /**
      * Call the output functor with the data provided. This is a convenience
      * function which takes care of loading the data into OpenCL buffers.
+     * If @a prepare is non-empty, it is called first.
      */
     void add(
         const ChunkId &chunkId,
@@ -165,7 +178,27 @@ protected:
         const boost::array<cl_float, 3> *internalVertices,
         const boost::array<cl_float, 3> *externalVertices,
         const cl_ulong *externalKeys,
-        const cl_uint *indices);
+        const cl_uint *indices,
+        const MesherBase::PrepareFunctor &prepare = MesherBase::PrepareFunctor());
+
+    /**
+     * Implementation of @ref testSimple and @ref testPrepared.
+     *
+     * @param usePrepare Whether to pass the meshes through the prepare functor.
+     */
+    void simple(bool usePrepare);
+
+    /**
+     * Implementation of @ref testChunk, @ref testChunkThreads, @ref
+     * testCheckpointPass, @ref testCompressed and @ref testCheckpointCompressed.
+     *
+     * @param writeThreads Value to pass to @ref MesherBase::setWriteThreads.
+     * @param checkpoint   If true, the mesher is checkpointed after the
+     *                     first two chunks and replaced by a new one resumed
+     *                     from the checkpoint.
+     * @param compress     Value to pass to @ref MesherBase::setTmpCompression.
+     */
+    void chunk(std::size_t writeThreads, bool checkpoint = false, bool compress = false);
 
     /**
      * Assert that the mesh produced is isomorphic to the data provided.
@@ -239,12 +272,17 @@ protected:
 
 public:
     void testSimple();          ///< Normal uses cases
+    void testPrepared();        ///< Normal use cases, with the prepare functor
     void testNoInternal();      ///< An entire mesh with no internal vertices
     void testNoExternal();      ///< An entire mesh with no external vertices
     void testEmpty();           ///< Empty mesh
     void testWeld();            ///< Tests vertex welding
     void testPrune();           ///< Tests component pruning
     void testChunk();           ///< Test chunking into multiple files
+    void testChunkThreads();    ///< Test writing multiple files concurrently
+    void testCheckpointPass();  ///< Test resuming part-way through a pass
+    void testCompressed();      ///< Test chunking with compressed temporary files
+    void testCheckpointCompressed(); ///< Test resuming a pass with compressed temporary files
     void testRandom();          ///< Test with pseudo-random data
 };
 
@@ -361,7 +399,8 @@ void TestMesherBase::add(
     const boost::array<cl_float, 3> *internalVertices,
     const boost::array<cl_float, 3> *externalVertices,
     const cl_ulong *externalKeys,
-    const cl_uint *indices)
+    const cl_uint *indices,
+    const MesherBase::PrepareFunctor &prepare)
 {
     Timeplot::Worker tworker("test");
 
@@ -395,6 +434,12 @@ void TestMesherBase::add(
     queue.flush();
 
     work.chunkId = chunkId;
+    MeshComponents components;
+    if (prepare)
+    {
+        prepare(work, components);
+        CPPUNIT_ASSERT(work.components == &components);
+    }
     functor(work, tworker);
 }
 
@@ -460,6 +505,16 @@ void TestMesherBase::checkIsomorphic(
 }
 
 void TestMesherBase::testSimple()
+{
+    simple(false);
+}
+
+void TestMesherBase::testPrepared()
+{
+    simple(true);
+}
+
+void TestMesherBase::simple(bool usePrepare)
 {
     Timeplot::Worker tworker("test");
 
@@ -502,6 +557,8 @@ void TestMesherBase::testSimple()
     for (unsigned int i = 0; i < passes; i++)
     {
         const MesherBase::InputFunctor functor = mesher->functor(i);
+        const MesherBase::PrepareFunctor prepare =
+            usePrepare ? mesher->prepareFunctor(i) : MesherBase::PrepareFunctor();
         /* Reverse the order on each pass, to ensure that the mesher
          * classes are robust to non-deterministic reordering.
          */
@@ -509,15 +566,15 @@ void TestMesherBase::testSimple()
         {
             add(ChunkId(), functor,
                 boost::size(internalVertices0), 0, boost::size(indices0),
-                internalVertices0, NULL, NULL, indices0);
+                internalVertices0, NULL, NULL, indices0, prepare);
             add(ChunkId(), functor,
                 0, boost::size(externalVertices1), boost::size(indices1),
-                NULL, externalVertices1, externalKeys1, indices1);
+                NULL, externalVertices1, externalKeys1, indices1, prepare);
             add(ChunkId(), functor,
                 boost::size(internalVertices2),
                 boost::size(externalVertices2),
                 boost::size(indices2),
-                internalVertices2, externalVertices2, externalKeys2, indices2);
+                internalVertices2, externalVertices2, externalKeys2, indices2, prepare);
         }
         else
         {
@@ -525,13 +582,13 @@ void TestMesherBase::testSimple()
                 boost::size(internalVertices2),
                 boost::size(externalVertices2),
                 boost::size(indices2),
-                internalVertices2, externalVertices2, externalKeys2, indices2);
+                internalVertices2, externalVertices2, externalKeys2, indices2, prepare);
             add(ChunkId(), functor,
                 0, boost::size(externalVertices1), boost::size(indices1),
-                NULL, externalVertices1, externalKeys1, indices1);
+                NULL, externalVertices1, externalKeys1, indices1, prepare);
             add(ChunkId(), functor,
                 boost::size(internalVertices0), 0, boost::size(indices0),
-                internalVertices0, NULL, NULL, indices0);
+                internalVertices0, NULL, NULL, indices0, prepare);
         }
     }
     mesher->write(tworker);
@@ -744,6 +801,9 @@ void TestMesherBase::testWeld()
 
 void TestMesherBase::testPrune()
 {
+    if (!canPrune())
+        return;
+
     Timeplot::Worker tworker("test");
 
     /* There are several cases to test:
@@ -922,6 +982,34 @@ void TestMesherBase::testPrune()
 }
 
 void TestMesherBase::testChunk()
+{
+    chunk(1);
+}
+
+void TestMesherBase::testChunkThreads()
+{
+    chunk(3);
+}
+
+void TestMesherBase::testCheckpointPass()
+{
+    if (canCheckpoint())
+        chunk(1, true);
+}
+
+void TestMesherBase::testCompressed()
+{
+    if (BlockCompress::haveCodec())
+        chunk(2, false, true);
+}
+
+void TestMesherBase::testCheckpointCompressed()
+{
+    if (canCheckpoint() && BlockCompress::haveCodec())
+        chunk(1, true, true);
+}
+
+void TestMesherBase::chunk(std::size_t writeThreads, bool checkpoint, bool compress)
 {
     Timeplot::Worker tworker("test");
 
@@ -946,6 +1034,8 @@ void TestMesherBase::testChunk()
     ChunkNamer namer("chunk");
     MemoryWriterPly writer;
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+    mesher->setWriteThreads(writeThreads);
+    mesher->setTmpCompression(compress);
     unsigned int passes = mesher->numPasses();
 
     ChunkId chunkId[4];
@@ -956,15 +1046,49 @@ void TestMesherBase::testChunk()
         chunkId[i].coords[1] = i * i;
         chunkId[i].coords[2] = 1;
     }
+    const boost::filesystem::path checkpointPath =
+        boost::filesystem::temp_directory_path()
+        / boost::filesystem::unique_path("mlsgpu-test-%%%%-%%%%-%%%%-%%%%");
+    if (checkpoint)
+    {
+        CPPUNIT_ASSERT_EQUAL(1U, passes);
+        // Ensures that data gets flushed to the temporary files after the checkpoint
+        mesher->setReorderCapacity(1);
+    }
+
     for (unsigned int i = 0; i < passes; i++)
     {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
+        MesherBase::InputFunctor functor = mesher->functor(i);
         add(chunkId[0], functor,
             boost::size(internalVertices0), 0, boost::size(indices0),
             internalVertices0, NULL, NULL, indices0);
         add(chunkId[1], functor,
             0, boost::size(externalVertices1), boost::size(indices1),
             NULL, externalVertices1, externalKeys1, indices1);
+        if (checkpoint)
+        {
+            mesher->checkpointPass(tworker, checkpointPath);
+            /* Carry on and then abandon the mesher, as if the process had
+             * died. The data for the later chunks must be discarded.
+             */
+            add(chunkId[2], functor,
+                boost::size(internalVertices2),
+                boost::size(externalVertices2),
+                boost::size(indices2),
+                internalVertices2, externalVertices2, externalKeys2, indices2);
+            add(chunkId[3], functor,
+                boost::size(internalVertices3),
+                boost::size(externalVertices3),
+                boost::size(indices3),
+                internalVertices3, externalVertices3, externalKeys3, indices3);
+
+            mesher.reset(mesherFactory(writer, namer));
+            mesher->setWriteThreads(writeThreads);
+            mesher->setTmpCompression(compress);
+            CPPUNIT_ASSERT_EQUAL(ChunkId::gen_type(2), mesher->resumePass(tworker, checkpointPath));
+            boost::filesystem::remove(checkpointPath);
+            functor = mesher->functor(i);
+        }
         add(chunkId[2], functor,
             boost::size(internalVertices2),
             boost::size(externalVertices2),
@@ -1076,7 +1200,7 @@ void TestMesherBase::testRandom()
             }
     }
 
-    const double pruneThreshold = 1.0 / numComponents;
+    const double pruneThreshold = canPrune() ? 1.0 / numComponents : 0.0;
     const std::size_t pruneThresholdVertices = std::size_t(allVertices.size() * pruneThreshold);
     // Assign triangles to blocks and compute expected outputs
     for (unsigned int cid = 0; cid < numComponents; cid++)
@@ -1382,3 +1506,97 @@ MesherBase *TestOOCMesher::mesherFactory(FastPly::Writer &writer, const MesherBa
 {
     return new OOCMesher(writer, namer);
 }
+
+class TestStreamMesher : public TestMesherBase
+{
+    CPPUNIT_TEST_SUB_SUITE(TestStreamMesher, TestMesherBase);
+    CPPUNIT_TEST(testInterleaved);
+    CPPUNIT_TEST(testChunkCapacity);
+    CPPUNIT_TEST_SUITE_END();
+protected:
+    virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+    virtual bool canPrune() const { return false; }
+    virtual bool canCheckpoint() const { return false; }
+public:
+    void testInterleaved();    ///< Test meshes for several chunks arriving interleaved
+    void testChunkCapacity();  ///< Test that exceeding the chunk buffer capacity is reported
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestStreamMesher, TestSet::perBuild());
+
+class TestStreamMesherSlow : public TestStreamMesher
+{
+    CPPUNIT_TEST_SUB_SUITE(TestStreamMesherSlow, TestMesherBaseSlow);
+    CPPUNIT_TEST_SUITE_END();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestStreamMesherSlow, TestSet::perCommit());
+
+MesherBase *TestStreamMesher::mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer)
+{
+    return new StreamMesher(writer, namer);
+}
+
+void TestStreamMesher::testInterleaved()
+{
+    Timeplot::Worker tworker("test");
+    ChunkNamer namer("chunk");
+    MemoryWriterPly writer;
+    boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+    MesherBase::InputFunctor functor = mesher->functor(0);
+
+    ChunkId first, second;
+    first.gen = 1;
+    first.coords[0] = 1;
+    second.gen = 0;
+    add(first, functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(second, functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+
+    MesherWork end;
+    end.chunkId = second;
+    end.chunkEnd = true;
+    functor(end, tworker);
+    // A second notice, or one for a chunk with no meshes, is harmless
+    functor(end, tworker);
+
+    add(first, functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    mesher->write(tworker);
+
+    checkIsomorphic(boost::size(internalVertices0),
+                    boost::size(indices0),
+                    internalVertices0, indices0, writer.getOutput("chunk_0000_0000_0000.ply"));
+
+    std::vector<boost::array<cl_float, 3> > expectedVertices(
+        internalVertices0, internalVertices0 + boost::size(internalVertices0));
+    expectedVertices.insert(expectedVertices.end(),
+                            externalVertices1, externalVertices1 + boost::size(externalVertices1));
+    std::vector<cl_uint> expectedIndices(indices0, indices0 + boost::size(indices0));
+    for (std::size_t i = 0; i < boost::size(indices1); i++)
+        expectedIndices.push_back(indices1[i] + boost::size(internalVertices0));
+    checkIsomorphic(expectedVertices.size(), expectedIndices.size(),
+                    &expectedVertices[0], &expectedIndices[0],
+                    writer.getOutput("chunk_0001_0000_0000.ply"));
+}
+
+void TestStreamMesher::testChunkCapacity()
+{
+    Timeplot::Worker tworker("test");
+    ChunkNamer namer("chunk");
+    MemoryWriterPly writer;
+    StreamMesher mesher(writer, namer);
+    mesher.setChunkCapacity(1);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), mesher.getChunkCapacity());
+    MesherBase::InputFunctor functor = mesher.functor(0);
+
+    ChunkId chunkId;
+    CPPUNIT_ASSERT_THROW(
+        add(chunkId, functor,
+            boost::size(internalVertices0), 0, boost::size(indices0),
+            internalVertices0, NULL, NULL, indices0),
+        std::runtime_error);
+    mesher.write(tworker);
+}
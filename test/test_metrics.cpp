@@ -0,0 +1,104 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref metrics.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <sstream>
+#include <string>
+#include <boost/lambda/lambda.hpp>
+#include "../src/metrics.h"
+#include "../src/statistics.h"
+#include "testutil.h"
+
+class TestMetrics : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestMetrics);
+    CPPUNIT_TEST(testGaugeNames);
+    CPPUNIT_TEST(testPrometheus);
+    CPPUNIT_TEST(testJson);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Whether @a haystack contains @a needle
+    static bool contains(const std::string &haystack, const std::string &needle);
+
+public:
+    void testGaugeNames();    ///< Test that gauge names are made unique
+    void testPrometheus();    ///< Test @ref Metrics::writePrometheus
+    void testJson();          ///< Test @ref Metrics::writeJson
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMetrics, TestSet::perBuild());
+
+bool TestMetrics::contains(const std::string &haystack, const std::string &needle)
+{
+    return haystack.find(needle) != std::string::npos;
+}
+
+void TestMetrics::testGaugeNames()
+{
+    Metrics::Gauge g1("test.gauge", boost::lambda::constant(1.0));
+    CPPUNIT_ASSERT_EQUAL(std::string("test.gauge"), g1.getName());
+    {
+        Metrics::Gauge g2("test.gauge", boost::lambda::constant(2.0));
+        Metrics::Gauge g3("test.gauge", boost::lambda::constant(3.0));
+        CPPUNIT_ASSERT_EQUAL(std::string("test.gauge.1"), g2.getName());
+        CPPUNIT_ASSERT_EQUAL(std::string("test.gauge.2"), g3.getName());
+    }
+    // The suffixes are free again once the gauges are destroyed
+    Metrics::Gauge g4("test.gauge", boost::lambda::constant(4.0));
+    CPPUNIT_ASSERT_EQUAL(std::string("test.gauge.1"), g4.getName());
+}
+
+void TestMetrics::testPrometheus()
+{
+    Statistics::getStatistic<Statistics::Counter>("test.metrics-counter").add(5);
+    Statistics::getStatistic<Statistics::Peak>("test.metrics.peak") = 7;
+    Metrics::Gauge gauge("test.metrics.gauge", boost::lambda::constant(2.5));
+
+    std::ostringstream out;
+    Metrics::writePrometheus(out);
+    const std::string text = out.str();
+    CPPUNIT_ASSERT(contains(text, "# TYPE mlsgpu_test_metrics_counter_total counter\n"));
+    CPPUNIT_ASSERT(contains(text, "\nmlsgpu_test_metrics_counter_total 5\n"));
+    CPPUNIT_ASSERT(contains(text, "\nmlsgpu_test_metrics_peak 7\n"));
+    CPPUNIT_ASSERT(contains(text, "\nmlsgpu_test_metrics_peak_max 7\n"));
+    CPPUNIT_ASSERT(contains(text, "\nmlsgpu_test_metrics_gauge 2.5\n"));
+}
+
+void TestMetrics::testJson()
+{
+    Statistics::getStatistic<Statistics::Variable>("test.metrics.variable").add(3.0);
+    Metrics::Gauge gauge("test.metrics.\"quoted\"", boost::lambda::constant(1.5));
+
+    std::ostringstream out;
+    Metrics::writeJson(out);
+    const std::string text = out.str();
+    CPPUNIT_ASSERT(contains(text, "\"test.metrics.variable\": {\"type\": \"variable\", \"samples\": 1, \"mean\": 3}"));
+    CPPUNIT_ASSERT(contains(text, "\"test.metrics.\\\"quoted\\\"\": 1.5"));
+}
@@ -427,7 +427,7 @@ void TestMls::testProcessCorners()
     const Grid::size_type size[3] = {sizeX, sizeY, sizeZ};
     const Grid::difference_type offset[3] = { 20, 15, 33 };
 
-    MlsFunctor generator(context, MLS_SHAPE_SPHERE);
+    MlsFunctor generator(context, MLS_SHAPE_SPHERE, sizeX, sizeY, sizeZ);
     Marching::Swathe swathe;
     swathe.width = sizeX;
     swathe.height = sizeY;
@@ -0,0 +1,423 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref simulate.h and @ref Timeplot::readTrace.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "../src/simulate.h"
+#include "../src/timeplot.h"
+#include "../src/splat.h"
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+
+class TestSimulate : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSimulate);
+    CPPUNIT_TEST(testReadText);
+    CPPUNIT_TEST(testReadBinary);
+    CPPUNIT_TEST(testReadErrors);
+    CPPUNIT_TEST(testExtract);
+    CPPUNIT_TEST(testExtractMultiDevice);
+    CPPUNIT_TEST(testBatching);
+    CPPUNIT_TEST(testScaling);
+    CPPUNIT_TEST(testMeshBuffer);
+    CPPUNIT_TEST(testCapacity);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Text trace of a tiny run with two bins in one device item
+    static std::string smallTrace();
+
+    /**
+     * Workload with @a numBins bins of 1000 splats, each taking a second on
+     * the device and emitting two meshes of 1000 bytes.
+     */
+    static Simulate::Workload uniformWorkload(std::size_t numBins);
+
+    /// Configuration that puts each bin of @ref uniformWorkload in its own item
+    static Simulate::Config uniformConfig();
+
+public:
+    void testReadText();            ///< Test @ref Timeplot::readTrace on the text format
+    void testReadBinary();          ///< Test @ref Timeplot::readTrace on the binary format
+    void testReadErrors();          ///< Test @ref Timeplot::readTrace on malformed input
+    void testExtract();             ///< Test @ref Simulate::extractWorkload
+    void testExtractMultiDevice();  ///< Test that multi-device traces are rejected
+    void testBatching();            ///< Test grouping of bins into batches and items
+    void testScaling();             ///< Test that extra devices and threads help a device-bound run
+    void testMeshBuffer();          ///< Test that a small mesh buffer throttles the devices
+    void testCapacity();            ///< Test that buffers too small for the workload are rejected
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSimulate, TestSet::perBuild());
+
+std::string TestSimulate::smallTrace()
+{
+    const std::size_t s = sizeof(Splat);
+    std::ostringstream o;
+    o << "EVENT main init 0 1\n"
+        "EVENT main bbox 1 2\n"
+        "EVENT main compute 2 3\n"
+        "EVENT main compute 3 3.5\n"
+        "EVENT main load 3.5 5\n"
+        "EVENT reader get 3.5 3.5\n"
+        "VALUE 1000\n"
+        "EVENT reader load 3.6 4.6\n"
+        "EVENT main write 5 5.5\n"
+        "VALUE " << 100 * s << "\n"
+        "EVENT main push 5.5 5.5\n"
+        "EVENT copy.0 pop 5.5 5.5\n"
+        "EVENT main write 5.5 6\n"
+        "VALUE " << 300 * s << "\n"
+        "EVENT main push 6 6\n"
+        "EVENT copy.0 compute 5.6 5.8\n"
+        "VALUE " << 100 * s << "\n"
+        "EVENT copy.0 pop 6 6\n"
+        "EVENT copy.0 compute 6.1 6.5\n"
+        "VALUE " << 300 * s << "\n"
+        "EVENT copy.0 pop 7 7\n"
+        "EVENT copy.0 get 7 7\n"
+        "EVENT copy.0 get 7 7\n"
+        "VALUE " << 400 * s << "\n"
+        "EVENT copy.0 push 7 7\n"
+        "EVENT copy.0 write 7 7.4\n"
+        "EVENT device.0 pop 7.4 7.5\n"
+        "EVENT device.0 compute 7.5 8.5\n"
+        "EVENT device.0 get 8.5 8.5\n"
+        "VALUE 64\n"
+        "EVENT device.0 push 8.5 8.5\n"
+        "EVENT mesher.0 pop 8.5 8.6\n"
+        "EVENT mesher.0 prepare 8.6 8.8\n"
+        "EVENT mesher.0 order 8.8 8.9\n"
+        "EVENT mesher.0 compute 8.9 9.2\n"
+        "EVENT device.0 compute 8.5 9.5\n"
+        "EVENT device.0 pop 9.5 9.5\n"
+        "EVENT mesher.0 pop 9.2 9.6\n"
+        "EVENT main write 9.6 9.7\n";
+    return o.str();
+}
+
+Simulate::Workload TestSimulate::uniformWorkload(std::size_t numBins)
+{
+    Simulate::Workload workload;
+    for (std::size_t i = 0; i < numBins; i++)
+    {
+        Simulate::Bin bin;
+        bin.splats = 1000;
+        bin.bucketCost = 0.001;
+        bin.readBytes = 1000 * sizeof(Splat);
+        bin.readCost = 0.01;
+        bin.writeCost = 0.001;
+        bin.copyCost = 0.001;
+        bin.transferCost = 0.001;
+        bin.deviceCost = 1.0;
+        for (int j = 0; j < 2; j++)
+        {
+            Simulate::Mesh mesh;
+            mesh.bytes = 1000;
+            mesh.offset = 0.5 * (j + 1);
+            mesh.prepareCost = 0.05;
+            mesh.inputCost = 0.1;
+            bin.meshes.push_back(mesh);
+        }
+        workload.bins.push_back(bin);
+    }
+    workload.recordedTime = numBins;
+    return workload;
+}
+
+Simulate::Config TestSimulate::uniformConfig()
+{
+    Simulate::Config config;
+    config.memBucketSplats = 1000 * sizeof(Splat);
+    return config;
+}
+
+void TestSimulate::testReadText()
+{
+    std::istringstream in(
+        "EVENT main compute 1 2\n"
+        "EVENT worker.0 get 0.5 1.5 extra\n"
+        "VALUE 1234\n"
+        "# unrecognised line\n"
+        "EVENT main load 0 0.5");
+    Timeplot::Trace trace;
+    Timeplot::readTrace(in, trace);
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), trace.size());
+    const std::vector<Timeplot::TraceEvent> &main = trace["main"];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), main.size());
+    // Sorted by stop time
+    CPPUNIT_ASSERT_EQUAL(std::string("load"), main[0].action);
+    CPPUNIT_ASSERT_EQUAL(std::string("compute"), main[1].action);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, main[1].start, 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, main[1].stop, 1e-12);
+    CPPUNIT_ASSERT(!main[1].value);
+
+    const std::vector<Timeplot::TraceEvent> &worker = trace["worker.0"];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), worker.size());
+    CPPUNIT_ASSERT(worker[0].value);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1234), *worker[0].value);
+}
+
+template<typename T>
+static void writeRaw(std::ostream &o, const T &value)
+{
+    o.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void writeName(std::ostream &o, std::tr1::uint32_t id, const std::string &name)
+{
+    writeRaw(o, std::tr1::uint32_t(1));
+    writeRaw(o, id);
+    writeRaw(o, std::tr1::uint32_t(name.size()));
+    o.write(name.data(), name.size());
+}
+
+static void writeEvent(std::ostream &o, std::tr1::uint32_t worker, std::tr1::uint32_t action,
+                       double start, double stop, bool hasValue, std::tr1::uint64_t value)
+{
+    writeRaw(o, std::tr1::uint32_t(2));
+    writeRaw(o, worker);
+    writeRaw(o, action);
+    writeRaw(o, std::tr1::uint32_t(hasValue));
+    writeRaw(o, start);
+    writeRaw(o, stop);
+    writeRaw(o, value);
+}
+
+void TestSimulate::testReadBinary()
+{
+    std::ostringstream o;
+    o.write("MLSGPUTP", 8);
+    writeRaw(o, std::tr1::uint32_t(1));
+    writeRaw(o, std::tr1::uint32_t(0x01020304));
+    writeName(o, 1, "device.0");
+    writeName(o, 2, "compute");
+    writeEvent(o, 1, 2, 2.0, 3.0, false, 0);
+    writeName(o, 3, "get");
+    writeEvent(o, 1, 3, 1.0, 1.25, true, 4096);
+    writeName(o, 4, "device.0");   // a second worker with the same name
+    writeEvent(o, 4, 2, 0.5, 2.5, false, 0);
+
+    std::istringstream in(o.str());
+    Timeplot::Trace trace;
+    Timeplot::readTrace(in, trace);
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), trace.size());
+    const std::vector<Timeplot::TraceEvent> &events = trace["device.0"];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), events.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("get"), events[0].action);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(4096), *events[0].value);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, events[1].start, 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, events[2].stop, 1e-12);
+    CPPUNIT_ASSERT(!events[2].value);
+}
+
+void TestSimulate::testReadErrors()
+{
+    Timeplot::Trace trace;
+    {
+        std::istringstream in("EVENT main compute 1\n");
+        CPPUNIT_ASSERT_THROW(Timeplot::readTrace(in, trace), std::runtime_error);
+    }
+    {
+        std::istringstream in("VALUE 3\n");
+        CPPUNIT_ASSERT_THROW(Timeplot::readTrace(in, trace), std::runtime_error);
+    }
+    {
+        std::ostringstream o;
+        o.write("MLSGPUTP", 8);
+        writeRaw(o, std::tr1::uint32_t(1));
+        writeRaw(o, std::tr1::uint32_t(0x04030201));
+        std::istringstream in(o.str());
+        CPPUNIT_ASSERT_THROW(Timeplot::readTrace(in, trace), std::runtime_error);
+    }
+    {
+        std::ostringstream o;
+        o.write("MLSGPUTP", 8);
+        writeRaw(o, std::tr1::uint32_t(1));
+        writeRaw(o, std::tr1::uint32_t(0x01020304));
+        writeName(o, 1, "main");
+        writeEvent(o, 1, 2, 0.0, 1.0, false, 0);
+        std::istringstream in(o.str());
+        CPPUNIT_ASSERT_THROW(Timeplot::readTrace(in, trace), std::runtime_error);
+    }
+    {
+        std::ostringstream o;
+        o.write("MLSGPUTP", 8);
+        writeRaw(o, std::tr1::uint32_t(1));
+        writeRaw(o, std::tr1::uint32_t(0x01020304));
+        writeName(o, 1, "main");
+        std::string data = o.str();
+        data.resize(data.size() - 2);
+        std::istringstream in(data);
+        CPPUNIT_ASSERT_THROW(Timeplot::readTrace(in, trace), std::runtime_error);
+    }
+}
+
+void TestSimulate::testExtract()
+{
+    std::istringstream in(smallTrace());
+    Timeplot::Trace trace;
+    Timeplot::readTrace(in, trace);
+    const Simulate::Workload workload = Simulate::extractWorkload(trace);
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(7.7, workload.recordedTime, 1e-9);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), workload.bins.size());
+    const Simulate::Bin &a = workload.bins[0];
+    const Simulate::Bin &b = workload.bins[1];
+    CPPUNIT_ASSERT_EQUAL(std::size_t(100), a.splats);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(300), b.splats);
+
+    // Batch costs are shared 1:3
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.25, a.bucketCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75, b.bucketCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.125, a.mergeCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(250.0, a.readBytes, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75, b.readCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.375, b.decodeCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, a.writeCost, 1e-9);
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.2, a.copyCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.4, b.copyCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.1, a.transferCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, a.deviceCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.5, b.deviceCost, 1e-9);
+
+    // The mesh was emitted after 1s of device time, i.e. during the second bin
+    CPPUNIT_ASSERT(a.meshes.empty());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), b.meshes.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(64), b.meshes[0].bytes);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, b.meshes[0].offset, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.2, b.meshes[0].prepareCost, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.3, b.meshes[0].inputCost, 1e-9);
+
+    // Replaying with the recorded settings should give a similar time
+    const Simulate::Result result = Simulate::simulate(workload, Simulate::Config());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), result.loadBatches);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), result.deviceItems);
+    CPPUNIT_ASSERT(result.time > 0.5 * workload.recordedTime);
+    CPPUNIT_ASSERT(result.time < 1.5 * workload.recordedTime);
+}
+
+void TestSimulate::testExtractMultiDevice()
+{
+    std::string text = smallTrace();
+    text += "EVENT device.0 compute 8 9\n";
+    std::istringstream in(text);
+    Timeplot::Trace trace;
+    Timeplot::readTrace(in, trace);
+    CPPUNIT_ASSERT_THROW(Simulate::extractWorkload(trace), std::runtime_error);
+}
+
+void TestSimulate::testBatching()
+{
+    const Simulate::Workload workload = uniformWorkload(20);
+    Simulate::Config config = uniformConfig();
+    config.memLoadSplats = 3000 * sizeof(Splat);
+    config.memBucketSplats = 2500 * sizeof(Splat);
+    const Simulate::Result result = Simulate::simulate(workload, config);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(7), result.loadBatches);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(10), result.deviceItems);
+
+    // Each stage is credited with its work
+    CPPUNIT_ASSERT_EQUAL(std::size_t(5), result.stages.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("device"), result.stages[3].name);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20.0, result.stages[3].busy, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20 * 2 * 0.15, result.stages[4].busy, 1e-9);
+
+    // Repeating the simulation gives the same answer
+    const Simulate::Result again = Simulate::simulate(workload, config);
+    CPPUNIT_ASSERT_EQUAL(result.time, again.time);
+}
+
+void TestSimulate::testScaling()
+{
+    const Simulate::Workload workload = uniformWorkload(20);
+    Simulate::Config config = uniformConfig();
+    const double base = Simulate::simulate(workload, config).time;
+    CPPUNIT_ASSERT(base >= 20.0);
+    CPPUNIT_ASSERT(base < 21.0);
+
+    config.devices = 2;
+    const double devices = Simulate::simulate(workload, config).time;
+    CPPUNIT_ASSERT(devices < 0.6 * base);
+
+    config.devices = 1;
+    config.deviceThreads = 4;
+    const double threads = Simulate::simulate(workload, config).time;
+    CPPUNIT_ASSERT(threads < 0.4 * base);
+    // The mesher is now the bottleneck, with 0.15s of work per mesh
+    CPPUNIT_ASSERT(threads >= 40 * 0.15);
+}
+
+void TestSimulate::testMeshBuffer()
+{
+    Simulate::Workload workload = uniformWorkload(10);
+    for (std::size_t i = 0; i < workload.bins.size(); i++)
+        for (std::size_t j = 0; j < workload.bins[i].meshes.size(); j++)
+            workload.bins[i].meshes[j].inputCost = 2.0;
+    Simulate::Config config = uniformConfig();
+    config.deviceThreads = 4;
+    const double roomy = Simulate::simulate(workload, config).time;
+
+    // Only one mesh fits at a time, so the devices wait for the mesher
+    config.memMesh = 1500;
+    const double tight = Simulate::simulate(workload, config).time;
+    CPPUNIT_ASSERT(tight >= roomy);
+    CPPUNIT_ASSERT(tight >= 20 * (2.0 + 0.05));
+}
+
+void TestSimulate::testCapacity()
+{
+    const Simulate::Workload workload = uniformWorkload(5);
+    Simulate::Config config = uniformConfig();
+
+    config.memHostSplats = 999 * sizeof(Splat);
+    CPPUNIT_ASSERT_THROW(Simulate::simulate(workload, config), std::runtime_error);
+    config = uniformConfig();
+    config.memBucketSplats = 999 * sizeof(Splat);
+    CPPUNIT_ASSERT_THROW(Simulate::simulate(workload, config), std::runtime_error);
+    config = uniformConfig();
+    config.memLoadSplats = 999 * sizeof(Splat);
+    CPPUNIT_ASSERT_THROW(Simulate::simulate(workload, config), std::runtime_error);
+    config = uniformConfig();
+    config.memMesh = 999;
+    CPPUNIT_ASSERT_THROW(Simulate::simulate(workload, config), std::runtime_error);
+
+    // Exactly enough is fine
+    config = uniformConfig();
+    config.memHostSplats = 1000 * sizeof(Splat);
+    config.memLoadSplats = 1000 * sizeof(Splat);
+    config.memMesh = 1000;
+    CPPUNIT_ASSERT_NO_THROW(Simulate::simulate(workload, config));
+}
@@ -242,3 +242,103 @@ void TestSplatTree::testRandom()
                 }
             }
 }
+
+/**
+ * Tests for @ref SplatTreeHost. In addition to the generic tests, this checks
+ * that the serial and parallel builders give identical results.
+ */
+class TestSplatTreeHost : public TestSplatTree
+{
+    CPPUNIT_TEST_SUB_SUITE(TestSplatTreeHost, TestSplatTree);
+    CPPUNIT_TEST(testBuildMethods);
+    CPPUNIT_TEST(testBuildMethodsEmpty);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    virtual void build(
+        std::size_t &numLevels,
+        std::vector<SplatTree::command_type> &commands,
+        std::vector<SplatTree::command_type> &start,
+        const std::vector<Splat> &splats,
+        int maxLevels, int subsampling, std::size_t maxSplats,
+        const Grid::size_type size[3], const Grid::difference_type offset[3]);
+
+public:
+    void testBuildMethods();       ///< Compare serial and parallel builders on random data
+    void testBuildMethodsEmpty();  ///< Compare serial and parallel builders with no entries
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSplatTreeHost, TestSet::perBuild());
+
+void TestSplatTreeHost::build(
+    std::size_t &numLevels,
+    std::vector<SplatTree::command_type> &commands,
+    std::vector<SplatTree::command_type> &start,
+    const std::vector<Splat> &splats,
+    int maxLevels, int subsampling, std::size_t maxSplats,
+    const Grid::size_type size[3], const Grid::difference_type offset[3])
+{
+    CPPUNIT_ASSERT(splats.size() <= maxSplats);
+
+    /* The host tree has no subsampling, so build it over a grid coarsened by
+     * 2^subsampling instead. Scaling by a power of 2 is exact, so each splat
+     * covers the same coarse cells as in a subsampled tree.
+     */
+    const float scale = 1.0f / (1 << subsampling);
+    std::vector<Splat> scaled(splats);
+    Grid::size_type scaledSize[3];
+    const Grid::difference_type scaledOffset[3] = {0, 0, 0};
+    for (unsigned int i = 0; i < 3; i++)
+        scaledSize[i] = (size[i] + (1 << subsampling) - 1) >> subsampling;
+    for (std::size_t i = 0; i < scaled.size(); i++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+            scaled[i].position[j] = (scaled[i].position[j] - offset[j]) * scale;
+        scaled[i].radius *= scale;
+    }
+
+    SplatTreeHost tree(scaled, scaledSize, scaledOffset);
+    numLevels = tree.getNumLevels();
+    CPPUNIT_ASSERT(numLevels <= std::size_t(maxLevels));
+    commands = tree.getCommands();
+    start = tree.getStart();
+}
+
+void TestSplatTreeHost::testBuildMethods()
+{
+    typedef tr1::mt19937 engine_type;
+    typedef tr1::uniform_real<float> dist_type;
+    typedef tr1::variate_generator<engine_type &, dist_type> gen_type;
+    engine_type engine;
+
+    const int numSplats = 5000;
+    const Grid::size_type cells[3] = {100, 63, 40};
+    const Grid::difference_type offset[3] = {-5, 7, 3};
+    gen_type xGen(engine, dist_type(offset[0] - 4.0f, offset[0] + cells[0] + 4.0f));
+    gen_type yGen(engine, dist_type(offset[1] - 4.0f, offset[1] + cells[1] + 4.0f));
+    gen_type zGen(engine, dist_type(offset[2] - 4.0f, offset[2] + cells[2] + 4.0f));
+    gen_type rGen(engine, dist_type(0.1f, 10.0f));
+
+    vector<Splat> splats;
+    for (int i = 0; i < numSplats; i++)
+        addSplat(splats, xGen(), yGen(), zGen(), rGen());
+
+    SplatTreeHost serial(splats, cells, offset, SplatTree::BUILD_SERIAL);
+    SplatTreeHost parallel(splats, cells, offset, SplatTree::BUILD_PARALLEL);
+    CPPUNIT_ASSERT_EQUAL(serial.getNumLevels(), parallel.getNumLevels());
+    CPPUNIT_ASSERT(serial.getCommands() == parallel.getCommands());
+    CPPUNIT_ASSERT(serial.getStart() == parallel.getStart());
+}
+
+void TestSplatTreeHost::testBuildMethodsEmpty()
+{
+    const Grid::size_type cells[3] = {10, 20, 30};
+    const Grid::difference_type offset[3] = {0, 0, 0};
+    vector<Splat> splats;
+    addSplat(splats, 100.0f, 100.0f, 100.0f, 1.0f); // outside the grid
+
+    SplatTreeHost serial(splats, cells, offset, SplatTree::BUILD_SERIAL);
+    SplatTreeHost parallel(splats, cells, offset, SplatTree::BUILD_PARALLEL);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), serial.getCommands().size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), parallel.getCommands().size());
+    CPPUNIT_ASSERT(serial.getStart() == parallel.getStart());
+}
@@ -36,6 +36,7 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cstddef>
 #include <vector>
+#include <set>
 #include <cmath>
 #include "testutil.h"
 #include "test_clh.h"
@@ -51,6 +52,7 @@ class TestSplatTreeCL : public TestSplatTree, public CLH::Test::Mixin
     CPPUNIT_TEST(testLevelShift);
     CPPUNIT_TEST(testPointBoxDist2);
     CPPUNIT_TEST(testMakeCode);
+    CPPUNIT_TEST(testBatch);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -72,6 +74,7 @@ private:
     void testLevelShift();     ///< Test @ref levelShift in @ref octree.cl.
     void testPointBoxDist2();  ///< Test @ref pointBoxDist2 in @ref octree.cl.
     void testMakeCode();       ///< Test @ref makeCode in @ref octree.cl.
+    void testBatch();          ///< Test @ref SplatTreeCL::enqueueBuildBatch.
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -202,3 +205,134 @@ void TestSplatTreeCL::testMakeCode()
     CPPUNIT_ASSERT_EQUAL(174, callMakeCode(2, 5, 3));
     CPPUNIT_ASSERT_EQUAL(511, callMakeCode(7, 7, 7));
 }
+
+/**
+ * Walks the command list starting from @a pos and returns the splat IDs found.
+ */
+static std::set<SplatTree::command_type> walkCommands(
+    const std::vector<SplatTree::command_type> &commands,
+    SplatTree::command_type pos)
+{
+    typedef SplatTree::command_type command_type;
+    std::set<command_type> found;
+    int ttl = 1000; // prevents a loop from making the test run forever
+    while (pos != -1 && ttl > 0)
+    {
+        CPPUNIT_ASSERT(pos >= 0 && pos < (command_type) commands.size());
+        command_type end = commands[pos++];
+        CPPUNIT_ASSERT(end >= pos && end < (command_type) commands.size());
+        for (command_type i = pos; i < end; i++)
+        {
+            CPPUNIT_ASSERT(!found.count(commands[i]));
+            found.insert(commands[i]);
+        }
+        pos = commands[end];
+        CPPUNIT_ASSERT(pos >= -1);
+        ttl--;
+    }
+    CPPUNIT_ASSERT(ttl > 0);
+    return found;
+}
+
+void TestSplatTreeCL::testBatch()
+{
+    typedef SplatTree::command_type command_type;
+    const Grid::size_type size[3] = {16, 16, 12};
+    const Grid::difference_type offsets[2][3] = { {3, 0, 1}, {40, -8, 5} };
+    const std::size_t numSplats[2] = {5, 3};
+    const float splatData[8][4] =
+    {
+        // First octree
+        { 10.5f, 7.5f, 8.5f, 1.0f },
+        { 11.5f, 9.5f, 5.5f, 2.0f },
+        { 10.0f, 10.0f, 6.0f, 4.5f },
+        { 3.0f, 0.5f, 1.0f, 0.75f },
+        { 19.0f, 8.0f, 5.0f, 0.6f },     // outside the octree
+        // Second octree
+        { 41.0f, -7.0f, 6.5f, 1.5f },
+        { 50.0f, 0.0f, 10.0f, 3.0f },
+        { 10.5f, 7.5f, 8.5f, 1.0f }      // outside the octree (but inside the first)
+    };
+
+    std::vector<Splat> splats;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        Splat s;
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            s.position[j] = splatData[i][j];
+            s.normal[j] = j == 0 ? 1.0f : 0.0f;
+        }
+        s.radius = splatData[i][3];
+        s.quality = 1.0f;
+        splats.push_back(s);
+    }
+
+    std::vector<SplatTreeCL::BatchItem> items(2);
+    std::size_t firstSplat = 0;
+    for (unsigned int t = 0; t < 2; t++)
+    {
+        items[t].firstSplat = firstSplat;
+        items[t].numSplats = numSplats[t];
+        for (unsigned int j = 0; j < 3; j++)
+            items[t].offset[j] = offsets[t][j];
+        firstSplat += numSplats[t];
+    }
+
+    const std::size_t levels = SplatTreeCL::levelsForSize(size, 0);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(5), levels);
+
+    SplatTreeCL tree(context, device, 7, 100);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), tree.maxBatchTrees(7));
+    CPPUNIT_ASSERT(tree.maxBatchTrees(levels) >= 2);
+
+    cl::Buffer splatBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           splats.size() * sizeof(Splat), &splats[0]);
+    tree.enqueueBuildBatch(queue, splatBuffer, items, levels, 0);
+
+    std::size_t commandsSize = tree.getCommands().getInfo<CL_MEM_SIZE>();
+    std::size_t startSize = tree.getStart().getInfo<CL_MEM_SIZE>();
+    std::vector<command_type> commands(commandsSize / sizeof(command_type));
+    std::vector<command_type> start(startSize / sizeof(command_type));
+    queue.enqueueReadBuffer(tree.getCommands(), CL_TRUE, 0, commandsSize, &commands[0]);
+    queue.enqueueReadBuffer(tree.getStart(), CL_TRUE, 0, startSize, &start[0]);
+
+    for (unsigned int t = 0; t < 2; t++)
+    {
+        const std::size_t base = tree.getStartOffset(t);
+        for (unsigned int z = 0; z < size[2]; z++)
+            for (unsigned int y = 0; y < size[1]; y++)
+                for (unsigned int x = 0; x < size[0]; x++)
+                {
+                    std::size_t idx = base + SplatTree::makeCode(x, y, z);
+                    CPPUNIT_ASSERT(idx < start.size());
+                    std::set<command_type> found = walkCommands(commands, start[idx]);
+
+                    float corner[3] =
+                    {
+                        float(x + offsets[t][0]),
+                        float(y + offsets[t][1]),
+                        float(z + offsets[t][2])
+                    };
+                    for (std::size_t i = 0; i < splats.size(); i++)
+                    {
+                        bool mine = i >= items[t].firstSplat && i < items[t].firstSplat + items[t].numSplats;
+                        if (!mine)
+                        {
+                            // Splats from other octrees in the batch must never be visited
+                            CPPUNIT_ASSERT(!found.count(i));
+                            continue;
+                        }
+                        float dist2 = 0.0f;
+                        for (unsigned int j = 0; j < 3; j++)
+                        {
+                            float n = max(min(splatData[i][j], corner[j] + 1.0f), corner[j]);
+                            n -= splatData[i][j];
+                            dist2 += n * n;
+                        }
+                        if (dist2 <= splatData[i][3] * splatData[i][3])
+                            CPPUNIT_ASSERT(found.count(i));
+                    }
+                }
+    }
+}
@@ -39,6 +39,9 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/serialization/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
 #include "../src/statistics.h"
 #include "testutil.h"
 
@@ -77,6 +80,7 @@ class TestVariable : public TestStatistic
     CPPUNIT_TEST(testGetNumSamples);
     CPPUNIT_TEST(testStream);
     CPPUNIT_TEST(testSerialize);
+    CPPUNIT_TEST(testThreads);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -92,6 +96,14 @@ private:
     void testGetNumSamples();  ///< Test @ref Statistics::Variable::getNumSamples
     void testStream();         ///< Test stream output of @ref Statistics::Variable
     void testSerialize();      ///< Test that serialization and deserialization works
+    void testThreads();        ///< Test adding samples from several threads
+
+    /// Sum of samples, combined across shards
+    static double sum(const Statistics::Variable &stat);
+    /// Sum of squares of samples, combined across shards
+    static double sum2(const Statistics::Variable &stat);
+    /// Number of samples, combined across shards
+    static unsigned long long n(const Statistics::Variable &stat);
 
 protected:
     virtual Statistics::Statistic *createStatistic(const std::string &name) const;
@@ -179,20 +191,44 @@ void TestVariable::setUp()
     stat2s->add(4.5);
 }
 
+double TestVariable::sum(const Statistics::Variable &stat)
+{
+    double sum, sum2;
+    unsigned long long n;
+    stat.totals(sum, sum2, n);
+    return sum;
+}
+
+double TestVariable::sum2(const Statistics::Variable &stat)
+{
+    double sum, sum2;
+    unsigned long long n;
+    stat.totals(sum, sum2, n);
+    return sum2;
+}
+
+unsigned long long TestVariable::n(const Statistics::Variable &stat)
+{
+    double sum, sum2;
+    unsigned long long n;
+    stat.totals(sum, sum2, n);
+    return n;
+}
+
 void TestVariable::testAdd()
 {
     // We test the add function by looking at the internal state of the fixtures
-    CPPUNIT_ASSERT_EQUAL(1.0, stat1->sum);
-    CPPUNIT_ASSERT_EQUAL(1.0, stat1->sum2);
-    CPPUNIT_ASSERT_EQUAL(1ULL, stat1->n);
+    CPPUNIT_ASSERT_EQUAL(1.0, sum(*stat1));
+    CPPUNIT_ASSERT_EQUAL(1.0, sum2(*stat1));
+    CPPUNIT_ASSERT_EQUAL(1ULL, n(*stat1));
 
-    CPPUNIT_ASSERT_EQUAL(5.0, stat2->sum);
-    CPPUNIT_ASSERT_EQUAL(13.0, stat2->sum2);
-    CPPUNIT_ASSERT_EQUAL(2ULL, stat2->n);
+    CPPUNIT_ASSERT_EQUAL(5.0, sum(*stat2));
+    CPPUNIT_ASSERT_EQUAL(13.0, sum2(*stat2));
+    CPPUNIT_ASSERT_EQUAL(2ULL, n(*stat2));
 
-    CPPUNIT_ASSERT_EQUAL(9.0, stat2s->sum);
-    CPPUNIT_ASSERT_EQUAL(40.5, stat2s->sum2);
-    CPPUNIT_ASSERT_EQUAL(2ULL, stat2s->n);
+    CPPUNIT_ASSERT_EQUAL(9.0, sum(*stat2s));
+    CPPUNIT_ASSERT_EQUAL(40.5, sum2(*stat2s));
+    CPPUNIT_ASSERT_EQUAL(2ULL, n(*stat2s));
 }
 
 void TestVariable::testGetMean()
@@ -273,9 +309,31 @@ void TestVariable::testSerialize()
 
     Statistics::Variable *newStat = dynamic_cast<Statistics::Variable *>(newPtr);
     CPPUNIT_ASSERT(newPtr != NULL);
-    CPPUNIT_ASSERT_EQUAL(stat2->sum, newStat->sum);
-    CPPUNIT_ASSERT_EQUAL(stat2->sum2, newStat->sum2);
-    CPPUNIT_ASSERT_EQUAL(stat2->n, newStat->n);
+    CPPUNIT_ASSERT_EQUAL(sum(*stat2), sum(*newStat));
+    CPPUNIT_ASSERT_EQUAL(sum2(*stat2), sum2(*newStat));
+    CPPUNIT_ASSERT_EQUAL(n(*stat2), n(*newStat));
+}
+
+/// Adds @a count samples of 1.0 to @a stat
+static void addSamples(Statistics::Variable &stat, int count)
+{
+    for (int i = 0; i < count; i++)
+        stat.add(1.0);
+}
+
+void TestVariable::testThreads()
+{
+    const int numThreads = 40; // more than the number of shards
+    const int perThread = 1000;
+    Statistics::Variable stat("threads");
+    boost::thread_group threads;
+    for (int i = 0; i < numThreads; i++)
+        threads.create_thread(boost::bind(addSamples, boost::ref(stat), perThread));
+    threads.join_all();
+
+    CPPUNIT_ASSERT_EQUAL((unsigned long long) numThreads * perThread, stat.getNumSamples());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, stat.getMean(), 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, stat.getVariance(), 1e-12);
 }
 
 Statistics::Statistic *TestVariable::createStatistic(const std::string &name) const
@@ -291,9 +349,9 @@ void TestCounter::setUp()
 
 void TestCounter::testAdd()
 {
-    MLSGPU_ASSERT_EQUAL(100, counter->total);
+    MLSGPU_ASSERT_EQUAL(100, counter->getTotal());
     counter->add(50);
-    MLSGPU_ASSERT_EQUAL(150, counter->total);
+    MLSGPU_ASSERT_EQUAL(150, counter->getTotal());
 }
 
 void TestCounter::testGetTotal()
@@ -322,7 +380,7 @@ void TestCounter::testSerialize()
 
     Statistics::Counter *newStat = dynamic_cast<Statistics::Counter *>(newPtr);
     CPPUNIT_ASSERT(newStat != NULL);
-    CPPUNIT_ASSERT_EQUAL(counter->total, newStat->total);
+    CPPUNIT_ASSERT_EQUAL(counter->getTotal(), newStat->getTotal());
 }
 
 Statistics::Statistic *TestCounter::createStatistic(const std::string &name) const
@@ -339,44 +397,44 @@ void TestPeak::setUp()
 void TestPeak::testSet()
 {
     // Test initial state
-    MLSGPU_ASSERT_EQUAL(-100, peak->current);
-    MLSGPU_ASSERT_EQUAL(0, peak->peak);
+    MLSGPU_ASSERT_EQUAL(-100, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(0, peak->peak.load());
 
     // Test setting a maximal value
     *peak = 1234567890;
-    MLSGPU_ASSERT_EQUAL(1234567890, peak->current);
-    MLSGPU_ASSERT_EQUAL(1234567890, peak->peak);
+    MLSGPU_ASSERT_EQUAL(1234567890, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(1234567890, peak->peak.load());
 
     // Test setting a non-maximal value
     *peak = 123456;
-    MLSGPU_ASSERT_EQUAL(123456, peak->current);
-    MLSGPU_ASSERT_EQUAL(1234567890, peak->peak);
+    MLSGPU_ASSERT_EQUAL(123456, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(1234567890, peak->peak.load());
 }
 
 void TestPeak::testAdd()
 {
     // Go up
     *peak += 250;
-    MLSGPU_ASSERT_EQUAL(150, peak->current);
-    MLSGPU_ASSERT_EQUAL(150, peak->peak);
+    MLSGPU_ASSERT_EQUAL(150, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(150, peak->peak.load());
 
     // Go down
     *peak += -200;
-    MLSGPU_ASSERT_EQUAL(-50, peak->current);
-    MLSGPU_ASSERT_EQUAL(150, peak->peak);
+    MLSGPU_ASSERT_EQUAL(-50, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(150, peak->peak.load());
 }
 
 void TestPeak::testSub()
 {
     // Go up
     *peak -= -250;
-    MLSGPU_ASSERT_EQUAL(150, peak->current);
-    MLSGPU_ASSERT_EQUAL(150, peak->peak);
+    MLSGPU_ASSERT_EQUAL(150, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(150, peak->peak.load());
 
     // Go down
     *peak -= 200;
-    MLSGPU_ASSERT_EQUAL(-50, peak->current);
-    MLSGPU_ASSERT_EQUAL(150, peak->peak);
+    MLSGPU_ASSERT_EQUAL(-50, peak->current.load());
+    MLSGPU_ASSERT_EQUAL(150, peak->peak.load());
 }
 
 void TestPeak::testGet()
@@ -431,7 +489,7 @@ void TestPeak::testSerialize()
 
     Statistics::Peak *newStat = dynamic_cast<Statistics::Peak *>(newPtr);
     CPPUNIT_ASSERT(newStat != NULL);
-    CPPUNIT_ASSERT_EQUAL(peak->peak, newStat->peak);
+    CPPUNIT_ASSERT_EQUAL(peak->peak.load(), newStat->peak.load());
 }
 
 Statistics::Statistic *TestPeak::createStatistic(const std::string &name) const
@@ -0,0 +1,211 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref subsampling_model.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <sstream>
+#include <stdexcept>
+#include "../src/subsampling_model.h"
+#include "../src/splat_tree_cl.h"
+#include "testutil.h"
+
+class TestSubsamplingModel : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSubsamplingModel);
+    CPPUNIT_TEST(testDefault);
+    CPPUNIT_TEST(testFit);
+    CPPUNIT_TEST(testMaxLevels);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testLoadBad);
+    CPPUNIT_TEST(testMerge);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Cost model used to generate synthetic timings
+    static double trueTime(std::size_t numSplats, const Grid::size_type size[3], int shift);
+
+    /// Records synthetic timings for a range of buckets and shifts
+    static void train(SubsamplingModel &model);
+
+public:
+    void testDefault();      ///< Test that the default is used before the model is fitted
+    void testFit();          ///< Test that a synthetic model is recovered
+    void testMaxLevels();    ///< Test that shifts needing too many levels are excluded
+    void testSaveLoad();     ///< Test round trip through @ref SubsamplingModel::save and @ref SubsamplingModel::load
+    void testLoadBad();      ///< Test loading a malformed model
+    void testMerge();        ///< Test combining models with @ref SubsamplingModel::saveRecorded and @ref SubsamplingModel::merge
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSubsamplingModel, TestSet::perBuild());
+
+double TestSubsamplingModel::trueTime(std::size_t numSplats, const Grid::size_type size[3], int shift)
+{
+    static const double coef[SubsamplingModel::NUM_FEATURES] = { 2e-9, 1e-7, 5e-9, 1e-7 };
+    double f[SubsamplingModel::NUM_FEATURES];
+    SubsamplingModel::features(numSplats, size, shift, f);
+    double t = 0.0;
+    for (int i = 0; i < SubsamplingModel::NUM_FEATURES; i++)
+        t += coef[i] * f[i];
+    return t;
+}
+
+void TestSubsamplingModel::train(SubsamplingModel &model)
+{
+    for (int shift = 3; shift <= 6; shift++)
+        for (std::size_t splats = 1000; splats <= 1000000; splats *= 10)
+            for (Grid::size_type side = 16; side <= 256; side *= 2)
+            {
+                const Grid::size_type size[3] = {side, side, side / 2};
+                double f[SubsamplingModel::NUM_FEATURES];
+                SubsamplingModel::features(splats, size, shift, f);
+                model.record(shift, f, trueTime(splats, size, shift));
+            }
+}
+
+void TestSubsamplingModel::testDefault()
+{
+    SubsamplingModel model(3, 6, 4);
+    const Grid::size_type size[3] = {64, 64, 64};
+    double f[SubsamplingModel::NUM_FEATURES];
+    SubsamplingModel::features(1000, size, 4, f);
+    CPPUNIT_ASSERT(model.predict(f) < 0.0);
+    for (int i = 0; i < SubsamplingModel::EXPLORE_INTERVAL - 1; i++)
+        CPPUNIT_ASSERT_EQUAL(4, model.choose(1000, size, 10));
+    // The next choice is exploratory, but must still be in range
+    int shift = model.choose(1000, size, 10);
+    CPPUNIT_ASSERT(shift >= 3 && shift <= 6);
+}
+
+void TestSubsamplingModel::testFit()
+{
+    SubsamplingModel model(3, 6, 6);
+    train(model);
+    CPPUNIT_ASSERT(model.getSamples() >= SubsamplingModel::MIN_SAMPLES);
+
+    const Grid::size_type size[3] = {200, 180, 120};
+    const std::size_t numSplats = 50000;
+    int best = 3;
+    for (int shift = 3; shift <= 6; shift++)
+    {
+        double f[SubsamplingModel::NUM_FEATURES];
+        SubsamplingModel::features(numSplats, size, shift, f);
+        double expected = trueTime(numSplats, size, shift);
+        MLSGPU_ASSERT_DOUBLES_EQUAL(expected, model.predict(f), expected * 1e-3);
+        if (expected < trueTime(numSplats, size, best))
+            best = shift;
+    }
+    CPPUNIT_ASSERT(best != 6); // otherwise the test doesn't show anything
+    CPPUNIT_ASSERT_EQUAL(best, model.choose(numSplats, size, 10));
+}
+
+void TestSubsamplingModel::testMaxLevels()
+{
+    SubsamplingModel model(3, 6, 5);
+    const Grid::size_type size[3] = {256, 16, 16};
+    const std::size_t maxLevels = SplatTreeCL::levelsForSize(size, 5);
+    for (int i = 0; i < 4 * SubsamplingModel::EXPLORE_INTERVAL; i++)
+    {
+        int shift = model.choose(1000, size, maxLevels);
+        CPPUNIT_ASSERT(shift >= 5 && shift <= 6);
+    }
+}
+
+void TestSubsamplingModel::testSaveLoad()
+{
+    SubsamplingModel model(3, 6, 4);
+    train(model);
+    std::ostringstream out;
+    model.save(out);
+
+    SubsamplingModel model2(3, 6, 4);
+    std::istringstream in(out.str());
+    model2.load(in);
+    CPPUNIT_ASSERT_EQUAL(model.getSamples(), model2.getSamples());
+
+    const Grid::size_type size[3] = {100, 50, 25};
+    double f[SubsamplingModel::NUM_FEATURES];
+    SubsamplingModel::features(12345, size, 5, f);
+    double expected = model.predict(f);
+    MLSGPU_ASSERT_DOUBLES_EQUAL(expected, model2.predict(f), expected * 1e-9);
+}
+
+void TestSubsamplingModel::testLoadBad()
+{
+    SubsamplingModel model(3, 6, 4);
+    std::istringstream truncated("mlsgpu-subsampling-model 1\n20\n1 2 3\n");
+    CPPUNIT_ASSERT_THROW(model.load(truncated), std::runtime_error);
+    std::istringstream wrongVersion("mlsgpu-subsampling-model 2\n0\n");
+    CPPUNIT_ASSERT_THROW(model.load(wrongVersion), std::runtime_error);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), model.getSamples());
+}
+
+void TestSubsamplingModel::testMerge()
+{
+    // Two workers start from the same saved model and each add their own data
+    SubsamplingModel base(3, 6, 4);
+    train(base);
+    std::ostringstream baseOut;
+    base.save(baseOut);
+
+    std::string recorded[2];
+    for (int i = 0; i < 2; i++)
+    {
+        SubsamplingModel worker(3, 6, 4);
+        std::istringstream in(baseOut.str());
+        worker.load(in);
+        train(worker);
+        std::ostringstream out;
+        worker.saveRecorded(out);
+        recorded[i] = out.str();
+    }
+
+    SubsamplingModel merged(3, 6, 4);
+    std::istringstream in(baseOut.str());
+    merged.load(in);
+    for (int i = 0; i < 2; i++)
+    {
+        std::istringstream recordedIn(recorded[i]);
+        merged.merge(recordedIn);
+    }
+
+    // The loaded data must only be counted once
+    SubsamplingModel expected(3, 6, 4);
+    for (int i = 0; i < 3; i++)
+        train(expected);
+    CPPUNIT_ASSERT_EQUAL(expected.getSamples(), merged.getSamples());
+
+    const Grid::size_type size[3] = {100, 50, 25};
+    double f[SubsamplingModel::NUM_FEATURES];
+    SubsamplingModel::features(12345, size, 5, f);
+    double t = expected.predict(f);
+    MLSGPU_ASSERT_DOUBLES_EQUAL(t, merged.predict(f), t * 1e-9);
+
+    std::istringstream bad("mlsgpu-subsampling-model 1\n20\n");
+    CPPUNIT_ASSERT_THROW(merged.merge(bad), std::runtime_error);
+    CPPUNIT_ASSERT_EQUAL(expected.getSamples(), merged.getSamples());
+}
@@ -0,0 +1,255 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref synthetic.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <cmath>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "../src/synthetic.h"
+#include "../src/splat_set.h"
+#include "../src/fast_ply.h"
+#include "testutil.h"
+
+class TestSynthetic : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSynthetic);
+    CPPUNIT_TEST(testParse);
+    CPPUNIT_TEST(testParseErrors);
+    CPPUNIT_TEST(testDeterministic);
+    CPPUNIT_TEST(testRandomAccess);
+    CPPUNIT_TEST(testValid);
+    CPPUNIT_TEST(testOrder);
+    CPPUNIT_TEST(testSet);
+    CPPUNIT_TEST(testFileSet);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Generate all the splats of a cloud
+    static std::vector<Splat> generateAll(const Synthetic::Params &params);
+
+    /// Lexicographic comparison of splat positions
+    static bool positionLess(const Splat &a, const Splat &b);
+
+public:
+    void testParse();           ///< Test @ref Synthetic::parseParams with valid input
+    void testParseErrors();     ///< Test @ref Synthetic::parseParams with invalid input
+    void testDeterministic();   ///< Test that the output depends only on the parameters
+    void testRandomAccess();    ///< Test that ranges match individually generated splats
+    void testValid();           ///< Test that splats are finite, normalized and in bounds
+    void testOrder();           ///< Test that random order is a permutation of scan order
+    void testSet();             ///< Test @ref Synthetic::Set streams
+    void testFileSet();         ///< Test reading through @ref Synthetic::PlyReader
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSynthetic, TestSet::perBuild());
+
+std::vector<Splat> TestSynthetic::generateAll(const Synthetic::Params &params)
+{
+    Synthetic::Generator gen(params);
+    std::vector<Splat> out(gen.size());
+    gen.generate(0, gen.size(), &out[0]);
+    return out;
+}
+
+bool TestSynthetic::positionLess(const Splat &a, const Splat &b)
+{
+    return std::lexicographical_compare(a.position, a.position + 3, b.position, b.position + 3);
+}
+
+static bool splatEqual(const Splat &a, const Splat &b)
+{
+    return std::equal(a.position, a.position + 3, b.position)
+        && std::equal(a.normal, a.normal + 3, b.normal)
+        && a.radius == b.radius;
+}
+
+void TestSynthetic::testParse()
+{
+    Synthetic::Params p = Synthetic::parseParams("spheres");
+    CPPUNIT_ASSERT_EQUAL(Synthetic::SCENE_SPHERES, p.scene);
+    CPPUNIT_ASSERT_EQUAL(Synthetic::Params().numSplats, p.numSplats);
+
+    p = Synthetic::parseParams("facades:splats=2e9,seed=7,size=50,density=0.5,holes=0.25,noise=0.1,radius=2,order=random");
+    CPPUNIT_ASSERT_EQUAL(Synthetic::SCENE_FACADES, p.scene);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(2000000000), p.numSplats);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(7), p.seed);
+    CPPUNIT_ASSERT_EQUAL(50.0f, p.size);
+    CPPUNIT_ASSERT_EQUAL(0.5f, p.density);
+    CPPUNIT_ASSERT_EQUAL(0.25f, p.holes);
+    CPPUNIT_ASSERT_EQUAL(0.1f, p.noise);
+    CPPUNIT_ASSERT_EQUAL(2.0f, p.radiusScale);
+    CPPUNIT_ASSERT_EQUAL(Synthetic::ORDER_RANDOM, p.order);
+}
+
+void TestSynthetic::testParseErrors()
+{
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("teapot"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:splats"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:splats=0"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:splats=1.5"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:density=1"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:noise=abc"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:order=sorted"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(Synthetic::parseParams("terrain:colour=red"), std::runtime_error);
+}
+
+void TestSynthetic::testDeterministic()
+{
+    Synthetic::Params params;
+    params.scene = Synthetic::SCENE_FACADES;
+    params.numSplats = 10000;
+    params.noise = 0.5f;
+    params.holes = 0.5f;
+    const std::vector<Splat> a = generateAll(params);
+    const std::vector<Splat> b = generateAll(params);
+    CPPUNIT_ASSERT(std::equal(a.begin(), a.end(), b.begin(), splatEqual));
+
+    params.seed++;
+    const std::vector<Splat> c = generateAll(params);
+    CPPUNIT_ASSERT(!std::equal(a.begin(), a.end(), c.begin(), splatEqual));
+}
+
+void TestSynthetic::testRandomAccess()
+{
+    Synthetic::Params params;
+    params.scene = Synthetic::SCENE_SPHERES;
+    params.numSplats = 50000;
+    params.order = Synthetic::ORDER_RANDOM;
+    params.density = 0.5f;
+    Synthetic::Generator gen(params);
+
+    std::vector<Splat> range(1000);
+    gen.generate(12345, 13345, &range[0]);
+    for (std::size_t i = 0; i < range.size(); i++)
+        CPPUNIT_ASSERT(splatEqual(gen(12345 + i), range[i]));
+}
+
+void TestSynthetic::testValid()
+{
+    const Synthetic::Scene scenes[] =
+    {
+        Synthetic::SCENE_TERRAIN, Synthetic::SCENE_FACADES, Synthetic::SCENE_SPHERES
+    };
+    for (std::size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++)
+    {
+        Synthetic::Params params;
+        params.scene = scenes[s];
+        params.numSplats = 20000;
+        params.size = 100.0f;
+        params.density = 0.9f;
+        params.holes = 1.0f;
+        params.noise = 0.2f;
+        const std::vector<Splat> splats = generateAll(params);
+        CPPUNIT_ASSERT_EQUAL(std::size_t(params.numSplats), splats.size());
+        for (std::size_t i = 0; i < splats.size(); i++)
+        {
+            const Splat &splat = splats[i];
+            CPPUNIT_ASSERT(splat.isFinite());
+            CPPUNIT_ASSERT(splat.radius > 0.0f);
+            const float len = std::sqrt(splat.normal[0] * splat.normal[0]
+                                        + splat.normal[1] * splat.normal[1]
+                                        + splat.normal[2] * splat.normal[2]);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, len, 1e-4);
+            if (scenes[s] != Synthetic::SCENE_SPHERES)
+            {
+                // Allow for the noise
+                CPPUNIT_ASSERT(splat.position[0] > -5.0f && splat.position[0] < 105.0f);
+                CPPUNIT_ASSERT(splat.position[1] > -5.0f && splat.position[1] < 105.0f);
+            }
+        }
+    }
+}
+
+void TestSynthetic::testOrder()
+{
+    Synthetic::Params params;
+    params.numSplats = 12345;  // not a power of 4, to exercise cycle-walking
+    params.holes = 0.5f;
+    std::vector<Splat> scan = generateAll(params);
+    params.order = Synthetic::ORDER_RANDOM;
+    std::vector<Splat> random = generateAll(params);
+
+    CPPUNIT_ASSERT(!std::equal(scan.begin(), scan.end(), random.begin(), splatEqual));
+    std::sort(scan.begin(), scan.end(), positionLess);
+    std::sort(random.begin(), random.end(), positionLess);
+    CPPUNIT_ASSERT(std::equal(scan.begin(), scan.end(), random.begin(), splatEqual));
+}
+
+void TestSynthetic::testSet()
+{
+    Synthetic::Params params;
+    params.numSplats = 5000;
+    const std::vector<Splat> expected = generateAll(params);
+    Synthetic::Set set(params);
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(5000), set.maxSplats());
+
+    std::vector<std::pair<SplatSet::splat_id, SplatSet::splat_id> > ranges;
+    ranges.push_back(std::make_pair(10, 20));
+    ranges.push_back(std::make_pair(100, 1000));
+    ranges.push_back(std::make_pair(4990, 6000)); // runs off the end
+    boost::scoped_ptr<SplatSet::SplatStream> stream(set.makeSplatStream(ranges.begin(), ranges.end()));
+
+    std::vector<Splat> splats(2000);
+    std::vector<SplatSet::splat_id> ids(2000);
+    // Read in pieces that do not align with the ranges
+    std::size_t total = 0;
+    std::size_t n;
+    while ((n = stream->read(&splats[total], &ids[total], 7)) > 0)
+        total += n;
+    CPPUNIT_ASSERT_EQUAL(std::size_t(10 + 900 + 10), total);
+    for (std::size_t i = 0; i < total; i++)
+    {
+        SplatSet::splat_id expectedId = i < 10 ? 10 + i : (i < 910 ? 90 + i : 4080 + i);
+        CPPUNIT_ASSERT_EQUAL(expectedId, ids[i]);
+        CPPUNIT_ASSERT(splatEqual(expected[expectedId], splats[i]));
+    }
+}
+
+void TestSynthetic::testFileSet()
+{
+    Synthetic::Params params;
+    params.scene = Synthetic::SCENE_FACADES;
+    params.numSplats = 30000;
+    params.noise = 0.1f;
+    const std::vector<Splat> expected = generateAll(params);
+
+    SplatSet::FileSet set;
+    set.addFile(new FastPly::Reader(
+            Synthetic::PlyReaderFactory(params), "synthetic:facades",
+            1.0f, std::numeric_limits<float>::infinity()));
+    boost::scoped_ptr<SplatSet::SplatStream> stream(set.makeSplatStream());
+    std::vector<Splat> splats(expected.size() + 1);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), stream->read(&splats[0], NULL, splats.size()));
+    splats.pop_back();
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), splats.begin(), splatEqual));
+}
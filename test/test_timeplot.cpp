@@ -0,0 +1,301 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref Timeplot.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include "testutil.h"
+#include "../src/timeplot.h"
+#include "../src/tr1_cstdint.h"
+
+using namespace std;
+
+/// Tests for @ref Timeplot
+class TestTimeplot : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestTimeplot);
+    CPPUNIT_TEST(testBinary);
+    CPPUNIT_TEST(testText);
+    CPPUNIT_TEST(testReopen);
+    CPPUNIT_TEST(testCloser);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// An event read back from a trace
+    struct Event
+    {
+        string action;
+        double start, stop;
+        bool hasValue;
+        std::tr1::uint64_t value;
+    };
+
+    /// Events in file order, keyed by worker name
+    typedef map<string, vector<Event> > Trace;
+
+    /// Parses a binary trace, checking its structure along the way
+    static void readBinary(const string &data, Trace &trace);
+
+    /// Parses a text trace
+    static void readText(const string &data, Trace &trace);
+
+    /// Writes a small trace with nested actions, an event and a value
+    static void writeEvents(Timeplot::Worker &worker);
+
+    /// Checks the trace written by @ref writeEvents
+    static void checkEvents(const Trace &trace);
+
+    /// Returns a unique path for a temporary trace file
+    static boost::filesystem::path tempPath();
+
+    /// Returns the contents of a file, and removes it
+    static string slurp(const boost::filesystem::path &path);
+
+    /// Writes a trace with @ref writeEvents and returns the file contents
+    static string roundTrip(Timeplot::Worker &worker, bool binary);
+
+public:
+    void testBinary();          ///< Test writing and reading back a binary trace
+    void testText();            ///< Test writing and reading back a text trace
+    void testReopen();          ///< Test a worker that outlives a closed binary trace
+    void testCloser();          ///< Test that @ref Timeplot::Closer completes the trace during unwinding
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestTimeplot, TestSet::perBuild());
+
+template<typename T>
+static T readRaw(const string &data, size_t &pos)
+{
+    CPPUNIT_ASSERT(pos + sizeof(T) <= data.size());
+    T value;
+    memcpy(&value, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+void TestTimeplot::readBinary(const string &data, Trace &trace)
+{
+    CPPUNIT_ASSERT(data.size() >= 16);
+    CPPUNIT_ASSERT_EQUAL(string("MLSGPUTP"), data.substr(0, 8));
+    size_t pos = 8;
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(1), readRaw<std::tr1::uint32_t>(data, pos));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(0x01020304), readRaw<std::tr1::uint32_t>(data, pos));
+
+    map<std::tr1::uint32_t, string> names;
+    while (pos < data.size())
+    {
+        std::tr1::uint32_t type = readRaw<std::tr1::uint32_t>(data, pos);
+        if (type == 1)
+        {
+            std::tr1::uint32_t id = readRaw<std::tr1::uint32_t>(data, pos);
+            std::tr1::uint32_t length = readRaw<std::tr1::uint32_t>(data, pos);
+            CPPUNIT_ASSERT(pos + length <= data.size());
+            CPPUNIT_ASSERT(!names.count(id));
+            names[id] = data.substr(pos, length);
+            pos += length;
+        }
+        else
+        {
+            CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(2), type);
+            std::tr1::uint32_t worker = readRaw<std::tr1::uint32_t>(data, pos);
+            std::tr1::uint32_t action = readRaw<std::tr1::uint32_t>(data, pos);
+            // Names must be defined before they are used
+            CPPUNIT_ASSERT(names.count(worker));
+            CPPUNIT_ASSERT(names.count(action));
+            Event e;
+            e.action = names[action];
+            e.hasValue = readRaw<std::tr1::uint32_t>(data, pos) != 0;
+            e.start = readRaw<double>(data, pos);
+            e.stop = readRaw<double>(data, pos);
+            e.value = readRaw<std::tr1::uint64_t>(data, pos);
+            trace[names[worker]].push_back(e);
+        }
+    }
+}
+
+void TestTimeplot::readText(const string &data, Trace &trace)
+{
+    istringstream in(data);
+    string line;
+    Event *last = NULL;
+    while (getline(in, line))
+    {
+        istringstream fields(line);
+        string kind;
+        fields >> kind;
+        if (kind == "EVENT")
+        {
+            string worker;
+            Event e;
+            fields >> worker >> e.action >> e.start >> e.stop;
+            CPPUNIT_ASSERT(fields);
+            e.hasValue = false;
+            e.value = 0;
+            trace[worker].push_back(e);
+            last = &trace[worker].back();
+        }
+        else
+        {
+            CPPUNIT_ASSERT_EQUAL(string("VALUE"), kind);
+            CPPUNIT_ASSERT(last != NULL);
+            fields >> last->value;
+            CPPUNIT_ASSERT(fields);
+            last->hasValue = true;
+        }
+    }
+}
+
+void TestTimeplot::writeEvents(Timeplot::Worker &worker)
+{
+    {
+        Timeplot::Action outer("outer", worker, NULL);
+        {
+            Timeplot::Action inner("inner", worker, NULL);
+            inner.setValue(1234);
+        }
+        Timeplot::recordEvent("push", worker);
+    }
+}
+
+void TestTimeplot::checkEvents(const Trace &trace)
+{
+    CPPUNIT_ASSERT_EQUAL(size_t(1), trace.size());
+    CPPUNIT_ASSERT(trace.count("device.1"));
+    const vector<Event> &events = trace.find("device.1")->second;
+
+    // The outer action is paused while the inner one runs
+    CPPUNIT_ASSERT_EQUAL(size_t(4), events.size());
+    CPPUNIT_ASSERT_EQUAL(string("outer"), events[0].action);
+    CPPUNIT_ASSERT_EQUAL(string("inner"), events[1].action);
+    CPPUNIT_ASSERT_EQUAL(string("push"), events[2].action);
+    CPPUNIT_ASSERT_EQUAL(string("outer"), events[3].action);
+
+    CPPUNIT_ASSERT(events[1].hasValue);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1234), events[1].value);
+    CPPUNIT_ASSERT(!events[0].hasValue);
+    CPPUNIT_ASSERT(!events[2].hasValue);
+    CPPUNIT_ASSERT_EQUAL(events[2].start, events[2].stop);
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        CPPUNIT_ASSERT(events[i].start >= 0.0);
+        CPPUNIT_ASSERT(events[i].start <= events[i].stop);
+    }
+    CPPUNIT_ASSERT(events[0].stop <= events[1].start);
+    CPPUNIT_ASSERT(events[1].stop <= events[3].start);
+}
+
+boost::filesystem::path TestTimeplot::tempPath()
+{
+    return boost::filesystem::temp_directory_path()
+        / boost::filesystem::unique_path("mlsgpu-test-%%%%-%%%%-%%%%-%%%%");
+}
+
+string TestTimeplot::slurp(const boost::filesystem::path &path)
+{
+    string data;
+    {
+        ifstream in(path.c_str(), ios::in | ios::binary);
+        CPPUNIT_ASSERT(in);
+        ostringstream contents;
+        contents << in.rdbuf();
+        data = contents.str();
+    }
+    boost::filesystem::remove(path);
+    return data;
+}
+
+string TestTimeplot::roundTrip(Timeplot::Worker &worker, bool binary)
+{
+    const boost::filesystem::path path = tempPath();
+    Timeplot::init(path.string(), binary);
+    writeEvents(worker);
+    Timeplot::close();
+    return slurp(path);
+}
+
+void TestTimeplot::testBinary()
+{
+    Timeplot::Worker worker("device", 1);
+    Trace trace;
+    readBinary(roundTrip(worker, true), trace);
+    checkEvents(trace);
+}
+
+void TestTimeplot::testText()
+{
+    Timeplot::Worker worker("device", 1);
+    Trace trace;
+    readText(roundTrip(worker, false), trace);
+    checkEvents(trace);
+}
+
+void TestTimeplot::testReopen()
+{
+    // The worker's ring is freed by the first close and must not be reused
+    Timeplot::Worker worker("device", 1);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        Trace trace;
+        readBinary(roundTrip(worker, true), trace);
+        checkEvents(trace);
+    }
+    // Nothing is recorded once closed
+    Timeplot::recordEvent("idle", worker);
+}
+
+void TestTimeplot::testCloser()
+{
+    Timeplot::Worker worker("device", 1);
+    const boost::filesystem::path path = tempPath();
+    try
+    {
+        Timeplot::Closer closer;
+        Timeplot::init(path.string(), true);
+        writeEvents(worker);
+        throw std::runtime_error("failed");
+    }
+    catch (std::runtime_error &)
+    {
+    }
+
+    Trace trace;
+    readBinary(slurp(path), trace);
+    checkEvents(trace);
+
+    // The trace must be closed, so that it can be opened again
+    Trace reopened;
+    readBinary(roundTrip(worker, true), reopened);
+    checkEvents(reopened);
+}
@@ -42,6 +42,7 @@ class TestUnionFind : public CppUnit::TestFixture
     CPPUNIT_TEST(testMerge);
     CPPUNIT_TEST(testFind);
     CPPUNIT_TEST(testSize);
+    CPPUNIT_TEST(testFlatten);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -68,6 +69,7 @@ public:
     void testMerge();
     void testFind();
     void testSize();
+    void testFlatten();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestUnionFind, TestSet::perBuild());
 
@@ -149,3 +151,19 @@ void TestUnionFind::testSize()
     CPPUNIT_ASSERT_EQUAL(1, nodes[roots[2]].size());
     CPPUNIT_ASSERT_EQUAL(1, nodes[roots[3]].size());
 }
+
+void TestUnionFind::testFlatten()
+{
+    UnionFind::merge(nodes, 3, 7);
+    int root = UnionFind::findRootConst(nodes, 0);
+    for (int i = 0; i < 8; i++)
+        if (i != 5)
+            CPPUNIT_ASSERT_EQUAL(root, UnionFind::findRootConst(nodes, i));
+
+    UnionFind::flatten(nodes);
+    for (int i = 0; i < 9; i++)
+    {
+        CPPUNIT_ASSERT(nodes[i].isRoot() || nodes[nodes[i].parent()].isRoot());
+    }
+    CPPUNIT_ASSERT_EQUAL(root, UnionFind::findRoot(nodes, 4));
+}
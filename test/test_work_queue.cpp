@@ -32,6 +32,7 @@
 #include <vector>
 #include <algorithm>
 #include <utility>
+#include <iterator>
 #include <boost/ref.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/locks.hpp>
@@ -136,3 +137,180 @@ void TestWorkQueue::testStress()
     for (int i = 0; i < elements; i++)
         CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
 }
+
+/// Tests for @ref LockFreeWorkQueue
+class TestLockFreeWorkQueue : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestLockFreeWorkQueue);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testFull);
+    CPPUNIT_TEST(testBatchFull);
+    CPPUNIT_TEST(testStress);
+    CPPUNIT_TEST_SUITE_END();
+private:
+    typedef LockFreeWorkQueue<int> Queue;
+
+    /**
+     * Adds a sequence of consecutive integers to the work queue, in batches
+     * of @a batch.
+     */
+    static void producerThread(Queue &queue, int start, int end, int batch);
+
+    /**
+     * Pulls integers from a work queue in batches of up to @a batch and appends
+     * them to a vector. The vector is locked while adding to it.
+     */
+    static void consumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex, int batch);
+
+public:
+    void testEmpty();            ///< Test LockFreeWorkQueue::empty
+    void testBatch();            ///< Test batch push and pop in a single thread
+    void testFull();             ///< Test that push blocks when the queue is full
+    void testBatchFull();        ///< Test a batch push larger than the capacity
+    void testStress();           ///< Stress test with multiple consumers and producers
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestLockFreeWorkQueue, TestSet::perCommit());
+
+void TestLockFreeWorkQueue::testEmpty()
+{
+    Queue queue;
+    CPPUNIT_ASSERT(queue.empty());
+    queue.push(3);
+    CPPUNIT_ASSERT(!queue.empty());
+    CPPUNIT_ASSERT_EQUAL(3, queue.pop());
+    CPPUNIT_ASSERT(queue.empty());
+    queue.stop();
+    CPPUNIT_ASSERT(!queue.empty());
+    CPPUNIT_ASSERT_EQUAL(0, queue.pop());
+    queue.start();
+    CPPUNIT_ASSERT(queue.empty());
+}
+
+void TestLockFreeWorkQueue::testBatch()
+{
+    Queue queue(8);
+    const int in[] = {1, 2, 3, 4, 5};
+    queue.push(in, in + 5);
+
+    vector<int> out;
+    CPPUNIT_ASSERT_EQUAL(Queue::size_type(3), queue.pop(back_inserter(out), 3));
+    CPPUNIT_ASSERT_EQUAL(Queue::size_type(2), queue.pop(back_inserter(out), 10));
+    CPPUNIT_ASSERT(equal(in, in + 5, out.begin()));
+    CPPUNIT_ASSERT(queue.empty());
+
+    queue.stop();
+    CPPUNIT_ASSERT_EQUAL(Queue::size_type(0), queue.pop(back_inserter(out), 10));
+}
+
+void TestLockFreeWorkQueue::testFull()
+{
+    Queue queue(4);
+    vector<int> out;
+    boost::mutex outMutex;
+    // Pushes more than the capacity, so can only finish if the consumer runs
+    boost::thread producer(boost::bind(&TestLockFreeWorkQueue::producerThread,
+                                       boost::ref(queue), 1, 101, 3));
+    boost::thread consumer(boost::bind(&TestLockFreeWorkQueue::consumerThread,
+                                       boost::ref(queue), boost::ref(out), boost::ref(outMutex), 1));
+    producer.join();
+    queue.stop();
+    consumer.join();
+
+    CPPUNIT_ASSERT_EQUAL(100, int(out.size()));
+    for (int i = 0; i < 100; i++)
+        CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
+}
+
+void TestLockFreeWorkQueue::testBatchFull()
+{
+    Queue queue(4);
+    vector<int> out;
+    boost::mutex outMutex;
+    boost::thread consumer(boost::bind(&TestLockFreeWorkQueue::consumerThread,
+                                       boost::ref(queue), boost::ref(out), boost::ref(outMutex), 2));
+    // Give the consumer time to park on the empty queue, so that it is only
+    // woken if the producer does so before blocking on the full queue.
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    producerThread(queue, 1, 101, 100);
+    queue.stop();
+    consumer.join();
+
+    CPPUNIT_ASSERT_EQUAL(100, int(out.size()));
+    for (int i = 0; i < 100; i++)
+        CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
+}
+
+void TestLockFreeWorkQueue::producerThread(Queue &queue, int start, int end, int batch)
+{
+    vector<int> items;
+    for (int i = start; i < end; i += batch)
+    {
+        items.clear();
+        for (int j = i; j < min(i + batch, end); j++)
+            items.push_back(j);
+        if (batch == 1)
+            queue.push(items[0]);
+        else
+            queue.push(items.begin(), items.end());
+    }
+}
+
+void TestLockFreeWorkQueue::consumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex, int batch)
+{
+    vector<int> items;
+    while (true)
+    {
+        items.clear();
+        if (batch == 1)
+        {
+            int next = queue.pop();
+            if (next > 0)
+                items.push_back(next);
+        }
+        else
+            queue.pop(back_inserter(items), batch);
+        if (items.empty())
+            break;
+        boost::lock_guard<boost::mutex> lock(mutex);
+        out.insert(out.end(), items.begin(), items.end());
+    }
+}
+
+void TestLockFreeWorkQueue::testStress()
+{
+    const int numProducers = 8;
+    const int numConsumers = 8;
+    const int elements = 1000000;
+    boost::ptr_vector<boost::thread> producers;
+    boost::ptr_vector<boost::thread> consumers;
+    vector<int> out;
+    boost::mutex outMutex;
+    Queue queue(64);
+
+    for (int i = 0; i < numProducers; i++)
+    {
+        int start = 1 + elements * i / numProducers;
+        int end = 1 + elements * (i + 1) / numProducers;
+        producers.push_back(new boost::thread(
+                boost::bind(&TestLockFreeWorkQueue::producerThread,
+                            boost::ref(queue), start, end, 1 + i % 4)));
+    }
+    for (int i = 0; i < numConsumers; i++)
+    {
+        consumers.push_back(new boost::thread(
+                boost::bind(&TestLockFreeWorkQueue::consumerThread,
+                            boost::ref(queue), boost::ref(out), boost::ref(outMutex), 1 + i % 3)));
+    }
+
+    for (int i = 0; i < numProducers; i++)
+        producers[i].join();
+    queue.stop();
+    for (int i = 0; i < numConsumers; i++)
+        consumers[i].join();
+
+    CPPUNIT_ASSERT_EQUAL(elements, int(out.size()));
+    sort(out.begin(), out.end());
+    for (int i = 0; i < elements; i++)
+        CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
+}
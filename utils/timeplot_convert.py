@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+
+# mlsgpu: surface reconstruction from point clouds
+# Copyright (C) 2013  University of Cape Town
+#
+# This file is part of mlsgpu.
+#
+# mlsgpu is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Convert a binary trace written with --timeplot-binary to the text format
+understood by the other timeplot utilities.
+"""
+
+from __future__ import division, print_function
+import sys
+import struct
+
+MAGIC = b'MLSGPUTP'
+RECORD_NAME = 1
+RECORD_EVENT = 2
+
+def convert(inf, outf):
+    header = inf.read(16)
+    if len(header) != 16 or header[:8] != MAGIC:
+        raise ValueError('Not a binary timeplot file')
+    # The byte-order marker determines how the rest of the file is decoded
+    for order in '<>':
+        version, marker = struct.unpack(order + 'II', header[8:])
+        if marker == 0x01020304:
+            break
+    else:
+        raise ValueError('Unrecognised byte order')
+    if version != 1:
+        raise ValueError('Unsupported version {0}'.format(version))
+
+    name_fmt = struct.Struct(order + 'III')
+    event_fmt = struct.Struct(order + 'IIIIddQ')
+    names = {}
+    while True:
+        type_bytes = inf.read(4)
+        if not type_bytes:
+            break
+        record_type, = struct.unpack(order + 'I', type_bytes)
+        if record_type == RECORD_NAME:
+            _, name_id, length = name_fmt.unpack(type_bytes + inf.read(name_fmt.size - 4))
+            names[name_id] = inf.read(length).decode('utf-8')
+        elif record_type == RECORD_EVENT:
+            data = type_bytes + inf.read(event_fmt.size - 4)
+            if len(data) != event_fmt.size:
+                raise ValueError('Truncated event record')
+            _, worker, action, has_value, start, stop, value = event_fmt.unpack(data)
+            print('EVENT {0} {1} {2:.9f} {3:.9f}'.format(names[worker], names[action], start, stop), file = outf)
+            if has_value:
+                print('VALUE {0}'.format(value), file = outf)
+        else:
+            raise ValueError('Unknown record type {0}'.format(record_type))
+
+def main():
+    if len(sys.argv) not in [2, 3]:
+        print('Usage: {0} <input.bin> [<output.txt>]'.format(sys.argv[0]), file = sys.stderr)
+        return 2
+    with open(sys.argv[1], 'rb') as inf:
+        if len(sys.argv) == 3:
+            with open(sys.argv[2], 'w') as outf:
+                convert(inf, outf)
+        else:
+            convert(inf, sys.stdout)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())